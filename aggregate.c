@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+
+/* ---------- Timeframe aggregation ----------
+ *
+ * Every input (a bar, or a tick passed as a bar with one price) is merged
+ * into the forming bar of each timeframe: high/low widen, close moves,
+ * volume adds up. Intraday periods are aligned to midnight (a 5m bar
+ * covers 09:15-09:19, a 1h bar 09:00-09:59) and daily ones to the date.
+ * A bar closes when the first input of a later period arrives; it is
+ * then pushed on its timeframe's ring and stays readable until
+ * TF_HISTORY newer bars have closed. A closed bar is stamped with the
+ * start of its period (midnight for daily bars).
+ *
+ * run_chunk calls aggregate_bar itself when the chunk reads timeframes
+ * (init_indicators then allocates IndicatorState.frames), so the VM sees
+ * this bar's `closed` set before any rule runs.
+ */
+
+void init_aggregator(BarAggregator *agg, uint32_t used) {
+    memset(agg, 0, sizeof(*agg));
+    agg->used = used & ~1u;   // TF_BAR is the input itself
+    for (int tf = 0; tf < TF_COUNT; ++tf) agg->period[tf] = -1;
+}
+
+static void open_bar(VMContext *f, const VMContext *bar, int minutes) {
+    *f = *bar;
+    if (minutes > 0) {
+        int start = (bar->hour * 60 + bar->minute) / minutes * minutes;
+        f->hour = start / 60;
+        f->minute = start % 60;
+    } else {
+        f->hour = f->minute = 0;
+    }
+    f->time = f->hour * 100 + f->minute;
+}
+
+uint32_t aggregate_bar(BarAggregator *agg, const VMContext *bar) {
+    uint32_t closed = 0;
+    int minute_of_day = bar->hour * 60 + bar->minute;
+    for (int tf = TF_BAR + 1; tf < TF_COUNT; ++tf) {
+        if (!(agg->used & (1u << tf))) continue;
+        int minutes = timeframe_minutes(tf);
+        int64_t period = minutes > 0
+            ? (int64_t)bar->date * 1440 + minute_of_day / minutes * minutes
+            : (int64_t)bar->date;
+        VMContext *f = &agg->forming[tf];
+        if (period == agg->period[tf]) {
+            if (bar->high > f->high) f->high = bar->high;
+            if (bar->low < f->low) f->low = bar->low;
+            f->close = bar->close;
+            f->volume += bar->volume;
+            continue;
+        }
+        if (agg->period[tf] >= 0) {
+            agg->history[tf][agg->count[tf] % TF_HISTORY] = *f;
+            agg->count[tf]++;
+            closed |= 1u << tf;
+        }
+        agg->period[tf] = period;
+        open_bar(f, bar, minutes);
+    }
+    agg->closed = closed;
+    return closed;
+}
+
+const VMContext *timeframe_bar(const BarAggregator *agg, int tf, size_t ago) {
+    if (!agg || tf <= TF_BAR || tf >= TF_COUNT) return NULL;
+    if (ago >= agg->count[tf] || ago >= TF_HISTORY) return NULL;
+    return &agg->history[tf][(agg->count[tf] - 1 - ago) % TF_HISTORY];
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+
+/* ---------- Arena allocator ----------
+ *
+ * Bump allocation out of a chain of blocks. Everything the front end
+ * builds for one compilation (token text, AST nodes, strings) lives in
+ * one arena and is released with a single arena_free.
+ */
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    max_align_t data[];
+};
+
+void arena_init(Arena *arena) {
+    arena->head = NULL;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaBlock *b = arena->head;
+    if (!b || b->size - b->used < size) {
+        size_t cap = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        b = (ArenaBlock*)malloc(sizeof(ArenaBlock) + cap);
+        if (!b) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        b->used = 0;
+        b->size = cap;
+        /* an oversized block goes behind the current one so the space
+         * left in the current block is still used */
+        if (arena->head && cap > ARENA_BLOCK_SIZE) {
+            b->next = arena->head->next;
+            arena->head->next = b;
+        } else {
+            b->next = arena->head;
+            arena->head = b;
+        }
+    }
+    void *p = (char*)b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+char *arena_strndup(Arena *arena, const char *s, size_t len) {
+    char *copy = (char*)arena_alloc(arena, len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char *arena_strdup(Arena *arena, const char *s) {
+    return arena_strndup(arena, s, strlen(s));
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *b = arena->head;
+    while (b) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    arena->head = NULL;
+}
@@ -1,6 +1,8 @@
 #ifndef TL_AST_H
 #define TL_AST_H
 
+#include <stddef.h>
+#include <stdio.h>
 #include <stdint.h>
 
 /* ---------- TOKEN TYPES ---------- */
@@ -18,6 +20,8 @@ typedef enum {
     TOK_AND,
     TOK_OR,
     TOK_NOT,
+    TOK_ON,
+    TOK_PARAM,
 
     TOK_IDENT,
     TOK_NUMBER,
@@ -35,15 +39,41 @@ typedef enum {
     TOK_NE,      // !=
     TOK_LPAREN,  // (
     TOK_RPAREN,  // )
-    TOK_COMMA    // ,
+    TOK_COMMA,   // ,
+    TOK_ASSIGN   // =
 } TokenType;
 
+/* ---------- ARENA ---------- */
+
+typedef struct ArenaBlock ArenaBlock;
+
+/* Owns all front-end memory of one compilation */
+typedef struct {
+    ArenaBlock *head;
+} Arena;
+
+/* A token is a slice of the source buffer (or of a static message for
+ * TOK_ERROR); it is never NUL-terminated and never owns memory. */
 typedef struct {
     TokenType type;
-    const char *lexeme;  // allocated string
+    const char *start;
+    int length;          // for TOK_STRING, excludes the quotes
     double number;       // valid if type == TOK_NUMBER
+    int line;            // 1-based position of the token's first character
+    int column;
 } Token;
 
+/* Scanner position; one per source being tokenized */
+typedef struct {
+    const char *src;
+    const char *start;
+    const char *current;
+    int line;               // line of `current`
+    const char *line_start; // first character of that line
+    int start_line;         // position of `start`
+    int start_column;
+} Lexer;
+
 /* ---------- AST TYPES ---------- */
 
 typedef enum {
@@ -52,7 +82,8 @@ typedef enum {
     EXPR_CALL,
     EXPR_BINARY,
     EXPR_UNARY,
-    EXPR_STRING
+    EXPR_STRING,
+    EXPR_PARAM
 } ExprKind;
 
 typedef enum {
@@ -76,20 +107,29 @@ struct Expr;
 
 typedef struct Expr {
     ExprKind kind;
+    int temp;              // CSE temp holding this value, set by the compiler (-1: none)
+    int cached;            // per-day / per-minute value holding it, likewise (-1: none)
+    int line, column;      // source position (operator token for BINARY/UNARY)
     union {
         struct {
             double value;
         } number;
         struct {
             char *name;
+            int timeframe; // Timeframe; TF_BAR unless under `on "..."`
         } ident;
         struct {
             char *value;
         } string;
+        struct {
+            int index;     // into Program.params
+        } param;
         struct {
             char *func_name;
             struct Expr **args;
             int arg_count;
+            int slot;      // indicator slot, assigned by the compiler
+            int timeframe; // bars the indicator is fed: Timeframe
         } call;
         struct {
             OpKind op;
@@ -109,6 +149,7 @@ typedef enum {
 typedef struct Stmt {
     StmtKind kind;
     int quantity;
+    int line;
     struct Stmt *next;
 } Stmt;
 
@@ -117,14 +158,32 @@ typedef struct Stmt {
 typedef struct Rule {
     Expr *condition;
     Stmt *action;    // single action for now
+    int index;       // position in the source, from 0; tags its signals
+    int line;        // line of its `if`
+    uint32_t timeframes; // 1 << Timeframe of the other timeframes its condition
+                         // reads as written; it runs only when one of them closes
     struct Rule *next;
 } Rule;
 
+/* Named parameter: `param fast = 10`. Rules read it like a number, but
+ * each run sets its own value (see sweep.c); `value` is the default. */
+
+#define PARAM_NAME_MAX 32
+#define TLC_PARAM_MAX 256
+
+typedef struct {
+    char name[PARAM_NAME_MAX];   // NUL-terminated
+    double value;
+} Param;
+
 /* Program */
 
 typedef struct Program {
-    char *symbol;   // "NIFTY"
+    char *symbol;   // NIFTY (without quotes)
+    Param *params;  // in declaration order
+    int param_count;
     Rule *rules;    // linked list
+    Arena arena;    // owns every node and string above
 } Program;
 
 /* ---------- BYTECODE & VM ---------- */
@@ -133,7 +192,8 @@ typedef enum {
     BC_HALT = 0,
     BC_PUSH_CONST,    // [double]
     BC_LOAD_VAR,      // [uint8 id]
-    BC_CALL_FUNC,     // [uint8 func_id][uint8 argc]
+    BC_IND_UPDATE,    // [uint8 func_id][uint16 slot]  pop x; feed x to the slot
+    BC_LOAD_IND,      // [uint16 slot]                 push the slot's latest output
     BC_ADD,
     BC_SUB,
     BC_MUL,
@@ -149,38 +209,251 @@ typedef enum {
     BC_NEG,
     BC_NOT,
     BC_JUMP_IF_FALSE, // [int32 offset]
+    BC_JUMP_IF_TRUE,  // [int32 offset]
+    BC_STORE_TEMP,    // [uint16 temp]                 pop into a per-bar temp
+    BC_LOAD_TEMP,     // [uint16 temp]
     BC_JUMP,          // [int32 offset]
-    BC_BUY,           // [int32 qty]
-    BC_SELL           // [int32 qty]
+    BC_BUY,           // [int32 qty][uint16 rule]
+    BC_SELL,          // [int32 qty][uint16 rule]
+
+    /* Superinstructions; [uint8 cmp] is one of BC_GT..BC_NE */
+    BC_CMP_VAR_CONST,         // [uint8 id][uint8 cmp][double]            push var cmp k
+    BC_JUMP_IF_NOT_CMP,       // [uint8 cmp][int32 offset]                pop b, a; jump unless a cmp b
+    BC_JUMP_IF_NOT_VAR_CONST, // [uint8 id][uint8 cmp][double][int32 offset]
+    BC_CMP_IND,               // [uint16 slot][uint8 cmp]                 pop a; push a cmp slot output
+
+    /* Timeframes (see aggregate.c); [uint8 frames] is a mask of 1 << Timeframe */
+    BC_LOAD_TF_VAR,           // [uint8 tf][uint8 id]     push the field of tf's last closed bar
+    BC_JUMP_IF_NOT_CLOSED,    // [uint8 frames][int32 offset]  jump unless one of them closed this bar
+
+    /* Values kept across bars in IndicatorState.cached; [uint8 freq] is FREQ_DAY or FREQ_MINUTE */
+    BC_JUMP_IF_SAME,          // [uint8 freq][int32 offset]   jump if the bar is in the day / minute
+                              //                              last seen here, else record it
+    BC_STORE_CACHED,          // [uint16 entry]               pop into a cached value
+    BC_LOAD_CACHED,           // [uint16 entry]
+    BC_JUMP_IF_NOT_CACHED,    // [uint16 entry][int32 offset] jump if the cached value is false
+
+    /* Rule gating (see gate.c); both jump to the end of the rules when no candidate is left */
+    BC_RULE_INDEX,            // [int32 offset]   list this bar's candidate rules, go to the first
+    BC_NEXT_RULE,             // [int32 offset]   go to the next candidate
+
+    BC_LOAD_PARAM,            // [uint16 param]   push this run's value of a parameter
+
+    BC_OPCODE_COUNT
 } OpCode;
 
+/* ---------- BUILTIN REGISTRY ----------
+ *
+ * The single list of builtin fields and indicator functions. The enums
+ * below, the name lookup used by the compiler (builtins.c) and the
+ * indicator dispatch table used by the VM (vm.c) are all expanded from
+ * these X-macros, so adding a builtin is a one-line change.
+ */
+
+/* X(id, name, frequency) */
+#define TL_BUILTIN_VARS(X)                              \
+    X(VAR_OPEN,    "open",    FREQ_BAR)                 \
+    X(VAR_HIGH,    "high",    FREQ_BAR)                 \
+    X(VAR_LOW,     "low",     FREQ_BAR)                 \
+    X(VAR_CLOSE,   "close",   FREQ_BAR)                 \
+    X(VAR_VOLUME,  "volume",  FREQ_BAR)                 \
+    X(VAR_DATE,    "date",    FREQ_DAY)    /* YYYYMMDD */ \
+    X(VAR_TIME,    "time",    FREQ_MINUTE) /* HHMM */     \
+    X(VAR_HOUR,    "hour",    FREQ_MINUTE)              \
+    X(VAR_MINUTE,  "minute",  FREQ_MINUTE)              \
+    X(VAR_WEEKDAY, "weekday", FREQ_DAY)    /* 1=Mon .. 7=Sun */
+
+/* X(id, name, arity, window, update)
+ * arity 2 is (series, period); arity 1 is (period) over close.
+ * window: the slot keeps a ring buffer of `period` inputs. */
+#define TL_BUILTIN_FUNCS(X)                     \
+    X(FUNC_SMA, "sma", 2, 1, builtin_sma)       \
+    X(FUNC_EMA, "ema", 2, 0, builtin_ema)       \
+    X(FUNC_RSI, "rsi", 1, 0, builtin_rsi)
+
+/* X(id, name, minutes); minutes 0 is one bar per date */
+#define TL_TIMEFRAMES(X)          \
+    X(TF_1M,  "1m",  1)           \
+    X(TF_5M,  "5m",  5)           \
+    X(TF_15M, "15m", 15)          \
+    X(TF_1H,  "1h",  60)          \
+    X(TF_1D,  "1d",  0)
+
+/* Bar series an expression reads: the bars passed to run_chunk, or one
+ * aggregated from them */
+typedef enum {
+    TF_BAR = 0,
+#define X(id, name, minutes) id,
+    TL_TIMEFRAMES(X)
+#undef X
+    TF_COUNT
+} Timeframe;
+
+/* How often a value can change, by the inputs it reads; ordered, so the
+ * frequency of an expression is the largest of its operands' */
+typedef enum {
+    FREQ_CONST,      // literals and parameters
+    FREQ_DAY,        // date, weekday
+    FREQ_MINUTE,     // time, hour, minute: the bar's timestamp
+    FREQ_BAR         // prices, volume, indicators, other timeframes
+} Frequency;
+
 /* Builtin variable IDs (for LOAD_VAR) */
 typedef enum {
-    VAR_OPEN = 0,
-    VAR_HIGH,
-    VAR_LOW,
-    VAR_CLOSE,
-    VAR_VOLUME,
-    VAR_DATE,    // as YYYYMMDD
-    VAR_TIME,    // as HHMM
-    VAR_HOUR,
-    VAR_MINUTE,
-    VAR_WEEKDAY  // 1=Mon .. 7=Sun
+#define X(id, name, frequency) id,
+    TL_BUILTIN_VARS(X)
+#undef X
+    VAR_COUNT
 } VarId;
 
-/* Builtin function IDs (for CALL_FUNC) */
+/* Builtin function IDs (for IND_UPDATE) */
 typedef enum {
-    FUNC_SMA = 0,
-    FUNC_EMA,
-    FUNC_RSI
+#define X(id, name, arity, window, update) id,
+    TL_BUILTIN_FUNCS(X)
+#undef X
+    FUNC_COUNT
 } FuncId;
 
+typedef enum {
+    BUILTIN_VAR,
+    BUILTIN_FUNC
+} BuiltinKind;
+
+typedef struct {
+    const char *name;
+    uint8_t length;
+    uint8_t kind;    // BuiltinKind
+    uint8_t id;      // VarId or FuncId
+    uint8_t arity;   // functions only
+    uint8_t window;  // functions only
+    uint8_t frequency; // fields only: Frequency
+} Builtin;
+
+/* Indicator call site: one per IND_UPDATE, assigned at compile time */
+typedef struct {
+    uint8_t func;    // FuncId
+    int period;      // 1 .. TLC_PERIOD_MAX; the parameter's default if param >= 0
+    int param;       // parameter whose value is the period, or -1
+} IndicatorSlot;
+
+#define TLC_PERIOD_MAX 100000
+
+/* Bump whenever the compiler's output for a given source changes; it is
+ * part of every compile-cache key and recorded in .tlcb files. */
+#define TLC_COMPILER_VERSION 23
+
+/* One pre-decoded instruction (see decode_chunk). Operands are unpacked,
+ * jump targets are instruction indices and double constants live in the
+ * chunk's constant pool. */
+typedef struct {
+    const void *handler;  // dispatch label, when built with threaded dispatch
+    int32_t arg;          // jump target, quantity, or constant index
+    int32_t konst;        // constant index of the *_VAR_CONST forms
+    uint16_t slot;        // indicator slot, temp, cached entry, parameter, rule of BUY/SELL,
+                          // or timeframe(s)
+    uint8_t op;           // OpCode
+    uint8_t a;            // field id, function id or frequency
+    uint8_t cmp;          // compare op of the fused forms
+} Instr;
+
+/* Source map entry: the bytecode from `offset` up to the next entry came
+ * from `line` (0: no source line) and belongs to rule `rule` (-1: the
+ * indicator updates and temps shared by all rules) */
+typedef struct {
+    int32_t offset;
+    int32_t line;
+    int32_t rule;
+} LineEntry;
+
+/* One field of a RuleIndex: its `count` breakpoints start at
+ * breaks[first], and its 2 * count + 2 rows of candidate bits at row */
+typedef struct {
+    int32_t var;          // VarId
+    int32_t first;
+    int32_t count;
+    int32_t row;
+} GateField;
+
+/* Per-field candidate sets of a chunk's rules, built by the compiler
+ * (see gate.c). rule_count is 0 when the chunk has no index. */
+typedef struct {
+    int32_t rule_count;
+    int32_t words;        // uint64 words per row: rule_count bits
+    int32_t *entries;     // bytecode offset of each rule's code, in rule order
+    GateField *fields;
+    int32_t field_count;
+    double *breaks;
+    int32_t break_count;
+    uint64_t *rows;       // row_count rows of `words` words
+    int32_t row_count;
+} RuleIndex;
+
 typedef struct {
     uint8_t *code;
     int count;
     int capacity;
+    IndicatorSlot *slots;
+    int slot_count;
+    int slot_capacity;
+    int temp_count;       // per-bar temps used by STORE_TEMP / LOAD_TEMP
+    int cached_count;     // values kept across bars (STORE_CACHED / LOAD_CACHED)
+    LineEntry *lines;     // ascending offsets; see chunk_line
+    int line_count;
+    int line_capacity;
+    RuleIndex gates;
+    Param *params;        // names and defaults of the program's parameters
+    int param_count;
+
+    /* Runtime form of `code`, built by decode_chunk */
+    Instr *instrs;
+    int instr_count;
+    double *constants;
+    int constant_count;
+    uint32_t timeframes;  // 1 << Timeframe of every timeframe the code reads
+    int32_t *rule_targets; // instruction index of each gates.entries[]
+    int stack_depth;      // deepest the operand stack gets
+    int jump_targets;     // most forward jump targets outstanding at once
 } Chunk;
 
+/* Streaming state for one indicator slot; updated once per bar in O(1) */
+typedef struct {
+    uint8_t func;
+    int period;
+    double *window;  // SMA ring buffer (period entries)
+    int head;
+    int filled;
+    double sum;      // SMA running sum
+    double comp;     // SMA Kahan compensation
+    double value;    // EMA / RSI current output
+    double prev;     // RSI previous input
+    double avg_gain;
+    double avg_loss;
+    int count;       // bars seen
+    double output;   // this bar's result, read by LOAD_IND
+} Indicator;
+
+/* Feeds one input to a slot and returns the indicator's new value */
+typedef double (*IndicatorUpdate)(Indicator *ind, double x);
+
+typedef struct BarAggregator BarAggregator;
+typedef struct BatchLanes BatchLanes;
+
+/* Per-run indicator state; one per (chunk, symbol) being evaluated */
+typedef struct {
+    Indicator *slots;
+    int count;
+    double *windows; // backing storage for all SMA ring buffers
+    size_t bars;     // bars run so far; the bar index of signals
+    BarAggregator *frames; // NULL unless the chunk reads other timeframes
+    double *cached;        // the chunk's per-day and per-minute values, NULL if none
+    int32_t day_stamp;     // date they were last computed for (-1: not yet)
+    int32_t minute_stamp[2]; // date and time, for the per-minute ones
+    int32_t *candidates;   // this bar's rules from the chunk's index, NULL without one
+    double *params;        // this run's parameter values (LOAD_PARAM), NULL if none
+    const double *const *feeds; // per slot, outputs computed elsewhere (see run_chunk_batch)
+    BatchLanes *lanes;     // run_chunk_batch's block buffers, NULL if it runs bar by bar
+} IndicatorState;
+
 typedef struct {
     double open, high, low, close, volume;
     int date;   // YYYYMMDD
@@ -190,20 +463,366 @@ typedef struct {
     int weekday; // 1–7
 } VMContext;
 
+/* Higher-timeframe bars built from the bars a symbol is run on (see
+ * aggregate.c). Fixed size: a ring of the last TF_HISTORY closed bars per
+ * timeframe, indexed by Timeframe (row TF_BAR is unused). */
+#define TF_HISTORY 64
+
+struct BarAggregator {
+    uint32_t used;                      // 1 << Timeframe of the timeframes kept
+    uint32_t closed;                    // the ones whose bar closed at the last input
+    int64_t period[TF_COUNT];           // period of the forming bar, -1 before any input
+    VMContext forming[TF_COUNT];
+    size_t count[TF_COUNT];             // bars closed so far
+    VMContext history[TF_COUNT][TF_HISTORY];
+};
+
+/* Executions and clock ticks per decoded instruction, gathered by
+ * run_chunk_profiled. Ticks are TSC cycles on x86 and nanoseconds
+ * elsewhere; see profile.c. */
+typedef struct {
+    const Chunk *chunk;
+    uint64_t *counts;
+    uint64_t *ticks;
+    size_t bars;
+    uint64_t overhead;   // ticks of one clock read, taken off in the report
+} VMProfile;
+
+/* Structure-of-arrays bar history: one column per VMContext field,
+ * all `count` long. Used by the batch VM. */
+typedef struct {
+    const double *open, *high, *low, *close, *volume;
+    const int32_t *date, *time, *hour, *minute, *weekday;
+    size_t count;
+} BarColumns;
+
+/* A BUY/SELL as handed to a SignalSink */
+typedef struct {
+    size_t bar;          // index of the bar in this symbol's run
+    uint32_t symbol_id;  // the sink's symbol_id
+    int32_t qty;
+    uint16_t rule;       // Rule.index of the rule that fired
+    uint8_t side;        // BC_BUY or BC_SELL
+} Signal;
+
+/* Where the VMs deliver signals: emit is called synchronously, in bar
+ * order and in rule order within a bar. See signals.c for the stock
+ * consumers (collect, print, SPSC ring). */
+typedef struct {
+    void (*emit)(void *user, const Signal *sig);
+    void *user;
+    uint32_t symbol_id;
+} SignalSink;
+
+typedef struct {
+    Signal *items;
+    size_t count;
+    size_t capacity;
+} SignalBuffer;
+
+/* Text output: "SYMBOL <name>: BUY <qty>", names indexed by symbol_id */
+typedef struct {
+    const char *const *symbols;
+    FILE *out;
+} SignalPrinter;
+
+/* Preallocated lock-free queue between one producer (a VM) and one
+ * consumer thread. Each side's index and its cached copy of the other's
+ * sit on their own cache line. */
+typedef struct {
+    Signal *items;
+    size_t mask;                 // capacity - 1; capacity is a power of two
+    char pad0[64 - sizeof(Signal*) - sizeof(size_t)];
+    _Atomic size_t head;         // next record the consumer reads
+    size_t tail_seen;            // consumer's last look at tail
+    char pad1[64 - 2 * sizeof(size_t)];
+    _Atomic size_t tail;         // next record the producer writes
+    size_t head_seen;            // producer's last look at head
+    char pad2[64 - 2 * sizeof(size_t)];
+} SignalRing;
+
+/* One symbol of a multi-symbol backtest */
+typedef struct {
+    const char *symbol;
+    BarColumns bars;
+} BacktestSymbol;
+
+/* Column order in a binary bar file (see bars.c) */
+typedef enum {
+    BAR_COL_OPEN = 0,
+    BAR_COL_HIGH,
+    BAR_COL_LOW,
+    BAR_COL_CLOSE,
+    BAR_COL_VOLUME,
+    BAR_COL_DATE,
+    BAR_COL_TIME,
+    BAR_COL_HOUR,
+    BAR_COL_MINUTE,
+    BAR_COL_WEEKDAY,
+    BAR_COLUMN_COUNT
+} BarColumn;
+
+#define BARS_SYMBOL_MAX 32
+
+/* A memory-mapped bar file; cols point into the mapping */
+typedef struct {
+    BarColumns cols;
+    char symbol[BARS_SYMBOL_MAX];
+    void *map;
+    size_t map_size;
+} BarFile;
+
+/* One bar of a binary feed (see stream.c); native byte order, 48 bytes.
+ * hour, minute and weekday are derived from date and time. */
+typedef struct {
+    double open, high, low, close, volume;
+    int32_t date;   // YYYYMMDD
+    int32_t time;   // HHMM
+} BarRecord;
+
+/* A mapped .tlcb file: chunk.code and chunk.slots point into the
+ * read-only mapping; only the decoded form is on the heap */
+typedef struct {
+    Chunk chunk;
+    const char *symbol;
+    uint64_t source_hash;
+    void *map;
+    size_t map_size;
+} ChunkFile;
+
+/* Compiler switches; NULL options mean the defaults */
+typedef struct {
+    int fuse;        // emit superinstructions (default 1)
+    int gate;        // build a rule gating index when it pays (default 1)
+} CompileOptions;
+
 /* ---------- PUBLIC API ---------- */
 
+/* arena.c */
+void arena_init(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strndup(Arena *arena, const char *s, size_t len);
+char *arena_strdup(Arena *arena, const char *s);
+void arena_free(Arena *arena);
+
+/* builtins.c */
+const Builtin *lookup_builtin(const char *name, size_t length);
+const Builtin *builtin_var(VarId id);
+const Builtin *builtin_func(FuncId id);
+int lookup_timeframe(const char *name, size_t length);
+const char *timeframe_name(int tf);
+int timeframe_minutes(int tf);
+
 /* lexer.c */
-void init_lexer(const char *source);
-Token next_token(void);
+void init_lexer(Lexer *lexer, const char *source);
+Token next_token(Lexer *lexer);
 
-/* parser.c */
+/* parser.c
+ * parse_program_r / compile_program_r are reentrant: they keep all state
+ * in locals, return NULL / -1 on error with a message in err, and never
+ * exit. parse_program / compile_program print the error and exit. */
+Program *parse_program_r(const char *source, char *err, size_t errlen);
 Program *parse_program(const char *source);
 void free_program(Program *program);
 
+/* optimize.c */
+void optimize_program(Program *program);
+Frequency expr_frequency(const Expr *e);
+
 /* vm.c */
+int string_literal_value(VarId var, const char *text, double *out);
 void init_chunk(Chunk *chunk);
 void free_chunk(Chunk *chunk);
+int instruction_length(const Chunk *chunk, int offset);
+int chunk_line(const Chunk *chunk, int offset, int *rule);
+int find_param(const Chunk *chunk, const char *name);
+int compile_program_r(Program *program, Chunk *chunk, const CompileOptions *opts,
+                      char *err, size_t errlen);
 void compile_program(Program *program, Chunk *chunk);
-void run_chunk(Chunk *chunk, const VMContext *ctx, const char *symbol);
+int decode_chunk(Chunk *chunk, char *err, size_t errlen);
+void init_indicators(IndicatorState *state, const Chunk *chunk);
+void init_indicators_with(IndicatorState *state, const Chunk *chunk, const double *params);
+void reset_indicators(IndicatorState *state);
+void free_indicators(IndicatorState *state);
+IndicatorUpdate indicator_function(int func);
+void run_chunk(Chunk *chunk, IndicatorState *ind, const VMContext *ctx, const SignalSink *sink);
+void run_chunk_batch(const Chunk *chunk, IndicatorState *ind, const BarColumns *bars,
+                     const SignalSink *sink);
+void run_chunk_profiled(Chunk *chunk, IndicatorState *ind, const VMContext *ctx,
+                        const SignalSink *sink, VMProfile *profile);
+void send_signal(const SignalSink *sink, const IndicatorState *ind, int side, int32_t qty,
+                 int rule);
+int same_period(IndicatorState *ind, const VMContext *ctx, int freq);
+
+/* signals.c
+ * Stock SignalSink consumers; `user` is the SignalBuffer, SignalPrinter
+ * or SignalRing. ring_signal waits while the ring is full. */
+void collect_signal(void *buffer, const Signal *sig);
+void free_signals(SignalBuffer *out);
+void print_signal(void *printer, const Signal *sig);
+int init_signal_ring(SignalRing *ring, size_t capacity);
+void free_signal_ring(SignalRing *ring);
+int signal_ring_push(SignalRing *ring, const Signal *sig);
+int signal_ring_pop(SignalRing *ring, Signal *sig);
+void ring_signal(void *ring, const Signal *sig);
+
+/* profile.c
+ * run_chunk_profiled runs a separately compiled copy of the dispatch loop
+ * that feeds a VMProfile; run_chunk itself is untouched. */
+uint64_t profile_clock(void);
+void init_profile(VMProfile *profile, const Chunk *chunk);
+void free_profile(VMProfile *profile);
+void print_profile(const VMProfile *profile, FILE *out);
+
+/* gate.c
+ * build_rule_index leaves rule_count 0 when the program is not worth
+ * indexing; otherwise the compiler fills in entries. rule_candidates
+ * writes the positions of the rules that may fire on ctx, ascending, and
+ * returns how many; block_candidates ORs them over n bars into `bits`.
+ * check_rule_index returns what is wrong with an index, or NULL. */
+void build_rule_index(RuleIndex *index, const Program *program);
+void free_rule_index(RuleIndex *index);
+int rule_candidates(const RuleIndex *index, const VMContext *ctx, int32_t *out);
+void block_candidates(const RuleIndex *index, const BarColumns *bars, size_t base, int n,
+                      uint64_t *bits);
+const char *check_rule_index(const RuleIndex *index);
+
+/* debug.c */
+const char *opcode_name(OpCode op);
+int disassemble_instruction(const Chunk *chunk, int offset, FILE *out);
+void disassemble_chunk(const Chunk *chunk, const char *title, FILE *out);
+
+/* jit.c
+ * Native x86-64 code for the per-bar run of a compiled chunk. jit_compile
+ * returns NULL when the host or the chunk is not supported; run_chunk is
+ * the fallback. jit_run sends exactly the signals run_chunk sends. Code
+ * for a chunk with a rule index reads it, so the chunk must outlive it. */
+typedef struct JitCode JitCode;
+JitCode *jit_compile(const Chunk *chunk);
+void jit_run(const JitCode *jit, IndicatorState *ind, const VMContext *ctx, const SignalSink *sink);
+void jit_free(JitCode *jit);
+
+/* emit.c
+ * Ahead-of-time translation. emit_c writes a chunk as a C file defining
+ * `const CompiledStrategy tlc_strategy`, built with
+ *   gcc -std=c11 -O3 -fPIC -shared -I<tlc> strategy.c -o strategy.so
+ * load_strategy dlopens such a file and run_strategy has run_chunk's
+ * semantics and output. */
+#define TLC_STRATEGY_ABI 4
+
+typedef struct {
+    int abi;                  // TLC_STRATEGY_ABI
+    int context_size;         // sizeof(VMContext) the file was built against
+    int indicator_size;       // sizeof(Indicator)
+    const char *symbol;       // the program's symbol
+    const IndicatorSlot *slots;
+    int slot_count;
+    void (*run)(IndicatorState *ind, const VMContext *ctx, const SignalSink *sink,
+                const IndicatorUpdate *update);
+    int cached_count;         // IndicatorState.cached entries run uses
+} CompiledStrategy;
+
+typedef struct {
+    void *handle;
+    const CompiledStrategy *strategy;
+    IndicatorUpdate update[FUNC_COUNT];
+} StrategyLib;
+
+int emit_c(const Chunk *chunk, const char *symbol, const char *source_name, FILE *out,
+           char *err, size_t errlen);
+int load_strategy(StrategyLib *lib, const char *path, char *err, size_t errlen);
+void unload_strategy(StrategyLib *lib);
+void init_strategy_indicators(IndicatorState *state, const StrategyLib *lib);
+void run_strategy(const StrategyLib *lib, IndicatorState *ind, const VMContext *ctx,
+                  const SignalSink *sink);
+
+/* aggregate.c
+ * aggregate_bar merges one bar (or a tick as a one-price bar) into every
+ * timeframe in agg->used and returns the ones whose bar it closed: a bar
+ * closes when the first input of the next period arrives. timeframe_bar
+ * is a closed bar, `ago` bars back, or NULL. */
+void init_aggregator(BarAggregator *agg, uint32_t used);
+uint32_t aggregate_bar(BarAggregator *agg, const VMContext *bar);
+const VMContext *timeframe_bar(const BarAggregator *agg, int tf, size_t ago);
+
+/* stream.c
+ * Runs a chunk bar by bar over a live feed on `fd` (stdin, a pipe or a
+ * FIFO) until end of input: CSV lines in the --convert format, trades
+ * (date,time,price,size) when opts->ticks, or BarRecords when
+ * opts->binary. Signals are printed to `out` in batches; throughput and
+ * bar-to-signal latency go to `report`. */
+typedef struct {
+    int binary;
+    int ticks;
+    JitCode *jit;    // runs instead of run_chunk when not NULL
+} StreamOptions;
+
+int run_stream(Chunk *chunk, int fd, const char *symbol, const StreamOptions *opts,
+               FILE *out, FILE *report);
+
+/* bars.c */
+int open_bar_file(BarFile *bf, const char *path);
+void close_bar_file(BarFile *bf);
+int write_bar_file(const char *path, const char *symbol, const BarColumns *cols);
+int convert_csv_to_bars(const char *csv_path, const char *out_path, const char *symbol);
+int date_weekday(int date);
+
+/* cache.c
+ * Compiled chunks on disk (.tlcb) and a compile cache keyed by
+ * compile_key, so a restart maps bytecode instead of compiling. Errors
+ * go to err; a cache miss is not an error and stays quiet. */
+uint64_t compile_key(const char *source, size_t length, const CompileOptions *opts);
+int write_chunk_file(const char *path, const Chunk *chunk, const char *symbol,
+                     uint64_t source_hash, char *err, size_t errlen);
+int open_chunk_file(ChunkFile *cf, const char *path, char *err, size_t errlen);
+void close_chunk_file(ChunkFile *cf);
+int cache_lookup(ChunkFile *cf, const char *dir, uint64_t key);
+int cache_store(const char *dir, uint64_t key, const Chunk *chunk, const char *symbol,
+                char *err, size_t errlen);
+
+/* backtest.c
+ * Runs one chunk over every symbol on `threads` workers (0 = one per
+ * core). results[i] receives the signals of universe[i] in bar order, so
+ * the merged output does not depend on scheduling. */
+int run_backtest(const Chunk *chunk, const BacktestSymbol *universe, int count,
+                 int threads, SignalBuffer *results);
+
+/* sweep.c
+ * Runs one chunk for every combination of parameter values over every
+ * symbol. Combination i gets the values sweep_values writes (the last
+ * axis varies fastest; parameters no axis names keep their defaults).
+ * Each result books the combination's signals at the close of the bar
+ * that fired them and values what is still open at the last close.
+ * sweep_size is 0 when an axis is empty or there are more than
+ * SWEEP_MAX combinations. NULL options mean the defaults. */
+#define SWEEP_MAX 10000000
+
+typedef struct {
+    int param;              // index in chunk->params
+    const double *values;
+    int count;
+} SweepAxis;
+
+typedef struct {
+    int threads;            // workers (0 = one per core)
+    int share;              // compute each distinct indicator once per bar (default 1)
+} SweepOptions;
+
+typedef struct {
+    size_t signals;
+    double pnl;
+} SweepResult;
+
+typedef struct {
+    size_t indicators;      // indicator slots over all combinations
+    size_t computed;        // indicators updated per bar once shared ones are merged
+} SweepStats;
+
+size_t sweep_size(const SweepAxis *axes, int axis_count);
+void sweep_values(const Chunk *chunk, const SweepAxis *axes, int axis_count,
+                  size_t combination, double *values);
+int run_sweep(const Chunk *chunk, const BacktestSymbol *universe, int count,
+              const SweepAxis *axes, int axis_count, const SweepOptions *opts,
+              SweepResult *results, SweepStats *stats, char *err, size_t errlen);
 
 #endif /* TL_AST_H */
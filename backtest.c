@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "ast.h"
+
+/* ---------- Multi-symbol backtest driver ----------
+ *
+ * The compiled Chunk is read-only and shared by all workers. Each worker
+ * owns one IndicatorState (allocated once, reset per symbol) and one
+ * deque of symbol indices. Symbols are dealt out largest-history-first;
+ * a worker drains its own deque from the front and, once empty, steals
+ * from the back of the others'. Every symbol writes only its own result
+ * slot, so the merged output is the same whatever the schedule.
+ */
+
+typedef struct {
+    int *tasks;
+    int head;       // next task the owner takes
+    int tail;       // one past the task a thief takes
+    pthread_mutex_t lock;
+} WorkQueue;
+
+typedef struct {
+    const Chunk *chunk;
+    const BacktestSymbol *universe;
+    SignalBuffer *results;
+    WorkQueue *queues;
+    int workers;
+} Pool;
+
+typedef struct {
+    Pool *pool;
+    int id;
+} Worker;
+
+static int pop_local(WorkQueue *q) {
+    int task = -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) task = q->tasks[q->head++];
+    pthread_mutex_unlock(&q->lock);
+    return task;
+}
+
+static int steal(Pool *pool, int thief) {
+    for (int i = 1; i < pool->workers; ++i) {
+        WorkQueue *q = &pool->queues[(thief + i) % pool->workers];
+        int task = -1;
+        pthread_mutex_lock(&q->lock);
+        if (q->head < q->tail) task = q->tasks[--q->tail];
+        pthread_mutex_unlock(&q->lock);
+        if (task >= 0) return task;
+    }
+    return -1;
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = (Worker*)arg;
+    Pool *pool = w->pool;
+    IndicatorState ind;
+    init_indicators(&ind, pool->chunk);
+
+    for (;;) {
+        int task = pop_local(&pool->queues[w->id]);
+        if (task < 0) task = steal(pool, w->id);
+        if (task < 0) break; // nothing is ever re-queued, so all work is claimed
+
+        const BacktestSymbol *sym = &pool->universe[task];
+        SignalSink sink = { collect_signal, &pool->results[task], (uint32_t)task };
+        reset_indicators(&ind);
+        run_chunk_batch(pool->chunk, &ind, &sym->bars, &sink);
+    }
+
+    free_indicators(&ind);
+    return NULL;
+}
+
+typedef struct {
+    size_t bars;
+    int index;
+} SizedTask;
+
+static int by_size_desc(const void *a, const void *b) {
+    const SizedTask *ta = (const SizedTask*)a, *tb = (const SizedTask*)b;
+    if (ta->bars != tb->bars) return ta->bars < tb->bars ? 1 : -1;
+    return ta->index - tb->index;
+}
+
+int run_backtest(const Chunk *chunk, const BacktestSymbol *universe, int count,
+                 int threads, SignalBuffer *results) {
+    memset(results, 0, (size_t)count * sizeof(SignalBuffer));
+    if (count <= 0) return 0;
+
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    if (threads > count) threads = count;
+
+    int per = (count + threads - 1) / threads;
+    SizedTask *order = (SizedTask*)malloc((size_t)count * sizeof(SizedTask));
+    int *slots = (int*)malloc((size_t)per * threads * sizeof(int));
+    WorkQueue *queues = (WorkQueue*)calloc((size_t)threads, sizeof(WorkQueue));
+    Worker *workers = (Worker*)malloc((size_t)threads * sizeof(Worker));
+    pthread_t *tids = (pthread_t*)malloc((size_t)threads * sizeof(pthread_t));
+    if (!order || !slots || !queues || !workers || !tids) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    /* Largest histories first, dealt round-robin, so every deque starts
+     * with a similar amount of work and the long tail is small symbols. */
+    for (int i = 0; i < count; ++i) {
+        order[i].bars = universe[i].bars.count;
+        order[i].index = i;
+    }
+    qsort(order, (size_t)count, sizeof(SizedTask), by_size_desc);
+
+    for (int w = 0; w < threads; ++w) {
+        queues[w].tasks = slots + (size_t)w * per;
+        queues[w].head = queues[w].tail = 0;
+        pthread_mutex_init(&queues[w].lock, NULL);
+    }
+    for (int i = 0; i < count; ++i) {
+        WorkQueue *q = &queues[i % threads];
+        q->tasks[q->tail++] = order[i].index;
+    }
+
+    Pool pool = { chunk, universe, results, queues, threads };
+
+    /* The calling thread is worker 0; if a thread cannot be started, the
+     * remaining workers steal its share. */
+    int started = 1;
+    for (int w = 0; w < threads; ++w) {
+        workers[w].pool = &pool;
+        workers[w].id = w;
+    }
+    for (int w = 1; w < threads; ++w) {
+        if (pthread_create(&tids[w], NULL, worker_main, &workers[w]) != 0) break;
+        started++;
+    }
+    worker_main(&workers[0]);
+    for (int w = 1; w < started; ++w) pthread_join(tids[w], NULL);
+
+    for (int w = 0; w < threads; ++w) pthread_mutex_destroy(&queues[w].lock);
+    free(tids);
+    free(workers);
+    free(queues);
+    free(slots);
+    free(order);
+    return 0;
+}
@@ -0,0 +1,278 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ast.h"
+
+/* ---------- Binary bar file ----------
+ *
+ * Layout (all little-endian, native alignment):
+ *
+ *   BarFileHeader
+ *   open[count]    double   \
+ *   high[count]    double    |
+ *   low[count]     double    |  each column starts on a
+ *   close[count]   double    |  BARS_ALIGN boundary
+ *   volume[count]  double    |
+ *   date[count]    int32     |
+ *   time[count]    int32     |
+ *   hour[count]    int32     |
+ *   minute[count]  int32     |
+ *   weekday[count] int32    /
+ *
+ * The file is mmap'ed read-only and BarColumns points straight into the
+ * mapping, so opening a multi-GB history costs one syscall and no copies.
+ */
+
+#define BARS_MAGIC "TLCBARS\0"
+#define BARS_VERSION 1
+#define BARS_ENDIAN_TAG 0x01020304u
+#define BARS_ALIGN 64
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint64_t count;
+    char symbol[BARS_SYMBOL_MAX];
+    uint64_t column_offset[BAR_COLUMN_COUNT];
+} BarFileHeader;
+
+static size_t column_width(int col) {
+    return col < BAR_COL_DATE ? sizeof(double) : sizeof(int32_t);
+}
+
+static uint64_t align_up(uint64_t v) {
+    return (v + BARS_ALIGN - 1) & ~(uint64_t)(BARS_ALIGN - 1);
+}
+
+static void layout_columns(BarFileHeader *h) {
+    uint64_t off = align_up(sizeof(BarFileHeader));
+    for (int c = 0; c < BAR_COLUMN_COUNT; ++c) {
+        h->column_offset[c] = off;
+        off = align_up(off + h->count * column_width(c));
+    }
+}
+
+int open_bar_file(BarFile *bf, const char *path) {
+    memset(bf, 0, sizeof(*bf));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return -1; }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) { perror(path); close(fd); return -1; }
+    size_t size = (size_t)st.st_size;
+    if (size < sizeof(BarFileHeader)) {
+        fprintf(stderr, "%s: not a bar file (too small)\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) { perror("mmap"); return -1; }
+
+    const BarFileHeader *h = (const BarFileHeader*)map;
+    const char *err = NULL;
+    if (memcmp(h->magic, BARS_MAGIC, 8) != 0)   err = "bad magic";
+    else if (h->endian != BARS_ENDIAN_TAG)      err = "written on a machine with different byte order";
+    else if (h->version != BARS_VERSION)        err = "unsupported version";
+    for (int c = 0; !err && c < BAR_COLUMN_COUNT; ++c) {
+        uint64_t off = h->column_offset[c];
+        if (off % BARS_ALIGN != 0 || off > size ||
+            h->count > (size - off) / column_width(c)) {
+            err = "column out of bounds";
+        }
+    }
+    if (err) {
+        fprintf(stderr, "%s: %s\n", path, err);
+        munmap(map, size);
+        return -1;
+    }
+
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+
+    const uint8_t *base = (const uint8_t*)map;
+    bf->map = map;
+    bf->map_size = size;
+    memcpy(bf->symbol, h->symbol, BARS_SYMBOL_MAX);
+    bf->symbol[BARS_SYMBOL_MAX - 1] = '\0';
+    bf->cols.count   = (size_t)h->count;
+    bf->cols.open    = (const double*)(base + h->column_offset[BAR_COL_OPEN]);
+    bf->cols.high    = (const double*)(base + h->column_offset[BAR_COL_HIGH]);
+    bf->cols.low     = (const double*)(base + h->column_offset[BAR_COL_LOW]);
+    bf->cols.close   = (const double*)(base + h->column_offset[BAR_COL_CLOSE]);
+    bf->cols.volume  = (const double*)(base + h->column_offset[BAR_COL_VOLUME]);
+    bf->cols.date    = (const int32_t*)(base + h->column_offset[BAR_COL_DATE]);
+    bf->cols.time    = (const int32_t*)(base + h->column_offset[BAR_COL_TIME]);
+    bf->cols.hour    = (const int32_t*)(base + h->column_offset[BAR_COL_HOUR]);
+    bf->cols.minute  = (const int32_t*)(base + h->column_offset[BAR_COL_MINUTE]);
+    bf->cols.weekday = (const int32_t*)(base + h->column_offset[BAR_COL_WEEKDAY]);
+    return 0;
+}
+
+void close_bar_file(BarFile *bf) {
+    if (bf->map) munmap(bf->map, bf->map_size);
+    memset(bf, 0, sizeof(*bf));
+}
+
+int write_bar_file(const char *path, const char *symbol, const BarColumns *cols) {
+    BarFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BARS_MAGIC, 8);
+    h.version = BARS_VERSION;
+    h.endian = BARS_ENDIAN_TAG;
+    h.count = cols->count;
+    if (symbol) strncpy(h.symbol, symbol, BARS_SYMBOL_MAX - 1);
+    layout_columns(&h);
+
+    const void *data[BAR_COLUMN_COUNT] = {
+        cols->open, cols->high, cols->low, cols->close, cols->volume,
+        cols->date, cols->time, cols->hour, cols->minute, cols->weekday
+    };
+
+    FILE *f = fopen(path, "wb");
+    if (!f) { perror(path); return -1; }
+
+    static const uint8_t zeros[BARS_ALIGN];
+    uint64_t pos = 0;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    pos += sizeof(h);
+    for (int c = 0; ok && c < BAR_COLUMN_COUNT; ++c) {
+        ok = fwrite(zeros, 1, (size_t)(h.column_offset[c] - pos), f) == h.column_offset[c] - pos;
+        pos = h.column_offset[c];
+        size_t bytes = (size_t)h.count * column_width(c);
+        if (ok && bytes) ok = fwrite(data[c], 1, bytes, f) == bytes;
+        pos += bytes;
+    }
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "%s: write failed\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* ---------- CSV -> bar file ----------
+ *
+ * One bar per line: date,time,open,high,low,close,volume
+ *   date: YYYYMMDD or YYYY-MM-DD
+ *   time: HHMM, HH:MM or HH:MM:SS
+ * A first line that does not start with a digit is taken as a header.
+ * hour, minute and weekday are derived here so the VM never computes them.
+ */
+
+/* Sakamoto's method on a YYYYMMDD date: 1=Mon .. 7=Sun */
+int date_weekday(int date) {
+    static const int t[] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+    int y = date / 10000, m = (date / 100) % 100, d = date % 100;
+    if (m < 1 || m > 12) return 0;
+    if (m < 3) y -= 1;
+    int w = (y + y / 4 - y / 100 + y / 400 + t[m - 1] + d) % 7; // 0=Sun
+    return w == 0 ? 7 : w;
+}
+
+static int parse_csv_date(const char *s, int *out) {
+    int y, m, d;
+    if (sscanf(s, "%4d-%2d-%2d", &y, &m, &d) == 3 ||
+        sscanf(s, "%4d%2d%2d", &y, &m, &d) == 3) {
+        if (m < 1 || m > 12 || d < 1 || d > 31) return 0;
+        *out = y * 10000 + m * 100 + d;
+        return 1;
+    }
+    return 0;
+}
+
+static int parse_csv_time(const char *s, int *hour, int *minute) {
+    int h, m;
+    if (sscanf(s, "%2d:%2d", &h, &m) == 2 || sscanf(s, "%2d%2d", &h, &m) == 2) {
+        if (h < 0 || h > 23 || m < 0 || m > 59) return 0;
+        *hour = h;
+        *minute = m;
+        return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    double *open, *high, *low, *close, *volume;
+    int32_t *date, *time, *hour, *minute, *weekday;
+    size_t count, capacity;
+} BarBuilder;
+
+static void builder_grow(BarBuilder *b) {
+    size_t cap = b->capacity ? b->capacity * 2 : 4096;
+#define GROW(field) do { \
+        b->field = realloc(b->field, cap * sizeof(*b->field)); \
+        if (!b->field) { fprintf(stderr, "Out of memory\n"); exit(1); } \
+    } while (0)
+    GROW(open); GROW(high); GROW(low); GROW(close); GROW(volume);
+    GROW(date); GROW(time); GROW(hour); GROW(minute); GROW(weekday);
+#undef GROW
+    b->capacity = cap;
+}
+
+static void builder_free(BarBuilder *b) {
+    free(b->open); free(b->high); free(b->low); free(b->close); free(b->volume);
+    free(b->date); free(b->time); free(b->hour); free(b->minute); free(b->weekday);
+}
+
+int convert_csv_to_bars(const char *csv_path, const char *out_path, const char *symbol) {
+    FILE *f = fopen(csv_path, "r");
+    if (!f) { perror(csv_path); return -1; }
+
+    BarBuilder b;
+    memset(&b, 0, sizeof(b));
+    char line[512];
+    long lineno = 0;
+    int status = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        if (line[0] == '\n' || line[0] == '\r' || line[0] == '\0') continue;
+        if (lineno == 1 && !(line[0] >= '0' && line[0] <= '9')) continue; // header
+
+        char date_s[32], time_s[32];
+        double o, h, l, c, v;
+        int date, hour, minute;
+        if (sscanf(line, "%31[^,],%31[^,],%lf,%lf,%lf,%lf,%lf",
+                   date_s, time_s, &o, &h, &l, &c, &v) != 7 ||
+            !parse_csv_date(date_s, &date) ||
+            !parse_csv_time(time_s, &hour, &minute)) {
+            fprintf(stderr, "%s:%ld: expected date,time,open,high,low,close,volume\n",
+                    csv_path, lineno);
+            status = -1;
+            break;
+        }
+
+        if (b.count == b.capacity) builder_grow(&b);
+        size_t i = b.count++;
+        b.open[i] = o;
+        b.high[i] = h;
+        b.low[i] = l;
+        b.close[i] = c;
+        b.volume[i] = v;
+        b.date[i] = date;
+        b.time[i] = hour * 100 + minute;
+        b.hour[i] = hour;
+        b.minute[i] = minute;
+        b.weekday[i] = date_weekday(date);
+    }
+    fclose(f);
+
+    if (status == 0) {
+        BarColumns cols = {
+            b.open, b.high, b.low, b.close, b.volume,
+            b.date, b.time, b.hour, b.minute, b.weekday,
+            b.count
+        };
+        status = write_bar_file(out_path, symbol, &cols);
+    }
+    builder_free(&b);
+    return status;
+}
@@ -0,0 +1,1321 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "ast.h"
+
+/* Throughput and latency of the engines on a corpus of representative
+ * strategies over synthetic random-walk bars.
+ *
+ *   tlc-bench [--bars N] [--symbols N] [--seed N] [--json] [bars]
+ *   tlc-bench --jit-check [strategies]
+ *
+ * For fused and unfused bytecode it reports static dispatches per bar,
+ * ns/bar of the scalar VM, the batch VM and the JIT over every symbol,
+ * per-bar p50/p99/p99.9 latency of the scalar VM and the JIT, heap
+ * allocations inside the timed loops, and the cost of the front end
+ * (parse, optimize, compile). The table goes to stderr; --json also
+ * writes the numbers to stdout for comparing builds. Signals go to a
+ * counting sink. The last line is the cost of handing signals through a
+ * SignalRing to a consumer thread. The rule gating table compares
+ * strategies of 16 to 4096 time-gated rules compiled with and without
+ * the rule index. The sweep line runs a grid of 500 parameter
+ * combinations over one symbol with and without shared indicators, and
+ * checks a few of them against the strategy compiled with those values
+ * written in as literals. --jit-check runs random strategies (some with
+ * parameters or other timeframes) over random bars through run_chunk,
+ * run_chunk_batch and jit_run and fails on the first difference in
+ * signals or indicator outputs; it also checks that neither the rule
+ * index nor the optimizer changes the signals, and first that a fixed
+ * set of timeframe rules sends the same signals optimized and not. */
+
+typedef struct {
+    const char *name;
+    const char *source;
+} Strategy;
+
+static const Strategy strategies[] = {
+    { "ma cross",
+      "symbol \"BENCH\"\n"
+      "if close > sma(close, 20) and close > ema(close, 50) then buy 10 end\n"
+      "if close < sma(close, 20) then sell 10 end\n" },
+    { "thresholds",
+      "symbol \"BENCH\"\n"
+      "if close > 140 then buy 1 end\n"
+      "if close < 60 then sell 1 end\n"
+      "if volume > 1990 then buy 2 end\n" },
+    { "time window",
+      "symbol \"BENCH\"\n"
+      "if hour == 9 and minute >= 15 and weekday != \"Fri\" then buy 1 end\n"
+      "if time >= \"15:29\" then sell 1 end\n" },
+    { "rsi revert",
+      "symbol \"BENCH\"\n"
+      "if rsi(14) < 20 then buy 5 end\n"
+      "if rsi(14) > 80 then sell 5 end\n" },
+    { "breakout",
+      "symbol \"BENCH\"\n"
+      "if close > sma(high, 50) * 1.01 and volume > sma(volume, 20) then buy 3 end\n"
+      "if close < sma(low, 50) * 0.99 or rsi(7) > 90 then sell 3 end\n"
+      "if (high - low) > 2 * (sma(high, 10) - sma(low, 10)) then sell 1 end\n" },
+    { "session mix",
+      "symbol \"BENCH\"\n"
+      "if time >= \"09:30\" and time < \"11:00\" and close > ema(close, 9) then buy 1 end\n"
+      "if time >= \"14:00\" and close < ema(close, 9) then sell 1 end\n"
+      "if weekday == \"Mon\" and rsi(14) < 30 then buy 2 end\n"
+      "if weekday == \"Fri\" and time >= \"15:15\" then sell 2 end\n"
+      "if not (close > open) and volume > 1900 then sell 1 end\n" },
+};
+
+#define STRATEGY_COUNT ((int)(sizeof(strategies) / sizeof(strategies[0])))
+
+typedef struct {
+    double *open, *high, *low, *close, *volume;
+    int32_t *date, *time, *hour, *minute, *weekday;
+    size_t count;
+} Series;
+
+/* One Series per symbol, all the same length */
+typedef struct {
+    Series *symbols;
+    int count;
+    size_t bars;
+} Universe;
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static double next_uniform(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (double)(rng_state >> 11) / 9007199254740992.0;
+}
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/* ---------- Allocation counter ----------
+ *
+ * With glibc the bench replaces the malloc family with counting wrappers
+ * around the libc allocator; every allocation in the process, including
+ * libc's own, goes through them. Elsewhere counts read as -1 (unknown). */
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static _Atomic long alloc_calls;
+
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&alloc_calls, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    atomic_fetch_add_explicit(&alloc_calls, 1, memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    atomic_fetch_add_explicit(&alloc_calls, 1, memory_order_relaxed);
+    return __libc_realloc(p, size);
+}
+
+static long allocations(void) {
+    return atomic_load_explicit(&alloc_calls, memory_order_relaxed);
+}
+#else
+static long allocations(void) {
+    return -1;
+}
+#endif
+
+/* Random-walk minute bars, 375 per session, five sessions a week */
+static void generate_series(Series *s, size_t count) {
+    s->count = count;
+    s->open = xmalloc(count * sizeof(double));
+    s->high = xmalloc(count * sizeof(double));
+    s->low = xmalloc(count * sizeof(double));
+    s->close = xmalloc(count * sizeof(double));
+    s->volume = xmalloc(count * sizeof(double));
+    s->date = xmalloc(count * sizeof(int32_t));
+    s->time = xmalloc(count * sizeof(int32_t));
+    s->hour = xmalloc(count * sizeof(int32_t));
+    s->minute = xmalloc(count * sizeof(int32_t));
+    s->weekday = xmalloc(count * sizeof(int32_t));
+
+    double price = 100.0;
+    for (size_t i = 0; i < count; ++i) {
+        double open = price;
+        price += next_uniform() - 0.5;
+        if (price < 1.0) price = 1.0;
+        s->open[i] = open;
+        s->close[i] = price;
+        s->high[i] = (open > price ? open : price) + next_uniform() * 0.2;
+        s->low[i] = (open < price ? open : price) - next_uniform() * 0.2;
+        s->volume[i] = 1000.0 + next_uniform() * 1000.0;
+
+        int session = (int)(i / 375), minute = 9 * 60 + 15 + (int)(i % 375);
+        s->date[i] = 20200101 + session;
+        s->hour[i] = minute / 60;
+        s->minute[i] = minute % 60;
+        s->time[i] = s->hour[i] * 100 + s->minute[i];
+        s->weekday[i] = 1 + session % 5;
+    }
+}
+
+static void free_series(Series *s) {
+    free(s->open); free(s->high); free(s->low); free(s->close); free(s->volume);
+    free(s->date); free(s->time); free(s->hour); free(s->minute); free(s->weekday);
+}
+
+/* Symbol k's walk depends only on (seed, k), so any build given the same
+ * arguments benchmarks the same bars */
+static void generate_universe(Universe *u, int symbols, size_t bars, uint64_t seed) {
+    u->symbols = xmalloc((size_t)symbols * sizeof(Series));
+    u->count = symbols;
+    u->bars = bars;
+    for (int k = 0; k < symbols; ++k) {
+        rng_state = (seed + (uint64_t)k + 1) * 0x9E3779B97F4A7C15ULL;
+        if (rng_state == 0) rng_state = 1;
+        generate_series(&u->symbols[k], bars);
+    }
+}
+
+static void free_universe(Universe *u) {
+    for (int k = 0; k < u->count; ++k) free_series(&u->symbols[k]);
+    free(u->symbols);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Instructions on the condition path, every one but the actions; a bar
+ * whose conditions short-circuit executes fewer */
+static int dispatches_per_bar(const Chunk *chunk) {
+    int n = 0;
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset)) {
+        OpCode op = (OpCode)chunk->code[offset];
+        if (op != BC_BUY && op != BC_SELL) n++;
+    }
+    return n;
+}
+
+static size_t signal_count;
+
+static void count_signal(void *user, const Signal *sig) {
+    (void)user;
+    (void)sig;
+    signal_count++;
+}
+
+static const SignalSink counter = { count_signal, NULL, 0 };
+
+/* ---------- Throughput ----------
+ *
+ * Each returns ns/bar over every bar of every symbol, and leaves the
+ * number of allocations made inside the timed loops in timed_allocs. */
+
+static long timed_allocs;
+
+static VMContext bar_context(const Series *s, size_t i) {
+    VMContext ctx = {
+        s->open[i], s->high[i], s->low[i], s->close[i], s->volume[i],
+        s->date[i], s->time[i], s->hour[i], s->minute[i], s->weekday[i]
+    };
+    return ctx;
+}
+
+static double time_scalar(const Chunk *chunk, const Universe *u) {
+    double elapsed = 0.0;
+    timed_allocs = 0;
+    for (int k = 0; k < u->count; ++k) {
+        const Series *s = &u->symbols[k];
+        IndicatorState ind;
+        init_indicators(&ind, chunk);
+        long allocs = allocations();
+        double start = now_ns();
+        for (size_t i = 0; i < s->count; ++i) {
+            VMContext ctx = bar_context(s, i);
+            run_chunk((Chunk *)chunk, &ind, &ctx, &counter);
+        }
+        elapsed += now_ns() - start;
+        timed_allocs += allocations() - allocs;
+        free_indicators(&ind);
+    }
+    return elapsed / ((double)u->bars * u->count);
+}
+
+static double time_jit(const Chunk *chunk, const Universe *u) {
+    JitCode *jit = jit_compile(chunk);
+    if (!jit) return -1.0;
+    double elapsed = 0.0;
+    timed_allocs = 0;
+    for (int k = 0; k < u->count; ++k) {
+        const Series *s = &u->symbols[k];
+        IndicatorState ind;
+        init_indicators(&ind, chunk);
+        long allocs = allocations();
+        double start = now_ns();
+        for (size_t i = 0; i < s->count; ++i) {
+            VMContext ctx = bar_context(s, i);
+            jit_run(jit, &ind, &ctx, &counter);
+        }
+        elapsed += now_ns() - start;
+        timed_allocs += allocations() - allocs;
+        free_indicators(&ind);
+    }
+    jit_free(jit);
+    return elapsed / ((double)u->bars * u->count);
+}
+
+static double time_batch(const Chunk *chunk, const Universe *u) {
+    double elapsed = 0.0;
+    timed_allocs = 0;
+    for (int k = 0; k < u->count; ++k) {
+        const Series *s = &u->symbols[k];
+        BarColumns cols = {
+            s->open, s->high, s->low, s->close, s->volume,
+            s->date, s->time, s->hour, s->minute, s->weekday, s->count
+        };
+        IndicatorState ind;
+        init_indicators(&ind, chunk);
+        long allocs = allocations();
+        double start = now_ns();
+        run_chunk_batch(chunk, &ind, &cols, &counter);
+        elapsed += now_ns() - start;
+        timed_allocs += allocations() - allocs;
+        free_indicators(&ind);
+    }
+    return elapsed / ((double)u->bars * u->count);
+}
+
+/* Best of a few runs, to keep scheduler noise out of the comparison */
+#define RUNS 3
+
+static double best_of(double (*fn)(const Chunk *, const Universe *),
+                      const Chunk *chunk, const Universe *u, long *allocs) {
+    double best = fn(chunk, u);
+    *allocs = timed_allocs;
+    for (int i = 1; i < RUNS; ++i) {
+        double t = fn(chunk, u);
+        if (t < best) best = t;
+        if (timed_allocs > *allocs) *allocs = timed_allocs;
+    }
+    return best;
+}
+
+/* ---------- Per-bar latency ----------
+ *
+ * Every bar of the first symbol is timed on its own. The numbers include
+ * one clock read (timer_overhead), which is reported alongside rather
+ * than subtracted. The batch VM has no per-bar latency. */
+
+typedef struct {
+    double p50, p99, p999;
+} Latency;
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static Latency percentiles(double *samples, size_t n) {
+    qsort(samples, n, sizeof(double), compare_doubles);
+    Latency l = {
+        samples[(size_t)(0.50 * (double)(n - 1))],
+        samples[(size_t)(0.99 * (double)(n - 1))],
+        samples[(size_t)(0.999 * (double)(n - 1))]
+    };
+    return l;
+}
+
+static double timer_overhead(void) {
+    enum { N = 10001 };
+    static double samples[N];
+    for (int i = 0; i < N; ++i) {
+        double start = now_ns();
+        samples[i] = now_ns() - start;
+    }
+    return percentiles(samples, N).p50;
+}
+
+static Latency latency_scalar(const Chunk *chunk, const Series *s, double *samples) {
+    IndicatorState ind;
+    init_indicators(&ind, chunk);
+    for (size_t i = 0; i < s->count; ++i) {
+        VMContext ctx = bar_context(s, i);
+        double start = now_ns();
+        run_chunk((Chunk *)chunk, &ind, &ctx, &counter);
+        samples[i] = now_ns() - start;
+    }
+    free_indicators(&ind);
+    return percentiles(samples, s->count);
+}
+
+static Latency latency_jit(const Chunk *chunk, const Series *s, double *samples) {
+    Latency none = { -1.0, -1.0, -1.0 };
+    JitCode *jit = jit_compile(chunk);
+    if (!jit) return none;
+    IndicatorState ind;
+    init_indicators(&ind, chunk);
+    for (size_t i = 0; i < s->count; ++i) {
+        VMContext ctx = bar_context(s, i);
+        double start = now_ns();
+        jit_run(jit, &ind, &ctx, &counter);
+        samples[i] = now_ns() - start;
+    }
+    free_indicators(&ind);
+    jit_free(jit);
+    return percentiles(samples, s->count);
+}
+
+/* ---------- Front end ---------- */
+
+#define FRONT_END_RUNS 2000
+
+/* µs per parse + optimize + compile of `source`, and allocations per run */
+static double time_front_end(const char *source, long *allocs) {
+    char err[256];
+    *allocs = -1;
+    long before = allocations();
+    double start = now_ns();
+    for (int i = 0; i < FRONT_END_RUNS; ++i) {
+        Program *prog = parse_program_r(source, err, sizeof(err));
+        if (!prog) return -1.0;
+        optimize_program(prog);
+        Chunk chunk;
+        if (compile_program_r(prog, &chunk, NULL, err, sizeof(err)) == 0) free_chunk(&chunk);
+        free_program(prog);
+    }
+    double elapsed = now_ns() - start;
+    *allocs = before < 0 ? -1 : (allocations() - before) / FRONT_END_RUNS;
+    return elapsed / FRONT_END_RUNS / 1000.0;
+}
+
+/* ---------- Report ---------- */
+
+enum { ENGINE_SCALAR, ENGINE_BATCH, ENGINE_JIT, ENGINE_COUNT };
+
+static const char *const engine_names[ENGINE_COUNT] = { "scalar", "batch", "jit" };
+
+typedef struct {
+    double ns_per_bar;   // < 0: engine not available
+    long allocs;         // allocations in the timed loops, worst run
+    Latency latency;     // < 0: not measured
+} EngineResult;
+
+typedef struct {
+    int dispatches;
+    EngineResult engines[ENGINE_COUNT];
+} ChunkResult;
+
+static void measure_chunk(ChunkResult *r, const Chunk *chunk, const Universe *u, double *samples) {
+    Latency none = { -1.0, -1.0, -1.0 };
+    r->dispatches = dispatches_per_bar(chunk);
+    r->engines[ENGINE_SCALAR].ns_per_bar = best_of(time_scalar, chunk, u, &r->engines[ENGINE_SCALAR].allocs);
+    r->engines[ENGINE_BATCH].ns_per_bar = best_of(time_batch, chunk, u, &r->engines[ENGINE_BATCH].allocs);
+    r->engines[ENGINE_JIT].ns_per_bar = best_of(time_jit, chunk, u, &r->engines[ENGINE_JIT].allocs);
+    r->engines[ENGINE_SCALAR].latency = latency_scalar(chunk, &u->symbols[0], samples);
+    r->engines[ENGINE_BATCH].latency = none;
+    r->engines[ENGINE_JIT].latency = latency_jit(chunk, &u->symbols[0], samples);
+    if (r->engines[ENGINE_JIT].ns_per_bar < 0) r->engines[ENGINE_JIT].allocs = -1;
+}
+
+/* A JSON number, or null for "not measured" */
+static void json_number(FILE *out, double v) {
+    if (v < 0) fprintf(out, "null");
+    else fprintf(out, "%.3f", v);
+}
+
+static void json_chunk(FILE *out, const ChunkResult *r) {
+    fprintf(out, "{\"dispatch_per_bar\": %d", r->dispatches);
+    for (int e = 0; e < ENGINE_COUNT; ++e) {
+        const EngineResult *er = &r->engines[e];
+        fprintf(out, ", \"%s\": {\"ns_per_bar\": ", engine_names[e]);
+        json_number(out, er->ns_per_bar);
+        fprintf(out, ", \"bars_per_sec\": ");
+        json_number(out, er->ns_per_bar > 0 ? 1e9 / er->ns_per_bar : -1.0);
+        fprintf(out, ", \"p50_ns\": ");
+        json_number(out, er->latency.p50);
+        fprintf(out, ", \"p99_ns\": ");
+        json_number(out, er->latency.p99);
+        fprintf(out, ", \"p999_ns\": ");
+        json_number(out, er->latency.p999);
+        fprintf(out, ", \"allocs\": ");
+        if (er->allocs < 0) fprintf(out, "null}");
+        else fprintf(out, "%ld}", er->allocs);
+    }
+    fprintf(out, "}");
+}
+
+/* ---------- Ring handoff ---------- */
+
+#define RING_SIGNALS 10000000
+
+static void *drain_ring(void *arg) {
+    SignalRing *ring = (SignalRing*)arg;
+    Signal sig;
+    size_t seen = 0;
+    while (seen < RING_SIGNALS) {
+        if (signal_ring_pop(ring, &sig)) seen++;
+        else sched_yield();
+    }
+    return NULL;
+}
+
+/* ns per signal from a producer's ring_signal to the consumer thread */
+static double time_ring(void) {
+    SignalRing ring;
+    pthread_t consumer;
+    if (init_signal_ring(&ring, 4096) != 0) return -1.0;
+    SignalSink sink = { ring_signal, &ring, 0 };
+    Signal sig = { 0, 0, 1, 0, BC_BUY };
+    double start = now_ns();
+    if (pthread_create(&consumer, NULL, drain_ring, &ring) != 0) {
+        free_signal_ring(&ring);
+        return -1.0;
+    }
+    for (size_t i = 0; i < RING_SIGNALS; ++i) {
+        sig.bar = i;
+        sink.emit(sink.user, &sig);
+    }
+    pthread_join(consumer, NULL);
+    double elapsed = now_ns() - start;
+    free_signal_ring(&ring);
+    return elapsed / RING_SIGNALS;
+}
+
+/* ---------- JIT differential check ---------- */
+
+typedef struct {
+    char text[16384];
+    size_t len;
+    int params;    // p0.. declared, read as values and periods
+    int frames;    // whether values may be read `on` other timeframes
+} Source;
+
+static void append(Source *src, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(src->text + src->len, sizeof(src->text) - src->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) src->len += (size_t)n;
+    if (src->len >= sizeof(src->text)) src->len = sizeof(src->text) - 1;
+}
+
+static int pick(int n) {
+    return (int)(next_uniform() * n);
+}
+
+static const char *const fields[] = {
+    "open", "high", "low", "close", "volume", "date", "time", "hour", "minute", "weekday"
+};
+static const char *const compares[] = { ">", "<", ">=", "<=", "==", "!=" };
+static const char *const weekdays[] = { "Mon", "Tue", "Wed", "Thu", "Fri" };
+static const char *const frames[] = { "1m", "5m", "15m", "1h", "1d" };
+
+/* A period: a literal, or a parameter when there are some */
+static void random_period(Source *src, int most) {
+    if (src->params && pick(3) == 0) append(src, "p%d", pick(src->params));
+    else append(src, "%d", 1 + pick(most));
+}
+
+static void random_value(Source *src, int depth) {
+    if (src->frames && pick(6) == 0) {
+        append(src, "(");
+        random_value(src, depth - 1);
+        append(src, ") on \"%s\"", frames[pick(5)]);
+        return;
+    }
+    int choice = depth <= 0 ? pick(3) : pick(8);
+    switch (choice) {
+        case 0: append(src, "%s", fields[pick(5)]); break;
+        case 1: append(src, "%s", fields[pick(10)]); break;
+        case 2:
+            if (src->params && pick(3) == 0) append(src, "p%d", pick(src->params));
+            else append(src, "%d", pick(150));
+            break;
+        case 3:
+            append(src, "%s(", pick(2) ? "sma" : "ema");
+            random_value(src, depth - 2);
+            append(src, ", ");
+            random_period(src, 20);
+            append(src, ")");
+            break;
+        case 4: append(src, "rsi("); random_period(src, 15); append(src, ")"); break;
+        case 5: append(src, "(0 - "); random_value(src, depth - 1); append(src, ")"); break;
+        default: {
+            static const char ops[] = "+-*/";
+            append(src, "(");
+            random_value(src, depth - 1);
+            append(src, " %c ", ops[pick(4)]);
+            random_value(src, depth - 1);
+            append(src, ")");
+            break;
+        }
+    }
+}
+
+static void random_condition(Source *src, int depth) {
+    switch (depth <= 0 ? pick(3) : pick(7)) {
+        case 0:
+            random_value(src, 2);
+            append(src, " %s ", compares[pick(6)]);
+            random_value(src, 2);
+            break;
+        case 1:
+            append(src, "%s %s %d", fields[pick(10)], compares[pick(6)], 90 + pick(20));
+            break;
+        case 2:
+            if (pick(2)) append(src, "time %s \"%02d:%02d\"", compares[pick(6)], 9 + pick(7), pick(60));
+            else append(src, "weekday %s \"%s\"", compares[pick(6)], weekdays[pick(5)]);
+            break;
+        case 3: append(src, "not ("); random_condition(src, depth - 1); append(src, ")"); break;
+        case 4:
+            append(src, "(");
+            random_value(src, 1);
+            append(src, " %s (", compares[pick(6)]);
+            random_condition(src, depth - 1);
+            append(src, "))");
+            break;
+        default:
+            append(src, "(");
+            random_condition(src, depth - 1);
+            append(src, pick(2) ? " and " : " or ");
+            random_condition(src, depth - 1);
+            append(src, ")");
+            break;
+    }
+}
+
+/* A guard the rule index can use: a time window, weekdays or a price band */
+static void random_gate(Source *src) {
+    switch (pick(5)) {
+        case 0: {
+            int from = 9 * 60 + 15 + pick(375), to = from + 1 + pick(60);
+            append(src, "time >= \"%02d:%02d\" and time < \"%02d:%02d\"",
+                   from / 60, from % 60, to / 60, to % 60);
+            break;
+        }
+        case 1: append(src, "weekday %s \"%s\"", compares[pick(6)], weekdays[pick(5)]); break;
+        case 2:
+            append(src, "(weekday == \"%s\" or weekday == \"%s\")", weekdays[pick(5)], weekdays[pick(5)]);
+            break;
+        case 3: append(src, "%d %s close", 90 + pick(20), compares[pick(6)]); break;
+        default: append(src, "not (hour %s %d)", compares[pick(6)], 9 + pick(7)); break;
+    }
+}
+
+/* A few rules of arbitrary conditions, or now and then enough guarded
+ * ones for the compiler to build a rule index. Some declare parameters,
+ * and some read other timeframes (those run on the interpreter only). */
+static void random_strategy(Source *src) {
+    src->len = 0;
+    append(src, "symbol \"JIT\"\n");
+    src->params = pick(3) == 0 ? 1 + pick(3) : 0;
+    src->frames = pick(5) == 0;
+    for (int i = 0; i < src->params; ++i) append(src, "param p%d = %d\n", i, 1 + pick(20));
+    int gated = pick(4) == 0;
+    int rules = gated ? 16 + pick(48) : 1 + pick(6);
+    for (int r = 0; r < rules; ++r) {
+        append(src, "if ");
+        if (gated) {
+            random_gate(src);
+            append(src, pick(2) ? " and " : " and not ");
+            if (pick(2)) random_gate(src);
+            else random_condition(src, 1);
+        } else {
+            random_condition(src, 3);
+        }
+        append(src, " then %s %d end\n", pick(2) ? "buy" : "sell", 1 + pick(9));
+    }
+}
+
+/* Random bars with the odd zero and repeated price, so divisions by zero,
+ * NaNs and equal compares all show up. The date and the minute carry over
+ * from the previous bar for a while, so values cached per day or minute
+ * are reused as well as recomputed; they only move forward, through the
+ * session and on to the next day, so bars of every timeframe close. */
+static void random_bar(VMContext *ctx, int first) {
+    ctx->open = pick(10) ? 90.0 + next_uniform() * 20.0 : 100.0;
+    ctx->close = pick(10) ? 90.0 + next_uniform() * 20.0 : ctx->open;
+    ctx->high = (ctx->open > ctx->close ? ctx->open : ctx->close) + (pick(4) ? next_uniform() : 0.0);
+    ctx->low = (ctx->open < ctx->close ? ctx->open : ctx->close) - (pick(4) ? next_uniform() : 0.0);
+    ctx->volume = pick(8) ? (double)pick(2000) : 0.0;
+    int next_day = 0;
+    if (first) {
+        ctx->date = 20200101 + pick(7);
+        ctx->hour = 9;
+        ctx->minute = 15 + pick(45);
+    } else if (pick(3) == 0) {
+        int m = ctx->hour * 60 + ctx->minute + 1 + pick(30);
+        if (m > 15 * 60 + 29) {
+            m = 9 * 60 + 15;
+            next_day = 1;
+        }
+        ctx->hour = m / 60;
+        ctx->minute = m % 60;
+    }
+    ctx->time = ctx->hour * 100 + ctx->minute;
+    if (first || next_day || pick(100) == 0) {
+        if (!first) ctx->date = ctx->date % 100 < 28 ? ctx->date + 1 : 20200101;
+        ctx->weekday = date_weekday(ctx->date);   // per-day values are keyed on the date
+    }
+}
+
+static int same_signals(const SignalBuffer *a, const SignalBuffer *b) {
+    if (a->count != b->count) return 0;
+    for (size_t i = 0; i < a->count; ++i) {
+        const Signal *x = &a->items[i], *y = &b->items[i];
+        if (x->bar != y->bar || x->symbol_id != y->symbol_id || x->qty != y->qty ||
+            x->rule != y->rule || x->side != y->side)
+            return 0;
+    }
+    return 1;
+}
+
+#define CHECK_BARS 500
+
+/* run_chunk over every bar, the signals into out */
+static void run_bars(Chunk *chunk, const VMContext *bars, SignalBuffer *out) {
+    IndicatorState ind;
+    init_indicators(&ind, chunk);
+    SignalSink sink = { collect_signal, out, 7 };
+    for (int bar = 0; bar < CHECK_BARS; ++bar) run_chunk(chunk, &ind, &bars[bar], &sink);
+    free_indicators(&ind);
+}
+
+static int compile_random(const Source *src, int optimize, const CompileOptions *opts,
+                          Chunk *chunk) {
+    char err[256];
+    Program *prog = parse_program_r(src->text, err, sizeof(err));
+    if (!prog) {
+        fprintf(stderr, "generated an invalid strategy: %s\n%s", err, src->text);
+        return -1;
+    }
+    if (optimize) optimize_program(prog);
+    int status = compile_program_r(prog, chunk, opts, err, sizeof(err));
+    if (status != 0) fprintf(stderr, "generated an invalid strategy: %s\n%s", err, src->text);
+    free_program(prog);
+    return status;
+}
+
+/* Each strategy is compiled optimized with the rule index, optimized
+ * without it and unoptimized; over the same bars run_chunk on each,
+ * run_chunk_batch and, when it compiles, the JIT must all send the
+ * signals of the first, and the JIT its indicator outputs too. */
+static int jit_check(int count) {
+    int compiled = 0, indexed = 0, params = 0, frames = 0;
+    static VMContext bars[CHECK_BARS];
+    static double columns[5][CHECK_BARS];
+    static int32_t fields[5][CHECK_BARS];
+    for (int n = 0; n < count; ++n) {
+        Source src;
+        random_strategy(&src);
+        Chunk chunk, ungated, unoptimized;
+        CompileOptions opts = { pick(2), 1 }, plain = { opts.fuse, 0 };
+        if (compile_random(&src, 1, &opts, &chunk) != 0) return 1;
+        if (compile_random(&src, 1, &plain, &ungated) != 0 ||
+            compile_random(&src, 0, &opts, &unoptimized) != 0) {
+            free_chunk(&chunk);
+            return 1;
+        }
+        if (chunk.gates.rule_count > 0) indexed++;
+        params += src.params > 0;
+        frames += chunk.timeframes != 0;
+        for (int bar = 0; bar < CHECK_BARS; ++bar) {
+            if (bar > 0) bars[bar] = bars[bar - 1];
+            random_bar(&bars[bar], bar == 0);
+            const VMContext *b = &bars[bar];
+            columns[0][bar] = b->open;
+            columns[1][bar] = b->high;
+            columns[2][bar] = b->low;
+            columns[3][bar] = b->close;
+            columns[4][bar] = b->volume;
+            fields[0][bar] = b->date;
+            fields[1][bar] = b->time;
+            fields[2][bar] = b->hour;
+            fields[3][bar] = b->minute;
+            fields[4][bar] = b->weekday;
+        }
+        BarColumns cols = {
+            columns[0], columns[1], columns[2], columns[3], columns[4],
+            fields[0], fields[1], fields[2], fields[3], fields[4], CHECK_BARS
+        };
+
+        SignalBuffer vm_out = {0}, plain_out = {0}, unopt_out = {0}, batch_out = {0};
+        run_bars(&chunk, bars, &vm_out);
+        run_bars(&ungated, bars, &plain_out);
+        run_bars(&unoptimized, bars, &unopt_out);
+        IndicatorState batch_ind;
+        init_indicators(&batch_ind, &chunk);
+        SignalSink batch_sink = { collect_signal, &batch_out, 7 };
+        run_chunk_batch(&chunk, &batch_ind, &cols, &batch_sink);
+        free_indicators(&batch_ind);
+
+        const char *failure = NULL;
+        if (!same_signals(&vm_out, &plain_out)) failure = "signals differ from the chunk without a rule index";
+        else if (!same_signals(&vm_out, &unopt_out)) failure = "signals differ from the unoptimized program";
+        else if (!same_signals(&vm_out, &batch_out)) failure = "run_chunk_batch signals differ";
+
+        JitCode *jit = failure ? NULL : jit_compile(&chunk);
+        if (jit) {
+            compiled++;
+            IndicatorState vm_ind, jit_ind;
+            init_indicators(&vm_ind, &chunk);
+            init_indicators(&jit_ind, &chunk);
+            SignalBuffer jit_out = {0};
+            SignalSink jit_sink = { collect_signal, &jit_out, 7 };
+            int bad_bar = -1;
+            for (int bar = 0; bar < CHECK_BARS && bad_bar < 0; ++bar) {
+                run_chunk(&chunk, &vm_ind, &bars[bar], &counter);
+                jit_run(jit, &jit_ind, &bars[bar], &jit_sink);
+                for (int i = 0; i < vm_ind.count; ++i) {
+                    if (memcmp(&vm_ind.slots[i].output, &jit_ind.slots[i].output, sizeof(double)) != 0)
+                        bad_bar = bar;
+                }
+            }
+            if (bad_bar >= 0) {
+                fprintf(stderr, "indicator outputs differ at bar %d\n", bad_bar);
+                failure = "JIT indicator outputs differ";
+            } else if (!same_signals(&vm_out, &jit_out)) {
+                failure = "JIT signals differ";
+            }
+            free_signals(&jit_out);
+            free_indicators(&vm_ind);
+            free_indicators(&jit_ind);
+            jit_free(jit);
+        }
+        free_signals(&vm_out);
+        free_signals(&plain_out);
+        free_signals(&unopt_out);
+        free_signals(&batch_out);
+        if (failure) {
+            fprintf(stderr, "%s\nfuse=%d\n%s", failure, opts.fuse, src.text);
+            disassemble_chunk(&chunk, "failing chunk", stderr);
+            return 1;
+        }
+        free_chunk(&chunk);
+        free_chunk(&ungated);
+        free_chunk(&unoptimized);
+    }
+    fprintf(stderr, "%d strategies (%d with a rule index, %d with parameters, %d on other "
+                    "timeframes), %d compiled by the JIT, %d bars each: no differences\n",
+            count, indexed, params, frames, compiled, CHECK_BARS);
+    return 0;
+}
+
+/* ---------- Timeframe cadence check ----------
+ *
+ * Rules on other timeframes, some with per-bar terms and some with terms
+ * the optimizer folds away, run over a week of minute bars (now and then
+ * two inputs in one minute) compiled with and without optimize_program.
+ * A rule fires only on the bars that close a timeframe it reads as
+ * written, so both must send the same signals. */
+
+#define CADENCE_BARS 2500
+
+static const char *const cadence_programs[] = {
+    "if close on \"1h\" > open on \"1h\" then buy 1 end\n",
+    "if close on \"1h\" > open on \"1h\" and weekday != \"Sun\" then buy 2 end\n",
+    "if (close on \"5m\") != (1 or date >= 20200118) then sell 3 end\n",
+    "if (1 or close on \"15m\" > open on \"15m\") and close > 100 then buy 4 end\n",
+    "if 0 and close on \"1d\" > 0 or close < 95 then sell 5 end\n",
+    "if close > sma(close, 5) on \"15m\" then sell 6 end\n",
+    "if high on \"1d\" > high on \"1h\" and minute == 30 then buy 7 end\n",
+    "if close * 1 on \"5m\" - 0 > close then buy 8 end\n",
+};
+
+#define CADENCE_PROGRAMS ((int)(sizeof(cadence_programs) / sizeof(cadence_programs[0])))
+
+static void session_bar(VMContext *ctx, int first) {
+    if (first) {
+        ctx->date = 20200106;
+        ctx->hour = 9;
+        ctx->minute = 15;
+    } else if (pick(8)) {
+        int m = ctx->hour * 60 + ctx->minute + 1;
+        if (m > 15 * 60 + 29) {
+            ctx->date++;
+            m = 9 * 60 + 15;
+        }
+        ctx->hour = m / 60;
+        ctx->minute = m % 60;
+    }
+    ctx->time = ctx->hour * 100 + ctx->minute;
+    ctx->weekday = date_weekday(ctx->date);
+    ctx->open = 90.0 + next_uniform() * 20.0;
+    ctx->close = 90.0 + next_uniform() * 20.0;
+    ctx->high = (ctx->open > ctx->close ? ctx->open : ctx->close) + next_uniform();
+    ctx->low = (ctx->open < ctx->close ? ctx->open : ctx->close) - next_uniform();
+    ctx->volume = (double)pick(2000);
+}
+
+static int compile_cadence(const char *text, int optimize, Chunk *chunk) {
+    char source[512], err[256];
+    snprintf(source, sizeof(source), "symbol \"TF\"\n%s", text);
+    Program *prog = parse_program_r(source, err, sizeof(err));
+    if (!prog) {
+        fprintf(stderr, "%s: %s", err, text);
+        return -1;
+    }
+    if (optimize) optimize_program(prog);
+    CompileOptions opts = { 1, 1 };
+    int status = compile_program_r(prog, chunk, &opts, err, sizeof(err));
+    if (status != 0) fprintf(stderr, "%s: %s", err, text);
+    free_program(prog);
+    return status;
+}
+
+static int cadence_check(void) {
+    VMContext *bars = malloc(CADENCE_BARS * sizeof(VMContext));
+    if (!bars) return 1;
+    for (int bar = 0; bar < CADENCE_BARS; ++bar) {
+        if (bar > 0) bars[bar] = bars[bar - 1];
+        session_bar(&bars[bar], bar == 0);
+    }
+    int status = 0;
+    for (int p = 0; p < CADENCE_PROGRAMS && status == 0; ++p) {
+        Chunk chunks[2];
+        if (compile_cadence(cadence_programs[p], 0, &chunks[0]) != 0) {
+            status = 1;
+            break;
+        }
+        if (compile_cadence(cadence_programs[p], 1, &chunks[1]) != 0) {
+            free_chunk(&chunks[0]);
+            status = 1;
+            break;
+        }
+        SignalBuffer out[2] = {{0}};
+        for (int o = 0; o < 2; ++o) {
+            IndicatorState ind;
+            init_indicators(&ind, &chunks[o]);
+            SignalSink sink = { collect_signal, &out[o], 7 };
+            for (int bar = 0; bar < CADENCE_BARS; ++bar) run_chunk(&chunks[o], &ind, &bars[bar], &sink);
+            free_indicators(&ind);
+        }
+        if (!same_signals(&out[0], &out[1])) {
+            fprintf(stderr, "optimized signals differ (%zu, unoptimized %zu):\n%s",
+                    out[1].count, out[0].count, cadence_programs[p]);
+            disassemble_chunk(&chunks[0], "unoptimized", stderr);
+            disassemble_chunk(&chunks[1], "optimized", stderr);
+            status = 1;
+        }
+        free_signals(&out[0]);
+        free_signals(&out[1]);
+        free_chunk(&chunks[0]);
+        free_chunk(&chunks[1]);
+    }
+    free(bars);
+    if (status == 0)
+        fprintf(stderr, "%d timeframe rules, %d bars, optimized and not: no differences\n",
+                CADENCE_PROGRAMS, CADENCE_BARS);
+    return status;
+}
+
+/* ---------- Rule gating ----------
+ *
+ * Each rule trades one weekday in a five-minute window of the session,
+ * on a price condition of its own, so on any bar about one rule in 375
+ * can fire. Without the index every rule tests at least its guard on
+ * every bar (the shared weekday and time compares are cached); with it
+ * a bar costs a lookup per field, a scan of one bit per rule, and the
+ * candidates. */
+
+#define GATING_BARS 50000
+
+static const int gating_sizes[] = { 16, 64, 256, 1024, 4096 };
+
+#define GATING_SIZES ((int)(sizeof(gating_sizes) / sizeof(gating_sizes[0])))
+
+typedef struct {
+    int rules;
+    double candidates;                     // per bar, with the index
+    double ns_per_bar[2][ENGINE_COUNT];    // [indexed][engine]
+} GatingResult;
+
+static char *gating_strategy(int rules) {
+    size_t cap = (size_t)rules * 160 + 64, len = 0;
+    char *text = (char*)xmalloc(cap);
+    len += (size_t)snprintf(text, cap, "symbol \"BENCH\"\n");
+    for (int r = 0; r < rules; ++r) {
+        int from = 9 * 60 + 15 + pick(370), to = from + 5;
+        len += (size_t)snprintf(text + len, cap - len,
+                                "if time >= \"%02d:%02d\" and time < \"%02d:%02d\" and weekday == \"%s\""
+                                " and close > open + 0.%02d then %s 1 end\n",
+                                from / 60, from % 60, to / 60, to % 60, weekdays[pick(5)],
+                                pick(100), pick(2) ? "buy" : "sell");
+    }
+    return text;
+}
+
+static double candidates_per_bar(const Chunk *chunk, const Series *s) {
+    if (chunk->gates.rule_count == 0) return -1.0;
+    int32_t *out = (int32_t*)xmalloc((size_t)chunk->gates.rule_count * sizeof(int32_t));
+    double total = 0.0;
+    for (size_t i = 0; i < s->count; ++i) {
+        VMContext ctx = bar_context(s, i);
+        total += rule_candidates(&chunk->gates, &ctx, out);
+    }
+    free(out);
+    return total / (double)s->count;
+}
+
+static int measure_gating(GatingResult *results, const Universe *u) {
+    Series s = u->symbols[0];
+    if (s.count > GATING_BARS) s.count = GATING_BARS;
+    Universe one = { &s, 1, s.count };
+    static double (*const engines[ENGINE_COUNT])(const Chunk *, const Universe *) = {
+        [ENGINE_SCALAR] = time_scalar, [ENGINE_BATCH] = time_batch, [ENGINE_JIT] = time_jit
+    };
+    rng_state = 0x2545F4914F6CDD1DULL;
+    for (int i = 0; i < GATING_SIZES; ++i) {
+        GatingResult *r = &results[i];
+        char err[256];
+        char *source = gating_strategy(gating_sizes[i]);
+        Program *prog = parse_program_r(source, err, sizeof(err));
+        free(source);
+        if (!prog) {
+            fprintf(stderr, "gating: %s\n", err);
+            return -1;
+        }
+        optimize_program(prog);
+        r->rules = gating_sizes[i];
+        for (int indexed = 0; indexed < 2; ++indexed) {
+            Chunk chunk;
+            CompileOptions opts = { 1, indexed };
+            if (compile_program_r(prog, &chunk, &opts, err, sizeof(err)) != 0) {
+                fprintf(stderr, "gating: %s\n", err);
+                free_program(prog);
+                return -1;
+            }
+            long allocs;
+            for (int e = 0; e < ENGINE_COUNT; ++e)
+                r->ns_per_bar[indexed][e] = best_of(engines[e], &chunk, &one, &allocs);
+            if (indexed) r->candidates = candidates_per_bar(&chunk, &s);
+            free_chunk(&chunk);
+        }
+        free_program(prog);
+    }
+    return 0;
+}
+
+/* ---------- Parameter sweep ----------
+ *
+ * A crossover with an RSI filter whose periods are parameters: over
+ * fast = 5..24 and slow = 30..78 step 2 there are 20 + 25 distinct SMAs
+ * and 20 RSIs to compute per bar instead of 1500. The shared and the
+ * unshared sweep must agree exactly, and each checked combination must
+ * match run_backtest of its literal program, booked the same way. */
+
+#define SWEEP_BARS 50000
+
+static const char sweep_source[] =
+    "symbol \"BENCH\"\n"
+    "param fast = 10\n"
+    "param slow = 40\n"
+    "param level = 50\n"
+    "if sma(close, fast) > sma(close, slow) and rsi(fast) < level + 20 then buy 1 end\n"
+    "if sma(close, fast) < sma(close, slow) and rsi(fast) > level - 20 then sell 1 end\n";
+
+typedef struct {
+    size_t combinations;
+    size_t bars;
+    size_t indicators;       // slots over all combinations
+    size_t computed;         // once shared
+    double ns_per_run_bar[2];  // [shared], per combination and bar
+    int checked;             // combinations compared with their literal program
+} SweepBench;
+
+static Chunk *compile_sweep_source(const char *source, Chunk *chunk) {
+    char err[256];
+    Program *prog = parse_program_r(source, err, sizeof(err));
+    if (!prog) {
+        fprintf(stderr, "sweep: %s\n", err);
+        return NULL;
+    }
+    optimize_program(prog);
+    int status = compile_program_r(prog, chunk, NULL, err, sizeof(err));
+    free_program(prog);
+    if (status != 0) {
+        fprintf(stderr, "sweep: %s\n", err);
+        return NULL;
+    }
+    return chunk;
+}
+
+/* One combination with its values written in as literals, run by
+ * run_backtest and booked like sweep.c: each signal at its bar's close,
+ * what is still open at the last close */
+static int check_literal(const double *values, const BacktestSymbol *sym, const SweepResult *expect) {
+    char source[512];
+    snprintf(source, sizeof(source),
+             "symbol \"BENCH\"\n"
+             "if sma(close, %g) > sma(close, %g) and rsi(%g) < %g + 20 then buy 1 end\n"
+             "if sma(close, %g) < sma(close, %g) and rsi(%g) > %g - 20 then sell 1 end\n",
+             values[0], values[1], values[0], values[2], values[0], values[1], values[0], values[2]);
+    Chunk chunk;
+    if (!compile_sweep_source(source, &chunk)) return -1;
+    SignalBuffer out;
+    run_backtest(&chunk, sym, 1, 1, &out);
+    free_chunk(&chunk);
+
+    double cash = 0.0, position = 0.0;
+    for (size_t i = 0; i < out.count; ++i) {
+        const Signal *sig = &out.items[i];
+        double value = (double)sig->qty * sym->bars.close[sig->bar];
+        if (sig->side == BC_BUY) {
+            position += sig->qty;
+            cash -= value;
+        } else {
+            position -= sig->qty;
+            cash += value;
+        }
+    }
+    double pnl = cash + position * sym->bars.close[sym->bars.count - 1];
+    int same = out.count == expect->signals && pnl == expect->pnl;
+    if (!same)
+        fprintf(stderr, "sweep: fast=%g slow=%g level=%g: %zu signals, pnl %.2f; "
+                        "the literal program gives %zu, %.2f\n", values[0], values[1], values[2],
+                expect->signals, expect->pnl, out.count, pnl);
+    free_signals(&out);
+    return same ? 0 : -1;
+}
+
+static int measure_sweep(SweepBench *r, const Universe *u) {
+    const Series *s = &u->symbols[0];
+    BacktestSymbol sym = { "BENCH", {
+        s->open, s->high, s->low, s->close, s->volume,
+        s->date, s->time, s->hour, s->minute, s->weekday,
+        s->count < SWEEP_BARS ? s->count : SWEEP_BARS
+    } };
+    Chunk chunk;
+    if (!compile_sweep_source(sweep_source, &chunk)) return -1;
+
+    double fast[20], slow[25];
+    for (int i = 0; i < 20; ++i) fast[i] = 5 + i;
+    for (int i = 0; i < 25; ++i) slow[i] = 30 + 2 * i;
+    SweepAxis axes[2] = { { find_param(&chunk, "fast"), fast, 20 },
+                          { find_param(&chunk, "slow"), slow, 25 } };
+    r->combinations = sweep_size(axes, 2);
+    r->bars = sym.bars.count;
+    SweepResult *results[2] = { xmalloc(r->combinations * sizeof(SweepResult)),
+                                xmalloc(r->combinations * sizeof(SweepResult)) };
+    int status = 0;
+    for (int shared = 0; shared < 2 && status == 0; ++shared) {
+        SweepOptions opts = { 1, shared };
+        SweepStats stats;
+        char err[256];
+        double start = now_ns();
+        if (run_sweep(&chunk, &sym, 1, axes, 2, &opts, results[shared], &stats, err, sizeof(err)) != 0) {
+            fprintf(stderr, "sweep: %s\n", err);
+            status = -1;
+            break;
+        }
+        r->ns_per_run_bar[shared] = (now_ns() - start) / ((double)r->combinations * (double)r->bars);
+        r->indicators = stats.indicators;
+        r->computed = stats.computed;
+    }
+    for (size_t c = 0; c < r->combinations && status == 0; ++c) {
+        if (results[0][c].signals != results[1][c].signals || results[0][c].pnl != results[1][c].pnl) {
+            fprintf(stderr, "sweep: combination %zu differs with shared indicators\n", c);
+            status = -1;
+        }
+    }
+    /* corners and a middle combination; level keeps its default */
+    static const size_t checks[] = { 0, 24, 262, 475, 499 };
+    r->checked = 0;
+    for (int i = 0; i < (int)(sizeof(checks) / sizeof(checks[0])) && status == 0; ++i) {
+        double values[3];
+        sweep_values(&chunk, axes, 2, checks[i], values);
+        status = check_literal(values, &sym, &results[1][checks[i]]);
+        r->checked += status == 0;
+    }
+    free(results[0]);
+    free(results[1]);
+    free_chunk(&chunk);
+    return status;
+}
+
+static int usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [--bars N] [--symbols N] [--seed N] [--json] [bars]\n"
+            "       %s --jit-check [strategies]\n",
+            argv0, argv0);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "--jit-check") == 0) {
+        int count = argc > 2 ? atoi(argv[2]) : 1000;
+        if (cadence_check() != 0) return 1;
+        return jit_check(count > 0 ? count : 1000);
+    }
+    size_t bars = 1000000;
+    int symbols = 1;
+    uint64_t seed = 0;
+    int json = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else if (strcmp(argv[i], "--bars") == 0 && i + 1 < argc) {
+            bars = (size_t)strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--symbols") == 0 && i + 1 < argc) {
+            symbols = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-') {
+            bars = (size_t)strtoull(argv[i], NULL, 10);
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (bars == 0 || symbols <= 0) return usage(argv[0]);
+
+    Universe universe;
+    generate_universe(&universe, symbols, bars, seed);
+    double *samples = xmalloc(bars * sizeof(double));
+    double timer_ns = timer_overhead();
+
+    ChunkResult results[STRATEGY_COUNT][2];   // [strategy][fused]
+    double front_end_us[STRATEGY_COUNT];
+    long front_end_allocs[STRATEGY_COUNT];
+
+    fprintf(stderr, "%d symbols x %zu bars, seed %llu\n", symbols, bars, (unsigned long long)seed);
+    fprintf(stderr, "%-12s %14s %20s %20s %20s\n", "strategy", "dispatch/bar",
+                    "scalar ns/bar", "batch ns/bar", "jit ns/bar");
+    for (int i = 0; i < STRATEGY_COUNT; ++i) {
+        char err[256];
+        Program *prog = parse_program_r(strategies[i].source, err, sizeof(err));
+        if (!prog) {
+            fprintf(stderr, "%s: %s\n", strategies[i].name, err);
+            return 1;
+        }
+        optimize_program(prog);
+
+        Chunk plain, fused;
+        CompileOptions off = { 0, 1 }, on = { 1, 1 };
+        if (compile_program_r(prog, &plain, &off, err, sizeof(err)) != 0 ||
+            compile_program_r(prog, &fused, &on, err, sizeof(err)) != 0) {
+            fprintf(stderr, "%s: %s\n", strategies[i].name, err);
+            return 1;
+        }
+
+        measure_chunk(&results[i][0], &plain, &universe, samples);
+        measure_chunk(&results[i][1], &fused, &universe, samples);
+        front_end_us[i] = time_front_end(strategies[i].source, &front_end_allocs[i]);
+
+        const ChunkResult *p = &results[i][0], *f = &results[i][1];
+        fprintf(stderr, "%-12s %6d -> %-6d %8.1f -> %-8.1f %8.1f -> %-8.1f %8.1f -> %-8.1f\n",
+                strategies[i].name, p->dispatches, f->dispatches,
+                p->engines[ENGINE_SCALAR].ns_per_bar, f->engines[ENGINE_SCALAR].ns_per_bar,
+                p->engines[ENGINE_BATCH].ns_per_bar, f->engines[ENGINE_BATCH].ns_per_bar,
+                p->engines[ENGINE_JIT].ns_per_bar, f->engines[ENGINE_JIT].ns_per_bar);
+
+        free_chunk(&plain);
+        free_chunk(&fused);
+        free_program(prog);
+    }
+
+    fprintf(stderr, "\nfused, per bar (ns, incl. %.0f ns clock read)\n", timer_ns);
+    fprintf(stderr, "%-12s %26s %26s %8s %12s\n", "strategy", "scalar p50/p99/p99.9",
+                    "jit p50/p99/p99.9", "allocs", "compile us");
+    for (int i = 0; i < STRATEGY_COUNT; ++i) {
+        const EngineResult *s = &results[i][1].engines[ENGINE_SCALAR];
+        const EngineResult *j = &results[i][1].engines[ENGINE_JIT];
+        long allocs = 0;
+        for (int e = 0; e < ENGINE_COUNT; ++e) {
+            if (results[i][1].engines[e].allocs > allocs) allocs = results[i][1].engines[e].allocs;
+        }
+        fprintf(stderr, "%-12s %8.0f %8.0f %8.0f %8.0f %8.0f %8.0f %8ld %12.1f\n", strategies[i].name,
+                s->latency.p50, s->latency.p99, s->latency.p999,
+                j->latency.p50, j->latency.p99, j->latency.p999,
+                allocs, front_end_us[i]);
+    }
+
+    double ring_ns = time_ring();
+    fprintf(stderr, "ring handoff %8.1f ns/signal\n", ring_ns);
+
+    GatingResult gating[GATING_SIZES];
+    if (measure_gating(gating, &universe) != 0) return 1;
+    fprintf(stderr, "\nrule gating, %zu bars, ns/bar without -> with the rule index\n",
+            bars < GATING_BARS ? bars : (size_t)GATING_BARS);
+    fprintf(stderr, "%-12s %14s %20s %20s %20s\n", "rules", "candidates/bar",
+                    "scalar ns/bar", "batch ns/bar", "jit ns/bar");
+    for (int i = 0; i < GATING_SIZES; ++i) {
+        const GatingResult *g = &gating[i];
+        fprintf(stderr, "%-12d %14.2f %8.1f -> %-8.1f %8.1f -> %-8.1f %8.1f -> %-8.1f\n",
+                g->rules, g->candidates,
+                g->ns_per_bar[0][ENGINE_SCALAR], g->ns_per_bar[1][ENGINE_SCALAR],
+                g->ns_per_bar[0][ENGINE_BATCH], g->ns_per_bar[1][ENGINE_BATCH],
+                g->ns_per_bar[0][ENGINE_JIT], g->ns_per_bar[1][ENGINE_JIT]);
+    }
+
+    SweepBench sweep;
+    if (measure_sweep(&sweep, &universe) != 0) return 1;
+    fprintf(stderr, "\nsweep, %zu combinations x %zu bars, 1 thread: %.1f -> %.1f ns per combination-bar "
+                    "sharing %zu indicators as %zu; %d checked against literals\n",
+            sweep.combinations, sweep.bars, sweep.ns_per_run_bar[0], sweep.ns_per_run_bar[1],
+            sweep.indicators, sweep.computed, sweep.checked);
+
+    if (json) {
+        printf("{\"bars\": %zu, \"symbols\": %d, \"seed\": %llu, \"timer_ns\": %.1f,\n",
+               bars, symbols, (unsigned long long)seed, timer_ns);
+        printf(" \"strategies\": [\n");
+        for (int i = 0; i < STRATEGY_COUNT; ++i) {
+            printf("  {\"name\": \"%s\", \"front_end_us\": ", strategies[i].name);
+            json_number(stdout, front_end_us[i]);
+            printf(", \"front_end_allocs\": ");
+            if (front_end_allocs[i] < 0) printf("null");
+            else printf("%ld", front_end_allocs[i]);
+            printf(",\n   \"unfused\": ");
+            json_chunk(stdout, &results[i][0]);
+            printf(",\n   \"fused\": ");
+            json_chunk(stdout, &results[i][1]);
+            printf("}%s\n", i + 1 < STRATEGY_COUNT ? "," : "");
+        }
+        printf(" ],\n \"ring_ns_per_signal\": ");
+        json_number(stdout, ring_ns);
+        printf(",\n \"gating\": [\n");
+        for (int i = 0; i < GATING_SIZES; ++i) {
+            const GatingResult *g = &gating[i];
+            printf("  {\"rules\": %d, \"candidates_per_bar\": ", g->rules);
+            json_number(stdout, g->candidates);
+            for (int indexed = 0; indexed < 2; ++indexed) {
+                printf(", \"%s\": {", indexed ? "indexed" : "unindexed");
+                for (int e = 0; e < ENGINE_COUNT; ++e) {
+                    printf("%s\"%s_ns_per_bar\": ", e ? ", " : "", engine_names[e]);
+                    json_number(stdout, g->ns_per_bar[indexed][e]);
+                }
+                printf("}");
+            }
+            printf("}%s\n", i + 1 < GATING_SIZES ? "," : "");
+        }
+        printf(" ],\n \"sweep\": {\"combinations\": %zu, \"bars\": %zu, \"indicators\": %zu, "
+               "\"computed\": %zu, \"unshared_ns_per_combination_bar\": ",
+               sweep.combinations, sweep.bars, sweep.indicators, sweep.computed);
+        json_number(stdout, sweep.ns_per_run_bar[0]);
+        printf(", \"shared_ns_per_combination_bar\": ");
+        json_number(stdout, sweep.ns_per_run_bar[1]);
+        printf("}}\n");
+    }
+
+    free(samples);
+    free_universe(&universe);
+    return 0;
+}
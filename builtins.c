@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ast.h"
+
+/* ---------- Builtin registry and perfect-hash lookup ----------
+ *
+ * builtins[] is expanded from the X-macro lists in ast.h: fields first
+ * (indexed by VarId), then functions (indexed by VAR_COUNT + FuncId).
+ *
+ * Name lookup uses hash-and-displace perfect hashing: a first hash picks
+ * a bucket, the bucket's displacement seeds a second hash that picks a
+ * table slot, and displacements are chosen once so no two names share a
+ * slot. A lookup is therefore two hashes, one probe and one memcmp no
+ * matter how many builtins are registered.
+ */
+
+#define BUILTIN_COUNT (VAR_COUNT + FUNC_COUNT)
+#define TABLE_MAX (4 * BUILTIN_COUNT)
+#define BUCKET_MAX (BUILTIN_COUNT)
+#define DISPLACEMENT_MAX 0xFFFF
+
+static const Builtin builtins[BUILTIN_COUNT] = {
+#define X(id, name, frequency) { name, sizeof(name) - 1, BUILTIN_VAR, id, 0, 0, frequency },
+    TL_BUILTIN_VARS(X)
+#undef X
+#define X(id, name, arity, window, update) { name, sizeof(name) - 1, BUILTIN_FUNC, id, arity, window, FREQ_BAR },
+    TL_BUILTIN_FUNCS(X)
+#undef X
+};
+
+static uint16_t displacement[BUCKET_MAX];
+static int16_t slot_index[TABLE_MAX];
+static uint32_t bucket_mask;
+static uint32_t table_mask;
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+/* FNV-1a with a seed and a final avalanche step */
+static uint32_t hash_name(const char *s, size_t len, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return h;
+}
+
+static uint32_t pow2_at_least(uint32_t n) {
+    uint32_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+static void build_table(void) {
+    uint32_t table_size = pow2_at_least(2 * BUILTIN_COUNT);
+    uint32_t bucket_count = pow2_at_least((BUILTIN_COUNT + 1) / 2);
+    table_mask = table_size - 1;
+    bucket_mask = bucket_count - 1;
+
+    int bucket_of[BUILTIN_COUNT];
+    int bucket_size[BUCKET_MAX] = {0};
+    int max_size = 0;
+    for (int i = 0; i < BUILTIN_COUNT; ++i) {
+        bucket_of[i] = (int)(hash_name(builtins[i].name, builtins[i].length, 0) & bucket_mask);
+        if (++bucket_size[bucket_of[i]] > max_size) max_size = bucket_size[bucket_of[i]];
+    }
+    for (uint32_t i = 0; i < table_size; ++i) slot_index[i] = -1;
+
+    /* place the fullest buckets first, while the table is still empty */
+    for (int size = max_size; size > 0; --size) {
+        for (uint32_t b = 0; b < bucket_count; ++b) {
+            if (bucket_size[b] != size) continue;
+
+            uint32_t d;
+            for (d = 1; d <= DISPLACEMENT_MAX; ++d) {
+                uint32_t taken[BUILTIN_COUNT];
+                int placed = 0, ok = 1;
+                for (int i = 0; ok && i < BUILTIN_COUNT; ++i) {
+                    if (bucket_of[i] != (int)b) continue;
+                    uint32_t slot = hash_name(builtins[i].name, builtins[i].length, d) & table_mask;
+                    if (slot_index[slot] >= 0) ok = 0;
+                    for (int k = 0; ok && k < placed; ++k) {
+                        if (taken[k] == slot) ok = 0;
+                    }
+                    taken[placed++] = slot;
+                }
+                if (!ok) continue;
+
+                placed = 0;
+                for (int i = 0; i < BUILTIN_COUNT; ++i) {
+                    if (bucket_of[i] == (int)b) slot_index[taken[placed++]] = (int16_t)i;
+                }
+                displacement[b] = (uint16_t)d;
+                break;
+            }
+            if (d > DISPLACEMENT_MAX) {
+                fprintf(stderr, "builtin registry: cannot build perfect hash (duplicate name?)\n");
+                exit(1);
+            }
+        }
+    }
+}
+
+const Builtin *lookup_builtin(const char *name, size_t length) {
+    pthread_once(&table_once, build_table);
+    uint32_t d = displacement[hash_name(name, length, 0) & bucket_mask];
+    if (d == 0) return NULL;
+    int index = slot_index[hash_name(name, length, d) & table_mask];
+    if (index < 0) return NULL;
+    const Builtin *b = &builtins[index];
+    if (b->length != length || memcmp(b->name, name, length) != 0) return NULL;
+    return b;
+}
+
+const Builtin *builtin_var(VarId id) {
+    return &builtins[id];
+}
+
+const Builtin *builtin_func(FuncId id) {
+    return &builtins[VAR_COUNT + id];
+}
+
+/* ---------- Timeframes ---------- */
+
+static const struct {
+    const char *name;
+    int minutes;
+} timeframes[TF_COUNT] = {
+    [TF_BAR] = { "bar", -1 },
+#define X(id, name, minutes) [id] = { name, minutes },
+    TL_TIMEFRAMES(X)
+#undef X
+};
+
+/* The Timeframe named by an `on "..."` string, or -1 */
+int lookup_timeframe(const char *name, size_t length) {
+    for (int tf = TF_BAR + 1; tf < TF_COUNT; ++tf) {
+        if (strlen(timeframes[tf].name) == length && memcmp(timeframes[tf].name, name, length) == 0)
+            return tf;
+    }
+    return -1;
+}
+
+const char *timeframe_name(int tf) {
+    return tf >= 0 && tf < TF_COUNT ? timeframes[tf].name : "?";
+}
+
+/* Period length in minutes; 0 for daily */
+int timeframe_minutes(int tf) {
+    return tf > TF_BAR && tf < TF_COUNT ? timeframes[tf].minutes : -1;
+}
@@ -0,0 +1,350 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ast.h"
+
+/* ---------- Compiled chunk file (.tlcb) ----------
+ *
+ * Layout (native byte order, checked by the endian tag):
+ *
+ *   ChunkFileHeader
+ *   slots[slot_count]   IndicatorSlot   (TLCB_ALIGN boundary)
+ *   params[param_count] Param           (TLCB_ALIGN boundary)
+ *   lines[line_count]   LineEntry       (TLCB_ALIGN boundary)
+ *   rule index, empty without one:     (each on a TLCB_ALIGN boundary)
+ *     entries[rule_count]             int32
+ *     fields[gate_field_count]        GateField
+ *     breaks[break_count]             double
+ *     rows[row_count * words]         uint64
+ *   code[code_size]     uint8           (TLCB_ALIGN boundary)
+ *   symbol[]            NUL-terminated
+ *
+ * The file is mmap'ed read-only and the Chunk points straight into the
+ * mapping. Loading checks the header, the section bounds and a checksum
+ * of everything after the header, then runs decode_chunk, which
+ * validates every instruction, so a damaged or hostile file is rejected
+ * before anything executes it. Double constants stay inline in the
+ * code; decode_chunk rebuilds the constant pool while it verifies.
+ */
+
+#define TLCB_MAGIC "TLCBC\0\0\0"
+#define TLCB_VERSION 5
+#define TLCB_ENDIAN_TAG 0x01020304u
+#define TLCB_ALIGN 64
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t compiler;        // TLC_COMPILER_VERSION that wrote the code
+    uint32_t temp_count;
+    uint32_t cached_count;
+    uint32_t reserved;        // zero
+    uint64_t source_hash;     // compile_key of the source, 0 if unknown
+    uint64_t checksum;        // of bytes [sizeof header, file size)
+    uint64_t slot_offset;
+    uint64_t slot_count;
+    uint64_t param_offset;    // parameter names and defaults, may be empty
+    uint64_t param_count;
+    uint64_t line_offset;     // source map, may be empty
+    uint64_t line_count;
+    uint64_t code_offset;
+    uint64_t code_size;
+    uint64_t symbol_offset;
+    uint64_t symbol_size;     // including the NUL
+    uint64_t rule_count;      // rule index; all its counts are 0 without one
+    uint64_t entry_offset;
+    uint64_t gate_field_offset;
+    uint64_t gate_field_count;
+    uint64_t break_offset;
+    uint64_t break_count;
+    uint64_t row_offset;
+    uint64_t row_count;       // rows of (rule_count + 63) / 64 words
+} ChunkFileHeader;
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static uint64_t align_up(uint64_t v) {
+    return (v + TLCB_ALIGN - 1) & ~(uint64_t)(TLCB_ALIGN - 1);
+}
+
+/* Source text, compiler version and options: anything that changes the
+ * bytecode changes the key */
+uint64_t compile_key(const char *source, size_t length, const CompileOptions *opts) {
+    uint32_t version = TLC_COMPILER_VERSION;
+    uint8_t fuse = (uint8_t)(opts ? opts->fuse != 0 : 1);
+    uint8_t gate = (uint8_t)(opts ? opts->gate != 0 : 1);
+    uint64_t h = fnv1a(FNV_OFFSET, source, length);
+    h = fnv1a(h, &version, sizeof(version));
+    h = fnv1a(h, &fuse, 1);
+    h = fnv1a(h, &gate, 1);
+    return h ? h : 1;   // 0 means "unknown" in the header
+}
+
+/* count items of `item` bytes at an aligned offset, inside size bytes */
+static int section_fits(uint64_t offset, uint64_t count, uint64_t item, size_t size) {
+    if (offset % TLCB_ALIGN != 0 || offset > size) return 0;
+    return item == 0 || count <= (size - offset) / item;
+}
+
+static int chunk_error(char *err, size_t errlen, const char *path, const char *what) {
+    if (err && errlen) snprintf(err, errlen, "%s: %s", path, what);
+    return -1;
+}
+
+int write_chunk_file(const char *path, const Chunk *chunk, const char *symbol,
+                     uint64_t source_hash, char *err, size_t errlen) {
+    ChunkFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TLCB_MAGIC, 8);
+    h.version = TLCB_VERSION;
+    h.endian = TLCB_ENDIAN_TAG;
+    h.compiler = TLC_COMPILER_VERSION;
+    h.temp_count = (uint32_t)chunk->temp_count;
+    h.cached_count = (uint32_t)chunk->cached_count;
+    h.source_hash = source_hash;
+    h.slot_count = (uint64_t)chunk->slot_count;
+    h.slot_offset = align_up(sizeof(h));
+    h.param_count = (uint64_t)chunk->param_count;
+    h.param_offset = align_up(h.slot_offset + h.slot_count * sizeof(IndicatorSlot));
+    h.line_count = (uint64_t)chunk->line_count;
+    h.line_offset = align_up(h.param_offset + h.param_count * sizeof(Param));
+    const RuleIndex *index = &chunk->gates;
+    uint64_t words = (uint64_t)index->words;
+    h.rule_count = (uint64_t)index->rule_count;
+    h.entry_offset = align_up(h.line_offset + h.line_count * sizeof(LineEntry));
+    h.gate_field_count = (uint64_t)index->field_count;
+    h.gate_field_offset = align_up(h.entry_offset + h.rule_count * sizeof(int32_t));
+    h.break_count = (uint64_t)index->break_count;
+    h.break_offset = align_up(h.gate_field_offset + h.gate_field_count * sizeof(GateField));
+    h.row_count = (uint64_t)index->row_count;
+    h.row_offset = align_up(h.break_offset + h.break_count * sizeof(double));
+    h.code_size = (uint64_t)chunk->count;
+    h.code_offset = align_up(h.row_offset + h.row_count * words * sizeof(uint64_t));
+    h.symbol_offset = h.code_offset + h.code_size;
+    h.symbol_size = strlen(symbol ? symbol : "") + 1;
+
+    size_t size = (size_t)(h.symbol_offset + h.symbol_size);
+    uint8_t *image = (uint8_t*)calloc(1, size);
+    if (!image) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    /* copy field by field so padding bytes are zero and the checksum is stable */
+    IndicatorSlot *slots = (IndicatorSlot*)(image + h.slot_offset);
+    for (int i = 0; i < chunk->slot_count; ++i) {
+        slots[i].func = chunk->slots[i].func;
+        slots[i].period = chunk->slots[i].period;
+        slots[i].param = chunk->slots[i].param;
+    }
+    Param *params = (Param*)(image + h.param_offset);
+    for (int i = 0; i < chunk->param_count; ++i) {
+        /* the rest of the name stays zero, as calloc left it */
+        memcpy(params[i].name, chunk->params[i].name, strnlen(chunk->params[i].name, PARAM_NAME_MAX - 1));
+        params[i].value = chunk->params[i].value;
+    }
+    if (h.line_count) memcpy(image + h.line_offset, chunk->lines, (size_t)h.line_count * sizeof(LineEntry));
+    if (h.rule_count) {
+        memcpy(image + h.entry_offset, index->entries, (size_t)h.rule_count * sizeof(int32_t));
+        memcpy(image + h.gate_field_offset, index->fields, (size_t)h.gate_field_count * sizeof(GateField));
+        memcpy(image + h.break_offset, index->breaks, (size_t)h.break_count * sizeof(double));
+        memcpy(image + h.row_offset, index->rows, (size_t)(h.row_count * words) * sizeof(uint64_t));
+    }
+    memcpy(image + h.code_offset, chunk->code, (size_t)h.code_size);
+    memcpy(image + h.symbol_offset, symbol ? symbol : "", (size_t)h.symbol_size);
+    h.checksum = fnv1a(FNV_OFFSET, image + sizeof(h), size - sizeof(h));
+    memcpy(image, &h, sizeof(h));
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        free(image);
+        return chunk_error(err, errlen, path, strerror(errno));
+    }
+    int ok = fwrite(image, 1, size, f) == size;
+    ok = (fclose(f) == 0) && ok;
+    free(image);
+    return ok ? 0 : chunk_error(err, errlen, path, "write failed");
+}
+
+int open_chunk_file(ChunkFile *cf, const char *path, char *err, size_t errlen) {
+    memset(cf, 0, sizeof(*cf));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return chunk_error(err, errlen, path, strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return chunk_error(err, errlen, path, strerror(errno));
+    }
+    size_t size = (size_t)st.st_size;
+    if (size < sizeof(ChunkFileHeader)) {
+        close(fd);
+        return chunk_error(err, errlen, path, "not a bytecode file (too small)");
+    }
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return chunk_error(err, errlen, path, strerror(errno));
+
+    const uint8_t *base = (const uint8_t*)map;
+    const ChunkFileHeader *h = (const ChunkFileHeader*)map;
+    const char *bad = NULL;
+    if (memcmp(h->magic, TLCB_MAGIC, 8) != 0)      bad = "bad magic";
+    else if (h->endian != TLCB_ENDIAN_TAG)         bad = "written on a machine with different byte order";
+    else if (h->version != TLCB_VERSION)           bad = "unsupported version";
+    else if (h->compiler != TLC_COMPILER_VERSION)  bad = "written by another compiler version";
+    else if (h->slot_offset % TLCB_ALIGN != 0 || h->slot_offset > size ||
+             h->slot_count > (size - h->slot_offset) / sizeof(IndicatorSlot) ||
+             h->slot_count > UINT16_MAX)           bad = "indicator slots out of bounds";
+    else if (!section_fits(h->param_offset, h->param_count, sizeof(Param), size) ||
+             h->param_count > TLC_PARAM_MAX)       bad = "parameters out of bounds";
+    else if (h->line_offset % TLCB_ALIGN != 0 || h->line_offset > size ||
+             h->line_count > (size - h->line_offset) / sizeof(LineEntry) ||
+             h->line_count > INT32_MAX)            bad = "source map out of bounds";
+    else if (!section_fits(h->entry_offset, h->rule_count, sizeof(int32_t), size) ||
+             !section_fits(h->gate_field_offset, h->gate_field_count, sizeof(GateField), size) ||
+             !section_fits(h->break_offset, h->break_count, sizeof(double), size) ||
+             h->rule_count > UINT16_MAX + 1 || h->gate_field_count > VAR_COUNT ||
+             h->break_count > INT32_MAX ||
+             !section_fits(h->row_offset, h->row_count, (h->rule_count + 63) / 64 * sizeof(uint64_t), size) ||
+             h->row_count > INT32_MAX)             bad = "rule index out of bounds";
+    else if (h->code_offset % TLCB_ALIGN != 0 || h->code_offset > size ||
+             h->code_size == 0 || h->code_size > size - h->code_offset ||
+             h->code_size > INT32_MAX)             bad = "code out of bounds";
+    else if (h->symbol_offset > size || h->symbol_size == 0 ||
+             h->symbol_size > size - h->symbol_offset ||
+             base[h->symbol_offset + h->symbol_size - 1] != '\0') bad = "symbol out of bounds";
+    else if (h->temp_count > UINT16_MAX)           bad = "too many temps";
+    else if (h->cached_count > UINT16_MAX)         bad = "too many cached values";
+    else if (fnv1a(FNV_OFFSET, base + sizeof(*h), size - sizeof(*h)) != h->checksum)
+        bad = "checksum mismatch";
+
+    const Param *params = bad ? NULL : (const Param*)(base + h->param_offset);
+    for (uint64_t i = 0; !bad && i < h->param_count; ++i) {
+        if (params[i].name[0] == '\0' || memchr(params[i].name, '\0', PARAM_NAME_MAX) == NULL)
+            bad = "bad parameter name";
+    }
+    const IndicatorSlot *slots = bad ? NULL : (const IndicatorSlot*)(base + h->slot_offset);
+    for (uint64_t i = 0; !bad && i < h->slot_count; ++i) {
+        if (slots[i].func >= FUNC_COUNT || slots[i].period < 1 || slots[i].period > TLC_PERIOD_MAX ||
+            slots[i].param < -1 || (slots[i].param >= 0 && (uint64_t)slots[i].param >= h->param_count))
+            bad = "bad indicator slot";
+        /* a period parameter's default is the slot's (whole) period */
+        else if (slots[i].param >= 0 && params[slots[i].param].value != (double)slots[i].period)
+            bad = "bad indicator slot";
+    }
+    /* source map: ascending offsets inside the code */
+    const LineEntry *lines = bad ? NULL : (const LineEntry*)(base + h->line_offset);
+    for (uint64_t i = 0; !bad && i < h->line_count; ++i) {
+        if (lines[i].offset < 0 || (uint64_t)lines[i].offset >= h->code_size ||
+            (i > 0 && lines[i].offset <= lines[i - 1].offset) ||
+            lines[i].line < 0 || lines[i].rule < -1)
+            bad = "bad source map";
+    }
+    if (bad) {
+        munmap(map, size);
+        return chunk_error(err, errlen, path, bad);
+    }
+
+    init_chunk(&cf->chunk);
+    cf->chunk.code = (uint8_t*)(base + h->code_offset);
+    cf->chunk.count = (int)h->code_size;
+    cf->chunk.slots = (IndicatorSlot*)slots;
+    cf->chunk.slot_count = (int)h->slot_count;
+    cf->chunk.params = h->param_count ? (Param*)params : NULL;
+    cf->chunk.param_count = (int)h->param_count;
+    cf->chunk.temp_count = (int)h->temp_count;
+    cf->chunk.cached_count = (int)h->cached_count;
+    cf->chunk.lines = (LineEntry*)lines;
+    cf->chunk.line_count = (int)h->line_count;
+    if (h->rule_count) {
+        RuleIndex *index = &cf->chunk.gates;
+        index->rule_count = (int32_t)h->rule_count;
+        index->words = (int32_t)((h->rule_count + 63) / 64);
+        index->entries = (int32_t*)(base + h->entry_offset);
+        index->fields = (GateField*)(base + h->gate_field_offset);
+        index->field_count = (int32_t)h->gate_field_count;
+        index->breaks = (double*)(base + h->break_offset);
+        index->break_count = (int32_t)h->break_count;
+        index->rows = (uint64_t*)(base + h->row_offset);
+        index->row_count = (int32_t)h->row_count;
+    }
+    cf->symbol = (const char*)(base + h->symbol_offset);
+    cf->source_hash = h->source_hash;
+    cf->map = map;
+    cf->map_size = size;
+
+    char why[256];
+    if (decode_chunk(&cf->chunk, why, sizeof(why)) != 0) {
+        munmap(map, size);
+        memset(cf, 0, sizeof(*cf));
+        return chunk_error(err, errlen, path, why);
+    }
+    return 0;
+}
+
+void close_chunk_file(ChunkFile *cf) {
+    free(cf->chunk.instrs);
+    free(cf->chunk.constants);
+    free(cf->chunk.rule_targets);
+    if (cf->map) munmap(cf->map, cf->map_size);
+    memset(cf, 0, sizeof(*cf));
+}
+
+/* ---------- Compile cache ----------
+ *
+ * One <key>.tlcb per compiled source in a flat directory. Entries are
+ * written to a temp file and renamed into place, so a reader never sees
+ * a partial file and concurrent writers of the same key are harmless.
+ */
+
+static void cache_path(char *buf, size_t size, const char *dir, uint64_t key) {
+    snprintf(buf, size, "%s/%016llx.tlcb", dir, (unsigned long long)key);
+}
+
+int cache_lookup(ChunkFile *cf, const char *dir, uint64_t key) {
+    char path[4096];
+    cache_path(path, sizeof(path), dir, key);
+    if (open_chunk_file(cf, path, NULL, 0) != 0) return -1;
+    if (cf->source_hash != key) {   // a foreign file under our name
+        close_chunk_file(cf);
+        return -1;
+    }
+    return 0;
+}
+
+int cache_store(const char *dir, uint64_t key, const Chunk *chunk, const char *symbol,
+                char *err, size_t errlen) {
+    char path[4096], tmp[4096 + 8];
+    cache_path(path, sizeof(path), dir, key);
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+        return chunk_error(err, errlen, dir, strerror(errno));
+    int fd = mkstemp(tmp);
+    if (fd < 0) return chunk_error(err, errlen, tmp, strerror(errno));
+    close(fd);
+    if (write_chunk_file(tmp, chunk, symbol, key, err, errlen) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    if (rename(tmp, path) != 0) {
+        unlink(tmp);
+        return chunk_error(err, errlen, path, strerror(errno));
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <string.h>
+#include "ast.h"
+
+/* ---------- Bytecode disassembler ---------- */
+
+static int32_t operand_int32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= ((uint32_t)p[i] << (i * 8));
+    return (int32_t)v;
+}
+
+static const char *simple_name(OpCode op) {
+    switch (op) {
+        case BC_HALT: return "HALT";
+        case BC_ADD:  return "ADD";
+        case BC_SUB:  return "SUB";
+        case BC_MUL:  return "MUL";
+        case BC_DIV:  return "DIV";
+        case BC_GT:   return "GT";
+        case BC_LT:   return "LT";
+        case BC_GE:   return "GE";
+        case BC_LE:   return "LE";
+        case BC_EQ:   return "EQ";
+        case BC_NE:   return "NE";
+        case BC_AND:  return "AND";
+        case BC_OR:   return "OR";
+        case BC_NEG:  return "NEG";
+        case BC_NOT:  return "NOT";
+        default:      return NULL;
+    }
+}
+
+static const char *var_name(uint8_t id) {
+    return id < VAR_COUNT ? builtin_var((VarId)id)->name : "?";
+}
+
+static const char *func_name(uint8_t fid) {
+    return fid < FUNC_COUNT ? builtin_func((FuncId)fid)->name : "?";
+}
+
+static const char *compare_symbol(uint8_t cmp) {
+    switch (cmp) {
+        case BC_GT: return ">";
+        case BC_LT: return "<";
+        case BC_GE: return ">=";
+        case BC_LE: return "<=";
+        case BC_EQ: return "==";
+        case BC_NE: return "!=";
+        default:    return "?";
+    }
+}
+
+/* "5m|1h" for a JUMP_IF_NOT_CLOSED mask */
+static void print_timeframes(uint8_t frames, FILE *out) {
+    const char *sep = "";
+    for (int tf = TF_BAR + 1; tf < TF_COUNT; ++tf) {
+        if (!(frames & (1u << tf))) continue;
+        fprintf(out, "%s%s", sep, timeframe_name(tf));
+        sep = "|";
+    }
+}
+
+static void print_slot(const Chunk *chunk, int slot, FILE *out) {
+    if (slot >= chunk->slot_count) return;
+    const IndicatorSlot *s = &chunk->slots[slot];
+    if (s->param >= 0 && s->param < chunk->param_count)
+        fprintf(out, " (period %s)", chunk->params[s->param].name);
+    else
+        fprintf(out, " (period %d)", s->period);
+}
+
+/* Prints one instruction and returns the offset of the next */
+const char *opcode_name(OpCode op) {
+    static const char *const names[BC_OPCODE_COUNT] = {
+        [BC_HALT] = "HALT", [BC_PUSH_CONST] = "PUSH_CONST", [BC_LOAD_VAR] = "LOAD_VAR",
+        [BC_IND_UPDATE] = "IND_UPDATE", [BC_LOAD_IND] = "LOAD_IND",
+        [BC_ADD] = "ADD", [BC_SUB] = "SUB", [BC_MUL] = "MUL", [BC_DIV] = "DIV",
+        [BC_GT] = "GT", [BC_LT] = "LT", [BC_GE] = "GE", [BC_LE] = "LE",
+        [BC_EQ] = "EQ", [BC_NE] = "NE", [BC_AND] = "AND", [BC_OR] = "OR",
+        [BC_NEG] = "NEG", [BC_NOT] = "NOT",
+        [BC_JUMP_IF_FALSE] = "JUMP_IF_FALSE", [BC_JUMP_IF_TRUE] = "JUMP_IF_TRUE",
+        [BC_STORE_TEMP] = "STORE_TEMP", [BC_LOAD_TEMP] = "LOAD_TEMP", [BC_JUMP] = "JUMP",
+        [BC_BUY] = "BUY", [BC_SELL] = "SELL",
+        [BC_CMP_VAR_CONST] = "CMP_VAR_CONST", [BC_JUMP_IF_NOT_CMP] = "JUMP_IF_NOT_CMP",
+        [BC_JUMP_IF_NOT_VAR_CONST] = "JUMP_IF_NOT_VAR_CONST", [BC_CMP_IND] = "CMP_IND",
+        [BC_LOAD_TF_VAR] = "LOAD_TF_VAR", [BC_JUMP_IF_NOT_CLOSED] = "JUMP_IF_NOT_CLOSED",
+        [BC_JUMP_IF_SAME] = "JUMP_IF_SAME", [BC_STORE_CACHED] = "STORE_CACHED",
+        [BC_LOAD_CACHED] = "LOAD_CACHED", [BC_JUMP_IF_NOT_CACHED] = "JUMP_IF_NOT_CACHED",
+        [BC_RULE_INDEX] = "RULE_INDEX", [BC_NEXT_RULE] = "NEXT_RULE",
+        [BC_LOAD_PARAM] = "LOAD_PARAM",
+    };
+    return (unsigned)op < BC_OPCODE_COUNT && names[op] ? names[op] : "???";
+}
+
+int disassemble_instruction(const Chunk *chunk, int offset, FILE *out) {
+    const uint8_t *code = chunk->code + offset;
+    OpCode op = (OpCode)code[0];
+    fprintf(out, "%04d  ", offset);
+
+    const char *name = simple_name(op);
+    if (name) {
+        fprintf(out, "%s\n", name);
+        return offset + 1;
+    }
+
+    switch (op) {
+        case BC_PUSH_CONST: {
+            double v;
+            memcpy(&v, code + 1, sizeof(double));
+            fprintf(out, "PUSH_CONST     %g\n", v);
+            return offset + 9;
+        }
+        case BC_LOAD_VAR: {
+            uint8_t id = code[1];
+            fprintf(out, "LOAD_VAR       %s\n", var_name(id));
+            return offset + 2;
+        }
+        case BC_IND_UPDATE: {
+            uint8_t fid = code[1];
+            int slot = code[2] | (code[3] << 8);
+            fprintf(out, "IND_UPDATE     %s slot %d", func_name(fid), slot);
+            print_slot(chunk, slot, out);
+            fputc('\n', out);
+            return offset + 4;
+        }
+        case BC_LOAD_IND:
+            fprintf(out, "LOAD_IND       slot %d\n", code[1] | (code[2] << 8));
+            return offset + 3;
+        case BC_STORE_TEMP:
+        case BC_LOAD_TEMP:
+            fprintf(out, "%-14s t%d\n", op == BC_STORE_TEMP ? "STORE_TEMP" : "LOAD_TEMP",
+                    code[1] | (code[2] << 8));
+            return offset + 3;
+        case BC_CMP_IND:
+            fprintf(out, "CMP_IND        %s slot %d\n", compare_symbol(code[3]),
+                    code[1] | (code[2] << 8));
+            return offset + 4;
+        case BC_CMP_VAR_CONST: {
+            double v;
+            memcpy(&v, code + 3, sizeof(double));
+            fprintf(out, "CMP_VAR_CONST  %s %s %g\n", var_name(code[1]),
+                    compare_symbol(code[2]), v);
+            return offset + 11;
+        }
+        case BC_JUMP_IF_NOT_CMP: {
+            int32_t jump = operand_int32(code + 2);
+            fprintf(out, "JUMP_IF_NOT_CMP %s -> %04d\n", compare_symbol(code[1]),
+                    offset + 6 + jump);
+            return offset + 6;
+        }
+        case BC_JUMP_IF_NOT_VAR_CONST: {
+            double v;
+            memcpy(&v, code + 3, sizeof(double));
+            int32_t jump = operand_int32(code + 11);
+            fprintf(out, "JUMP_IF_NOT_VAR_CONST %s %s %g -> %04d\n", var_name(code[1]),
+                    compare_symbol(code[2]), v, offset + 15 + jump);
+            return offset + 15;
+        }
+        case BC_LOAD_TF_VAR:
+            fprintf(out, "LOAD_TF_VAR    %s on %s\n", var_name(code[2]), timeframe_name(code[1]));
+            return offset + 3;
+        case BC_JUMP_IF_NOT_CLOSED: {
+            int32_t jump = operand_int32(code + 2);
+            fprintf(out, "JUMP_IF_NOT_CLOSED ");
+            print_timeframes(code[1], out);
+            fprintf(out, " -> %04d\n", offset + 6 + jump);
+            return offset + 6;
+        }
+        case BC_JUMP_IF_SAME: {
+            int32_t jump = operand_int32(code + 2);
+            fprintf(out, "JUMP_IF_SAME   %s -> %04d\n", code[1] == FREQ_DAY ? "day" : "minute",
+                    offset + 6 + jump);
+            return offset + 6;
+        }
+        case BC_STORE_CACHED:
+        case BC_LOAD_CACHED:
+            fprintf(out, "%-14s c%d\n", op == BC_STORE_CACHED ? "STORE_CACHED" : "LOAD_CACHED",
+                    code[1] | (code[2] << 8));
+            return offset + 3;
+        case BC_LOAD_PARAM: {
+            int p = code[1] | (code[2] << 8);
+            fprintf(out, "LOAD_PARAM     %s\n", p < chunk->param_count ? chunk->params[p].name : "?");
+            return offset + 3;
+        }
+        case BC_JUMP_IF_NOT_CACHED: {
+            int32_t jump = operand_int32(code + 3);
+            fprintf(out, "JUMP_IF_NOT_CACHED c%d -> %04d\n", code[1] | (code[2] << 8),
+                    offset + 7 + jump);
+            return offset + 7;
+        }
+        case BC_JUMP_IF_FALSE:
+        case BC_JUMP_IF_TRUE:
+        case BC_JUMP:
+        case BC_RULE_INDEX:
+        case BC_NEXT_RULE: {
+            int32_t jump = operand_int32(code + 1);
+            fprintf(out, "%-14s -> %04d\n", opcode_name(op), offset + 5 + jump);
+            return offset + 5;
+        }
+        case BC_BUY:
+        case BC_SELL:
+            fprintf(out, "%-14s %d (rule %d)\n", op == BC_BUY ? "BUY" : "SELL",
+                    operand_int32(code + 1), code[5] | (code[6] << 8));
+            return offset + 7;
+        default:
+            fprintf(out, "??? (%d)\n", op);
+            return offset + 1;
+    }
+}
+
+void disassemble_chunk(const Chunk *chunk, const char *title, FILE *out) {
+    fprintf(out, "== %s (%d bytes, %d indicator slots, %d temps, %d cached) ==\n",
+            title, chunk->count, chunk->slot_count, chunk->temp_count, chunk->cached_count);
+    if (chunk->param_count > 0) {
+        fprintf(out, "      ; params:");
+        for (int p = 0; p < chunk->param_count; ++p)
+            fprintf(out, "%s %s = %g", p ? "," : "", chunk->params[p].name, chunk->params[p].value);
+        fputc('\n', out);
+    }
+    const RuleIndex *index = &chunk->gates;
+    if (index->rule_count > 0) {
+        fprintf(out, "      ; rule index over %d rules:", index->rule_count);
+        for (int f = 0; f < index->field_count; ++f)
+            fprintf(out, "%s %s (%d breakpoints)", f ? "," : "", var_name((uint8_t)index->fields[f].var),
+                    index->fields[f].count);
+        fputc('\n', out);
+    }
+    int entry = 0;
+    for (int offset = 0; offset < chunk->count; ) {
+        /* a source-map run starting here gets a header line */
+        while (entry < chunk->line_count && chunk->lines[entry].offset < offset) entry++;
+        if (entry < chunk->line_count && chunk->lines[entry].offset == offset) {
+            const LineEntry *l = &chunk->lines[entry];
+            if (l->line > 0 && l->rule >= 0) fprintf(out, "      ; line %d, rule %d\n", l->line, l->rule);
+            else if (l->line > 0) fprintf(out, "      ; line %d, shared\n", l->line);
+        }
+        offset = disassemble_instruction(chunk, offset, out);
+    }
+}
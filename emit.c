@@ -0,0 +1,406 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dlfcn.h>
+#include "ast.h"
+
+/* ---------- Ahead-of-time C backend ----------
+ *
+ * Translates a compiled chunk into one C function. The translation works
+ * on the bytecode, not the AST, so the generated code runs exactly the
+ * instruction sequence run_chunk would (fusion, short-circuit jumps and
+ * CSE temps included): stack entry i becomes the local s<i>, temps are a
+ * local array, cached values stay in IndicatorState, jumps become gotos
+ * and every expression keeps the VM's
+ * C semantics. With -std=c11 (no FP contraction) and without -ffast-math
+ * the results are bit-identical to the interpreter.
+ *
+ * A rule index (RULE_INDEX / NEXT_RULE) is not used: every rule's code
+ * runs, which sends the same signals.
+ *
+ * Indicator updates go through the host's table, passed in by
+ * run_strategy, so a strategy object has no link-time dependency on tlc.
+ */
+
+static const char *const func_ids[FUNC_COUNT] = {
+#define X(id, name, arity, window, update) #id,
+    TL_BUILTIN_FUNCS(X)
+#undef X
+};
+
+static const char *compare_c(uint8_t op) {
+    switch (op) {
+        case BC_GT: return ">";
+        case BC_LT: return "<";
+        case BC_GE: return ">=";
+        case BC_LE: return "<=";
+        case BC_EQ: return "==";
+        default:    return "!=";
+    }
+}
+
+static uint16_t operand_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static int32_t operand_i32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= (uint32_t)p[i] << (i * 8);
+    return (int32_t)v;
+}
+
+static double operand_double(const uint8_t *p) {
+    double v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* A literal that reads back as exactly v */
+static void format_double(char *buf, size_t size, double v) {
+    if (isnan(v)) { snprintf(buf, size, "NAN"); return; }
+    if (isinf(v)) { snprintf(buf, size, v < 0 ? "(-INFINITY)" : "INFINITY"); return; }
+    snprintf(buf, size, "%.17g", v);
+    if (!strpbrk(buf, ".e")) strncat(buf, ".0", size - strlen(buf) - 1);
+    if (v < 0) {
+        char tmp[64];
+        snprintf(tmp, sizeof(tmp), "(%s)", buf);
+        snprintf(buf, size, "%s", tmp);
+    }
+}
+
+static const char *var_name(uint8_t id) {
+    return id < VAR_COUNT ? builtin_var((VarId)id)->name : NULL;
+}
+
+static int emit_error(char *err, size_t errlen, int offset, const char *what) {
+    if (err && errlen) snprintf(err, errlen, "Cannot emit C at %04d: %s", offset, what);
+    return -1;
+}
+
+/* Stack depth before every instruction; -1 where unreachable. Also
+ * marks the offsets that are jump targets. */
+static int stack_depths(const Chunk *chunk, int *depth_at, uint8_t *is_target, int *max_depth,
+                        char *err, size_t errlen) {
+    const uint8_t *code = chunk->code;
+    int depth = 0, reachable = 1;
+    *max_depth = 0;
+    for (int i = 0; i < chunk->count; ++i) depth_at[i] = -1;
+
+    for (int offset = 0; offset < chunk->count; ) {
+        if (is_target[offset]) {
+            if (reachable && depth_at[offset] != depth)
+                return emit_error(err, errlen, offset, "inconsistent stack depth");
+            depth = depth_at[offset];
+            reachable = 1;
+        } else if (!reachable) {
+            offset += instruction_length(chunk, offset);
+            continue;
+        }
+        depth_at[offset] = depth;
+        int len = instruction_length(chunk, offset);
+        int pops = 0, pushes = 0, target = -1;
+        switch ((OpCode)code[offset]) {
+            case BC_HALT:                 reachable = 0; break;
+            case BC_PUSH_CONST:
+            case BC_LOAD_VAR:
+            case BC_LOAD_IND:
+            case BC_LOAD_TEMP:
+            case BC_LOAD_CACHED:
+            case BC_CMP_VAR_CONST:        pushes = 1; break;
+            case BC_IND_UPDATE:
+            case BC_STORE_TEMP:
+            case BC_STORE_CACHED:         pops = 1; break;
+            case BC_CMP_IND:
+            case BC_NEG:
+            case BC_NOT:                  pops = 1; pushes = 1; break;
+            case BC_ADD: case BC_SUB: case BC_MUL: case BC_DIV:
+            case BC_GT: case BC_LT: case BC_GE: case BC_LE: case BC_EQ: case BC_NE:
+            case BC_AND: case BC_OR:      pops = 2; pushes = 1; break;
+            case BC_JUMP_IF_FALSE:
+            case BC_JUMP_IF_TRUE:         pops = 1; target = 1; break;
+            case BC_JUMP_IF_NOT_CMP:      pops = 2; target = 1; break;
+            case BC_JUMP_IF_NOT_VAR_CONST:
+            case BC_JUMP_IF_SAME:
+            case BC_JUMP_IF_NOT_CACHED:   target = 1; break;
+            case BC_JUMP:                 target = 1; reachable = 0; break;
+            case BC_BUY:
+            case BC_SELL:
+            case BC_RULE_INDEX:           // no index here: every rule runs
+            case BC_NEXT_RULE:            break;
+            default:
+                return emit_error(err, errlen, offset, "unknown opcode");
+        }
+        if (depth < pops) return emit_error(err, errlen, offset, "stack underflow");
+        depth += pushes - pops;
+        if (depth > *max_depth) *max_depth = depth;
+        if (target >= 0) {
+            int to = offset + len + operand_i32(code + offset + len - 4);
+            if (to <= offset || to >= chunk->count)
+                return emit_error(err, errlen, offset, "bad jump target");
+            if (is_target[to] && depth_at[to] >= 0 && depth_at[to] != depth)
+                return emit_error(err, errlen, offset, "inconsistent stack depth");
+            is_target[to] = 1;
+            depth_at[to] = depth;
+        }
+        offset += len;
+    }
+    return 0;
+}
+
+static void emit_body(const Chunk *chunk, const int *depth_at, const uint8_t *is_target,
+                      FILE *out) {
+    const uint8_t *code = chunk->code;
+    char k[64];
+
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset)) {
+        if (is_target[offset]) fprintf(out, "L%04d:;\n", offset);
+        if (depth_at[offset] < 0) continue;
+
+        const uint8_t *p = code + offset;
+        int len = instruction_length(chunk, offset);
+        int d = depth_at[offset];
+        int target = len >= 5 ? offset + len + operand_i32(p + len - 4) : -1;   // jumps only
+        switch ((OpCode)p[0]) {
+            case BC_HALT:
+                fprintf(out, "    return;\n");
+                break;
+            case BC_PUSH_CONST:
+                format_double(k, sizeof(k), operand_double(p + 1));
+                fprintf(out, "    s%d = %s;\n", d, k);
+                break;
+            case BC_LOAD_VAR:
+                fprintf(out, "    s%d = (double)ctx->%s;\n", d, var_name(p[1]));
+                break;
+            case BC_IND_UPDATE: {
+                uint16_t slot = operand_u16(p + 2);
+                fprintf(out, "    slot[%u].output = update[%s](&slot[%u], s%d);\n",
+                        slot, func_ids[p[1]], slot, d - 1);
+                break;
+            }
+            case BC_LOAD_IND:
+                fprintf(out, "    s%d = slot[%u].output;\n", d, operand_u16(p + 1));
+                break;
+            case BC_CMP_IND:
+                fprintf(out, "    s%d = (double)(s%d %s slot[%u].output);\n",
+                        d - 1, d - 1, compare_c(p[3]), operand_u16(p + 1));
+                break;
+            case BC_STORE_TEMP:
+                fprintf(out, "    t[%u] = s%d;\n", operand_u16(p + 1), d - 1);
+                break;
+            case BC_LOAD_TEMP:
+                fprintf(out, "    s%d = t[%u];\n", d, operand_u16(p + 1));
+                break;
+            case BC_STORE_CACHED:
+                fprintf(out, "    ind->cached[%u] = s%d;\n", operand_u16(p + 1), d - 1);
+                break;
+            case BC_LOAD_CACHED:
+                fprintf(out, "    s%d = ind->cached[%u];\n", d, operand_u16(p + 1));
+                break;
+            case BC_JUMP_IF_NOT_CACHED:
+                fprintf(out, "    if (ind->cached[%u] == 0.0) goto L%04d;\n", operand_u16(p + 1), target);
+                break;
+            case BC_JUMP_IF_SAME:
+                if (p[1] == FREQ_DAY) {
+                    fprintf(out, "    if (ctx->date == ind->day_stamp) goto L%04d;\n"
+                                 "    ind->day_stamp = ctx->date;\n", target);
+                } else {
+                    fprintf(out, "    if (ctx->date == ind->minute_stamp[0] && ctx->time == ind->minute_stamp[1])"
+                                 " goto L%04d;\n"
+                                 "    ind->minute_stamp[0] = ctx->date;\n"
+                                 "    ind->minute_stamp[1] = ctx->time;\n", target);
+                }
+                break;
+            case BC_ADD: case BC_SUB: case BC_MUL: case BC_DIV: {
+                static const char ops[] = "+-*/";
+                fprintf(out, "    s%d = s%d %c s%d;\n", d - 2, d - 2, ops[p[0] - BC_ADD], d - 1);
+                break;
+            }
+            case BC_GT: case BC_LT: case BC_GE: case BC_LE: case BC_EQ: case BC_NE:
+                fprintf(out, "    s%d = (double)(s%d %s s%d);\n",
+                        d - 2, d - 2, compare_c(p[0]), d - 1);
+                break;
+            case BC_AND:
+            case BC_OR:
+                fprintf(out, "    s%d = (double)(s%d != 0.0 %s s%d != 0.0);\n",
+                        d - 2, d - 2, p[0] == BC_AND ? "&&" : "||", d - 1);
+                break;
+            case BC_NEG:
+                fprintf(out, "    s%d = -s%d;\n", d - 1, d - 1);
+                break;
+            case BC_NOT:
+                fprintf(out, "    s%d = (double)(s%d == 0.0);\n", d - 1, d - 1);
+                break;
+            case BC_CMP_VAR_CONST:
+                format_double(k, sizeof(k), operand_double(p + 3));
+                fprintf(out, "    s%d = (double)((double)ctx->%s %s %s);\n",
+                        d, var_name(p[1]), compare_c(p[2]), k);
+                break;
+            case BC_JUMP_IF_FALSE:
+                fprintf(out, "    if (s%d == 0.0) goto L%04d;\n", d - 1, target);
+                break;
+            case BC_JUMP_IF_TRUE:
+                fprintf(out, "    if (s%d != 0.0) goto L%04d;\n", d - 1, target);
+                break;
+            case BC_JUMP_IF_NOT_CMP:
+                fprintf(out, "    if (!(s%d %s s%d)) goto L%04d;\n",
+                        d - 2, compare_c(p[1]), d - 1, target);
+                break;
+            case BC_JUMP_IF_NOT_VAR_CONST:
+                format_double(k, sizeof(k), operand_double(p + 3));
+                fprintf(out, "    if (!((double)ctx->%s %s %s)) goto L%04d;\n",
+                        var_name(p[1]), compare_c(p[2]), k, target);
+                break;
+            case BC_JUMP:
+                fprintf(out, "    goto L%04d;\n", target);
+                break;
+            case BC_BUY:
+            case BC_SELL:
+                fprintf(out, "    send(sink, ind, %s, %d, %u);\n",
+                        p[0] == BC_BUY ? "BC_BUY" : "BC_SELL", operand_i32(p + 1), operand_u16(p + 5));
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void emit_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20 || c >= 0x7F) fprintf(out, "\\%03o", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+int emit_c(const Chunk *chunk, const char *symbol, const char *source_name, FILE *out,
+           char *err, size_t errlen) {
+    if (!chunk->code || chunk->count == 0) return emit_error(err, errlen, 0, "empty chunk");
+    if (chunk->timeframes)
+        return emit_error(err, errlen, 0, "other timeframes (`on`) need the VM's bar aggregation");
+    if (chunk->param_count > 0)
+        return emit_error(err, errlen, 0, "parameters are set per run; compile with their values instead");
+
+    int *depth_at = (int*)malloc((size_t)chunk->count * sizeof(int));
+    uint8_t *is_target = (uint8_t*)calloc((size_t)chunk->count, 1);
+    if (!depth_at || !is_target) { fprintf(stderr, "Out of memory\n"); exit(1); }
+
+    int max_depth;
+    if (stack_depths(chunk, depth_at, is_target, &max_depth, err, errlen) != 0) {
+        free(depth_at);
+        free(is_target);
+        return -1;
+    }
+
+    fprintf(out, "/* Generated by tlc --emit-c from %s. Do not edit.\n", source_name);
+    fprintf(out, " * Build with -std=c11 (no FP contraction) and without -ffast-math. */\n");
+    fprintf(out, "#include <math.h>\n#include \"ast.h\"\n\n");
+
+    fprintf(out, "static void send(const SignalSink *sink, const IndicatorState *ind, int side,\n"
+                 "                 int32_t qty, int rule) {\n"
+                 "    Signal sig;\n"
+                 "    sig.bar = ind->bars;\n"
+                 "    sig.symbol_id = sink->symbol_id;\n"
+                 "    sig.qty = qty;\n"
+                 "    sig.rule = (uint16_t)rule;\n"
+                 "    sig.side = (uint8_t)side;\n"
+                 "    sink->emit(sink->user, &sig);\n"
+                 "}\n\n");
+    fprintf(out, "static void run(IndicatorState *ind, const VMContext *ctx, const SignalSink *sink,\n"
+                 "                const IndicatorUpdate *update) {\n");
+    fprintf(out, "    Indicator *slot = ind->slots;\n");
+    if (max_depth > 0) {
+        fprintf(out, "    double");
+        for (int i = 0; i < max_depth; ++i) fprintf(out, "%s s%d = 0.0", i ? "," : "", i);
+        fprintf(out, ";\n");
+    }
+    if (chunk->temp_count > 0) fprintf(out, "    double t[%d];\n", chunk->temp_count);
+    fprintf(out, "    (void)slot; (void)ctx; (void)sink; (void)update;\n\n");
+    emit_body(chunk, depth_at, is_target, out);
+    fprintf(out, "}\n\n");
+
+    if (chunk->slot_count > 0) {
+        fprintf(out, "static const IndicatorSlot slots[%d] = {\n", chunk->slot_count);
+        for (int i = 0; i < chunk->slot_count; ++i)
+            fprintf(out, "    { %s, %d, -1 },\n", func_ids[chunk->slots[i].func], chunk->slots[i].period);
+        fprintf(out, "};\n\n");
+    }
+
+    fprintf(out, "const CompiledStrategy tlc_strategy = {\n");
+    fprintf(out, "    TLC_STRATEGY_ABI, (int)sizeof(VMContext), (int)sizeof(Indicator),\n    ");
+    emit_string(out, symbol);
+    fprintf(out, ", %s, %d, run, %d\n};\n", chunk->slot_count > 0 ? "slots" : "NULL",
+            chunk->slot_count, chunk->cached_count);
+
+    free(depth_at);
+    free(is_target);
+    if (ferror(out)) {
+        if (err && errlen) snprintf(err, errlen, "Cannot write C output");
+        return -1;
+    }
+    return 0;
+}
+
+/* ---------- Loading compiled strategies ---------- */
+
+int load_strategy(StrategyLib *lib, const char *path, char *err, size_t errlen) {
+    memset(lib, 0, sizeof(*lib));
+    /* dlopen searches the library path for bare names; ./ keeps it local */
+    char local[4096];
+    if (!strchr(path, '/')) {
+        snprintf(local, sizeof(local), "./%s", path);
+        path = local;
+    }
+    lib->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!lib->handle) {
+        if (err && errlen) snprintf(err, errlen, "%s", dlerror());
+        return -1;
+    }
+
+    const CompiledStrategy *s = (const CompiledStrategy*)dlsym(lib->handle, "tlc_strategy");
+    const char *problem = NULL;
+    if (!s) problem = "no tlc_strategy symbol";
+    else if (s->abi != TLC_STRATEGY_ABI) problem = "built for another strategy ABI";
+    else if (s->context_size != (int)sizeof(VMContext) || s->indicator_size != (int)sizeof(Indicator))
+        problem = "built against another ast.h";
+    else if (!s->run || s->slot_count < 0 || (s->slot_count > 0 && !s->slots) ||
+             s->cached_count < 0) problem = "malformed descriptor";
+    for (int i = 0; !problem && s && i < s->slot_count; ++i) {
+        if (s->slots[i].func >= FUNC_COUNT || s->slots[i].period < 1 ||
+            s->slots[i].param != -1) problem = "bad indicator slot";
+    }
+    if (problem) {
+        if (err && errlen) snprintf(err, errlen, "%s: %s", path, problem);
+        dlclose(lib->handle);
+        lib->handle = NULL;
+        return -1;
+    }
+
+    lib->strategy = s;
+    for (int f = 0; f < FUNC_COUNT; ++f) lib->update[f] = indicator_function(f);
+    return 0;
+}
+
+void unload_strategy(StrategyLib *lib) {
+    if (lib->handle) dlclose(lib->handle);
+    memset(lib, 0, sizeof(*lib));
+}
+
+void init_strategy_indicators(IndicatorState *state, const StrategyLib *lib) {
+    Chunk shape;
+    init_chunk(&shape);
+    shape.slots = (IndicatorSlot*)lib->strategy->slots;
+    shape.slot_count = lib->strategy->slot_count;
+    shape.cached_count = lib->strategy->cached_count;
+    init_indicators(state, &shape);
+}
+
+void run_strategy(const StrategyLib *lib, IndicatorState *ind, const VMContext *ctx,
+                  const SignalSink *sink) {
+    lib->strategy->run(ind, ctx, sink, lib->update);
+    ind->bars++;
+}
@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ast.h"
+
+/* ---------- Rule gating index ----------
+ *
+ * Most rules of a large strategy are guarded by a time window, a set of
+ * weekdays or a price threshold, and on any one bar only a few of them
+ * can fire. For every rule and field the compiler derives a necessary
+ * condition from its AST: the set of values of the field outside which
+ * the condition is false whatever else holds. Comparisons of the field
+ * with a constant give intervals; `and` intersects, `or` unites and `not`
+ * complements (De Morgan, with NaN handled like the VM compares it);
+ * anything else allows every value.
+ *
+ * The finite interval ends of all rules become a field's sorted
+ * breakpoints b[0..m), which cut the line into 2m + 1 segments: the gap
+ * below b[0] (0), each point b[i] (2i + 1), each gap above it (2i + 2),
+ * plus a row for NaN (2m + 1). Each segment has a row of rule bits, set
+ * for the rules whose value set meets it. Per bar the VM finds the
+ * segment of each indexed field by binary search and ANDs their rows; the
+ * bits left are the candidate rules, and only their code runs. The sets
+ * are supersets of where a rule can fire, so skipping the others never
+ * changes a signal.
+ */
+
+#define GATE_MIN_RULES 16          // gated rules needed before an index pays
+#define GATE_BREAKS_MAX 4096       // breakpoints per field
+#define GATE_WORDS_MAX (1 << 20)   // row words per field
+#define SET_INTERVALS 8            // a longer union is widened to its hull
+
+typedef struct {
+    double lo, hi;                 // infinite ends count as closed
+    int lo_open, hi_open;
+} Interval;
+
+/* Values of one field for which a condition can be true */
+typedef struct {
+    int any;                       // no constraint
+    int nan;                       // NaN is in the set
+    int count;
+    Interval iv[SET_INTERVALS];
+} ValueSet;
+
+static ValueSet set_any(void) {
+    ValueSet s;
+    memset(&s, 0, sizeof(s));
+    s.any = 1;
+    s.nan = 1;
+    return s;
+}
+
+static int interval_empty(const Interval *v) {
+    return v->lo > v->hi || (v->lo == v->hi && (v->lo_open || v->hi_open));
+}
+
+/* Appends v unless it is empty; past SET_INTERVALS the set becomes the
+ * hull of its intervals */
+static void add_interval(ValueSet *s, Interval v) {
+    if (interval_empty(&v)) return;
+    if (s->count < SET_INTERVALS) {
+        s->iv[s->count++] = v;
+        return;
+    }
+    Interval *h = &s->iv[0];
+    for (int i = 1; i < s->count; ++i) {
+        if (s->iv[i].lo < h->lo || (s->iv[i].lo == h->lo && !s->iv[i].lo_open)) {
+            h->lo = s->iv[i].lo;
+            h->lo_open = s->iv[i].lo_open;
+        }
+        if (s->iv[i].hi > h->hi || (s->iv[i].hi == h->hi && !s->iv[i].hi_open)) {
+            h->hi = s->iv[i].hi;
+            h->hi_open = s->iv[i].hi_open;
+        }
+    }
+    if (v.lo < h->lo || (v.lo == h->lo && !v.lo_open)) { h->lo = v.lo; h->lo_open = v.lo_open; }
+    if (v.hi > h->hi || (v.hi == h->hi && !v.hi_open)) { h->hi = v.hi; h->hi_open = v.hi_open; }
+    s->count = 1;
+}
+
+static Interval interval(double lo, int lo_open, double hi, int hi_open) {
+    Interval v = { lo, hi, lo_open && isfinite(lo), hi_open && isfinite(hi) };
+    return v;
+}
+
+/* field op k, or its negation: where the VM's compare is true (false) */
+static ValueSet set_compare(OpKind op, double k, int negate) {
+    if (isnan(k)) return set_any();
+    ValueSet s;
+    memset(&s, 0, sizeof(s));
+    s.nan = (op == OP_NE_OP) != negate;   // NaN compares false except with !=
+    if (negate) {
+        switch (op) {
+            case OP_GT_OP: op = OP_LE_OP; break;
+            case OP_GE_OP: op = OP_LT_OP; break;
+            case OP_LT_OP: op = OP_GE_OP; break;
+            case OP_LE_OP: op = OP_GT_OP; break;
+            case OP_EQ_OP: op = OP_NE_OP; break;
+            default:       op = OP_EQ_OP; break;
+        }
+    }
+    switch (op) {
+        case OP_GT_OP: add_interval(&s, interval(k, 1, INFINITY, 0)); break;
+        case OP_GE_OP: add_interval(&s, interval(k, 0, INFINITY, 0)); break;
+        case OP_LT_OP: add_interval(&s, interval(-INFINITY, 0, k, 1)); break;
+        case OP_LE_OP: add_interval(&s, interval(-INFINITY, 0, k, 0)); break;
+        case OP_EQ_OP: add_interval(&s, interval(k, 0, k, 0)); break;
+        default:
+            add_interval(&s, interval(-INFINITY, 0, k, 1));
+            add_interval(&s, interval(k, 1, INFINITY, 0));
+            break;
+    }
+    return s;
+}
+
+static ValueSet set_intersect(const ValueSet *a, const ValueSet *b) {
+    if (a->any) return *b;
+    if (b->any) return *a;
+    ValueSet s;
+    memset(&s, 0, sizeof(s));
+    s.nan = a->nan && b->nan;
+    for (int i = 0; i < a->count; ++i) {
+        for (int j = 0; j < b->count; ++j) {
+            const Interval *x = &a->iv[i], *y = &b->iv[j];
+            Interval v = *x;
+            if (y->lo > v.lo || (y->lo == v.lo && y->lo_open)) { v.lo = y->lo; v.lo_open = y->lo_open; }
+            if (y->hi < v.hi || (y->hi == v.hi && y->hi_open)) { v.hi = y->hi; v.hi_open = y->hi_open; }
+            add_interval(&s, v);
+        }
+    }
+    return s;
+}
+
+static ValueSet set_union(const ValueSet *a, const ValueSet *b) {
+    if (a->any) return *a;
+    if (b->any) return *b;
+    ValueSet s = *a;
+    s.nan = a->nan || b->nan;
+    for (int j = 0; j < b->count; ++j) add_interval(&s, b->iv[j]);
+    return s;
+}
+
+/* The value of `e` when it is a constant facing field `var` */
+static int constant_value(const Expr *e, VarId var, double *out) {
+    if (e->kind == EXPR_NUMBER) {
+        *out = e->as.number.value;
+        return 1;
+    }
+    return e->kind == EXPR_STRING && string_literal_value(var, e->as.string.value, out);
+}
+
+static int names_field(const Expr *e, VarId var) {
+    if (e->kind != EXPR_IDENT || e->as.ident.timeframe != TF_BAR) return 0;
+    const Builtin *b = lookup_builtin(e->as.ident.name, strlen(e->as.ident.name));
+    return b && b->kind == BUILTIN_VAR && b->id == var;
+}
+
+/* Values of `var` for which e (or `not e`) can be true */
+static ValueSet gate_field(const Expr *e, VarId var, int negate) {
+    if (e->kind == EXPR_UNARY && e->as.op.op == OP_NOT_OP)
+        return gate_field(e->as.op.left, var, !negate);
+    if (e->kind != EXPR_BINARY) return set_any();
+
+    OpKind op = e->as.op.op;
+    if (op == OP_AND_OP || op == OP_OR_OP) {
+        ValueSet a = gate_field(e->as.op.left, var, negate);
+        ValueSet b = gate_field(e->as.op.right, var, negate);
+        return (op == OP_AND_OP) != negate ? set_intersect(&a, &b) : set_union(&a, &b);
+    }
+    if (op < OP_GT_OP || op > OP_NE_OP) return set_any();
+
+    double k;
+    if (names_field(e->as.op.left, var) && constant_value(e->as.op.right, var, &k))
+        return set_compare(op, k, negate);
+    if (names_field(e->as.op.right, var) && constant_value(e->as.op.left, var, &k)) {
+        switch (op) {   // k op field  ==  field mirrored(op) k
+            case OP_GT_OP: op = OP_LT_OP; break;
+            case OP_LT_OP: op = OP_GT_OP; break;
+            case OP_GE_OP: op = OP_LE_OP; break;
+            case OP_LE_OP: op = OP_GE_OP; break;
+            default: break;
+        }
+        return set_compare(op, k, negate);
+    }
+    return set_any();
+}
+
+/* ---------- Building ---------- */
+
+static int compare_doubles(const void *pa, const void *pb) {
+    double a = *(const double*)pa, b = *(const double*)pb;
+    return a < b ? -1 : a > b;
+}
+
+/* Index of the first breakpoint >= x */
+static int lower_bound(const double *b, int n, double x) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (b[mid] < x) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int segment_of(const double *b, int n, double x) {
+    if (isnan(x)) return 2 * n + 1;
+    int i = lower_bound(b, n, x);
+    return i < n && b[i] == x ? 2 * i + 1 : 2 * i;
+}
+
+static void *gate_alloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    return p;
+}
+
+static void set_bit(uint64_t *row, int rule) {
+    row[rule >> 6] |= (uint64_t)1 << (rule & 63);
+}
+
+/* Sets rule's bit in the rows of every segment its set meets */
+static void fill_rows(uint64_t *rows, int words, const double *b, int m, const ValueSet *s,
+                      int rule) {
+    if (s->any) {
+        for (int seg = 0; seg < 2 * m + 2; ++seg) set_bit(rows + (size_t)seg * words, rule);
+        return;
+    }
+    if (s->nan) set_bit(rows + (size_t)(2 * m + 1) * words, rule);
+    for (int i = 0; i < s->count; ++i) {
+        const Interval *v = &s->iv[i];
+        int from, to;
+        if (v->lo == -INFINITY) from = 0;
+        else if (v->lo == INFINITY) from = 2 * m;
+        else from = 2 * lower_bound(b, m, v->lo) + (v->lo_open ? 2 : 1);
+        if (v->hi == INFINITY) to = 2 * m;
+        else if (v->hi == -INFINITY) to = 0;
+        else to = 2 * lower_bound(b, m, v->hi) + (v->hi_open ? 0 : 1);
+        for (int seg = from; seg <= to; ++seg) set_bit(rows + (size_t)seg * words, rule);
+    }
+}
+
+void build_rule_index(RuleIndex *index, const Program *program) {
+    memset(index, 0, sizeof(*index));
+    int n = 0;
+    for (const Rule *r = program->rules; r; r = r->next) n++;
+    if (n < GATE_MIN_RULES || n > UINT16_MAX + 1) return;
+
+    int words = (n + 63) / 64;
+    ValueSet *sets = (ValueSet*)gate_alloc((size_t)n, sizeof(ValueSet));
+    uint8_t *gated = (uint8_t*)gate_alloc((size_t)n, 1);
+    GateField fields[VAR_COUNT];
+    int field_count = 0, break_count = 0, row_count = 0;
+    double *breaks = NULL, *ends = NULL;
+    uint64_t *rows = NULL;
+
+    for (int var = 0; var < VAR_COUNT; ++var) {
+        int p = 0, constrained = 0, m = 0;
+        for (const Rule *r = program->rules; r; r = r->next, ++p) {
+            sets[p] = gate_field(r->condition, (VarId)var, 0);
+            if (!sets[p].any) constrained++;
+        }
+        if (constrained == 0) continue;
+
+        /* breakpoints: every finite interval end, sorted and distinct */
+        ends = (double*)realloc(ends, (size_t)n * SET_INTERVALS * 2 * sizeof(double));
+        if (!ends) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        for (p = 0; p < n; ++p) {
+            for (int i = 0; i < sets[p].count; ++i) {
+                if (isfinite(sets[p].iv[i].lo)) ends[m++] = sets[p].iv[i].lo;
+                if (isfinite(sets[p].iv[i].hi)) ends[m++] = sets[p].iv[i].hi;
+            }
+        }
+        qsort(ends, (size_t)m, sizeof(double), compare_doubles);
+        int distinct = 0;
+        for (int i = 0; i < m; ++i) {
+            if (distinct == 0 || ends[i] != ends[distinct - 1]) ends[distinct++] = ends[i];
+        }
+        m = distinct;
+        if (m > GATE_BREAKS_MAX || (size_t)(2 * m + 2) * (size_t)words > GATE_WORDS_MAX) continue;
+
+        breaks = (double*)realloc(breaks, (size_t)(break_count + m + 1) * sizeof(double));
+        rows = (uint64_t*)realloc(rows, (size_t)(row_count + 2 * m + 2) * (size_t)words * sizeof(uint64_t));
+        if (!breaks || !rows) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        memcpy(breaks + break_count, ends, (size_t)m * sizeof(double));
+        uint64_t *field_rows = rows + (size_t)row_count * words;
+        memset(field_rows, 0, (size_t)(2 * m + 2) * (size_t)words * sizeof(uint64_t));
+        for (p = 0; p < n; ++p) {
+            fill_rows(field_rows, words, breaks + break_count, m, &sets[p], p);
+            if (!sets[p].any) gated[p] = 1;
+        }
+        fields[field_count].var = var;
+        fields[field_count].first = break_count;
+        fields[field_count].count = m;
+        fields[field_count].row = row_count;
+        field_count++;
+        break_count += m;
+        row_count += 2 * m + 2;
+    }
+
+    int gated_rules = 0;
+    for (int p = 0; p < n; ++p) gated_rules += gated[p];
+    free(sets);
+    free(gated);
+    free(ends);
+    if (gated_rules < GATE_MIN_RULES) {
+        free(breaks);
+        free(rows);
+        return;
+    }
+    index->rule_count = n;
+    index->words = words;
+    index->entries = (int32_t*)gate_alloc((size_t)n, sizeof(int32_t));
+    index->fields = (GateField*)gate_alloc((size_t)field_count, sizeof(GateField));
+    memcpy(index->fields, fields, (size_t)field_count * sizeof(GateField));
+    index->field_count = field_count;
+    index->breaks = breaks;
+    index->break_count = break_count;
+    index->rows = rows;
+    index->row_count = row_count;
+}
+
+void free_rule_index(RuleIndex *index) {
+    free(index->entries);
+    free(index->fields);
+    free(index->breaks);
+    free(index->rows);
+    memset(index, 0, sizeof(*index));
+}
+
+/* Structure only: decode_chunk checks the entries against the code */
+const char *check_rule_index(const RuleIndex *index) {
+    if (index->rule_count < 1 || index->rule_count > UINT16_MAX + 1) return "bad rule count";
+    if (index->words != (index->rule_count + 63) / 64) return "bad rule index width";
+    if (index->field_count < 1 || index->field_count > VAR_COUNT) return "bad rule index fields";
+    uint32_t seen = 0;
+    int32_t first = 0, row = 0;
+    for (int f = 0; f < index->field_count; ++f) {
+        const GateField *g = &index->fields[f];
+        if (g->var < 0 || g->var >= VAR_COUNT || (seen & (1u << g->var)))
+            return "bad rule index field";
+        seen |= 1u << g->var;
+        if (g->first != first || g->row != row || g->count < 0 || g->count > GATE_BREAKS_MAX)
+            return "bad rule index field";
+        for (int i = 0; i < g->count; ++i) {
+            double b = index->breaks[first + i];
+            if (!isfinite(b) || (i > 0 && !(b > index->breaks[first + i - 1])))
+                return "rule index breakpoints not ascending";
+        }
+        first += g->count;
+        row += 2 * g->count + 2;
+    }
+    if (first != index->break_count || row != index->row_count) return "bad rule index size";
+    /* no bits past the last rule, so no candidate is out of range */
+    int tail = index->rule_count & 63;
+    if (tail) {
+        uint64_t spare = ~(((uint64_t)1 << tail) - 1);
+        for (int r = 0; r < index->row_count; ++r) {
+            if (index->rows[(size_t)r * index->words + index->words - 1] & spare)
+                return "rule index bit out of range";
+        }
+    }
+    return NULL;
+}
+
+/* ---------- Lookup ---------- */
+
+static int lowest_bit(uint64_t bits) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int n = 0;
+    while (!(bits & 1)) { bits >>= 1; n++; }
+    return n;
+#endif
+}
+
+static double context_field(const VMContext *ctx, int var) {
+    switch (var) {
+        case VAR_OPEN:    return ctx->open;
+        case VAR_HIGH:    return ctx->high;
+        case VAR_LOW:     return ctx->low;
+        case VAR_CLOSE:   return ctx->close;
+        case VAR_VOLUME:  return ctx->volume;
+        case VAR_DATE:    return (double)ctx->date;
+        case VAR_TIME:    return (double)ctx->time;
+        case VAR_HOUR:    return (double)ctx->hour;
+        case VAR_MINUTE:  return (double)ctx->minute;
+        default:          return (double)ctx->weekday;
+    }
+}
+
+static double column_field(const BarColumns *bars, int var, size_t i) {
+    switch (var) {
+        case VAR_OPEN:    return bars->open[i];
+        case VAR_HIGH:    return bars->high[i];
+        case VAR_LOW:     return bars->low[i];
+        case VAR_CLOSE:   return bars->close[i];
+        case VAR_VOLUME:  return bars->volume[i];
+        case VAR_DATE:    return (double)bars->date[i];
+        case VAR_TIME:    return (double)bars->time[i];
+        case VAR_HOUR:    return (double)bars->hour[i];
+        case VAR_MINUTE:  return (double)bars->minute[i];
+        default:          return (double)bars->weekday[i];
+    }
+}
+
+static const uint64_t *field_row(const RuleIndex *index, const GateField *g, double x) {
+    int seg = segment_of(index->breaks + g->first, g->count, x);
+    return index->rows + (size_t)(g->row + seg) * index->words;
+}
+
+int rule_candidates(const RuleIndex *index, const VMContext *ctx, int32_t *out) {
+    const uint64_t *row[VAR_COUNT];
+    int fields = index->field_count, n = 0;
+    for (int f = 0; f < fields; ++f)
+        row[f] = field_row(index, &index->fields[f], context_field(ctx, index->fields[f].var));
+    for (int w = 0; w < index->words; ++w) {
+        uint64_t bits = row[0][w];
+        for (int f = 1; f < fields && bits; ++f) bits &= row[f][w];
+        while (bits) {
+            out[n++] = w * 64 + lowest_bit(bits);
+            bits &= bits - 1;
+        }
+    }
+    return n;
+}
+
+void block_candidates(const RuleIndex *index, const BarColumns *bars, size_t base, int n,
+                      uint64_t *bits) {
+    const uint64_t *row[VAR_COUNT], *prev[VAR_COUNT];
+    int fields = index->field_count;
+    memset(bits, 0, (size_t)index->words * sizeof(uint64_t));
+    for (int l = 0; l < n; ++l) {
+        int same = l > 0;
+        for (int f = 0; f < fields; ++f) {
+            row[f] = field_row(index, &index->fields[f], column_field(bars, index->fields[f].var, base + (size_t)l));
+            same = same && row[f] == prev[f];
+            prev[f] = row[f];
+        }
+        if (same) continue;   // consecutive bars mostly share their segments
+        for (int w = 0; w < index->words; ++w) {
+            uint64_t b = row[0][w];
+            for (int f = 1; f < fields && b; ++f) b &= row[f][w];
+            bits[w] |= b;
+        }
+    }
+}
@@ -0,0 +1,745 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "ast.h"
+
+/* ---------- x86-64 JIT ----------
+ *
+ * Translates a chunk's bytecode into one native function per chunk:
+ *
+ *   void fn(const VMContext *ctx, IndicatorState *ind, const SignalSink *sink)
+ *
+ * The operand stack is resolved at compile time: stack entry i lives in
+ * xmm<i> (xmm0..xmm13; xmm14/xmm15 are scratch), so pushes and pops cost
+ * nothing and every opcode is one or two SSE instructions. All jumps are
+ * forward and the stack depth at each one is known, so they become plain
+ * conditional branches. Temps and register spills live in the native
+ * frame, cached values in IndicatorState; indicator updates, JUMP_IF_SAME
+ * (same_period) and BUY/SELL (send_signal) call back into C.
+ *
+ * With a rule index, RULE_INDEX calls rule_candidates and keeps a cursor
+ * into ind->candidates in the frame; it and every NEXT_RULE go to one stub
+ * that takes the next candidate and jumps to its rule through a table of
+ * native offsets placed after the code. The generated code reads the
+ * index through the chunk, so the chunk must outlive it.
+ *
+ * Comparisons follow C semantics exactly (ucomisd plus the parity flag
+ * for NaN), so jit_run produces bit-for-bit the same signals and
+ * indicator state as run_chunk. A chunk needing more than 14 stack
+ * registers, or containing an opcode this file does not know, is not
+ * compiled and the caller keeps using the interpreter.
+ */
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__FreeBSD__))
+
+#include <sys/mman.h>
+
+typedef void (*JitFn)(const VMContext *ctx, IndicatorState *ind, const SignalSink *sink);
+
+struct JitCode {
+    void *mem;
+    size_t size;
+    JitFn fn;
+};
+
+#define STACK_REGS 14     // xmm0..xmm13 hold the operand stack
+#define SCRATCH_A  14
+#define SCRATCH_B  15
+#define TEMP_SLOTS 256    // matches the compiler's temp limit
+
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+       R12 = 12, R13 = 13, R14 = 14 };
+
+/* condition codes for Jcc / SETcc */
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+       CC_P = 0xA, CC_NP = 0xB };
+
+typedef struct {
+    int at;          // offset of the rel32 in the native buffer
+    int target;      // bytecode offset it jumps to
+} Fixup;
+
+typedef struct {
+    uint8_t *buf;
+    int len;
+    int cap;
+    Fixup *fixups;
+    int fixup_count;
+    int fixup_cap;
+    int frame;       // bytes below the saved registers
+    int spill_base;  // frame offset of the register spill area
+    int cursor;      // frame offset of the next and end candidate pointers
+    int stub;        // native offset of the next-candidate stub, -1 if none
+    int table_at;    // offset of its rel32 to the rule table
+} Emitter;
+
+static void emit8(Emitter *e, uint8_t b) {
+    if (e->len == e->cap) {
+        e->cap = e->cap ? e->cap * 2 : 1024;
+        e->buf = (uint8_t*)realloc(e->buf, (size_t)e->cap);
+        if (!e->buf) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    }
+    e->buf[e->len++] = b;
+}
+
+static void emit32(Emitter *e, uint32_t v) {
+    for (int i = 0; i < 4; ++i) emit8(e, (uint8_t)(v >> (i * 8)));
+}
+
+static void emit64(Emitter *e, uint64_t v) {
+    for (int i = 0; i < 8; ++i) emit8(e, (uint8_t)(v >> (i * 8)));
+}
+
+static void emit_rex(Emitter *e, int w, int reg, int base) {
+    uint8_t rex = (uint8_t)(0x40 | (w << 3) | ((reg >> 3) << 2) | (base >> 3));
+    if (rex != 0x40) emit8(e, rex);
+}
+
+/* ModRM with a disp32 off a GPR; rsp/r12 bases need a SIB byte */
+static void emit_mem(Emitter *e, int reg, int base, int32_t disp) {
+    emit8(e, (uint8_t)(0x80 | ((reg & 7) << 3) | (base & 7)));
+    if ((base & 7) == RSP) emit8(e, 0x24);
+    emit32(e, (uint32_t)disp);
+}
+
+/* prefix 0F op  xmm, xmm */
+static void sse_rr(Emitter *e, uint8_t prefix, uint8_t op, int reg, int rm) {
+    if (prefix) emit8(e, prefix);
+    emit_rex(e, 0, reg, rm);
+    emit8(e, 0x0F);
+    emit8(e, op);
+    emit8(e, (uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+/* prefix 0F op  xmm, [base + disp] */
+static void sse_rm(Emitter *e, uint8_t prefix, uint8_t op, int reg, int base, int32_t disp) {
+    if (prefix) emit8(e, prefix);
+    emit_rex(e, 0, reg, base);
+    emit8(e, 0x0F);
+    emit8(e, op);
+    emit_mem(e, reg, base, disp);
+}
+
+#define MOVSD_LOAD(e, x, base, disp)  sse_rm(e, 0xF2, 0x10, x, base, disp)
+#define MOVSD_STORE(e, x, base, disp) sse_rm(e, 0xF2, 0x11, x, base, disp)
+#define MOVAPD(e, dst, src)           sse_rr(e, 0x66, 0x28, dst, src)
+#define XORPD(e, dst, src)            sse_rr(e, 0x66, 0x57, dst, src)
+#define UCOMISD(e, a, b)              sse_rr(e, 0x66, 0x2E, a, b)
+
+static void mov_rax_imm64(Emitter *e, uint64_t v) {
+    emit8(e, 0x48);
+    emit8(e, 0xB8);
+    emit64(e, v);
+}
+
+static void load_const(Emitter *e, int x, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    if (bits == 0) {
+        XORPD(e, x, x);
+        return;
+    }
+    mov_rax_imm64(e, bits);
+    /* movq xmm, rax */
+    emit8(e, 0x66);
+    emit_rex(e, 1, x, RAX);
+    emit8(e, 0x0F);
+    emit8(e, 0x6E);
+    emit8(e, (uint8_t)(0xC0 | ((x & 7) << 3)));
+}
+
+static void setcc(Emitter *e, int cc, int reg8) {
+    emit8(e, 0x0F);
+    emit8(e, (uint8_t)(0x90 | cc));
+    emit8(e, (uint8_t)(0xC0 | reg8));
+}
+
+/* x = (double)al */
+static void al_to_xmm(Emitter *e, int x) {
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0);   // movzx eax, al
+    XORPD(e, x, x);                                   // break the dependency on x
+    sse_rr(e, 0xF2, 0x2A, x, RAX);                    // cvtsi2sd x, eax
+}
+
+/* al = (a cmp b), NaN compares like C */
+static void compare_to_al(Emitter *e, uint8_t cmp, int a, int b) {
+    switch (cmp) {
+        case BC_GT: UCOMISD(e, a, b); setcc(e, CC_A, RAX); break;
+        case BC_GE: UCOMISD(e, a, b); setcc(e, CC_AE, RAX); break;
+        case BC_LT: UCOMISD(e, b, a); setcc(e, CC_A, RAX); break;
+        case BC_LE: UCOMISD(e, b, a); setcc(e, CC_AE, RAX); break;
+        case BC_EQ:
+            UCOMISD(e, a, b);
+            setcc(e, CC_E, RAX);
+            setcc(e, CC_NP, RCX);
+            emit8(e, 0x20); emit8(e, 0xC8);           // and al, cl
+            break;
+        default:
+            UCOMISD(e, a, b);
+            setcc(e, CC_NE, RAX);
+            setcc(e, CC_P, RCX);
+            emit8(e, 0x08); emit8(e, 0xC8);           // or al, cl
+            break;
+    }
+}
+
+/* al = (x != 0.0); NaN is true */
+static void truth_to_al(Emitter *e, int x) {
+    XORPD(e, SCRATCH_B, SCRATCH_B);
+    UCOMISD(e, x, SCRATCH_B);
+    setcc(e, CC_NE, RAX);
+    setcc(e, CC_P, RCX);
+    emit8(e, 0x08); emit8(e, 0xC8);                   // or al, cl
+}
+
+static void add_fixup(Emitter *e, int target) {
+    if (e->fixup_count == e->fixup_cap) {
+        e->fixup_cap = e->fixup_cap ? e->fixup_cap * 2 : 32;
+        e->fixups = (Fixup*)realloc(e->fixups, (size_t)e->fixup_cap * sizeof(Fixup));
+        if (!e->fixups) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    }
+    e->fixups[e->fixup_count].at = e->len;
+    e->fixups[e->fixup_count].target = target;
+    e->fixup_count++;
+    emit32(e, 0);
+}
+
+static void jcc(Emitter *e, int cc, int target) {
+    emit8(e, 0x0F);
+    emit8(e, (uint8_t)(0x80 | cc));
+    add_fixup(e, target);
+}
+
+static void jmp(Emitter *e, int target) {
+    emit8(e, 0xE9);
+    add_fixup(e, target);
+}
+
+/* Jcc over the 6-byte Jcc rel32 that follows */
+static void skip_next_jcc(Emitter *e, int cc) {
+    emit8(e, (uint8_t)(0x70 | cc));
+    emit8(e, 6);
+}
+
+/* branch to target unless (a cmp b) */
+static void jump_unless(Emitter *e, uint8_t cmp, int a, int b, int target) {
+    switch (cmp) {
+        case BC_GT: UCOMISD(e, a, b); jcc(e, CC_BE, target); break;
+        case BC_GE: UCOMISD(e, a, b); jcc(e, CC_B, target); break;
+        case BC_LT: UCOMISD(e, b, a); jcc(e, CC_BE, target); break;
+        case BC_LE: UCOMISD(e, b, a); jcc(e, CC_B, target); break;
+        case BC_EQ:
+            UCOMISD(e, a, b);
+            jcc(e, CC_P, target);
+            jcc(e, CC_NE, target);
+            break;
+        default:
+            UCOMISD(e, a, b);
+            skip_next_jcc(e, CC_P);
+            jcc(e, CC_E, target);
+            break;
+    }
+}
+
+/* branch to target when x's truth equals `when` */
+static void jump_if(Emitter *e, int x, int when, int target) {
+    XORPD(e, SCRATCH_B, SCRATCH_B);
+    UCOMISD(e, x, SCRATCH_B);
+    if (when) {
+        jcc(e, CC_P, target);
+        jcc(e, CC_NE, target);
+    } else {
+        skip_next_jcc(e, CC_P);
+        jcc(e, CC_E, target);
+    }
+}
+
+static int var_offset(uint8_t id, int *is_int) {
+    *is_int = 1;
+    switch (id) {
+        case VAR_OPEN:    *is_int = 0; return (int)offsetof(VMContext, open);
+        case VAR_HIGH:    *is_int = 0; return (int)offsetof(VMContext, high);
+        case VAR_LOW:     *is_int = 0; return (int)offsetof(VMContext, low);
+        case VAR_CLOSE:   *is_int = 0; return (int)offsetof(VMContext, close);
+        case VAR_VOLUME:  *is_int = 0; return (int)offsetof(VMContext, volume);
+        case VAR_DATE:    return (int)offsetof(VMContext, date);
+        case VAR_TIME:    return (int)offsetof(VMContext, time);
+        case VAR_HOUR:    return (int)offsetof(VMContext, hour);
+        case VAR_MINUTE:  return (int)offsetof(VMContext, minute);
+        case VAR_WEEKDAY: return (int)offsetof(VMContext, weekday);
+        default:          return -1;
+    }
+}
+
+static int load_var(Emitter *e, int x, uint8_t id) {
+    int is_int;
+    int off = var_offset(id, &is_int);
+    if (off < 0) return -1;
+    if (is_int) {
+        XORPD(e, x, x);
+        sse_rm(e, 0xF2, 0x2A, x, RBX, off);           // cvtsi2sd x, dword [rbx + off]
+    } else {
+        MOVSD_LOAD(e, x, RBX, off);
+    }
+    return 0;
+}
+
+static int32_t slot_output(int slot) {
+    return (int32_t)((size_t)slot * sizeof(Indicator) + offsetof(Indicator, output));
+}
+
+/* Calls fn with the live stack registers below `live` saved in the frame */
+static void spill(Emitter *e, int live) {
+    for (int i = 0; i < live; ++i) MOVSD_STORE(e, i, RSP, e->spill_base + 8 * i);
+}
+
+static void unspill(Emitter *e, int live) {
+    for (int i = 0; i < live; ++i) MOVSD_LOAD(e, i, RSP, e->spill_base + 8 * i);
+}
+
+static void call_rax(Emitter *e) {
+    emit8(e, 0xFF);
+    emit8(e, 0xD0);
+}
+
+/* rax = ind->cached */
+static void load_cached_base(Emitter *e) {
+    emit_rex(e, 1, RAX, R14);
+    emit8(e, 0x8B);
+    emit_mem(e, RAX, R14, (int32_t)offsetof(IndicatorState, cached));
+}
+
+static void emit_prologue(Emitter *e) {
+    emit8(e, 0x55);                                   // push rbp
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xE5);   // mov rbp, rsp
+    emit8(e, 0x53);                                   // push rbx
+    emit8(e, 0x41); emit8(e, 0x54);                   // push r12
+    emit8(e, 0x41); emit8(e, 0x55);                   // push r13
+    emit8(e, 0x41); emit8(e, 0x56);                   // push r14
+    emit8(e, 0x48); emit8(e, 0x81); emit8(e, 0xEC);   // sub rsp, frame
+    emit32(e, (uint32_t)e->frame);
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xFB);   // mov rbx, rdi   (ctx)
+    emit8(e, 0x49); emit8(e, 0x89); emit8(e, 0xF6);   // mov r14, rsi   (ind)
+    emit8(e, 0x49); emit8(e, 0x89); emit8(e, 0xD5);   // mov r13, rdx   (sink)
+    emit_rex(e, 1, R12, R14);                         // mov r12, [r14 + slots]
+    emit8(e, 0x8B);
+    emit_mem(e, R12, R14, (int32_t)offsetof(IndicatorState, slots));
+}
+
+static void emit_epilogue(Emitter *e) {
+    emit8(e, 0x48); emit8(e, 0x81); emit8(e, 0xC4);   // add rsp, frame
+    emit32(e, (uint32_t)e->frame);
+    emit8(e, 0x41); emit8(e, 0x5E);                   // pop r14
+    emit8(e, 0x41); emit8(e, 0x5D);                   // pop r13
+    emit8(e, 0x41); emit8(e, 0x5C);                   // pop r12
+    emit8(e, 0x5B);                                   // pop rbx
+    emit8(e, 0x5D);                                   // pop rbp
+    emit8(e, 0xC3);                                   // ret
+}
+
+static uint16_t operand_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static int32_t operand_i32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= (uint32_t)p[i] << (i * 8);
+    return (int32_t)v;
+}
+
+static double operand_double(const uint8_t *p) {
+    double v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* mov reg64, [base + disp] / mov [base + disp], reg64 */
+static void load_q(Emitter *e, int reg, int base, int32_t disp) {
+    emit_rex(e, 1, reg, base);
+    emit8(e, 0x8B);
+    emit_mem(e, reg, base, disp);
+}
+
+static void store_q(Emitter *e, int reg, int base, int32_t disp) {
+    emit_rex(e, 1, reg, base);
+    emit8(e, 0x89);
+    emit_mem(e, reg, base, disp);
+}
+
+/* RULE_INDEX: fills ind->candidates, then falls into the stub that
+ * NEXT_RULE jumps to: past the last candidate go to `end`, else to the
+ * next candidate's rule */
+static void emit_rule_index(Emitter *e, const RuleIndex *index, int end) {
+    int32_t candidates = (int32_t)offsetof(IndicatorState, candidates);
+    emit8(e, 0x48); emit8(e, 0xBF);                   // mov rdi, index
+    emit64(e, (uint64_t)(uintptr_t)index);
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDE);   // mov rsi, rbx   (ctx)
+    load_q(e, RDX, R14, candidates);
+    mov_rax_imm64(e, (uint64_t)(uintptr_t)rule_candidates);
+    call_rax(e);
+    emit8(e, 0x48); emit8(e, 0x63); emit8(e, 0xC0);   // movsxd rax, eax
+    load_q(e, RCX, R14, candidates);
+    emit8(e, 0x48); emit8(e, 0x8D);                   // lea rdx, [rcx + rax*4]
+    emit8(e, 0x14); emit8(e, 0x81);
+    store_q(e, RCX, RSP, e->cursor);
+    store_q(e, RDX, RSP, e->cursor + 8);
+
+    e->stub = e->len;
+    load_q(e, RAX, RSP, e->cursor);
+    emit_rex(e, 1, RAX, RSP);                         // cmp rax, end
+    emit8(e, 0x3B);
+    emit_mem(e, RAX, RSP, e->cursor + 8);
+    jcc(e, CC_AE, end);
+    emit8(e, 0x48); emit8(e, 0x63); emit8(e, 0x08);   // movsxd rcx, dword [rax]
+    emit8(e, 0x48); emit8(e, 0x83);                   // add rax, 4
+    emit8(e, 0xC0); emit8(e, 0x04);
+    store_q(e, RAX, RSP, e->cursor);
+    emit8(e, 0x48); emit8(e, 0x8D); emit8(e, 0x15);   // lea rdx, [rip + table]
+    e->table_at = e->len;
+    emit32(e, 0);
+    emit8(e, 0x48); emit8(e, 0x63);                   // movsxd rax, dword [rdx + rcx*4]
+    emit8(e, 0x04); emit8(e, 0x8A);
+    emit8(e, 0x48); emit8(e, 0x01); emit8(e, 0xD0);   // add rax, rdx
+    emit8(e, 0xFF); emit8(e, 0xE0);                   // jmp rax
+}
+
+/* Records the stack depth a jump arrives with; every way into an
+ * offset must agree */
+static int note_depth(int *depth_at, int target, int depth) {
+    if (depth_at[target] >= 0 && depth_at[target] != depth) return -1;
+    depth_at[target] = depth;
+    return 0;
+}
+
+/* Emits the body; returns -1 on anything it cannot translate */
+static int translate(Emitter *e, const Chunk *chunk, int *native_at, int *depth_at) {
+    const uint8_t *code = chunk->code;
+    int depth = 0, reachable = 1;
+
+    for (int offset = 0; offset < chunk->count; ) {
+        if (depth_at[offset] >= 0) {
+            if (reachable && depth_at[offset] != depth) return -1;
+            depth = depth_at[offset];
+        } else if (!reachable) {
+            depth = 0;
+        }
+        reachable = 1;
+        native_at[offset] = e->len;
+
+        const uint8_t *p = code + offset;
+        int len = instruction_length(chunk, offset);
+        int next = offset + len;
+        int top = depth - 1;      // register of the stack top
+        switch ((OpCode)p[0]) {
+            case BC_HALT:
+                emit_epilogue(e);
+                reachable = 0;
+                break;
+
+            case BC_PUSH_CONST:
+                if (depth >= STACK_REGS) return -1;
+                load_const(e, depth++, operand_double(p + 1));
+                break;
+
+            case BC_LOAD_VAR:
+                if (depth >= STACK_REGS || load_var(e, depth++, p[1]) != 0) return -1;
+                break;
+
+            case BC_IND_UPDATE: {
+                IndicatorUpdate fn = indicator_function(p[1]);
+                uint16_t slot = operand_u16(p + 2);
+                if (!fn || depth < 1) return -1;
+                spill(e, top);
+                if (top != 0) MOVAPD(e, 0, top);
+                /* lea rdi, [r12 + slot * sizeof(Indicator)] */
+                emit8(e, 0x49); emit8(e, 0x8D);
+                emit_mem(e, RDI, R12, (int32_t)((size_t)slot * sizeof(Indicator)));
+                mov_rax_imm64(e, (uint64_t)(uintptr_t)fn);
+                call_rax(e);
+                MOVSD_STORE(e, 0, R12, slot_output(slot));
+                unspill(e, top);
+                depth--;
+                break;
+            }
+
+            case BC_LOAD_IND:
+                if (depth >= STACK_REGS) return -1;
+                MOVSD_LOAD(e, depth++, R12, slot_output(operand_u16(p + 1)));
+                break;
+
+            case BC_CMP_IND:
+                if (depth < 1) return -1;
+                MOVSD_LOAD(e, SCRATCH_B, R12, slot_output(operand_u16(p + 1)));
+                compare_to_al(e, p[3], top, SCRATCH_B);
+                al_to_xmm(e, top);
+                break;
+
+            case BC_STORE_TEMP:
+            case BC_LOAD_TEMP: {
+                uint16_t t = operand_u16(p + 1);
+                if (t >= TEMP_SLOTS) return -1;
+                if (p[0] == BC_STORE_TEMP) {
+                    if (depth < 1) return -1;
+                    MOVSD_STORE(e, top, RSP, 8 * t);
+                    depth--;
+                } else {
+                    if (depth >= STACK_REGS) return -1;
+                    MOVSD_LOAD(e, depth++, RSP, 8 * t);
+                }
+                break;
+            }
+
+            case BC_STORE_CACHED:
+                if (depth < 1) return -1;
+                load_cached_base(e);
+                MOVSD_STORE(e, top, RAX, 8 * operand_u16(p + 1));
+                depth--;
+                break;
+
+            case BC_LOAD_CACHED:
+                if (depth >= STACK_REGS) return -1;
+                load_cached_base(e);
+                MOVSD_LOAD(e, depth++, RAX, 8 * operand_u16(p + 1));
+                break;
+
+            case BC_LOAD_PARAM:
+                if (depth >= STACK_REGS) return -1;
+                load_q(e, RAX, R14, (int32_t)offsetof(IndicatorState, params));
+                MOVSD_LOAD(e, depth++, RAX, 8 * operand_u16(p + 1));
+                break;
+
+            case BC_ADD:
+            case BC_SUB:
+            case BC_MUL:
+            case BC_DIV: {
+                static const uint8_t ops[] = { 0x58, 0x5C, 0x59, 0x5E };
+                if (depth < 2) return -1;
+                sse_rr(e, 0xF2, ops[p[0] - BC_ADD], top - 1, top);
+                depth--;
+                break;
+            }
+
+            case BC_GT:
+            case BC_LT:
+            case BC_GE:
+            case BC_LE:
+            case BC_EQ:
+            case BC_NE:
+                if (depth < 2) return -1;
+                compare_to_al(e, p[0], top - 1, top);
+                al_to_xmm(e, top - 1);
+                depth--;
+                break;
+
+            case BC_AND:
+            case BC_OR:
+                if (depth < 2) return -1;
+                truth_to_al(e, top - 1);
+                emit8(e, 0x88); emit8(e, 0xC2);           // mov dl, al
+                truth_to_al(e, top);
+                emit8(e, p[0] == BC_AND ? 0x20 : 0x08);   // and/or al, dl
+                emit8(e, 0xD0);
+                al_to_xmm(e, top - 1);
+                depth--;
+                break;
+
+            case BC_NEG:
+                if (depth < 1) return -1;
+                load_const(e, SCRATCH_B, -0.0);
+                XORPD(e, top, SCRATCH_B);
+                break;
+
+            case BC_NOT:
+                if (depth < 1) return -1;
+                truth_to_al(e, top);
+                emit8(e, 0x34); emit8(e, 0x01);           // xor al, 1
+                al_to_xmm(e, top);
+                break;
+
+            case BC_CMP_VAR_CONST:
+                if (depth >= STACK_REGS || load_var(e, depth, p[1]) != 0) return -1;
+                load_const(e, SCRATCH_B, operand_double(p + 3));
+                compare_to_al(e, p[2], depth, SCRATCH_B);
+                al_to_xmm(e, depth);
+                depth++;
+                break;
+
+            case BC_JUMP_IF_FALSE:
+            case BC_JUMP_IF_TRUE:
+            case BC_JUMP:
+            case BC_JUMP_IF_NOT_CMP:
+            case BC_JUMP_IF_NOT_VAR_CONST:
+            case BC_JUMP_IF_SAME:
+            case BC_JUMP_IF_NOT_CACHED: {
+                int32_t rel = operand_i32(p + len - 4);
+                int target = next + rel;
+                if (rel < 0 || target >= chunk->count) return -1;
+                if (p[0] == BC_JUMP) {
+                    jmp(e, target);
+                    reachable = 0;
+                } else if (p[0] == BC_JUMP_IF_NOT_VAR_CONST) {
+                    if (load_var(e, SCRATCH_A, p[1]) != 0) return -1;
+                    load_const(e, SCRATCH_B, operand_double(p + 3));
+                    jump_unless(e, p[2], SCRATCH_A, SCRATCH_B, target);
+                } else if (p[0] == BC_JUMP_IF_SAME) {
+                    spill(e, depth);
+                    emit8(e, 0x4C); emit8(e, 0x89); emit8(e, 0xF7);   // mov rdi, r14   (ind)
+                    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDE);   // mov rsi, rbx   (ctx)
+                    emit8(e, 0xBA); emit32(e, (uint32_t)p[1]);         // mov edx, freq
+                    mov_rax_imm64(e, (uint64_t)(uintptr_t)same_period);
+                    call_rax(e);
+                    unspill(e, depth);
+                    emit8(e, 0x85); emit8(e, 0xC0);                    // test eax, eax
+                    jcc(e, CC_NE, target);
+                } else if (p[0] == BC_JUMP_IF_NOT_CACHED) {
+                    load_cached_base(e);
+                    MOVSD_LOAD(e, SCRATCH_A, RAX, 8 * operand_u16(p + 1));
+                    jump_if(e, SCRATCH_A, 0, target);
+                } else if (p[0] == BC_JUMP_IF_NOT_CMP) {
+                    if (depth < 2) return -1;
+                    jump_unless(e, p[1], top - 1, top, target);
+                    depth -= 2;
+                } else {
+                    if (depth < 1) return -1;
+                    jump_if(e, top, p[0] == BC_JUMP_IF_TRUE, target);
+                    depth--;
+                }
+                if (note_depth(depth_at, target, depth) != 0) return -1;
+                break;
+            }
+
+            case BC_RULE_INDEX:
+            case BC_NEXT_RULE: {
+                int32_t rel = operand_i32(p + 1);
+                int target = next + rel;
+                if (rel < 0 || target >= chunk->count || depth != 0) return -1;
+                if (p[0] == BC_RULE_INDEX) {
+                    if (chunk->gates.rule_count == 0 || e->stub >= 0) return -1;
+                    emit_rule_index(e, &chunk->gates, target);
+                } else {
+                    if (e->stub < 0) return -1;
+                    emit8(e, 0xE9);                               // jmp stub
+                    emit32(e, (uint32_t)(e->stub - (e->len + 4)));
+                }
+                if (note_depth(depth_at, target, 0) != 0) return -1;
+                reachable = 0;
+                break;
+            }
+
+            case BC_BUY:
+            case BC_SELL:
+                spill(e, depth);
+                emit8(e, 0x4C); emit8(e, 0x89); emit8(e, 0xEF);   // mov rdi, r13   (sink)
+                emit8(e, 0x4C); emit8(e, 0x89); emit8(e, 0xF6);   // mov rsi, r14   (ind)
+                emit8(e, 0xBA); emit32(e, (uint32_t)p[0]);         // mov edx, side
+                emit8(e, 0xB9); emit32(e, (uint32_t)operand_i32(p + 1));   // mov ecx, qty
+                emit8(e, 0x41); emit8(e, 0xB8);                    // mov r8d, rule
+                emit32(e, (uint32_t)operand_u16(p + 5));
+                mov_rax_imm64(e, (uint64_t)(uintptr_t)send_signal);
+                call_rax(e);
+                unspill(e, depth);
+                break;
+
+            default:
+                return -1;
+        }
+        offset = next;
+    }
+    return reachable ? -1 : 0;   // must end in HALT
+}
+
+JitCode *jit_compile(const Chunk *chunk) {
+    if (!chunk->code || chunk->count == 0) return NULL;
+
+    Emitter e;
+    memset(&e, 0, sizeof(e));
+    /* frame: temps, spill slots, then the candidate cursor; a multiple of
+     * 16 keeps calls aligned */
+    e.spill_base = 8 * TEMP_SLOTS;
+    e.cursor = e.spill_base + 8 * STACK_REGS;
+    e.frame = e.cursor + 16;
+    e.frame = (e.frame + 15) & ~15;
+    e.stub = e.table_at = -1;
+
+    int *native_at = (int*)malloc((size_t)chunk->count * sizeof(int));
+    int *depth_at = (int*)malloc((size_t)chunk->count * sizeof(int));
+    if (!native_at || !depth_at) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    for (int i = 0; i < chunk->count; ++i) depth_at[i] = -1;
+
+    emit_prologue(&e);
+    int ok = translate(&e, chunk, native_at, depth_at) == 0;
+    if (ok) {
+        for (int i = 0; i < e.fixup_count; ++i) {
+            int at = e.fixups[i].at;
+            int32_t rel = (int32_t)(native_at[e.fixups[i].target] - (at + 4));
+            memcpy(e.buf + at, &rel, 4);
+        }
+    }
+    if (ok && e.stub >= 0) {
+        /* rule table: each rule's native offset from the table */
+        while (e.len % 4) emit8(&e, 0xCC);
+        int table = e.len;
+        int32_t rel = (int32_t)(table - (e.table_at + 4));
+        memcpy(e.buf + e.table_at, &rel, 4);
+        for (int i = 0; i < chunk->gates.rule_count; ++i)
+            emit32(&e, (uint32_t)(native_at[chunk->gates.entries[i]] - table));
+    }
+    free(native_at);
+    free(depth_at);
+    free(e.fixups);
+    if (!ok) {
+        free(e.buf);
+        return NULL;
+    }
+
+    /* W^X: written while RW, then flipped to RX */
+    size_t size = (size_t)e.len;
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        free(e.buf);
+        return NULL;
+    }
+    memcpy(mem, e.buf, size);
+    free(e.buf);
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return NULL;
+    }
+
+    JitCode *jit = (JitCode*)malloc(sizeof(JitCode));
+    if (!jit) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    jit->mem = mem;
+    jit->size = size;
+    *(void **)&jit->fn = mem;
+    return jit;
+}
+
+void jit_run(const JitCode *jit, IndicatorState *ind, const VMContext *ctx, const SignalSink *sink) {
+    jit->fn(ctx, ind, sink);
+    ind->bars++;
+}
+
+void jit_free(JitCode *jit) {
+    if (!jit) return;
+    munmap(jit->mem, jit->size);
+    free(jit);
+}
+
+#else /* no JIT for this target */
+
+JitCode *jit_compile(const Chunk *chunk) {
+    (void)chunk;
+    return NULL;
+}
+
+void jit_run(const JitCode *jit, IndicatorState *ind, const VMContext *ctx, const SignalSink *sink) {
+    (void)jit; (void)ind; (void)ctx; (void)sink;
+}
+
+void jit_free(JitCode *jit) {
+    (void)jit;
+}
+
+#endif
@@ -1,18 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include "ast.h"
 
-static const char *src;
-static const char *start;
-static const char *current;
+/* All scanning state lives in the caller's Lexer, so any number of
+ * sources can be tokenized concurrently. Tokens are slices of the source
+ * buffer; nothing is copied or allocated while scanning. */
 
-static void skip_whitespace(void) {
+static void skip_whitespace(Lexer *lx) {
     for (;;) {
-        char c = *current;
-        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
-            current++;
+        char c = *lx->current;
+        if (c == '\n') {
+            lx->current++;
+            lx->line++;
+            lx->line_start = lx->current;
+        } else if (c == ' ' || c == '\t' || c == '\r') {
+            lx->current++;
         } else {
             break;
         }
@@ -29,132 +32,192 @@ static int is_digit(char c) {
     return (c >= '0' && c <= '9');
 }
 
-static Token make_token(TokenType type) {
+static Token make_token(Lexer *lx, TokenType type) {
     Token t;
     t.type = type;
-    size_t len = current - start;
-    char *s = (char*)malloc(len + 1);
-    memcpy(s, start, len);
-    s[len] = '\0';
-    t.lexeme = s;
+    t.start = lx->start;
+    t.length = (int)(lx->current - lx->start);
     t.number = 0.0;
+    t.line = lx->start_line;
+    t.column = lx->start_column;
     return t;
 }
 
-static Token error_token(const char *msg) {
+static Token error_token(Lexer *lx, const char *msg) {
     Token t;
     t.type = TOK_ERROR;
-    size_t len = strlen(msg);
-    char *s = (char*)malloc(len + 1);
-    memcpy(s, msg, len + 1);
-    t.lexeme = s;
+    t.start = msg;
+    t.length = (int)strlen(msg);
     t.number = 0.0;
+    t.line = lx->start_line;
+    t.column = lx->start_column;
     return t;
 }
 
-void init_lexer(const char *source) {
-    src = source;
-    start = src;
-    current = src;
+void init_lexer(Lexer *lx, const char *source) {
+    lx->src = source;
+    lx->start = source;
+    lx->current = source;
+    lx->line = 1;
+    lx->line_start = source;
+    lx->start_line = 1;
+    lx->start_column = 1;
 }
 
-static int match(char expected) {
-    if (*current == expected) {
-        current++;
+static int match(Lexer *lx, char expected) {
+    if (*lx->current == expected) {
+        lx->current++;
         return 1;
     }
     return 0;
 }
 
-static Token string_token(void) {
-    while (*current && *current != '"') {
-        current++;
+/* The token covers the text between the quotes */
+static Token string_token(Lexer *lx) {
+    while (*lx->current && *lx->current != '"') {
+        if (*lx->current == '\n') {
+            lx->line++;
+            lx->line_start = lx->current + 1;
+        }
+        lx->current++;
     }
-    if (!*current) {
-        return error_token("Unterminated string");
+    if (!*lx->current) {
+        return error_token(lx, "Unterminated string");
     }
+    Token t = make_token(lx, TOK_STRING);
+    t.start++; // opening "
+    t.length--;
     // consume closing "
-    current++;
-    return make_token(TOK_STRING);
+    lx->current++;
+    return t;
+}
+
+/* Converts digits[.digits] in place. With at most 15 significant digits
+ * both the digit string and the power of ten are exact doubles, so a single
+ * division is correctly rounded; longer literals go through strtod. */
+static double scan_number(const char *s, int len) {
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    uint64_t mantissa = 0;
+    int significant = 0, fraction = 0, after_dot = 0;
+    for (int i = 0; i < len; ++i) {
+        char c = s[i];
+        if (c == '.') { after_dot = 1; continue; }
+        if (mantissa == 0 && c == '0') {
+            if (after_dot) fraction++;
+            continue;
+        }
+        mantissa = mantissa * 10 + (uint64_t)(c - '0');
+        significant++;
+        if (after_dot) fraction++;
+        if (significant > 15) break;
+    }
+    if (significant <= 15 && fraction <= 22) {
+        return (double)mantissa / pow10[fraction];
+    }
+
+    char buf[64];
+    char *copy = len < (int)sizeof(buf) ? buf : (char*)malloc((size_t)len + 1);
+    if (!copy) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    memcpy(copy, s, (size_t)len);
+    copy[len] = '\0';
+    double v = strtod(copy, NULL);
+    if (copy != buf) free(copy);
+    return v;
 }
 
-static Token number_token(void) {
-    while (is_digit(*current)) current++;
-    if (*current == '.') {
-        current++;
-        while (is_digit(*current)) current++;
+static Token number_token(Lexer *lx) {
+    while (is_digit(*lx->current)) lx->current++;
+    if (*lx->current == '.') {
+        lx->current++;
+        while (is_digit(*lx->current)) lx->current++;
     }
-    Token t = make_token(TOK_NUMBER);
-    t.number = atof(t.lexeme);
+    Token t = make_token(lx, TOK_NUMBER);
+    t.number = scan_number(t.start, t.length);
     return t;
 }
 
-static TokenType identifier_type(const char *text) {
-    if (strcmp(text, "symbol") == 0) return TOK_SYMBOL;
-    if (strcmp(text, "if") == 0)     return TOK_IF;
-    if (strcmp(text, "then") == 0)   return TOK_THEN;
-    if (strcmp(text, "end") == 0)    return TOK_END;
-    if (strcmp(text, "buy") == 0)    return TOK_BUY;
-    if (strcmp(text, "sell") == 0)   return TOK_SELL;
-    if (strcmp(text, "and") == 0)    return TOK_AND;
-    if (strcmp(text, "or") == 0)     return TOK_OR;
-    if (strcmp(text, "not") == 0)    return TOK_NOT;
+static TokenType check_keyword(const Token *t, const char *kw, int len, TokenType type) {
+    if (t->length == len && memcmp(t->start, kw, (size_t)len) == 0) return type;
     return TOK_IDENT;
 }
 
-static Token identifier_token(void) {
-    while (is_alpha(*current) || is_digit(*current)) current++;
-    Token t = make_token(TOK_IDENT);
-    TokenType kw = identifier_type(t.lexeme);
-    t.type = kw;
+/* Dispatch on the first character, then at most one memcmp */
+static TokenType identifier_type(const Token *t) {
+    switch (t->start[0]) {
+        case 'a': return check_keyword(t, "and", 3, TOK_AND);
+        case 'b': return check_keyword(t, "buy", 3, TOK_BUY);
+        case 'e': return check_keyword(t, "end", 3, TOK_END);
+        case 'i': return check_keyword(t, "if", 2, TOK_IF);
+        case 'n': return check_keyword(t, "not", 3, TOK_NOT);
+        case 'o':
+            if (t->length == 2 && t->start[1] == 'n') return TOK_ON;
+            return check_keyword(t, "or", 2, TOK_OR);
+        case 'p': return check_keyword(t, "param", 5, TOK_PARAM);
+        case 's':
+            if (t->length == 6) return check_keyword(t, "symbol", 6, TOK_SYMBOL);
+            return check_keyword(t, "sell", 4, TOK_SELL);
+        case 't': return check_keyword(t, "then", 4, TOK_THEN);
+        default:  return TOK_IDENT;
+    }
+}
+
+static Token identifier_token(Lexer *lx) {
+    while (is_alpha(*lx->current) || is_digit(*lx->current)) lx->current++;
+    Token t = make_token(lx, TOK_IDENT);
+    t.type = identifier_type(&t);
     return t;
 }
 
-Token next_token(void) {
-    skip_whitespace();
-    start = current;
+Token next_token(Lexer *lx) {
+    skip_whitespace(lx);
+    lx->start = lx->current;
+    lx->start_line = lx->line;
+    lx->start_column = (int)(lx->start - lx->line_start) + 1;
 
-    if (*current == '\0') {
-        Token t = make_token(TOK_EOF);
+    if (*lx->current == '\0') {
+        Token t = make_token(lx, TOK_EOF);
         return t;
     }
 
-    char c = *current++;
+    char c = *lx->current++;
     switch (c) {
-        case '+': return make_token(TOK_PLUS);
-        case '-': return make_token(TOK_MINUS);
-        case '*': return make_token(TOK_STAR);
-        case '/': return make_token(TOK_SLASH);
-        case '(': return make_token(TOK_LPAREN);
-        case ')': return make_token(TOK_RPAREN);
-        case ',': return make_token(TOK_COMMA);
+        case '+': return make_token(lx, TOK_PLUS);
+        case '-': return make_token(lx, TOK_MINUS);
+        case '*': return make_token(lx, TOK_STAR);
+        case '/': return make_token(lx, TOK_SLASH);
+        case '(': return make_token(lx, TOK_LPAREN);
+        case ')': return make_token(lx, TOK_RPAREN);
+        case ',': return make_token(lx, TOK_COMMA);
         case '>':
-            if (match('=')) return make_token(TOK_GE);
-            return make_token(TOK_GT);
+            if (match(lx, '=')) return make_token(lx, TOK_GE);
+            return make_token(lx, TOK_GT);
         case '<':
-            if (match('=')) return make_token(TOK_LE);
-            return make_token(TOK_LT);
+            if (match(lx, '=')) return make_token(lx, TOK_LE);
+            return make_token(lx, TOK_LT);
         case '=':
-            if (match('=')) return make_token(TOK_EQ);
-            break;
+            if (match(lx, '=')) return make_token(lx, TOK_EQ);
+            return make_token(lx, TOK_ASSIGN);
         case '!':
-            if (match('=')) return make_token(TOK_NE);
+            if (match(lx, '=')) return make_token(lx, TOK_NE);
             break;
         case '"':
-            return string_token();
+            return string_token(lx);
         default:
             break;
     }
 
     if (is_digit(c)) {
-        current--; // step back, number_token will handle
-        return number_token();
+        lx->current--; // step back, number_token will handle
+        return number_token(lx);
     }
 
     if (is_alpha(c)) {
-        current--;
-        return identifier_token();
+        lx->current--;
+        return identifier_token(lx);
     }
 
-    return error_token("Unexpected character");
+    return error_token(lx, "Unexpected character");
 }
@@ -1,7 +1,17 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 #include "ast.h"
 
+static int has_suffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
 static char *read_file(const char *path) {
     FILE *f = fopen(path, "rb");
     if (!f) { perror("fopen"); exit(1); }
@@ -16,35 +26,499 @@ static char *read_file(const char *path) {
     return buf;
 }
 
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [--dump-bytecode] [--jit] [--cache dir] program.tl|program.tlcb\n"
+            "       %s [--threads N] --data a.bars [--data b.bars ...] program.tl\n"
+            "       %s --profile [--data a.bars ... | --universe list.txt] program.tl\n"
+            "       %s [--threads N] --universe list.txt program.tl\n"
+            "       %s --save-bytecode program.tlcb program.tl\n"
+            "       %s --emit-c program.tl > strategy.c\n"
+            "       %s --load strategy.so [--data a.bars ... | --universe list.txt]\n"
+            "       %s [--threads N] --sweep name=a,b,c|name=from:to[:step] [--sweep ...]\n"
+            "          --data a.bars ... | --universe list.txt program.tl\n"
+            "       %s --stream [--feed path] [--binary | --ticks] [--jit] program.tl < bars.csv\n"
+            "       %s --convert history.csv history.bars [symbol]\n",
+            argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+}
+
+typedef struct {
+    char **paths;
+    int count;
+    int capacity;
+} PathList;
+
+static void add_path(PathList *list, const char *path) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->paths = (char**)realloc(list->paths, list->capacity * sizeof(char*));
+        if (!list->paths) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    }
+    size_t len = strlen(path);
+    char *copy = (char*)malloc(len + 1);
+    if (!copy) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    memcpy(copy, path, len + 1);
+    list->paths[list->count++] = copy;
+}
+
+/* A universe file lists one .bars path per line */
+static void read_universe(PathList *list, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); exit(1); }
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        if (len == 0 || line[0] == '#') continue;
+        add_path(list, line);
+    }
+    fclose(f);
+}
+
+static int run_universe(const Chunk *chunk, const PathList *list, int threads,
+                        const char *default_symbol) {
+    BarFile *files = (BarFile*)calloc((size_t)list->count, sizeof(BarFile));
+    BacktestSymbol *universe = (BacktestSymbol*)calloc((size_t)list->count, sizeof(BacktestSymbol));
+    SignalBuffer *results = (SignalBuffer*)calloc((size_t)list->count, sizeof(SignalBuffer));
+    if (!files || !universe || !results) { fprintf(stderr, "Out of memory\n"); exit(1); }
+
+    int opened = 0, status = 0;
+    for (; opened < list->count; ++opened) {
+        if (open_bar_file(&files[opened], list->paths[opened]) != 0) { status = 1; break; }
+        universe[opened].symbol = files[opened].symbol[0] ? files[opened].symbol : default_symbol;
+        universe[opened].bars = files[opened].cols;
+    }
+
+    if (status == 0) {
+        const char **names = (const char**)malloc((size_t)list->count * sizeof(char*));
+        if (!names) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        for (int i = 0; i < list->count; ++i) names[i] = universe[i].symbol;
+        SignalPrinter printer = { names, stdout };
+        run_backtest(chunk, universe, list->count, threads, results);
+        for (int i = 0; i < list->count; ++i) {
+            for (size_t j = 0; j < results[i].count; ++j) print_signal(&printer, &results[i].items[j]);
+            free_signals(&results[i]);
+        }
+        free(names);
+    }
+
+    for (int i = 0; i < opened; ++i) close_bar_file(&files[i]);
+    free(results);
+    free(universe);
+    free(files);
+    return status;
+}
+
+/* --sweep name=a,b,c or name=from:to[:step] (both ends included) */
+static int parse_axis(const Chunk *chunk, const char *spec, SweepAxis *axis) {
+    const char *eq = strchr(spec, '=');
+    char name[PARAM_NAME_MAX];
+    size_t len = eq ? (size_t)(eq - spec) : 0;
+    if (!eq || len == 0 || len >= sizeof(name)) {
+        fprintf(stderr, "--sweep %s: expected name=values\n", spec);
+        return -1;
+    }
+    memcpy(name, spec, len);
+    name[len] = '\0';
+    axis->param = find_param(chunk, name);
+    if (axis->param < 0) {
+        fprintf(stderr, "--sweep %s: the program declares no parameter %s\n", spec, name);
+        return -1;
+    }
+
+    const char *p = eq + 1;
+    char *end;
+    double *values = NULL;
+    int count = 0;
+    if (strchr(p, ':')) {
+        double from = strtod(p, &end), to = 0.0, step = 1.0;
+        int ok = end != p && *end == ':';
+        if (ok) {
+            p = end + 1;
+            to = strtod(p, &end);
+            ok = end != p;
+        }
+        if (ok && *end == ':') {
+            p = end + 1;
+            step = strtod(p, &end);
+            ok = end != p;
+        }
+        if (!ok || *end != '\0' || !(step > 0) || !(to >= from) || (to - from) / step >= SWEEP_MAX) {
+            fprintf(stderr, "--sweep %s: expected from:to[:step] with from <= to and step > 0\n", spec);
+            return -1;
+        }
+        count = (int)((to - from) / step + 1e-9) + 1;
+        values = (double*)malloc((size_t)count * sizeof(double));
+        if (!values) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        for (int i = 0; i < count; ++i) values[i] = from + i * step;
+    } else {
+        for (const char *c = p; *c; ++c) count += *c == ',';
+        values = (double*)malloc((size_t)(count + 1) * sizeof(double));
+        if (!values) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        count = 0;
+        for (;;) {
+            values[count] = strtod(p, &end);
+            if (end == p || (*end != ',' && *end != '\0')) {
+                fprintf(stderr, "--sweep %s: expected a comma-separated list of numbers\n", spec);
+                free(values);
+                return -1;
+            }
+            count++;
+            if (*end == '\0') break;
+            p = end + 1;
+        }
+    }
+    axis->values = values;
+    axis->count = count;
+    return 0;
+}
+
+/* --sweep: one CSV row per combination on stdout (the swept values, then
+ * signals and P&L over the whole universe), a summary on stderr */
+static int run_sweep_universe(const Chunk *chunk, const PathList *list, const PathList *specs,
+                              int threads) {
+    SweepAxis *axes = (SweepAxis*)calloc((size_t)specs->count, sizeof(SweepAxis));
+    BarFile *files = (BarFile*)calloc((size_t)list->count, sizeof(BarFile));
+    BacktestSymbol *universe = (BacktestSymbol*)calloc((size_t)list->count, sizeof(BacktestSymbol));
+    if (!axes || !files || !universe) { fprintf(stderr, "Out of memory\n"); exit(1); }
+
+    int parsed = 0, opened = 0, status = 0;
+    for (; parsed < specs->count; ++parsed) {
+        if (parse_axis(chunk, specs->paths[parsed], &axes[parsed]) != 0) { status = 1; break; }
+    }
+    size_t bars = 0;
+    for (; status == 0 && opened < list->count; ++opened) {
+        if (open_bar_file(&files[opened], list->paths[opened]) != 0) { status = 1; break; }
+        universe[opened].symbol = files[opened].symbol;
+        universe[opened].bars = files[opened].cols;
+        bars += files[opened].cols.count;
+    }
+
+    size_t combinations = status == 0 ? sweep_size(axes, specs->count) : 0;
+    SweepResult *results = combinations ? (SweepResult*)malloc(combinations * sizeof(SweepResult)) : NULL;
+    if (combinations && !results) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    char err[256];
+    SweepOptions opts = { threads, 1 };
+    SweepStats stats;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (status == 0 &&
+        run_sweep(chunk, universe, list->count, axes, specs->count, &opts, results, &stats,
+                  err, sizeof(err)) != 0) {
+        fprintf(stderr, "%s\n", err);
+        status = 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (status == 0) {
+        double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+        double *values = (double*)malloc((size_t)(chunk->param_count ? chunk->param_count : 1) * sizeof(double));
+        if (!values) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        for (int a = 0; a < specs->count; ++a) printf("%s,", chunk->params[axes[a].param].name);
+        printf("signals,pnl\n");
+        size_t best = 0;
+        for (size_t c = 0; c < combinations; ++c) {
+            sweep_values(chunk, axes, specs->count, c, values);
+            for (int a = 0; a < specs->count; ++a) printf("%g,", values[axes[a].param]);
+            printf("%zu,%.2f\n", results[c].signals, results[c].pnl);
+            if (results[c].pnl > results[best].pnl) best = c;
+        }
+        fprintf(stderr, "== sweep: %zu combinations x %zu bars in %.3f s, %.0f combination-bars/s ==\n",
+                combinations, bars, secs, secs > 0 ? (double)combinations * (double)bars / secs : 0.0);
+        fprintf(stderr, "indicators per bar: %zu over all combinations, %zu computed after sharing\n",
+                stats.indicators, stats.computed);
+        sweep_values(chunk, axes, specs->count, best, values);
+        fprintf(stderr, "best:");
+        for (int a = 0; a < specs->count; ++a)
+            fprintf(stderr, " %s=%g", chunk->params[axes[a].param].name, values[axes[a].param]);
+        fprintf(stderr, " (%zu signals, pnl %.2f)\n", results[best].signals, results[best].pnl);
+        free(values);
+    }
+
+    for (int i = 0; i < opened; ++i) close_bar_file(&files[i]);
+    for (int a = 0; a < parsed; ++a) free((double*)axes[a].values);
+    free(results);
+    free(universe);
+    free(files);
+    free(axes);
+    return status;
+}
+
+/* Dummy candle context for testing */
+static void sample_context(VMContext *ctx) {
+    ctx->open = 100.0;
+    ctx->high = 110.0;
+    ctx->low =  95.0;
+    ctx->close = 108.0;
+    ctx->volume = 1000000;
+    ctx->date = 20251117;  // YYYYMMDD
+    ctx->time = 940;       // 09:40
+    ctx->hour = 9;
+    ctx->minute = 40;
+    ctx->weekday = 1;      // Monday
+}
+
+/* Runs a strategy built from --emit-c output, one bar at a time. Symbols
+ * run in list order, so the output matches run_universe's. */
+static int run_loaded(const char *lib_path, const PathList *list) {
+    char err[512];
+    StrategyLib lib;
+    if (load_strategy(&lib, lib_path, err, sizeof(err)) != 0) {
+        fprintf(stderr, "%s\n", err);
+        return 1;
+    }
+
+    int status = 0;
+    IndicatorState ind;
+    const char *symbol = lib.strategy->symbol;
+    SignalPrinter printer = { &symbol, stdout };
+    SignalSink sink = { print_signal, &printer, 0 };
+    if (list->count == 0) {
+        VMContext ctx;
+        sample_context(&ctx);
+        init_strategy_indicators(&ind, &lib);
+        run_strategy(&lib, &ind, &ctx, &sink);
+        free_indicators(&ind);
+    }
+    for (int i = 0; i < list->count && status == 0; ++i) {
+        BarFile bf;
+        if (open_bar_file(&bf, list->paths[i]) != 0) { status = 1; break; }
+        const BarColumns *c = &bf.cols;
+        symbol = bf.symbol[0] ? bf.symbol : lib.strategy->symbol;
+        init_strategy_indicators(&ind, &lib);
+        for (size_t j = 0; j < c->count; ++j) {
+            VMContext ctx = {
+                c->open[j], c->high[j], c->low[j], c->close[j], c->volume[j],
+                c->date[j], c->time[j], c->hour[j], c->minute[j], c->weekday[j]
+            };
+            run_strategy(&lib, &ind, &ctx, &sink);
+        }
+        free_indicators(&ind);
+        close_bar_file(&bf);
+    }
+    unload_strategy(&lib);
+    return status;
+}
+
+/* --profile: the profiled scalar VM one bar at a time, symbols in list
+ * order (so the signals match run_universe's), then the per-opcode report
+ * on stderr */
+static int run_profiled(Chunk *chunk, const PathList *list, const char *default_symbol) {
+    VMProfile profile;
+    init_profile(&profile, chunk);
+
+    int status = 0;
+    IndicatorState ind;
+    const char *symbol = default_symbol;
+    SignalPrinter printer = { &symbol, stdout };
+    SignalSink sink = { print_signal, &printer, 0 };
+    if (list->count == 0) {
+        VMContext ctx;
+        sample_context(&ctx);
+        init_indicators(&ind, chunk);
+        run_chunk_profiled(chunk, &ind, &ctx, &sink, &profile);
+        free_indicators(&ind);
+    }
+    for (int i = 0; i < list->count && status == 0; ++i) {
+        BarFile bf;
+        if (open_bar_file(&bf, list->paths[i]) != 0) { status = 1; break; }
+        const BarColumns *c = &bf.cols;
+        symbol = bf.symbol[0] ? bf.symbol : default_symbol;
+        init_indicators(&ind, chunk);
+        for (size_t j = 0; j < c->count; ++j) {
+            VMContext ctx = {
+                c->open[j], c->high[j], c->low[j], c->close[j], c->volume[j],
+                c->date[j], c->time[j], c->hour[j], c->minute[j], c->weekday[j]
+            };
+            run_chunk_profiled(chunk, &ind, &ctx, &sink, &profile);
+        }
+        free_indicators(&ind);
+        close_bar_file(&bf);
+    }
+
+    print_profile(&profile, stderr);
+    free_profile(&profile);
+    return status;
+}
+
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s program.tl\n", argv[0]);
+    PathList data = { NULL, 0, 0 };
+    PathList sweeps = { NULL, 0, 0 };
+    const char *program_path = NULL;
+    int threads = 0;
+    int dump_bytecode = 0;
+    int use_jit = 0;
+    int emit = 0;
+    int profile = 0;
+    const char *load_path = NULL;
+    const char *cache_dir = NULL;
+    const char *save_path = NULL;
+    int stream = 0;
+    int binary = 0;
+    int ticks = 0;
+    const char *feed_path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--convert") == 0) {
+            if (i + 2 >= argc) { usage(argv[0]); return 1; }
+            const char *symbol = (i + 3 < argc) ? argv[i + 3] : "";
+            return convert_csv_to_bars(argv[i + 1], argv[i + 2], symbol) == 0 ? 0 : 1;
+        } else if (strcmp(argv[i], "--data") == 0) {
+            if (i + 1 >= argc) { usage(argv[0]); return 1; }
+            add_path(&data, argv[++i]);
+        } else if (strcmp(argv[i], "--universe") == 0) {
+            if (i + 1 >= argc) { usage(argv[0]); return 1; }
+            read_universe(&data, argv[++i]);
+        } else if (strcmp(argv[i], "--dump-bytecode") == 0) {
+            dump_bytecode = 1;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            use_jit = 1;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile = 1;
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            emit = 1;
+        } else if (strcmp(argv[i], "--load") == 0) {
+            if (i + 1 >= argc) { usage(argv[0]); return 1; }
+            load_path = argv[++i];
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            if (i + 1 >= argc) { usage(argv[0]); return 1; }
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--save-bytecode") == 0) {
+            if (i + 1 >= argc) { usage(argv[0]); return 1; }
+            save_path = argv[++i];
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream = 1;
+        } else if (strcmp(argv[i], "--feed") == 0) {
+            if (i + 1 >= argc) { usage(argv[0]); return 1; }
+            feed_path = argv[++i];
+            stream = 1;
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            binary = 1;
+        } else if (strcmp(argv[i], "--ticks") == 0) {
+            ticks = 1;
+        } else if (strcmp(argv[i], "--sweep") == 0) {
+            if (i + 1 >= argc) { usage(argv[0]); return 1; }
+            add_path(&sweeps, argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 >= argc) { usage(argv[0]); return 1; }
+            threads = atoi(argv[++i]);
+        } else if (!program_path) {
+            program_path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (load_path && !program_path) {
+        int status = run_loaded(load_path, &data);
+        for (int i = 0; i < data.count; ++i) free(data.paths[i]);
+        free(data.paths);
+        return status;
+    }
+    if (!program_path || load_path || (binary && ticks) || (sweeps.count > 0 && data.count == 0)) {
+        usage(argv[0]);
         return 1;
     }
 
-    char *source = read_file(argv[1]);
+    /* The bytecode comes from a .tlcb, the compile cache, or the compiler */
+    char err[256];
+    char *source = NULL;
+    Program *prog = NULL;
+    Chunk compiled;
+    ChunkFile mapped;
+    int is_mapped = 0;
+    uint64_t key = 0;
+    if (has_suffix(program_path, ".tlcb")) {
+        if (open_chunk_file(&mapped, program_path, err, sizeof(err)) != 0) {
+            fprintf(stderr, "%s\n", err);
+            return 1;
+        }
+        is_mapped = 1;
+    } else {
+        source = read_file(program_path);
+        key = compile_key(source, strlen(source), NULL);
+        /* --dump-bytecode needs the AST for its "before" listing */
+        is_mapped = cache_dir && !dump_bytecode && cache_lookup(&mapped, cache_dir, key) == 0;
+    }
 
-    Program *prog = parse_program(source);
-    Chunk chunk;
-    compile_program(prog, &chunk);
+    if (!is_mapped) {
+        prog = parse_program(source);
+        if (dump_bytecode) {
+            if (compile_program_r(prog, &compiled, NULL, err, sizeof(err)) == 0) {
+                disassemble_chunk(&compiled, "before optimization", stderr);
+                free_chunk(&compiled);
+            } else {
+                fprintf(stderr, "== before optimization: %s ==\n", err);
+            }
+        }
+        optimize_program(prog);
+        compile_program(prog, &compiled);
+        if (cache_dir && cache_store(cache_dir, key, &compiled, prog->symbol, err, sizeof(err)) != 0)
+            fprintf(stderr, "warning: not cached: %s\n", err);
+    }
+    Chunk *chunk = is_mapped ? &mapped.chunk : &compiled;
+    const char *symbol = is_mapped ? mapped.symbol : prog->symbol;
+    if (dump_bytecode) disassemble_chunk(chunk, "after optimization", stderr);
 
-    // Dummy candle context for testing
-    VMContext ctx;
-    ctx.open = 100.0;
-    ctx.high = 110.0;
-    ctx.low =  95.0;
-    ctx.close = 108.0;
-    ctx.volume = 1000000;
-    ctx.date = 20251117;  // YYYYMMDD
-    ctx.time = 940;       // 09:40
-    ctx.hour = 9;
-    ctx.minute = 40;
-    ctx.weekday = 1;      // Monday
+    if (save_path &&
+        write_chunk_file(save_path, chunk, symbol, is_mapped ? mapped.source_hash : key,
+                         err, sizeof(err)) != 0) {
+        fprintf(stderr, "%s\n", err);
+        return 1;
+    }
 
-    run_chunk(&chunk, &ctx, prog->symbol);
+    int status = 0;
+    if (emit) {
+        if (emit_c(chunk, symbol, program_path, stdout, err, sizeof(err)) != 0) {
+            fprintf(stderr, "%s\n", err);
+            status = 1;
+        }
+    } else if (stream) {
+        int fd = feed_path ? open(feed_path, O_RDONLY) : STDIN_FILENO;
+        if (fd < 0) {
+            perror(feed_path);
+            status = 1;
+        } else {
+            StreamOptions opts = { binary, ticks, use_jit ? jit_compile(chunk) : NULL };
+            status = run_stream(chunk, fd, symbol, &opts, stdout, stderr) == 0 ? 0 : 1;
+            if (opts.jit) jit_free(opts.jit);
+            if (feed_path) close(fd);
+        }
+    } else if (sweeps.count > 0) {
+        status = run_sweep_universe(chunk, &data, &sweeps, threads);
+    } else if (profile) {
+        status = run_profiled(chunk, &data, symbol);
+    } else if (data.count > 0) {
+        status = run_universe(chunk, &data, threads, symbol);
+    } else {
+        IndicatorState ind;
+        init_indicators(&ind, chunk);
 
-    free_chunk(&chunk);
-    free_program(prog);
+        VMContext ctx;
+        sample_context(&ctx);
+
+        SignalPrinter printer = { &symbol, stdout };
+        SignalSink sink = { print_signal, &printer, 0 };
+        JitCode *jit = use_jit ? jit_compile(chunk) : NULL;
+        if (jit) {
+            jit_run(jit, &ind, &ctx, &sink);
+            jit_free(jit);
+        } else {
+            run_chunk(chunk, &ind, &ctx, &sink);
+        }
+        free_indicators(&ind);
+    }
+
+    for (int i = 0; i < data.count; ++i) free(data.paths[i]);
+    free(data.paths);
+    for (int i = 0; i < sweeps.count; ++i) free(sweeps.paths[i]);
+    free(sweeps.paths);
+    if (is_mapped) {
+        close_chunk_file(&mapped);
+    } else {
+        free_chunk(&compiled);
+        free_program(prog);
+    }
     free(source);
-    return 0;
+    return status;
 }
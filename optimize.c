@@ -0,0 +1,291 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+
+/* ---------- AST optimization pass ----------
+ *
+ * Runs between parse_program and compile_program and rewrites the tree in
+ * place (new nodes come from the program's arena):
+ *
+ *   - constant folding with the VM's exact semantics (doubles, 0/1 bools)
+ *   - string literals compared with date/time/weekday become numbers
+ *   - identities: x-0, x*1, x/1, --x, not not b, b and 1, b or 0
+ *   - short-circuit constants: 0 and x -> 0, 1 or x -> 1
+ *   - rules whose condition folds to false are dropped
+ *   - the operands of an and/or chain are ordered by how often they can
+ *     change: per-day tests first, then per-minute ones, then the rest
+ *
+ * Nothing that could change a result is rewritten: x*0 is kept (x may be
+ * NaN or inf), x+0 too (-0 + 0 is +0, which 1/x tells apart), and
+ * `not not x` only collapses when x is already 0/1.
+ * Parameters are never folded: each run sets its own value.
+ */
+
+static int is_number(const Expr *e, double v) {
+    return e->kind == EXPR_NUMBER && e->as.number.value == v;
+}
+
+static int is_const(const Expr *e) {
+    return e->kind == EXPR_NUMBER;
+}
+
+/* Does e always evaluate to exactly 0 or 1? */
+static int is_boolean(const Expr *e) {
+    switch (e->kind) {
+        case EXPR_NUMBER:
+            return e->as.number.value == 0.0 || e->as.number.value == 1.0;
+        case EXPR_UNARY:
+            return e->as.op.op == OP_NOT_OP;
+        case EXPR_BINARY:
+            return e->as.op.op >= OP_GT_OP && e->as.op.op <= OP_OR_OP;
+        default:
+            return 0;
+    }
+}
+
+static Expr *make_number(Expr *e, double v) {
+    e->kind = EXPR_NUMBER;
+    e->as.number.value = v;
+    return e;
+}
+
+static double eval_binary(OpKind op, double a, double b) {
+    switch (op) {
+        case OP_ADD:    return a + b;
+        case OP_SUB:    return a - b;
+        case OP_MUL:    return a * b;
+        case OP_DIV:    return a / b;
+        case OP_GT_OP:  return a >  b;
+        case OP_LT_OP:  return a <  b;
+        case OP_GE_OP:  return a >= b;
+        case OP_LE_OP:  return a <= b;
+        case OP_EQ_OP:  return a == b;
+        case OP_NE_OP:  return a != b;
+        case OP_AND_OP: return (a != 0.0) && (b != 0.0);
+        case OP_OR_OP:  return (a != 0.0) || (b != 0.0);
+        default:        return 0.0;
+    }
+}
+
+/* "Fri", "09:15", "2025-01-31" facing a field become that field's code */
+static void resolve_string(Expr *str, const Expr *other) {
+    if (str->kind != EXPR_STRING || other->kind != EXPR_IDENT) return;
+    const Builtin *b = lookup_builtin(other->as.ident.name, strlen(other->as.ident.name));
+    double v;
+    if (b && b->kind == BUILTIN_VAR &&
+        string_literal_value((VarId)b->id, str->as.string.value, &v)) {
+        make_number(str, v);
+    }
+}
+
+static Expr *fold(Expr *e);
+
+static Expr *fold_unary(Expr *e) {
+    Expr *sub = e->as.op.left = fold(e->as.op.left);
+    if (is_const(sub)) {
+        double v = sub->as.number.value;
+        return make_number(e, e->as.op.op == OP_NEG_OP ? -v : (double)(v == 0.0));
+    }
+    /* --x -> x;  not not b -> b when b is already 0/1 */
+    if (sub->kind == EXPR_UNARY && sub->as.op.op == e->as.op.op) {
+        if (e->as.op.op == OP_NEG_OP || is_boolean(sub->as.op.left)) {
+            return sub->as.op.left;
+        }
+    }
+    return e;
+}
+
+static Expr *fold_binary(Expr *e) {
+    Expr *l = e->as.op.left = fold(e->as.op.left);
+    Expr *r = e->as.op.right = fold(e->as.op.right);
+    OpKind op = e->as.op.op;
+
+    if (op >= OP_GT_OP && op <= OP_NE_OP) {
+        resolve_string(l, r);
+        resolve_string(r, l);
+    }
+    if (is_const(l) && is_const(r)) {
+        return make_number(e, eval_binary(op, l->as.number.value, r->as.number.value));
+    }
+
+    switch (op) {
+        case OP_SUB:
+            /* x - (-0) is x + 0 */
+            if (is_number(r, 0.0) && !signbit(r->as.number.value)) return l;
+            break;
+        case OP_MUL:
+            if (is_number(r, 1.0)) return l;
+            if (is_number(l, 1.0)) return r;
+            break;
+        case OP_DIV:
+            if (is_number(r, 1.0)) return l;
+            break;
+        case OP_AND_OP:
+        case OP_OR_OP: {
+            /* a constant operand either decides the result or drops out */
+            Expr *k = is_const(l) ? l : is_const(r) ? r : NULL;
+            if (!k) break;
+            Expr *x = (k == l) ? r : l;
+            int truthy = k->as.number.value != 0.0;
+            if (op == OP_AND_OP && !truthy) return make_number(e, 0.0);
+            if (op == OP_OR_OP && truthy)   return make_number(e, 1.0);
+            if (is_boolean(x)) return x;
+            break;
+        }
+        default:
+            break;
+    }
+    return e;
+}
+
+static Expr *fold(Expr *e) {
+    switch (e->kind) {
+        case EXPR_UNARY:
+            return fold_unary(e);
+        case EXPR_BINARY:
+            return fold_binary(e);
+        case EXPR_CALL:
+            for (int i = 0; i < e->as.call.arg_count; ++i) {
+                e->as.call.args[i] = fold(e->as.call.args[i]);
+            }
+            return e;
+        default:
+            return e;
+    }
+}
+
+/* ---------- Evaluation frequency ----------
+ *
+ * and/or are pure and commutative, so a chain's operands can run in any
+ * order. Putting the ones that change least often first makes them a
+ * subtree of their own, e.g. ((weekday == 5 and date >= 20240101) and
+ * close > sma(close, 50)): the first test decides most bars, and the
+ * compiler can keep its value across bars (see compile_temps). Chains
+ * that are already in order are left as written.
+ */
+
+Frequency expr_frequency(const Expr *e) {
+    switch (e->kind) {
+        case EXPR_NUMBER:
+        case EXPR_STRING:
+        case EXPR_PARAM:    // fixed for the whole run
+            return FREQ_CONST;
+        case EXPR_IDENT: {
+            if (e->as.ident.timeframe != TF_BAR) return FREQ_BAR;
+            const Builtin *b = lookup_builtin(e->as.ident.name, strlen(e->as.ident.name));
+            return b && b->kind == BUILTIN_VAR ? (Frequency)b->frequency : FREQ_BAR;
+        }
+        case EXPR_BINARY: {
+            Frequency l = expr_frequency(e->as.op.left);
+            Frequency r = expr_frequency(e->as.op.right);
+            return l > r ? l : r;
+        }
+        case EXPR_UNARY:
+            return expr_frequency(e->as.op.left);
+        default:
+            return FREQ_BAR;
+    }
+}
+
+typedef struct {
+    Expr **items;
+    int count;
+    int capacity;
+} ExprList;
+
+static void push_expr(ExprList *list, Expr *e) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 8;
+        list->items = (Expr**)realloc(list->items, (size_t)list->capacity * sizeof(Expr*));
+        if (!list->items) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    }
+    list->items[list->count++] = e;
+}
+
+/* Operands of the chain of `op` rooted at e, left to right, and its nodes */
+static void flatten_chain(Expr *e, OpKind op, ExprList *terms, ExprList *nodes) {
+    if (e->kind == EXPR_BINARY && e->as.op.op == op) {
+        push_expr(nodes, e);
+        flatten_chain(e->as.op.left, op, terms, nodes);
+        flatten_chain(e->as.op.right, op, terms, nodes);
+    } else {
+        push_expr(terms, e);
+    }
+}
+
+static Expr *order_by_frequency(Expr *e);
+
+/* Orders the chains inside the operands of the chain of `op` at e */
+static void order_operands(Expr *e, OpKind op) {
+    Expr **kids[2] = { &e->as.op.left, &e->as.op.right };
+    for (int i = 0; i < 2; ++i) {
+        Expr *k = *kids[i];
+        if (k->kind == EXPR_BINARY && k->as.op.op == op) order_operands(k, op);
+        else *kids[i] = order_by_frequency(k);
+    }
+}
+
+static Expr *order_by_frequency(Expr *e) {
+    if (e->kind == EXPR_UNARY) {
+        e->as.op.left = order_by_frequency(e->as.op.left);
+        return e;
+    }
+    if (e->kind != EXPR_BINARY) return e;
+    OpKind op = e->as.op.op;
+    if (op != OP_AND_OP && op != OP_OR_OP) {
+        e->as.op.left = order_by_frequency(e->as.op.left);
+        e->as.op.right = order_by_frequency(e->as.op.right);
+        return e;
+    }
+
+    order_operands(e, op);
+    ExprList terms = {0}, nodes = {0};
+    flatten_chain(e, op, &terms, &nodes);
+    int *freq = (int*)malloc((size_t)terms.count * sizeof(int));
+    if (!freq) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    int sorted = 1;
+    for (int i = 0; i < terms.count; ++i) {
+        freq[i] = (int)expr_frequency(terms.items[i]);
+        if (i > 0 && freq[i] < freq[i - 1]) sorted = 0;
+    }
+    if (!sorted) {
+        /* stable insertion sort, then rebuild left-deep from the same nodes */
+        for (int i = 1; i < terms.count; ++i) {
+            Expr *t = terms.items[i];
+            int f = freq[i], j = i;
+            for (; j > 0 && freq[j - 1] > f; --j) {
+                terms.items[j] = terms.items[j - 1];
+                freq[j] = freq[j - 1];
+            }
+            terms.items[j] = t;
+            freq[j] = f;
+        }
+        Expr *left = terms.items[0];
+        for (int i = 1; i < terms.count; ++i) {
+            Expr *n = nodes.items[i - 1];
+            n->as.op.left = left;
+            n->as.op.right = terms.items[i];
+            left = n;
+        }
+        e = left;
+    }
+    free(freq);
+    free(terms.items);
+    free(nodes.items);
+    return e;
+}
+
+void optimize_program(Program *program) {
+    Rule **link = &program->rules;
+    while (*link) {
+        Rule *r = *link;
+        r->condition = order_by_frequency(fold(r->condition));
+        if (is_number(r->condition, 0.0)) {
+            *link = r->next; // can never fire
+            continue;
+        }
+        link = &r->next;
+    }
+}
@@ -1,40 +1,43 @@
-#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <setjmp.h>
 #include "ast.h"
 
-/* ---------- Utilities to allocate AST ---------- */
+/* ---------- Utilities to allocate AST ----------
+ * Every node is carved out of the program's arena. */
 
-static void *xmalloc(size_t sz) {
-    void *p = malloc(sz);
-    if (!p) { fprintf(stderr, "Out of memory\n"); exit(1); }
-    return p;
-}
-
-static Expr *new_number(double v) {
-    Expr *e = (Expr*)xmalloc(sizeof(Expr));
+static Expr *new_number(Arena *a, double v) {
+    Expr *e = (Expr*)arena_alloc(a, sizeof(Expr));
     e->kind = EXPR_NUMBER;
     e->as.number.value = v;
     return e;
 }
 
-static Expr *new_ident(char *name) {
-    Expr *e = (Expr*)xmalloc(sizeof(Expr));
+static Expr *new_ident(Arena *a, char *name) {
+    Expr *e = (Expr*)arena_alloc(a, sizeof(Expr));
     e->kind = EXPR_IDENT;
     e->as.ident.name = name;
+    e->as.ident.timeframe = TF_BAR;
     return e;
 }
 
-static Expr *new_string(char *val) {
-    Expr *e = (Expr*)xmalloc(sizeof(Expr));
+static Expr *new_string(Arena *a, char *val) {
+    Expr *e = (Expr*)arena_alloc(a, sizeof(Expr));
     e->kind = EXPR_STRING;
     e->as.string.value = val;
     return e;
 }
 
-static Expr *new_unary(OpKind op, Expr *sub) {
-    Expr *e = (Expr*)xmalloc(sizeof(Expr));
+static Expr *new_param(Arena *a, int index) {
+    Expr *e = (Expr*)arena_alloc(a, sizeof(Expr));
+    e->kind = EXPR_PARAM;
+    e->as.param.index = index;
+    return e;
+}
+
+static Expr *new_unary(Arena *a, OpKind op, Expr *sub) {
+    Expr *e = (Expr*)arena_alloc(a, sizeof(Expr));
     e->kind = EXPR_UNARY;
     e->as.op.op = op;
     e->as.op.left = sub;
@@ -42,8 +45,8 @@ static Expr *new_unary(OpKind op, Expr *sub) {
     return e;
 }
 
-static Expr *new_binary(OpKind op, Expr *left, Expr *right) {
-    Expr *e = (Expr*)xmalloc(sizeof(Expr));
+static Expr *new_binary(Arena *a, OpKind op, Expr *left, Expr *right) {
+    Expr *e = (Expr*)arena_alloc(a, sizeof(Expr));
     e->kind = EXPR_BINARY;
     e->as.op.op = op;
     e->as.op.left = left;
@@ -51,129 +54,229 @@ static Expr *new_binary(OpKind op, Expr *left, Expr *right) {
     return e;
 }
 
-static Expr *new_call(char *name, Expr **args, int arg_count) {
-    Expr *e = (Expr*)xmalloc(sizeof(Expr));
+static Expr *new_call(Arena *a, char *name, Expr **args, int arg_count) {
+    Expr *e = (Expr*)arena_alloc(a, sizeof(Expr));
     e->kind = EXPR_CALL;
     e->as.call.func_name = name;
     e->as.call.args = args;
     e->as.call.arg_count = arg_count;
+    e->as.call.timeframe = TF_BAR;
     return e;
 }
 
-static Stmt *new_stmt(StmtKind kind, int qty) {
-    Stmt *s = (Stmt*)xmalloc(sizeof(Stmt));
+static Stmt *new_stmt(Arena *a, StmtKind kind, int qty, int line) {
+    Stmt *s = (Stmt*)arena_alloc(a, sizeof(Stmt));
     s->kind = kind;
     s->quantity = qty;
+    s->line = line;
     s->next = NULL;
     return s;
 }
 
-static Rule *new_rule(Expr *cond, Stmt *act) {
-    Rule *r = (Rule*)xmalloc(sizeof(Rule));
+/* Other timeframes whose fields or indicators e reads */
+static uint32_t read_timeframes(const Expr *e) {
+    switch (e->kind) {
+        case EXPR_IDENT:
+            return e->as.ident.timeframe == TF_BAR ? 0 : 1u << e->as.ident.timeframe;
+        case EXPR_CALL:   // its output only changes when its slot is fed
+            return e->as.call.timeframe == TF_BAR ? 0 : 1u << e->as.call.timeframe;
+        case EXPR_BINARY:
+            return read_timeframes(e->as.op.left) | read_timeframes(e->as.op.right);
+        case EXPR_UNARY:
+            return read_timeframes(e->as.op.left);
+        default:
+            return 0;
+    }
+}
+
+/* The timeframes are taken from the condition as written, before the
+ * optimizer can fold any of it away, so optimized and unoptimized code
+ * fire on the same bars */
+static Rule *new_rule(Arena *a, Expr *cond, Stmt *act, int index, int line) {
+    Rule *r = (Rule*)arena_alloc(a, sizeof(Rule));
     r->condition = cond;
     r->action = act;
+    r->index = index;
+    r->line = line;
+    r->timeframes = read_timeframes(cond);
     r->next = NULL;
     return r;
 }
 
-static Program *new_program(char *symbol, Rule *rules) {
-    Program *p = (Program*)xmalloc(sizeof(Program));
-    p->symbol = symbol;
-    p->rules = rules;
-    return p;
+/* Tags a new node with the position of the token it came from */
+static Expr *at(Expr *e, Token t) {
+    e->line = t.line;
+    e->column = t.column;
+    return e;
 }
 
 /* ---------- Parser state ---------- */
 
-static Token current_token;
+/* All parse state lives here, so independent parses can run on separate
+ * threads. Errors unwind to parse_program_r via on_error. */
+typedef struct {
+    Lexer lexer;
+    Token current_token;
+    Arena *arena;
+    Program *program;  // the parameters declared so far
+    jmp_buf on_error;
+    char *err;
+    size_t errlen;
+} Parser;
+
+static void advance(Parser *p) {
+    p->current_token = next_token(&p->lexer);
+}
+
+static void error(Parser *p, const char *msg) {
+    if (p->err && p->errlen) {
+        snprintf(p->err, p->errlen, "Parse error at line %d, column %d: %s (token: %.*s)",
+                 p->current_token.line, p->current_token.column, msg,
+                 p->current_token.length, p->current_token.start);
+    }
+    longjmp(p->on_error, 1);
+}
 
-static void advance(void) {
-    current_token = next_token();
+/* Materialize the current token's text; only names and strings the AST
+ * keeps are ever copied out of the source. */
+static char *token_text(Parser *p) {
+    return arena_strndup(p->arena, p->current_token.start, (size_t)p->current_token.length);
 }
 
-static void error(const char *msg) {
-    fprintf(stderr, "Parse error: %s (token: %s)\n", msg, current_token.lexeme);
-    exit(1);
+static void consume(Parser *p, TokenType type, const char *msg) {
+    if (p->current_token.type != type) {
+        error(p, msg);
+    }
+    advance(p);
 }
 
-static void consume(TokenType type, const char *msg) {
-    if (current_token.type != type) {
-        error(msg);
+static int declared_param(const Program *program, const char *name, size_t length) {
+    for (int i = 0; i < program->param_count; ++i) {
+        if (strlen(program->params[i].name) == length &&
+            memcmp(program->params[i].name, name, length) == 0) return i;
     }
-    advance();
+    return -1;
 }
 
 /* Forward declarations for expression parsing */
-static Expr *parse_expr(void);
-static Expr *parse_or(void);
-static Expr *parse_and(void);
-static Expr *parse_not(void);
-static Expr *parse_cmp(void);
-static Expr *parse_add(void);
-static Expr *parse_mul(void);
-static Expr *parse_primary(void);
+static Expr *parse_expr(Parser *p);
+static Expr *parse_or(Parser *p);
+static Expr *parse_and(Parser *p);
+static Expr *parse_not(Parser *p);
+static Expr *parse_cmp(Parser *p);
+static Expr *parse_add(Parser *p);
+static Expr *parse_mul(Parser *p);
+static Expr *parse_timeframe(Parser *p);
+static Expr *parse_primary(Parser *p);
 
 /* ---------- Parsing functions ---------- */
 
-static Expr *parse_primary(void) {
-    if (current_token.type == TOK_NUMBER) {
-        double v = current_token.number;
-        advance();
-        return new_number(v);
+static Expr *parse_primary(Parser *p) {
+    Token start = p->current_token;
+    if (p->current_token.type == TOK_NUMBER) {
+        double v = p->current_token.number;
+        advance(p);
+        return at(new_number(p->arena, v), start);
     }
-    if (current_token.type == TOK_IDENT) {
-        char *name = strdup(current_token.lexeme);
-        advance();
+    if (p->current_token.type == TOK_IDENT) {
+        char *name = token_text(p);
+        advance(p);
         // function call or simple identifier?
-        if (current_token.type == TOK_LPAREN) {
+        if (p->current_token.type == TOK_LPAREN) {
             // function call
-            advance(); // consume '('
+            advance(p); // consume '('
             Expr **args = NULL;
             int arg_count = 0, cap = 0;
-            if (current_token.type != TOK_RPAREN) {
+            if (p->current_token.type != TOK_RPAREN) {
                 for (;;) {
                     if (arg_count == cap) {
                         cap = cap ? cap * 2 : 4;
-                        args = (Expr**)realloc(args, cap * sizeof(Expr*));
+                        Expr **grown = (Expr**)arena_alloc(p->arena, cap * sizeof(Expr*));
+                        if (arg_count) memcpy(grown, args, arg_count * sizeof(Expr*));
+                        args = grown;
                     }
-                    args[arg_count++] = parse_expr();
-                    if (current_token.type == TOK_COMMA) {
-                        advance();
+                    args[arg_count++] = parse_expr(p);
+                    if (p->current_token.type == TOK_COMMA) {
+                        advance(p);
                         continue;
                     }
                     break;
                 }
             }
-            consume(TOK_RPAREN, "Expected ')' after function arguments");
-            return new_call(name, args, arg_count);
+            consume(p, TOK_RPAREN, "Expected ')' after function arguments");
+            return at(new_call(p->arena, name, args, arg_count), start);
         }
-        // variable / builtin ident
-        return new_ident(name);
+        // parameter, or variable / builtin ident
+        int param = declared_param(p->program, start.start, (size_t)start.length);
+        if (param >= 0) return at(new_param(p->arena, param), start);
+        return at(new_ident(p->arena, name), start);
     }
-    if (current_token.type == TOK_STRING) {
-        char *s = strdup(current_token.lexeme);
-        advance();
-        return new_string(s);
+    if (p->current_token.type == TOK_STRING) {
+        char *s = token_text(p);
+        advance(p);
+        return at(new_string(p->arena, s), start);
     }
-    if (current_token.type == TOK_LPAREN) {
-        advance();
-        Expr *e = parse_expr();
-        consume(TOK_RPAREN, "Expected ')'");
+    if (p->current_token.type == TOK_LPAREN) {
+        advance(p);
+        Expr *e = parse_expr(p);
+        consume(p, TOK_RPAREN, "Expected ')'");
         return e;
     }
-    error("Expected expression");
+    error(p, "Expected expression");
     return NULL;
 }
 
-static Expr *parse_mul(void) {
-    Expr *left = parse_primary();
+/* Puts every field and indicator call in e that has no timeframe yet on
+ * tf, so `sma(close, 20) on "5m"` feeds the 5m close to a 5m indicator */
+static void set_timeframe(Expr *e, int tf) {
+    switch (e->kind) {
+        case EXPR_IDENT:
+            if (e->as.ident.timeframe == TF_BAR) e->as.ident.timeframe = tf;
+            return;
+        case EXPR_CALL:
+            if (e->as.call.timeframe == TF_BAR) e->as.call.timeframe = tf;
+            for (int i = 0; i < e->as.call.arg_count; ++i) set_timeframe(e->as.call.args[i], tf);
+            return;
+        case EXPR_BINARY:
+            set_timeframe(e->as.op.left, tf);
+            set_timeframe(e->as.op.right, tf);
+            return;
+        case EXPR_UNARY:
+            set_timeframe(e->as.op.left, tf);
+            return;
+        default:
+            return;
+    }
+}
+
+/* timeframe   ::= primary { "on" string_lit } */
+static Expr *parse_timeframe(Parser *p) {
+    Expr *e = parse_primary(p);
+    while (p->current_token.type == TOK_ON) {
+        advance(p);
+        if (p->current_token.type != TOK_STRING) {
+            error(p, "Expected a timeframe string after 'on'");
+        }
+        int tf = lookup_timeframe(p->current_token.start, (size_t)p->current_token.length);
+        if (tf < 0) {
+            error(p, "Unknown timeframe (expected \"1m\", \"5m\", \"15m\", \"1h\" or \"1d\")");
+        }
+        advance(p);
+        set_timeframe(e, tf);
+    }
+    return e;
+}
+
+static Expr *parse_mul(Parser *p) {
+    Expr *left = parse_timeframe(p);
     for (;;) {
-        if (current_token.type == TOK_STAR) {
-            advance();
-            left = new_binary(OP_MUL, left, parse_primary());
-        } else if (current_token.type == TOK_SLASH) {
-            advance();
-            left = new_binary(OP_DIV, left, parse_primary());
+        Token op = p->current_token;
+        if (op.type == TOK_STAR) {
+            advance(p);
+            left = at(new_binary(p->arena, OP_MUL, left, parse_timeframe(p)), op);
+        } else if (op.type == TOK_SLASH) {
+            advance(p);
+            left = at(new_binary(p->arena, OP_DIV, left, parse_timeframe(p)), op);
         } else {
             break;
         }
@@ -181,15 +284,16 @@ static Expr *parse_mul(void) {
     return left;
 }
 
-static Expr *parse_add(void) {
-    Expr *left = parse_mul();
+static Expr *parse_add(Parser *p) {
+    Expr *left = parse_mul(p);
     for (;;) {
-        if (current_token.type == TOK_PLUS) {
-            advance();
-            left = new_binary(OP_ADD, left, parse_mul());
-        } else if (current_token.type == TOK_MINUS) {
-            advance();
-            left = new_binary(OP_SUB, left, parse_mul());
+        Token op = p->current_token;
+        if (op.type == TOK_PLUS) {
+            advance(p);
+            left = at(new_binary(p->arena, OP_ADD, left, parse_mul(p)), op);
+        } else if (op.type == TOK_MINUS) {
+            advance(p);
+            left = at(new_binary(p->arena, OP_SUB, left, parse_mul(p)), op);
         } else {
             break;
         }
@@ -197,16 +301,16 @@ static Expr *parse_add(void) {
     return left;
 }
 
-static Expr *parse_cmp(void) {
-    Expr *left = parse_add();
-    if (current_token.type == TOK_GT || current_token.type == TOK_LT ||
-        current_token.type == TOK_GE || current_token.type == TOK_LE ||
-        current_token.type == TOK_EQ || current_token.type == TOK_NE) {
-        TokenType op_tok = current_token.type;
-        advance();
-        Expr *right = parse_add();
+static Expr *parse_cmp(Parser *p) {
+    Expr *left = parse_add(p);
+    if (p->current_token.type == TOK_GT || p->current_token.type == TOK_LT ||
+        p->current_token.type == TOK_GE || p->current_token.type == TOK_LE ||
+        p->current_token.type == TOK_EQ || p->current_token.type == TOK_NE) {
+        Token op_tok = p->current_token;
+        advance(p);
+        Expr *right = parse_add(p);
         OpKind op;
-        switch (op_tok) {
+        switch (op_tok.type) {
             case TOK_GT: op = OP_GT_OP; break;
             case TOK_LT: op = OP_LT_OP; break;
             case TOK_GE: op = OP_GE_OP; break;
@@ -215,157 +319,188 @@ static Expr *parse_cmp(void) {
             case TOK_NE: op = OP_NE_OP; break;
             default: op = OP_EQ_OP; break;
         }
-        return new_binary(op, left, right);
+        return at(new_binary(p->arena, op, left, right), op_tok);
     }
     return left;
 }
 
-static Expr *parse_not(void) {
-    if (current_token.type == TOK_NOT) {
-        advance();
-        return new_unary(OP_NOT_OP, parse_not());
+static Expr *parse_not(Parser *p) {
+    if (p->current_token.type == TOK_NOT) {
+        Token op = p->current_token;
+        advance(p);
+        return at(new_unary(p->arena, OP_NOT_OP, parse_not(p)), op);
     }
-    return parse_cmp();
+    return parse_cmp(p);
 }
 
-static Expr *parse_and(void) {
-    Expr *left = parse_not();
-    while (current_token.type == TOK_AND) {
-        advance();
-        left = new_binary(OP_AND_OP, left, parse_not());
+static Expr *parse_and(Parser *p) {
+    Expr *left = parse_not(p);
+    while (p->current_token.type == TOK_AND) {
+        Token op = p->current_token;
+        advance(p);
+        left = at(new_binary(p->arena, OP_AND_OP, left, parse_not(p)), op);
     }
     return left;
 }
 
-static Expr *parse_or(void) {
-    Expr *left = parse_and();
-    while (current_token.type == TOK_OR) {
-        advance();
-        left = new_binary(OP_OR_OP, left, parse_and());
+static Expr *parse_or(Parser *p) {
+    Expr *left = parse_and(p);
+    while (p->current_token.type == TOK_OR) {
+        Token op = p->current_token;
+        advance(p);
+        left = at(new_binary(p->arena, OP_OR_OP, left, parse_and(p)), op);
     }
     return left;
 }
 
-static Expr *parse_expr(void) {
-    return parse_or();
+static Expr *parse_expr(Parser *p) {
+    return parse_or(p);
 }
 
 /* rule        ::= "if" expr "then" action "end" */
 
-static Stmt *parse_action(void) {
-    if (current_token.type == TOK_BUY) {
-        advance();
-        if (current_token.type != TOK_NUMBER) {
-            error("Expected number after 'buy'");
+static Stmt *parse_action(Parser *p) {
+    int line = p->current_token.line;
+    if (p->current_token.type == TOK_BUY) {
+        advance(p);
+        if (p->current_token.type != TOK_NUMBER) {
+            error(p, "Expected number after 'buy'");
         }
-        int qty = (int)current_token.number;
-        advance();
-        return new_stmt(STMT_BUY, qty);
-    } else if (current_token.type == TOK_SELL) {
-        advance();
-        if (current_token.type != TOK_NUMBER) {
-            error("Expected number after 'sell'");
+        int qty = (int)p->current_token.number;
+        advance(p);
+        return new_stmt(p->arena, STMT_BUY, qty, line);
+    } else if (p->current_token.type == TOK_SELL) {
+        advance(p);
+        if (p->current_token.type != TOK_NUMBER) {
+            error(p, "Expected number after 'sell'");
         }
-        int qty = (int)current_token.number;
-        advance();
-        return new_stmt(STMT_SELL, qty);
+        int qty = (int)p->current_token.number;
+        advance(p);
+        return new_stmt(p->arena, STMT_SELL, qty, line);
     }
-    error("Expected 'buy' or 'sell'");
+    error(p, "Expected 'buy' or 'sell'");
     return NULL;
 }
 
-static Rule *parse_rule_list(void) {
+static Rule *parse_rule_list(Parser *p) {
     Rule *head = NULL;
     Rule *tail = NULL;
+    int index = 0;
 
-    while (current_token.type == TOK_IF) {
-        advance(); // consume 'if'
-        Expr *cond = parse_expr();
-        consume(TOK_THEN, "Expected 'then'");
-        Stmt *act = parse_action();
-        consume(TOK_END, "Expected 'end'");
+    while (p->current_token.type == TOK_IF) {
+        int line = p->current_token.line;
+        advance(p); // consume 'if'
+        Expr *cond = parse_expr(p);
+        consume(p, TOK_THEN, "Expected 'then'");
+        Stmt *act = parse_action(p);
+        consume(p, TOK_END, "Expected 'end'");
 
-        Rule *rule = new_rule(cond, act);
+        Rule *rule = new_rule(p->arena, cond, act, index++, line);
         if (!head) head = tail = rule;
         else { tail->next = rule; tail = rule; }
     }
     return head;
 }
 
-/* program     ::= symbol_decl rule_list
+/* param_decl  ::= "param" ident "=" [ "-" ] number */
+
+static void parse_params(Parser *p, Program *program) {
+    int cap = 0;
+    while (p->current_token.type == TOK_PARAM) {
+        advance(p);
+        Token name = p->current_token;
+        if (name.type != TOK_IDENT) {
+            error(p, "Expected a parameter name after 'param'");
+        }
+        if (name.length >= PARAM_NAME_MAX) {
+            error(p, "Parameter name too long");
+        }
+        if (lookup_builtin(name.start, (size_t)name.length)) {
+            error(p, "A builtin field or function cannot be a parameter");
+        }
+        if (declared_param(program, name.start, (size_t)name.length) >= 0) {
+            error(p, "Parameter declared twice");
+        }
+        if (program->param_count == TLC_PARAM_MAX) {
+            error(p, "Too many parameters");
+        }
+        advance(p);
+        consume(p, TOK_ASSIGN, "Expected '=' after the parameter name");
+        int negative = p->current_token.type == TOK_MINUS;
+        if (negative) advance(p);
+        if (p->current_token.type != TOK_NUMBER) {
+            error(p, "Expected a number as the parameter's default");
+        }
+        if (program->param_count == cap) {
+            cap = cap ? cap * 2 : 8;
+            Param *grown = (Param*)arena_alloc(p->arena, (size_t)cap * sizeof(Param));
+            if (program->param_count)
+                memcpy(grown, program->params, (size_t)program->param_count * sizeof(Param));
+            program->params = grown;
+        }
+        Param *param = &program->params[program->param_count++];
+        memset(param->name, 0, sizeof(param->name));
+        memcpy(param->name, name.start, (size_t)name.length);
+        param->value = negative ? -p->current_token.number : p->current_token.number;
+        advance(p);
+    }
+}
+
+/* program     ::= symbol_decl { param_decl } rule_list
  * symbol_decl ::= "symbol" string_lit
  */
 
-Program *parse_program(const char *source) {
-    init_lexer(source);
-    advance(); // load first token
-
-    consume(TOK_SYMBOL, "Expected 'symbol' at beginning");
-    if (current_token.type != TOK_STRING) {
-        error("Expected string literal after 'symbol'");
+Program *parse_program_r(const char *source, char *err, size_t errlen) {
+    Program *volatile program = (Program*)malloc(sizeof(Program));
+    if (!program) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    arena_init(&program->arena);
+    program->params = NULL;
+    program->param_count = 0;
+
+    Parser parser;
+    Parser *p = &parser;
+    p->arena = &program->arena;
+    p->program = program;
+    p->err = err;
+    p->errlen = errlen;
+    if (setjmp(p->on_error)) {
+        free_program(program);
+        return NULL;
     }
-    char *sym = strdup(current_token.lexeme);
-    advance();
 
-    Rule *rules = parse_rule_list();
+    init_lexer(&p->lexer, source);
+    advance(p); // load first token
 
-    if (current_token.type != TOK_EOF) {
-        error("Expected end of input");
+    consume(p, TOK_SYMBOL, "Expected 'symbol' at beginning");
+    if (p->current_token.type != TOK_STRING) {
+        error(p, "Expected string literal after 'symbol'");
     }
+    program->symbol = token_text(p);
+    advance(p);
 
-    return new_program(sym, rules);
-}
+    parse_params(p, program);
+    program->rules = parse_rule_list(p);
 
-/* Very simple free routine (leaks some inner strings, OK for skeleton) */
-
-static void free_expr(Expr *e) {
-    if (!e) return;
-    switch (e->kind) {
-        case EXPR_CALL:
-            for (int i = 0; i < e->as.call.arg_count; ++i)
-                free_expr(e->as.call.args[i]);
-            free(e->as.call.args);
-            free(e->as.call.func_name);
-            break;
-        case EXPR_IDENT:
-            free(e->as.ident.name);
-            break;
-        case EXPR_STRING:
-            free(e->as.string.value);
-            break;
-        case EXPR_BINARY:
-        case EXPR_UNARY:
-            free_expr(e->as.op.left);
-            if (e->as.op.right) free_expr(e->as.op.right);
-            break;
-        case EXPR_NUMBER:
-        default:
-            break;
+    if (p->current_token.type != TOK_EOF) {
+        error(p, "Expected end of input");
     }
-    free(e);
-}
 
-static void free_stmt(Stmt *s) {
-    while (s) {
-        Stmt *next = s->next;
-        free(s);
-        s = next;
-    }
+    return program;
 }
 
-static void free_rule(Rule *r) {
-    while (r) {
-        Rule *next = r->next;
-        free_expr(r->condition);
-        free_stmt(r->action);
-        free(r);
-        r = next;
+Program *parse_program(const char *source) {
+    char err[256];
+    Program *program = parse_program_r(source, err, sizeof(err));
+    if (!program) {
+        fprintf(stderr, "%s\n", err);
+        exit(1);
     }
+    return program;
 }
 
+/* The whole tree lives in the program's arena */
 void free_program(Program *program) {
     if (!program) return;
-    free(program->symbol);
-    free_rule(program->rules);
+    arena_free(&program->arena);
     free(program);
 }
@@ -0,0 +1,197 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "ast.h"
+
+/* ---------- Opcode profiler ----------
+ *
+ * run_chunk_profiled reads the clock at every dispatch and charges the
+ * ticks since the previous one to the instruction that just ran, so each
+ * instruction's total covers its handler plus one clock read. The read is
+ * measured once in init_profile and taken off per execution in the report.
+ * Indicator updates and signal delivery are charged to the IND_UPDATE and
+ * BUY/SELL that call them. With a source map the report also sums the
+ * ticks per rule and shows how often each rule fired.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TICK_UNIT "cycles"
+#else
+#define TICK_UNIT "ns"
+#endif
+
+uint64_t profile_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static uint64_t clock_overhead(void) {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t a = profile_clock();
+        uint64_t b = profile_clock();
+        if (b - a < best) best = b - a;
+    }
+    return best;
+}
+
+void init_profile(VMProfile *profile, const Chunk *chunk) {
+    size_t n = (size_t)(chunk->instr_count > 0 ? chunk->instr_count : 1);
+    profile->chunk = chunk;
+    profile->counts = (uint64_t*)calloc(n, sizeof(uint64_t));
+    profile->ticks = (uint64_t*)calloc(n, sizeof(uint64_t));
+    if (!profile->counts || !profile->ticks) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    profile->bars = 0;
+    profile->overhead = clock_overhead();
+}
+
+void free_profile(VMProfile *profile) {
+    free(profile->counts);
+    free(profile->ticks);
+    profile->counts = profile->ticks = NULL;
+}
+
+typedef struct {
+    uint64_t ticks;
+    uint64_t count;
+    int key;          // opcode or instruction index
+} ProfileRow;
+
+static int by_ticks_desc(const void *pa, const void *pb) {
+    const ProfileRow *a = (const ProfileRow*)pa, *b = (const ProfileRow*)pb;
+    if (a->ticks != b->ticks) return a->ticks < b->ticks ? 1 : -1;
+    return a->key - b->key;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * (double)part / (double)total : 0.0;
+}
+
+/* Per rule: share of the ticks and how often its action ran. The shared
+ * indicator updates and temps are their own row. */
+typedef struct {
+    uint64_t ticks;
+    uint64_t fired;
+    int line;         // first source line of the rule
+    int rule;         // -1: shared
+} RuleRow;
+
+static int rules_by_ticks_desc(const void *pa, const void *pb) {
+    const RuleRow *a = (const RuleRow*)pa, *b = (const RuleRow*)pb;
+    if (a->ticks != b->ticks) return a->ticks < b->ticks ? 1 : -1;
+    return a->rule - b->rule;
+}
+
+static void print_rules(const VMProfile *profile, const int *offsets, const uint64_t *net,
+                        uint64_t total, FILE *out) {
+    const Chunk *chunk = profile->chunk;
+    int rules = 0;
+    for (int i = 0; i < chunk->line_count; ++i) {
+        if (chunk->lines[i].rule + 1 > rules) rules = chunk->lines[i].rule + 1;
+    }
+    /* row 0 is the shared part, rule r is row r + 1 */
+    RuleRow *rows = (RuleRow*)calloc((size_t)rules + 1, sizeof(RuleRow));
+    if (!rows) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    for (int r = 0; r <= rules; ++r) rows[r].rule = r - 1;
+
+    for (int i = 0; i < chunk->instr_count; ++i) {
+        int rule;
+        int line = chunk_line(chunk, offsets[i], &rule);
+        RuleRow *row = &rows[rule + 1];
+        row->ticks += net[i];
+        if (line > 0 && (row->line == 0 || line < row->line)) row->line = line;
+        OpCode op = (OpCode)chunk->instrs[i].op;
+        if (op == BC_BUY || op == BC_SELL) row->fired += profile->counts[i];
+    }
+    qsort(rows, (size_t)rules + 1, sizeof(RuleRow), rules_by_ticks_desc);
+
+    double bars = profile->bars ? (double)profile->bars : 1.0;
+    fprintf(out, "\n%-8s %6s %7s %14s %8s\n", "rule", "line", "%", TICK_UNIT "/bar", "fired");
+    for (int r = 0; r <= rules; ++r) {
+        const RuleRow *row = &rows[r];
+        if (row->rule < 0) {
+            if (row->ticks == 0) continue;
+            fprintf(out, "%-8s %6s %6.1f%% %14.1f %8s\n", "shared", "-",
+                    percent(row->ticks, total), (double)row->ticks / bars, "-");
+        } else {
+            fprintf(out, "%-8d %6d %6.1f%% %14.1f %7.1f%%\n", row->rule, row->line,
+                    percent(row->ticks, total), (double)row->ticks / bars,
+                    100.0 * (double)row->fired / bars);
+        }
+    }
+    free(rows);
+}
+
+/* Tables, hottest first: totals per opcode, per rule (with a source map),
+ * then every instruction that ran, with its line and disassembly */
+void print_profile(const VMProfile *profile, FILE *out) {
+    const Chunk *chunk = profile->chunk;
+    int n = chunk->instr_count;
+    ProfileRow *rows = (ProfileRow*)calloc((size_t)n + 1, sizeof(ProfileRow));
+    ProfileRow ops[BC_OPCODE_COUNT];
+    int *offsets = (int*)malloc(((size_t)n + 1) * sizeof(int));
+    uint64_t *net = (uint64_t*)malloc(((size_t)n + 1) * sizeof(uint64_t));
+    if (!rows || !offsets || !net) { fprintf(stderr, "Out of memory\n"); exit(1); }
+
+    for (int op = 0; op < BC_OPCODE_COUNT; ++op) {
+        ops[op].ticks = ops[op].count = 0;
+        ops[op].key = op;
+    }
+    uint64_t total = 0, executed = 0;
+    int offset = 0;
+    for (int i = 0; i < n; ++i) {
+        uint64_t cost = profile->overhead * profile->counts[i];
+        uint64_t ticks = profile->ticks[i] > cost ? profile->ticks[i] - cost : 0;
+        net[i] = rows[i].ticks = ticks;
+        rows[i].count = profile->counts[i];
+        rows[i].key = i;
+        offsets[i] = offset;
+        ops[chunk->instrs[i].op].ticks += ticks;
+        ops[chunk->instrs[i].op].count += profile->counts[i];
+        total += ticks;
+        executed += profile->counts[i];
+        offset += instruction_length(chunk, offset);
+    }
+    qsort(rows, (size_t)n, sizeof(ProfileRow), by_ticks_desc);
+    qsort(ops, BC_OPCODE_COUNT, sizeof(ProfileRow), by_ticks_desc);
+
+    double bars = profile->bars ? (double)profile->bars : 1.0;
+    fprintf(out, "== profile: %zu bars, %.1f instructions and %.1f " TICK_UNIT " per bar"
+                 " (clock read of %llu " TICK_UNIT " excluded) ==\n",
+            profile->bars, (double)executed / bars, (double)total / bars,
+            (unsigned long long)profile->overhead);
+
+    fprintf(out, "%-22s %12s %14s %10s %7s\n", "opcode", "count", TICK_UNIT, "per exec", "%");
+    for (int i = 0; i < BC_OPCODE_COUNT; ++i) {
+        if (ops[i].count == 0) continue;
+        fprintf(out, "%-22s %12llu %14llu %10.1f %6.1f%%\n", opcode_name((OpCode)ops[i].key),
+                (unsigned long long)ops[i].count, (unsigned long long)ops[i].ticks,
+                (double)ops[i].ticks / (double)ops[i].count, percent(ops[i].ticks, total));
+    }
+
+    if (chunk->line_count > 0) print_rules(profile, offsets, net, total, out);
+
+    fprintf(out, "\n%6s %12s %10s %6s  %s\n", "%", "count", "per exec", "line", "instruction");
+    for (int i = 0; i < n; ++i) {
+        if (rows[i].count == 0) continue;
+        int line = chunk_line(chunk, offsets[rows[i].key], NULL);
+        fprintf(out, "%5.1f%% %12llu %10.1f %6d  ", percent(rows[i].ticks, total),
+                (unsigned long long)rows[i].count, (double)rows[i].ticks / (double)rows[i].count,
+                line);
+        disassemble_instruction(chunk, offsets[rows[i].key], out);
+    }
+
+    free(net);
+    free(offsets);
+    free(rows);
+}
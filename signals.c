@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include "ast.h"
+
+/* ---------- Signal consumers ----------
+ *
+ * The VMs never format or buffer signals themselves: each BUY/SELL becomes
+ * a 24-byte Signal handed to a SignalSink. These are the stock sinks:
+ * collect into a growable buffer, print the classic text line, or push
+ * into a preallocated SPSC ring for another thread (an order router, a
+ * printer) to drain.
+ */
+
+void collect_signal(void *buffer, const Signal *sig) {
+    SignalBuffer *out = (SignalBuffer*)buffer;
+    if (out->count == out->capacity) {
+        out->capacity = out->capacity ? out->capacity * 2 : 64;
+        out->items = (Signal*)realloc(out->items, out->capacity * sizeof(Signal));
+        if (!out->items) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    }
+    out->items[out->count++] = *sig;
+}
+
+void free_signals(SignalBuffer *out) {
+    free(out->items);
+    out->items = NULL;
+    out->count = out->capacity = 0;
+}
+
+void print_signal(void *printer, const Signal *sig) {
+    const SignalPrinter *p = (const SignalPrinter*)printer;
+    fprintf(p->out ? p->out : stdout, "SYMBOL %s: %s %d\n", p->symbols[sig->symbol_id],
+            sig->side == BC_BUY ? "BUY" : "SELL", sig->qty);
+}
+
+/* ---------- SPSC ring ----------
+ *
+ * head and tail only ever grow; the slot is the index masked by the
+ * capacity. The producer publishes a record with a release store of tail
+ * and the consumer frees its slot with a release store of head. Each side
+ * re-reads the other's index (an acquire load, and a cache miss when the
+ * other thread just wrote it) only when its cached copy says the ring is
+ * full or empty.
+ */
+
+int init_signal_ring(SignalRing *ring, size_t capacity) {
+    size_t n = 1;
+    while (n < capacity) n <<= 1;
+    ring->items = (Signal*)malloc(n * sizeof(Signal));
+    if (!ring->items) return -1;
+    ring->mask = n - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->head_seen = ring->tail_seen = 0;
+    return 0;
+}
+
+void free_signal_ring(SignalRing *ring) {
+    free(ring->items);
+    ring->items = NULL;
+}
+
+int signal_ring_push(SignalRing *ring, const Signal *sig) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - ring->head_seen > ring->mask) {
+        ring->head_seen = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - ring->head_seen > ring->mask) return -1;   // full
+    }
+    ring->items[tail & ring->mask] = *sig;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+int signal_ring_pop(SignalRing *ring, Signal *sig) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == ring->tail_seen) {
+        ring->tail_seen = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == ring->tail_seen) return 0;                 // empty
+    }
+    *sig = ring->items[head & ring->mask];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+void ring_signal(void *ring, const Signal *sig) {
+    while (signal_ring_push((SignalRing*)ring, sig) != 0) sched_yield();
+}
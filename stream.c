@@ -0,0 +1,330 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "ast.h"
+
+/* ---------- Live bar feed ----------
+ *
+ * run_stream reads the feed into one fixed buffer, runs every complete
+ * bar in it, and moves the partial tail to the front before the next
+ * read(), so nothing is allocated per bar. Text lines are parsed in place
+ * (the newline becomes the terminator). Signals are staged with the time
+ * their bar's bytes arrived and written out with one fflush per batch:
+ * when the batch is full and after every read. The latency reported is
+ * from that read to the flush that made the signal visible.
+ */
+
+#define STREAM_BUFFER (64 * 1024)
+#define STREAM_BATCH 256
+
+/* Log-linear latency histogram in ns: exact below 8, then 8 buckets per
+ * power of two (12.5% resolution) */
+#define LATENCY_BUCKETS (62 * 8)
+
+typedef struct {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} LatencyHistogram;
+
+static int latency_bucket(uint64_t ns) {
+    if (ns < 8) return (int)ns;
+    int octave = 3;
+    while (octave < 63 && (ns >> (octave + 1)) != 0) octave++;
+    return (octave - 2) * 8 + (int)((ns >> (octave - 3)) & 7);
+}
+
+static uint64_t bucket_floor(int bucket) {
+    if (bucket < 8) return (uint64_t)bucket;
+    int octave = bucket / 8 + 2;
+    return (uint64_t)(8 + bucket % 8) << (octave - 3);
+}
+
+static void record_latency(LatencyHistogram *h, uint64_t ns) {
+    h->counts[latency_bucket(ns)]++;
+    h->total++;
+    if (ns > h->max) h->max = ns;
+}
+
+static uint64_t latency_percentile(const LatencyHistogram *h, double p) {
+    if (h->total == 0) return 0;
+    uint64_t rank = (uint64_t)(p * (double)(h->total - 1)) + 1, seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+        seen += h->counts[b];
+        if (seen >= rank) return bucket_floor(b);
+    }
+    return h->max;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct {
+    Signal sig;
+    uint64_t received;   // when the bar that fired it was read
+} PendingSignal;
+
+typedef struct {
+    PendingSignal pending[STREAM_BATCH];
+    int count;
+    uint64_t received;   // of the bars being run now
+    SignalPrinter printer;
+    LatencyHistogram latency;
+    size_t signals;
+} SignalBatch;
+
+static void flush_batch(SignalBatch *batch) {
+    if (batch->count == 0) return;
+    for (int i = 0; i < batch->count; ++i) print_signal(&batch->printer, &batch->pending[i].sig);
+    fflush(batch->printer.out);
+    uint64_t now = now_ns();
+    for (int i = 0; i < batch->count; ++i) record_latency(&batch->latency, now - batch->pending[i].received);
+    batch->signals += (size_t)batch->count;
+    batch->count = 0;
+}
+
+static void stage_signal(void *user, const Signal *sig) {
+    SignalBatch *batch = (SignalBatch*)user;
+    if (batch->count == STREAM_BATCH) flush_batch(batch);
+    batch->pending[batch->count].sig = *sig;
+    batch->pending[batch->count].received = batch->received;
+    batch->count++;
+}
+
+typedef struct {
+    Chunk *chunk;
+    JitCode *jit;
+    IndicatorState ind;
+    SignalSink sink;
+    size_t bars;
+    size_t malformed;
+    long lineno;
+    int ticks;
+} Feed;
+
+static void run_bar(Feed *feed, const VMContext *ctx) {
+    if (feed->jit) jit_run(feed->jit, &feed->ind, ctx, &feed->sink);
+    else run_chunk(feed->chunk, &feed->ind, ctx, &feed->sink);
+    feed->bars++;
+}
+
+/* Fills the fields --convert derives: hour, minute, weekday */
+static int finish_context(VMContext *ctx, int date, int hour, int minute) {
+    int month = (date / 100) % 100, day = date % 100;
+    if (month < 1 || month > 12 || day < 1 || day > 31 ||
+        hour < 0 || hour > 23 || minute < 0 || minute > 59) return 0;
+    ctx->date = date;
+    ctx->time = hour * 100 + minute;
+    ctx->hour = hour;
+    ctx->minute = minute;
+    ctx->weekday = date_weekday(date);
+    return 1;
+}
+
+static int read_digits(const char **s, int n, int *out) {
+    int v = 0;
+    for (int i = 0; i < n; ++i) {
+        char c = (*s)[i];
+        if (c < '0' || c > '9') return 0;
+        v = v * 10 + (c - '0');
+    }
+    *s += n;
+    *out = v;
+    return 1;
+}
+
+/* date,time,open,high,low,close,volume in the formats --convert accepts,
+ * or with `ticks` date,time,price,size: one trade, run as a bar whose
+ * four prices are equal. Times may carry seconds (HH:MM:SS, HHMMSS). */
+static int parse_bar_line(const char *p, VMContext *ctx, int ticks) {
+    int y, m, d, hour, minute, second;
+    if (!read_digits(&p, 4, &y)) return 0;
+    if (*p == '-') {
+        ++p;
+        if (!read_digits(&p, 2, &m) || *p++ != '-' || !read_digits(&p, 2, &d)) return 0;
+    } else if (!read_digits(&p, 2, &m) || !read_digits(&p, 2, &d)) {
+        return 0;
+    }
+    if (*p++ != ',') return 0;
+
+    if (p[0] != '\0' && p[1] == ':') {      // H:MM
+        if (!read_digits(&p, 1, &hour)) return 0;
+    } else if (!read_digits(&p, 2, &hour)) {
+        return 0;
+    }
+    if (*p == ':') ++p;
+    if (!read_digits(&p, 2, &minute)) return 0;
+    if (*p == ':') ++p;
+    if (*p >= '0' && *p <= '9' && !read_digits(&p, 2, &second)) return 0;
+    if (!finish_context(ctx, y * 10000 + m * 100 + d, hour, minute)) return 0;
+
+    double v[5];
+    int fields = ticks ? 2 : 5;
+    for (int i = 0; i < fields; ++i) {
+        if (*p++ != ',') return 0;
+        while (*p == ' ') ++p;
+        if (!((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.')) return 0;
+        char *end;
+        v[i] = strtod(p, &end);
+        if (end == p) return 0;
+        p = end;
+    }
+    while (*p == ' ' || *p == '\t' || *p == '\r') ++p;
+    if (*p != '\0') return 0;
+    if (ticks) {
+        ctx->open = ctx->high = ctx->low = ctx->close = v[0];
+        ctx->volume = v[1];
+        return 1;
+    }
+    ctx->open = v[0];
+    ctx->high = v[1];
+    ctx->low = v[2];
+    ctx->close = v[3];
+    ctx->volume = v[4];
+    return 1;
+}
+
+static void run_line(Feed *feed, char *line) {
+    feed->lineno++;
+    if (line[0] == '\0' || line[0] == '\r' || line[0] == '#') return;
+    if (feed->lineno == 1 && !(line[0] >= '0' && line[0] <= '9')) return;   // header
+    VMContext ctx;
+    if (!parse_bar_line(line, &ctx, feed->ticks)) {
+        fprintf(stderr, "stream:%ld: expected %s; skipped\n", feed->lineno,
+                feed->ticks ? "date,time,price,size" : "date,time,open,high,low,close,volume");
+        feed->malformed++;
+        return;
+    }
+    run_bar(feed, &ctx);
+}
+
+/* Runs the complete lines in buf[0, len), and at EOF the unterminated
+ * last one; returns the bytes consumed. buf has a spare byte at len. */
+static size_t run_lines(Feed *feed, char *buf, size_t len, int eof) {
+    size_t start = 0;
+    for (;;) {
+        char *nl = (char*)memchr(buf + start, '\n', len - start);
+        if (!nl) break;
+        *nl = '\0';
+        run_line(feed, buf + start);
+        start = (size_t)(nl - buf) + 1;
+    }
+    if (eof && start < len) {
+        buf[len] = '\0';
+        run_line(feed, buf + start);
+        start = len;
+    }
+    return start;
+}
+
+static size_t run_records(Feed *feed, const char *buf, size_t len) {
+    size_t n = len / sizeof(BarRecord);
+    for (size_t i = 0; i < n; ++i) {
+        BarRecord r;
+        memcpy(&r, buf + i * sizeof(BarRecord), sizeof(r));
+        VMContext ctx;
+        ctx.open = r.open;
+        ctx.high = r.high;
+        ctx.low = r.low;
+        ctx.close = r.close;
+        ctx.volume = r.volume;
+        if (!finish_context(&ctx, r.date, r.time / 100, r.time % 100)) {
+            fprintf(stderr, "stream: record %zu: bad date %d or time %d; skipped\n",
+                    feed->bars + feed->malformed, (int)r.date, (int)r.time);
+            feed->malformed++;
+            continue;
+        }
+        run_bar(feed, &ctx);
+    }
+    return n * sizeof(BarRecord);
+}
+
+int run_stream(Chunk *chunk, int fd, const char *symbol, const StreamOptions *opts,
+               FILE *out, FILE *report) {
+    char *buf = (char*)malloc(STREAM_BUFFER + 1);
+    SignalBatch *batch = (SignalBatch*)calloc(1, sizeof(SignalBatch));
+    if (!buf || !batch) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    batch->printer.symbols = &symbol;
+    batch->printer.out = out;
+
+    Feed feed;
+    memset(&feed, 0, sizeof(feed));
+    feed.chunk = chunk;
+    feed.jit = opts ? opts->jit : NULL;
+    feed.ticks = opts && opts->ticks;
+    feed.sink.emit = stage_signal;
+    feed.sink.user = batch;
+    init_indicators(&feed.ind, chunk);
+    int binary = opts && opts->binary;
+
+    size_t have = 0;
+    int skipping = 0;     // inside a line longer than the buffer
+    int status = 0;
+    uint64_t busy = 0, start = now_ns();
+    for (;;) {
+        ssize_t n = read(fd, buf + have, STREAM_BUFFER - have);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("stream: read");
+            status = -1;
+            break;
+        }
+        uint64_t t0 = now_ns();
+        int eof = n == 0;
+        batch->received = t0;
+        have += (size_t)n;
+
+        size_t used = 0;
+        if (binary) {
+            used = run_records(&feed, buf, have);
+        } else {
+            if (skipping) {
+                char *nl = (char*)memchr(buf, '\n', have);
+                used = nl ? (size_t)(nl - buf) + 1 : have;
+                skipping = nl == NULL;
+            }
+            if (!skipping) used += run_lines(&feed, buf + used, have - used, eof);
+            if (used == 0 && have == STREAM_BUFFER) {
+                feed.lineno++;
+                fprintf(stderr, "stream:%ld: line longer than %d bytes; skipped\n",
+                        feed.lineno, STREAM_BUFFER);
+                feed.malformed++;
+                skipping = 1;
+                used = have;
+            }
+        }
+        memmove(buf, buf + used, have - used);
+        have -= used;
+        flush_batch(batch);
+        busy += now_ns() - t0;
+        if (eof) break;
+    }
+    if (binary && have > 0)
+        fprintf(stderr, "stream: %zu trailing bytes (not a whole record) ignored\n", have);
+    double wall = (double)(now_ns() - start) / 1e9;
+    free_indicators(&feed.ind);
+
+    if (report) {
+        double secs = (double)busy / 1e9;
+        fprintf(report, "== stream: %zu bars, %zu signals, %zu malformed; "
+                        "%.0f bars/s busy, %.0f bars/s wall ==\n",
+                feed.bars, batch->signals, feed.malformed,
+                secs > 0 ? (double)feed.bars / secs : 0.0,
+                wall > 0 ? (double)feed.bars / wall : 0.0);
+        if (batch->latency.total)
+            fprintf(report, "bar to signal: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+                    (double)latency_percentile(&batch->latency, 0.50) / 1e3,
+                    (double)latency_percentile(&batch->latency, 0.99) / 1e3,
+                    (double)batch->latency.max / 1e3);
+    }
+    free(batch);
+    free(buf);
+    return status;
+}
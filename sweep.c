@@ -0,0 +1,403 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "ast.h"
+
+/* ---------- Parameter sweep ----------
+ *
+ * Every combination owns an IndicatorState sized by its own parameter
+ * values, and the whole grid walks each symbol together, one span of
+ * bars at a time, so the span's columns stay in cache while every
+ * combination reads them. A span has two phases, each ended by a
+ * barrier:
+ *
+ *   1. every distinct indicator key (function, input field, period) is
+ *      computed once over the span into a column of its own;
+ *   2. every combination runs the batch VM over the span, its shared
+ *      slots fed from those columns (IndicatorState.feeds) instead of
+ *      updating their own state.
+ *
+ * A slot is shared when its input is a plain field: the instruction
+ * before its IND_UPDATE is a LOAD_VAR. With no timeframes nothing jumps
+ * into the update preamble, so every bar updates every slot, which is
+ * what the key columns assume. sma(close, fast) over fast = 5..50 and
+ * slow = 20..200 is then 46 + 181 SMAs per bar, not two per combination.
+ *
+ * Work inside a phase is claimed one key or combination at a time, and
+ * whoever claims it at a symbol's first span resets it. The last worker
+ * to reach a barrier resets the counter of the phase just finished.
+ */
+
+#define SWEEP_SPAN 16384
+#define SWEEP_MIN_SPAN 1024
+#define SWEEP_COLUMN_BUDGET ((size_t)64 << 20)   // bytes of key columns
+
+size_t sweep_size(const SweepAxis *axes, int axis_count) {
+    size_t n = 1;
+    for (int a = 0; a < axis_count; ++a) {
+        if (axes[a].count <= 0 || n > SWEEP_MAX / (size_t)axes[a].count) return 0;
+        n *= (size_t)axes[a].count;
+    }
+    return n;
+}
+
+void sweep_values(const Chunk *chunk, const SweepAxis *axes, int axis_count,
+                  size_t combination, double *values) {
+    for (int p = 0; p < chunk->param_count; ++p) values[p] = chunk->params[p].value;
+    for (int a = axis_count - 1; a >= 0; --a) {
+        size_t n = (size_t)axes[a].count;
+        values[axes[a].param] = axes[a].values[combination % n];
+        combination /= n;
+    }
+}
+
+typedef struct {
+    int func;
+    int var;
+    int period;
+} SweepKey;
+
+typedef struct {
+    SweepKey key;
+    IndicatorState state;   // one slot, reset at each symbol's first span
+    double *column;         // this span's outputs
+} SharedIndicator;
+
+typedef struct {
+    double cash;
+    double position;
+    size_t signals;
+    const double *close;    // of the symbol: Signal.bar counts from its first bar
+} Book;
+
+typedef struct {
+    const Chunk *chunk;
+    const BacktestSymbol *universe;
+    int count;
+    size_t span;
+    SharedIndicator *shared;
+    int shared_count;
+    IndicatorState *states;     // per combination
+    Book *books;
+    SweepResult *results;
+    size_t combinations;
+
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+    int workers;
+    int arrived;
+    unsigned long generation;
+    int next_key;
+    size_t next_combination;
+} SweepPool;
+
+static void book_signal(void *user, const Signal *sig) {
+    Book *book = (Book*)user;
+    double value = (double)sig->qty * book->close[sig->bar];
+    if (sig->side == BC_BUY) {
+        book->position += sig->qty;
+        book->cash -= value;
+    } else {
+        book->position -= sig->qty;
+        book->cash += value;
+    }
+    book->signals++;
+}
+
+/* Waits for every worker; the last to arrive resets the counter of the
+ * phase that just ended (1: keys, 2: combinations) and releases them. */
+static void sweep_barrier(SweepPool *pool, int phase) {
+    pthread_mutex_lock(&pool->lock);
+    unsigned long generation = pool->generation;
+    if (++pool->arrived == pool->workers) {
+        if (phase == 1) pool->next_key = 0;
+        else pool->next_combination = 0;
+        pool->arrived = 0;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->turn);
+    } else {
+        while (generation == pool->generation) pthread_cond_wait(&pool->turn, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static int claim_key(SweepPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    int k = pool->next_key < pool->shared_count ? pool->next_key++ : -1;
+    pthread_mutex_unlock(&pool->lock);
+    return k;
+}
+
+static size_t claim_combination(SweepPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    size_t c = pool->next_combination < pool->combinations ? pool->next_combination++
+                                                           : pool->combinations;
+    pthread_mutex_unlock(&pool->lock);
+    return c;
+}
+
+static double series_value(const BarColumns *bars, int var, size_t i) {
+    switch (var) {
+        case VAR_OPEN:    return bars->open[i];
+        case VAR_HIGH:    return bars->high[i];
+        case VAR_LOW:     return bars->low[i];
+        case VAR_CLOSE:   return bars->close[i];
+        case VAR_VOLUME:  return bars->volume[i];
+        case VAR_DATE:    return (double)bars->date[i];
+        case VAR_TIME:    return (double)bars->time[i];
+        case VAR_HOUR:    return (double)bars->hour[i];
+        case VAR_MINUTE:  return (double)bars->minute[i];
+        default:          return (double)bars->weekday[i];
+    }
+}
+
+/* The span [start, start + n) of sym as columns of their own */
+static BarColumns span_view(const BarColumns *bars, size_t start, size_t n) {
+    BarColumns v = {
+        bars->open + start, bars->high + start, bars->low + start, bars->close + start,
+        bars->volume + start, bars->date + start, bars->time + start, bars->hour + start,
+        bars->minute + start, bars->weekday + start, n
+    };
+    return v;
+}
+
+static void *sweep_main(void *arg) {
+    SweepPool *pool = (SweepPool*)arg;
+
+    for (int s = 0; s < pool->count; ++s) {
+        const BarColumns *bars = &pool->universe[s].bars;
+        for (size_t start = 0; start < bars->count; start += pool->span) {
+            size_t n = bars->count - start < pool->span ? bars->count - start : pool->span;
+            int last = start + n == bars->count;
+            BarColumns view = span_view(bars, start, n);
+
+            for (int k; (k = claim_key(pool)) >= 0; ) {
+                SharedIndicator *sh = &pool->shared[k];
+                if (start == 0) reset_indicators(&sh->state);
+                Indicator *slot = &sh->state.slots[0];
+                IndicatorUpdate update = indicator_function(sh->key.func);
+                for (size_t i = 0; i < n; ++i)
+                    sh->column[i] = update(slot, series_value(&view, sh->key.var, i));
+            }
+            sweep_barrier(pool, 1);
+
+            for (size_t c; (c = claim_combination(pool)) < pool->combinations; ) {
+                IndicatorState *ind = &pool->states[c];
+                Book *book = &pool->books[c];
+                if (start == 0) {
+                    reset_indicators(ind);
+                    book->cash = book->position = 0.0;
+                }
+                book->close = bars->close;
+                SignalSink sink = { book_signal, book, (uint32_t)s };
+                run_chunk_batch(pool->chunk, ind, &view, &sink);
+                if (last) {
+                    pool->results[c].pnl += book->cash + book->position * view.close[n - 1];
+                    pool->results[c].signals += book->signals;
+                    book->signals = 0;
+                }
+            }
+            sweep_barrier(pool, 2);
+        }
+    }
+    return NULL;
+}
+
+static int sweep_error(char *err, size_t errlen, const char *fmt, const char *name, double value) {
+    if (err && errlen) snprintf(err, errlen, fmt, name, value, TLC_PERIOD_MAX);
+    return -1;
+}
+
+/* The field a slot's IND_UPDATE reads, or -1 when its input is computed */
+static void slot_inputs(const Chunk *chunk, int *var) {
+    for (int s = 0; s < chunk->slot_count; ++s) var[s] = -1;
+    int previous = -1;
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset)) {
+        const uint8_t *p = chunk->code + offset;
+        if (p[0] == BC_IND_UPDATE && previous >= 0 && chunk->code[previous] == BC_LOAD_VAR) {
+            int slot = p[2] | (p[3] << 8);
+            if (slot < chunk->slot_count) var[slot] = chunk->code[previous + 1];
+        }
+        previous = offset;
+    }
+}
+
+static int find_key(const SharedIndicator *shared, int count, const SweepKey *key) {
+    for (int k = 0; k < count; ++k) {
+        if (memcmp(&shared[k].key, key, sizeof(*key)) == 0) return k;
+    }
+    return -1;
+}
+
+int run_sweep(const Chunk *chunk, const BacktestSymbol *universe, int count,
+              const SweepAxis *axes, int axis_count, const SweepOptions *opts,
+              SweepResult *results, SweepStats *stats, char *err, size_t errlen) {
+    size_t combinations = sweep_size(axes, axis_count);
+    if (combinations == 0) {
+        if (err && errlen) snprintf(err, errlen, "a sweep needs 1 to %d combinations", SWEEP_MAX);
+        return -1;
+    }
+    for (int a = 0; a < axis_count; ++a) {
+        if (axes[a].param < 0 || axes[a].param >= chunk->param_count) {
+            if (err && errlen) snprintf(err, errlen, "sweep axis %d names no parameter", a);
+            return -1;
+        }
+        for (int b = 0; b < a; ++b) {
+            if (axes[b].param == axes[a].param) {
+                if (err && errlen) snprintf(err, errlen, "parameter %s is swept twice",
+                                            chunk->params[axes[a].param].name);
+                return -1;
+            }
+        }
+        /* a period parameter sizes indicator state: whole and in range */
+        for (int s = 0; s < chunk->slot_count; ++s) {
+            if (chunk->slots[s].param != axes[a].param) continue;
+            for (int i = 0; i < axes[a].count; ++i) {
+                double v = axes[a].values[i];
+                if (!(v >= 1 && v <= TLC_PERIOD_MAX) || v != (double)(int)v)
+                    return sweep_error(err, errlen, "parameter %s is a period; %g is not a whole "
+                                       "number between 1 and %d", chunk->params[axes[a].param].name, v);
+            }
+        }
+    }
+    memset(results, 0, combinations * sizeof(SweepResult));
+
+    int threads = opts ? opts->threads : 0;
+    int share = opts ? opts->share : 1;
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    if ((size_t)threads > combinations) threads = (int)combinations;
+
+    int slots = chunk->slot_count;
+    int *input = (int*)malloc((size_t)(slots ? slots : 1) * sizeof(int));
+    double *values = (double*)malloc((size_t)(chunk->param_count ? chunk->param_count : 1) * sizeof(double));
+    IndicatorState *states = (IndicatorState*)malloc(combinations * sizeof(IndicatorState));
+    Book *books = (Book*)calloc(combinations, sizeof(Book));
+    const double **feeds = slots ? (const double**)calloc(combinations * (size_t)slots, sizeof(double*)) : NULL;
+    int *key_of = slots ? (int*)malloc(combinations * (size_t)slots * sizeof(int)) : NULL;
+    if (!input || !values || !states || !books || (slots && (!feeds || !key_of))) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    slot_inputs(chunk, input);
+    if (!share || chunk->timeframes) {
+        for (int s = 0; s < slots; ++s) input[s] = -1;
+    }
+
+    /* distinct keys over the grid; key_of[c * slots + s] for the feeds */
+    SharedIndicator *shared = NULL;
+    int shared_count = 0, shared_cap = 0;
+    size_t unshared = 0;
+    for (size_t c = 0; c < combinations; ++c) {
+        sweep_values(chunk, axes, axis_count, c, values);
+        init_indicators_with(&states[c], chunk, values);
+        for (int s = 0; s < slots; ++s) {
+            key_of[c * (size_t)slots + (size_t)s] = -1;
+            if (input[s] < 0) {
+                unshared++;
+                continue;
+            }
+            SweepKey key;
+            memset(&key, 0, sizeof(key));
+            key.func = chunk->slots[s].func;
+            key.var = input[s];
+            key.period = states[c].slots[s].period;
+            /* the last axis varies fastest: usually the previous key */
+            int k = c > 0 && key_of[(c - 1) * (size_t)slots + (size_t)s] >= 0 &&
+                    memcmp(&shared[key_of[(c - 1) * (size_t)slots + (size_t)s]].key, &key, sizeof(key)) == 0
+                  ? key_of[(c - 1) * (size_t)slots + (size_t)s] : find_key(shared, shared_count, &key);
+            if (k < 0) {
+                if (shared_count == shared_cap) {
+                    shared_cap = shared_cap ? shared_cap * 2 : 16;
+                    shared = (SharedIndicator*)realloc(shared, (size_t)shared_cap * sizeof(SharedIndicator));
+                    if (!shared) { fprintf(stderr, "Out of memory\n"); exit(1); }
+                }
+                k = shared_count++;
+                shared[k].key = key;
+            }
+            key_of[c * (size_t)slots + (size_t)s] = k;
+        }
+    }
+
+    /* one-slot shapes size each key's state; its columns share the budget */
+    size_t span = SWEEP_SPAN;
+    double *columns = NULL;
+    if (shared_count > 0) {
+        size_t column_bytes = (size_t)shared_count * sizeof(double);   // per bar of span
+        if (SWEEP_COLUMN_BUDGET / column_bytes < span) span = SWEEP_COLUMN_BUDGET / column_bytes;
+        if (span < SWEEP_MIN_SPAN) span = SWEEP_MIN_SPAN;
+        columns = (double*)malloc(column_bytes * span);
+        if (!columns) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    }
+    for (int k = 0; k < shared_count; ++k) {
+        IndicatorSlot slot = { shared[k].key.func, shared[k].key.period, -1 };
+        Chunk shape;
+        init_chunk(&shape);
+        shape.slots = &slot;
+        shape.slot_count = 1;
+        init_indicators(&shared[k].state, &shape);
+        shared[k].column = columns + (size_t)k * span;
+    }
+    for (size_t c = 0; c < combinations && shared_count > 0; ++c) {
+        const double **feed = feeds + c * (size_t)slots;
+        for (int s = 0; s < slots; ++s) {
+            int k = key_of[c * (size_t)slots + (size_t)s];
+            if (k >= 0) feed[s] = shared[k].column;
+        }
+        states[c].feeds = feed;
+    }
+    if (stats) {
+        stats->indicators = combinations * (size_t)slots;
+        stats->computed = (size_t)shared_count + unshared;
+    }
+
+    SweepPool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.chunk = chunk;
+    pool.universe = universe;
+    pool.count = count;
+    pool.span = span;
+    pool.shared = shared;
+    pool.shared_count = shared_count;
+    pool.states = states;
+    pool.books = books;
+    pool.results = results;
+    pool.combinations = combinations;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.turn, NULL);
+
+    /* The calling thread is worker 0. Every worker takes part in every
+     * barrier, so the pool is sized to the threads that did start. */
+    pthread_t *tids = (pthread_t*)malloc((size_t)threads * sizeof(pthread_t));
+    if (!tids) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    int started = 1;
+    pthread_mutex_lock(&pool.lock);
+    for (int w = 1; w < threads; ++w) {
+        if (pthread_create(&tids[w], NULL, sweep_main, &pool) != 0) break;
+        started++;
+    }
+    pool.workers = started;
+    pthread_mutex_unlock(&pool.lock);
+    sweep_main(&pool);
+    for (int w = 1; w < started; ++w) pthread_join(tids[w], NULL);
+
+    pthread_cond_destroy(&pool.turn);
+    pthread_mutex_destroy(&pool.lock);
+    for (int k = 0; k < shared_count; ++k) free_indicators(&shared[k].state);
+    for (size_t c = 0; c < combinations; ++c) free_indicators(&states[c]);
+    free(tids);
+    free(columns);
+    free(shared);
+    free(key_of);
+    free(feeds);
+    free(books);
+    free(states);
+    free(values);
+    free(input);
+    return 0;
+}
@@ -2,6 +2,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <stdarg.h>
+#include <setjmp.h>
 #include "ast.h"
 
 /* ---------- Chunk helpers ---------- */
@@ -10,6 +13,25 @@ void init_chunk(Chunk *chunk) {
     chunk->code = NULL;
     chunk->count = 0;
     chunk->capacity = 0;
+    chunk->slots = NULL;
+    chunk->slot_count = 0;
+    chunk->slot_capacity = 0;
+    chunk->temp_count = 0;
+    chunk->cached_count = 0;
+    chunk->lines = NULL;
+    chunk->line_count = 0;
+    chunk->line_capacity = 0;
+    memset(&chunk->gates, 0, sizeof(chunk->gates));
+    chunk->params = NULL;
+    chunk->param_count = 0;
+    chunk->instrs = NULL;
+    chunk->instr_count = 0;
+    chunk->constants = NULL;
+    chunk->constant_count = 0;
+    chunk->timeframes = 0;
+    chunk->rule_targets = NULL;
+    chunk->stack_depth = 0;
+    chunk->jump_targets = 0;
 }
 
 static void write_byte(Chunk *chunk, uint8_t byte) {
@@ -21,6 +43,11 @@ static void write_byte(Chunk *chunk, uint8_t byte) {
     chunk->code[chunk->count++] = byte;
 }
 
+static void write_uint16(Chunk *chunk, uint16_t val) {
+    write_byte(chunk, (uint8_t)(val & 0xFF));
+    write_byte(chunk, (uint8_t)(val >> 8));
+}
+
 static void write_int32(Chunk *chunk, int32_t val) {
     for (int i = 0; i < 4; ++i) {
         write_byte(chunk, (uint8_t)((val >> (i * 8)) & 0xFF));
@@ -35,74 +62,260 @@ static void write_double(Chunk *chunk, double val) {
     }
 }
 
+static int add_slot(Chunk *chunk, FuncId func, int period, int param) {
+    if (chunk->slot_count + 1 > chunk->slot_capacity) {
+        int old_cap = chunk->slot_capacity;
+        chunk->slot_capacity = old_cap ? old_cap * 2 : 8;
+        chunk->slots = (IndicatorSlot*)realloc(chunk->slots,
+                                               chunk->slot_capacity * sizeof(IndicatorSlot));
+    }
+    chunk->slots[chunk->slot_count].func = (uint8_t)func;
+    chunk->slots[chunk->slot_count].period = period;
+    chunk->slots[chunk->slot_count].param = param;
+    return chunk->slot_count++;
+}
+
 void free_chunk(Chunk *chunk) {
     if (chunk->code) free(chunk->code);
-    chunk->code = NULL;
-    chunk->count = chunk->capacity = 0;
+    if (chunk->slots) free(chunk->slots);
+    free(chunk->lines);
+    free_rule_index(&chunk->gates);
+    free(chunk->params);
+    free(chunk->instrs);
+    free(chunk->constants);
+    free(chunk->rule_targets);
+    init_chunk(chunk);
+}
+
+/* Source line of the instruction at offset, 0 if the chunk has no source
+ * map; *rule (if not NULL) gets its rule index or -1 */
+int chunk_line(const Chunk *chunk, int offset, int *rule) {
+    int lo = 0, hi = chunk->line_count - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (chunk->lines[mid].offset <= offset) { found = mid; lo = mid + 1; }
+        else hi = mid - 1;
+    }
+    if (rule) *rule = found >= 0 ? chunk->lines[found].rule : -1;
+    return found >= 0 ? chunk->lines[found].line : 0;
+}
+
+/* Index of the parameter called name, or -1 */
+int find_param(const Chunk *chunk, const char *name) {
+    for (int i = 0; i < chunk->param_count; ++i) {
+        if (strcmp(chunk->params[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+/* Size in bytes of the instruction at offset, operands included */
+int instruction_length(const Chunk *chunk, int offset) {
+    switch ((OpCode)chunk->code[offset]) {
+        case BC_PUSH_CONST:              return 9;
+        case BC_LOAD_VAR:                return 2;
+        case BC_IND_UPDATE:              return 4;
+        case BC_LOAD_IND:
+        case BC_STORE_TEMP:
+        case BC_LOAD_TEMP:
+        case BC_LOAD_TF_VAR:
+        case BC_STORE_CACHED:
+        case BC_LOAD_CACHED:
+        case BC_LOAD_PARAM:              return 3;
+        case BC_CMP_IND:                 return 4;
+        case BC_CMP_VAR_CONST:           return 11;
+        case BC_JUMP_IF_NOT_CMP:
+        case BC_JUMP_IF_NOT_CLOSED:
+        case BC_JUMP_IF_SAME:            return 6;
+        case BC_JUMP_IF_NOT_CACHED:      return 7;
+        case BC_JUMP_IF_NOT_VAR_CONST:   return 15;
+        case BC_JUMP_IF_FALSE:
+        case BC_JUMP_IF_TRUE:
+        case BC_JUMP:
+        case BC_RULE_INDEX:
+        case BC_NEXT_RULE:               return 5;
+        case BC_BUY:
+        case BC_SELL:                    return 7;
+        default:                         return 1;
+    }
+}
+
+/* Most forward jump targets outstanding at any point of a linear run
+ * through the decoded code, each counted once however many jumps share
+ * it: the batch VM parks lanes on every one until it gets there. */
+static int count_jump_targets(const Instr *instrs, int n) {
+    uint8_t *targeted = (uint8_t*)calloc((size_t)n + 1, 1);
+    if (!targeted) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    int live = 0, max = 0;
+    for (int i = 0; i < n; ++i) {
+        if (targeted[i]) live--;
+        switch ((OpCode)instrs[i].op) {
+            case BC_JUMP_IF_FALSE:
+            case BC_JUMP_IF_TRUE:
+            case BC_JUMP:
+            case BC_JUMP_IF_NOT_CMP:
+            case BC_JUMP_IF_NOT_VAR_CONST:
+            case BC_JUMP_IF_NOT_CACHED:
+            case BC_JUMP_IF_NOT_CLOSED:
+            case BC_JUMP_IF_SAME:
+                if (!targeted[instrs[i].arg]) {
+                    targeted[instrs[i].arg] = 1;
+                    if (++live > max) max = live;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    free(targeted);
+    return max;
+}
+
+/* Deepest the operand stack gets; all jumps are forward, so one linear
+ * pass over the code is enough */
+static int max_stack_depth(const Chunk *chunk) {
+    int depth = 0, max = 0;
+    for (int i = 0; i < chunk->count; i += instruction_length(chunk, i)) {
+        switch ((OpCode)chunk->code[i]) {
+            case BC_PUSH_CONST:
+            case BC_LOAD_VAR:
+            case BC_LOAD_IND:
+            case BC_LOAD_TEMP:
+            case BC_LOAD_TF_VAR:
+            case BC_LOAD_CACHED:
+            case BC_LOAD_PARAM:
+            case BC_CMP_VAR_CONST:   depth++; break;
+            case BC_HALT:
+            case BC_CMP_IND:
+            case BC_NEG:
+            case BC_NOT:
+            case BC_JUMP:
+            case BC_BUY:
+            case BC_SELL:
+            case BC_JUMP_IF_NOT_VAR_CONST:
+            case BC_JUMP_IF_NOT_CLOSED:
+            case BC_JUMP_IF_SAME:
+            case BC_JUMP_IF_NOT_CACHED:
+            case BC_RULE_INDEX:
+            case BC_NEXT_RULE:       break;
+            case BC_JUMP_IF_NOT_CMP: depth -= 2; break;
+            default:                 depth--; break; // binary ops, IND_UPDATE, STORE_TEMP/CACHED, conditional jumps
+        }
+        if (depth > max) max = depth;
+    }
+    return max;
 }
 
 /* ---------- Helpers to map names ---------- */
 
 static int is_builtin_var(const char *name, VarId *out_id) {
-    if (strcmp(name, "open") == 0)    { *out_id = VAR_OPEN; return 1; }
-    if (strcmp(name, "high") == 0)    { *out_id = VAR_HIGH; return 1; }
-    if (strcmp(name, "low") == 0)     { *out_id = VAR_LOW; return 1; }
-    if (strcmp(name, "close") == 0)   { *out_id = VAR_CLOSE; return 1; }
-    if (strcmp(name, "volume") == 0)  { *out_id = VAR_VOLUME; return 1; }
-    if (strcmp(name, "date") == 0)    { *out_id = VAR_DATE; return 1; }
-    if (strcmp(name, "time") == 0)    { *out_id = VAR_TIME; return 1; }
-    if (strcmp(name, "hour") == 0)    { *out_id = VAR_HOUR; return 1; }
-    if (strcmp(name, "minute") == 0)  { *out_id = VAR_MINUTE; return 1; }
-    if (strcmp(name, "weekday") == 0) { *out_id = VAR_WEEKDAY; return 1; }
-    return 0;
+    const Builtin *b = lookup_builtin(name, strlen(name));
+    if (!b || b->kind != BUILTIN_VAR) return 0;
+    *out_id = (VarId)b->id;
+    return 1;
 }
 
-static int is_builtin_func(const char *name, FuncId *out_f) {
-    if (strcmp(name, "sma") == 0) { *out_f = FUNC_SMA; return 1; }
-    if (strcmp(name, "ema") == 0) { *out_f = FUNC_EMA; return 1; }
-    if (strcmp(name, "rsi") == 0) { *out_f = FUNC_RSI; return 1; }
-    return 0;
+static const Builtin *find_builtin_func(const char *name) {
+    const Builtin *b = lookup_builtin(name, strlen(name));
+    return (b && b->kind == BUILTIN_FUNC) ? b : NULL;
 }
 
-/* ---------- Compile expressions to bytecode ---------- */
+/* ---------- Compiler state ---------- */
 
-static void compile_expr(Chunk *chunk, Expr *e);
+#define TEMP_MAX 256   // per-bar CSE temps a chunk may use
 
-static void compile_binary(Chunk *chunk, Expr *e) {
-    compile_expr(chunk, e->as.op.left);
-    compile_expr(chunk, e->as.op.right);
-    switch (e->as.op.op) {
-        case OP_ADD:   write_byte(chunk, BC_ADD); break;
-        case OP_SUB:   write_byte(chunk, BC_SUB); break;
-        case OP_MUL:   write_byte(chunk, BC_MUL); break;
-        case OP_DIV:   write_byte(chunk, BC_DIV); break;
-        case OP_GT_OP: write_byte(chunk, BC_GT);  break;
-        case OP_LT_OP: write_byte(chunk, BC_LT);  break;
-        case OP_GE_OP: write_byte(chunk, BC_GE);  break;
-        case OP_LE_OP: write_byte(chunk, BC_LE);  break;
-        case OP_EQ_OP: write_byte(chunk, BC_EQ);  break;
-        case OP_NE_OP: write_byte(chunk, BC_NE);  break;
-        case OP_AND_OP: write_byte(chunk, BC_AND); break;
-        case OP_OR_OP:  write_byte(chunk, BC_OR);  break;
-        default: break;
+/* A distinct pure subexpression of the rule conditions (see plan_temps) */
+typedef struct {
+    Expr *expr;      // first occurrence
+    uint32_t hash;
+    int count;       // occurrences not already covered by a larger temp
+    int cost;        // instructions it takes inline
+    int order;       // first-seen order, keeps the plan deterministic
+    int freq;        // Frequency: which block computes it
+    int temp;        // assigned per-bar temp, or -1
+    int cached;      // assigned cached value (FREQ_DAY / FREQ_MINUTE), or -1
+} CseEntry;
+
+/* Open-addressing table from expr_hash to entries (CSE candidates or
+ * indicator slots): linear probing, at most half full. A cell holds the
+ * entry + 1, 0 when empty; the entry's own expression settles collisions. */
+typedef struct {
+    uint32_t *hashes;
+    int *entries;
+    int size;        // power of two, or 0 before the first add
+    int count;
+} ExprTable;
+
+/* Per-compilation state; compile_program_r is reentrant because nothing
+ * outlives this struct. Errors unwind to compile_program_r via on_error. */
+typedef struct {
+    Chunk *chunk;
+    int fuse;        // select superinstructions
+    int index_rules; // build a RuleIndex (see gate.c)
+    Expr **slot_calls;  // the call that owns each indicator slot
+    ExprTable slot_table; // slot_calls by hash
+    CseEntry *cse;
+    int cse_count;
+    int cse_capacity;
+    ExprTable cse_table;  // cse by hash
+    int temps_ready; // temps below this index are stored and may be loaded
+    int cached_ready; // likewise for cached values
+    int gate;        // timeframe the updates being emitted are gated on (see open_gate)
+    int gate_jumps;  // its JUMP_IF_NOT_CLOSED, patched by close_gate
+    int line;        // source position of the code being emitted
+    int rule;
+    jmp_buf on_error;
+    char *err;
+    size_t errlen;
+} Compiler;
+
+/* `at` (may be NULL) is the node the message is about */
+static void compile_error(Compiler *c, const Expr *at, const char *fmt, ...) {
+    if (c->err && c->errlen) {
+        int n = 0;
+        if (at && at->line > 0)
+            n = snprintf(c->err, c->errlen, "line %d, column %d: ", at->line, at->column);
+        if (n < 0 || (size_t)n >= c->errlen) n = 0;
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(c->err + n, c->errlen - (size_t)n, fmt, ap);
+        va_end(ap);
     }
+    longjmp(c->on_error, 1);
 }
 
-static void compile_unary(Chunk *chunk, Expr *e) {
-    compile_expr(chunk, e->as.op.left);
-    switch (e->as.op.op) {
-        case OP_NEG_OP: write_byte(chunk, BC_NEG); break;
-        case OP_NOT_OP: write_byte(chunk, BC_NOT); break;
-        default: break;
+/* Starts a source-map run at the current offset for (line, rule). A run
+ * that has no code yet is replaced rather than kept empty. */
+static void set_position(Compiler *c, int line, int rule) {
+    Chunk *chunk = c->chunk;
+    c->line = line;
+    c->rule = rule;
+    LineEntry *last = chunk->line_count ? &chunk->lines[chunk->line_count - 1] : NULL;
+    if (last && last->offset == chunk->count) {
+        chunk->line_count--;
+        last = chunk->line_count ? &chunk->lines[chunk->line_count - 1] : NULL;
     }
+    if (last && last->line == line && last->rule == rule) return;
+    if (chunk->line_count == chunk->line_capacity) {
+        chunk->line_capacity = chunk->line_capacity ? chunk->line_capacity * 2 : 16;
+        chunk->lines = (LineEntry*)realloc(chunk->lines, (size_t)chunk->line_capacity * sizeof(LineEntry));
+        if (!chunk->lines) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    }
+    LineEntry *entry = &chunk->lines[chunk->line_count++];
+    entry->offset = chunk->count;
+    entry->line = line;
+    entry->rule = rule;
 }
 
+/* ---------- Compile expressions to bytecode ---------- */
+
+static void compile_expr(Compiler *c, Expr *e);
+
 /* Compile-time conversion of string time/date/weekday literals into numeric codes */
 
 static int parse_date_string(const char *s) {
     // expecting "YYYY-MM-DD"
     int y, m, d;
-    if (sscanf(s, "\"%d-%d-%d\"", &y, &m, &d) == 3) {
+    if (sscanf(s, "%d-%d-%d", &y, &m, &d) == 3) {
         return y * 10000 + m * 100 + d;
     }
     return 0;
@@ -111,10 +324,10 @@ static int parse_date_string(const char *s) {
 static int parse_time_string(const char *s) {
     // expecting "HH:MM"
     int h, m;
-    if (sscanf(s, "\"%d:%d\"", &h, &m) == 2) {
+    if (sscanf(s, "%d:%d", &h, &m) == 2) {
         return h * 100 + m;
     }
-    return 0;
+    return -1; // 00:00 is a valid time
 }
 
 static int parse_weekday_string(const char *s) {
@@ -128,11 +341,605 @@ static int parse_weekday_string(const char *s) {
     return 0;
 }
 
-/* For this skeleton, string literals are only allowed on right side of
- * time/date/weekday comparisons. We simply compile them as numeric constants.
+/* String literals are only meaningful compared against date, time or
+ * weekday; they become the numeric code that field holds at runtime. */
+int string_literal_value(VarId var, const char *text, double *out) {
+    int v = 0;
+    switch (var) {
+        case VAR_DATE:    v = parse_date_string(text); break;
+        case VAR_TIME:    v = parse_time_string(text); break;
+        case VAR_WEEKDAY: v = parse_weekday_string(text); break;
+        default:          return 0;
+    }
+    if (var == VAR_TIME ? v < 0 : v == 0) return 0;
+    *out = (double)v;
+    return 1;
+}
+
+static uint8_t compare_opcode(OpKind op) {
+    switch (op) {
+        case OP_GT_OP: return BC_GT;
+        case OP_LT_OP: return BC_LT;
+        case OP_GE_OP: return BC_GE;
+        case OP_LE_OP: return BC_LE;
+        case OP_EQ_OP: return BC_EQ;
+        default:       return BC_NE;
+    }
+}
+
+static int is_compare(const Expr *e) {
+    return e->kind == EXPR_BINARY && e->as.op.op >= OP_GT_OP && e->as.op.op <= OP_NE_OP;
+}
+
+/* a OP b  ==  b swapped(OP) a */
+static OpKind swap_compare(OpKind op) {
+    switch (op) {
+        case OP_GT_OP: return OP_LT_OP;
+        case OP_LT_OP: return OP_GT_OP;
+        case OP_GE_OP: return OP_LE_OP;
+        case OP_LE_OP: return OP_GE_OP;
+        default:       return op;
+    }
+}
+
+/* Operand value known at compile time: a number, or a string literal
+ * facing a date/time/weekday field. */
+static int constant_operand(Compiler *c, Expr *e, Expr *other, double *out) {
+    VarId var;
+    if (e->kind == EXPR_NUMBER) {
+        *out = e->as.number.value;
+        return 1;
+    }
+    if (e->kind == EXPR_STRING && other->kind == EXPR_IDENT &&
+        is_builtin_var(other->as.ident.name, &var)) {
+        if (!string_literal_value(var, e->as.string.value, out)) {
+            compile_error(c, e, "Cannot compare %s with \"%s\"",
+                          other->as.ident.name, e->as.string.value);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* Compile one side of a binary op; a string literal facing a date, time
+ * or weekday field is compiled as that field's numeric code. */
+static void compile_operand(Compiler *c, Expr *e, Expr *other) {
+    double value;
+    if (e->kind == EXPR_STRING && constant_operand(c, e, other, &value)) {
+        write_byte(c->chunk, BC_PUSH_CONST);
+        write_double(c->chunk, value);
+        return;
+    }
+    compile_expr(c, e);
+}
+
+/* Comparison operands in the order the fused forms want them: a field
+ * or indicator call goes on the side that lets it fuse with the compare.
+ * Both sides are pure (indicators are only read here), so the evaluation
+ * order does not matter. */
+typedef struct {
+    Expr *left;
+    Expr *right;
+    OpKind op;
+    uint8_t var;     // left is this field and right is constant (has_const)
+    int has_const;
+    double value;
+} Comparison;
+
+static Comparison plan_compare(Compiler *c, Expr *e) {
+    Comparison cmp;
+    cmp.left = e->as.op.left;
+    cmp.right = e->as.op.right;
+    cmp.op = e->as.op.op;
+    cmp.has_const = 0;
+    cmp.var = 0;
+    cmp.value = 0.0;
+    if (!c->fuse) return cmp;
+
+    double value;
+    if ((cmp.left->kind == EXPR_CALL && cmp.right->kind != EXPR_CALL) ||
+        (cmp.right->kind == EXPR_IDENT && constant_operand(c, cmp.left, cmp.right, &value))) {
+        Expr *t = cmp.left;
+        cmp.left = cmp.right;
+        cmp.right = t;
+        cmp.op = swap_compare(cmp.op);
+    }
+
+    VarId var;
+    if (cmp.left->kind == EXPR_IDENT && cmp.left->as.ident.timeframe == TF_BAR &&
+        is_builtin_var(cmp.left->as.ident.name, &var) &&
+        constant_operand(c, cmp.right, cmp.left, &cmp.value)) {
+        cmp.has_const = 1;
+        cmp.var = (uint8_t)var;
+    }
+    return cmp;
+}
+
+static void compile_binary(Compiler *c, Expr *e) {
+    Chunk *chunk = c->chunk;
+    if (is_compare(e)) {
+        Comparison cmp = plan_compare(c, e);
+        if (cmp.has_const) {
+            write_byte(chunk, BC_CMP_VAR_CONST);
+            write_byte(chunk, cmp.var);
+            write_byte(chunk, compare_opcode(cmp.op));
+            write_double(chunk, cmp.value);
+            return;
+        }
+        compile_operand(c, cmp.left, cmp.right);
+        if (c->fuse && cmp.right->kind == EXPR_CALL) {
+            write_byte(chunk, BC_CMP_IND);
+            write_uint16(chunk, (uint16_t)cmp.right->as.call.slot);
+            write_byte(chunk, compare_opcode(cmp.op));
+            return;
+        }
+        compile_operand(c, cmp.right, cmp.left);
+        write_byte(chunk, compare_opcode(cmp.op));
+        return;
+    }
+
+    compile_operand(c, e->as.op.left, e->as.op.right);
+    compile_operand(c, e->as.op.right, e->as.op.left);
+    switch (e->as.op.op) {
+        case OP_ADD:   write_byte(chunk, BC_ADD); break;
+        case OP_SUB:   write_byte(chunk, BC_SUB); break;
+        case OP_MUL:   write_byte(chunk, BC_MUL); break;
+        case OP_DIV:   write_byte(chunk, BC_DIV); break;
+        case OP_AND_OP: write_byte(chunk, BC_AND); break;
+        case OP_OR_OP:  write_byte(chunk, BC_OR);  break;
+        default: break;
+    }
+}
+
+static void compile_unary(Compiler *c, Expr *e) {
+    Chunk *chunk = c->chunk;
+    compile_expr(c, e->as.op.left);
+    switch (e->as.op.op) {
+        case OP_NEG_OP: write_byte(chunk, BC_NEG); break;
+        case OP_NOT_OP: write_byte(chunk, BC_NOT); break;
+        default: break;
+    }
+}
+
+
+/* ---------- Structural equality ---------- */
+
+static int expr_equal(const Expr *a, const Expr *b) {
+    if (a->kind != b->kind) return 0;
+    switch (a->kind) {
+        case EXPR_NUMBER:
+            /* bitwise, so 0 and -0 stay apart */
+            return memcmp(&a->as.number.value, &b->as.number.value, sizeof(double)) == 0;
+        case EXPR_IDENT:
+            return a->as.ident.timeframe == b->as.ident.timeframe &&
+                   strcmp(a->as.ident.name, b->as.ident.name) == 0;
+        case EXPR_STRING:
+            return strcmp(a->as.string.value, b->as.string.value) == 0;
+        case EXPR_PARAM:
+            return a->as.param.index == b->as.param.index;
+        case EXPR_CALL:
+            if (strcmp(a->as.call.func_name, b->as.call.func_name) != 0 ||
+                a->as.call.arg_count != b->as.call.arg_count ||
+                a->as.call.timeframe != b->as.call.timeframe) return 0;
+            for (int i = 0; i < a->as.call.arg_count; ++i) {
+                if (!expr_equal(a->as.call.args[i], b->as.call.args[i])) return 0;
+            }
+            return 1;
+        case EXPR_BINARY:
+            return a->as.op.op == b->as.op.op &&
+                   expr_equal(a->as.op.left, b->as.op.left) &&
+                   expr_equal(a->as.op.right, b->as.op.right);
+        case EXPR_UNARY:
+            return a->as.op.op == b->as.op.op && expr_equal(a->as.op.left, b->as.op.left);
+    }
+    return 0;
+}
+
+static uint32_t hash_step(uint32_t h, uint32_t v) {
+    return (h ^ v) * 16777619u;
+}
+
+static uint32_t hash_text(uint32_t h, const char *s) {
+    while (*s) h = hash_step(h, (uint8_t)*s++);
+    return h;
+}
+
+/* FNV-style hash that agrees with expr_equal */
+static uint32_t expr_hash(const Expr *e) {
+    uint32_t h = hash_step(2166136261u, (uint32_t)e->kind);
+    switch (e->kind) {
+        case EXPR_NUMBER: {
+            uint64_t bits;
+            memcpy(&bits, &e->as.number.value, sizeof(bits));
+            h = hash_step(h, (uint32_t)bits);
+            return hash_step(h, (uint32_t)(bits >> 32));
+        }
+        case EXPR_IDENT:
+            return hash_text(hash_step(h, (uint32_t)e->as.ident.timeframe), e->as.ident.name);
+        case EXPR_STRING:
+            return hash_text(h, e->as.string.value);
+        case EXPR_PARAM:
+            return hash_step(h, (uint32_t)e->as.param.index);
+        case EXPR_CALL:
+            h = hash_text(hash_step(h, (uint32_t)e->as.call.timeframe), e->as.call.func_name);
+            for (int i = 0; i < e->as.call.arg_count; ++i)
+                h = hash_step(h, expr_hash(e->as.call.args[i]));
+            return h;
+        case EXPR_BINARY:
+            h = hash_step(h, (uint32_t)e->as.op.op);
+            h = hash_step(h, expr_hash(e->as.op.left));
+            return hash_step(h, expr_hash(e->as.op.right));
+        case EXPR_UNARY:
+            h = hash_step(h, (uint32_t)e->as.op.op);
+            return hash_step(h, expr_hash(e->as.op.left));
+    }
+    return h;
+}
+
+static void table_insert(ExprTable *t, uint32_t hash, int entry) {
+    int mask = t->size - 1;
+    int i = (int)(hash & (uint32_t)mask);
+    while (t->entries[i]) i = (i + 1) & mask;
+    t->hashes[i] = hash;
+    t->entries[i] = entry + 1;
+}
+
+static void table_add(ExprTable *t, uint32_t hash, int entry) {
+    if ((t->count + 1) * 2 > t->size) {
+        ExprTable grown = { NULL, NULL, t->size ? t->size * 2 : 32, t->count };
+        grown.hashes = (uint32_t*)malloc((size_t)grown.size * sizeof(uint32_t));
+        grown.entries = (int*)calloc((size_t)grown.size, sizeof(int));
+        if (!grown.hashes || !grown.entries) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        for (int i = 0; i < t->size; ++i)
+            if (t->entries[i]) table_insert(&grown, t->hashes[i], t->entries[i] - 1);
+        free(t->hashes);
+        free(t->entries);
+        *t = grown;
+    }
+    table_insert(t, hash, entry);
+    t->count++;
+}
+
+/* Drops every entry, keeping the cells */
+static void table_clear(ExprTable *t) {
+    if (t->size) memset(t->entries, 0, (size_t)t->size * sizeof(int));
+    t->count = 0;
+}
+
+static void free_table(ExprTable *t) {
+    free(t->hashes);
+    free(t->entries);
+    t->hashes = NULL;
+    t->entries = NULL;
+    t->size = t->count = 0;
+}
+
+/* ---------- Indicator prologue ----------
+ *
+ * Every indicator call is fed its input once per bar at the top of the
+ * chunk (IND_UPDATE), before any rule runs; conditions only read the
+ * result (LOAD_IND). A condition that short-circuits past a call can then
+ * never leave that call's streaming window a bar behind. A call on another
+ * timeframe is fed only on the bars that close one of its bars; runs of
+ * such updates share one JUMP_IF_NOT_CLOSED.
+ */
+
+static void compile_updates(Compiler *c, Expr *e);
+static void open_gate(Compiler *c, int tf);
+static void compile_cached(Compiler *c, Expr **by_cached, int from, int to, int freq);
+
+/* The slot an equal call already feeds, or -1 */
+static int find_slot(Compiler *c, const Expr *e, uint32_t hash) {
+    const ExprTable *t = &c->slot_table;
+    if (!t->size) return -1;
+    int mask = t->size - 1;
+    for (int i = (int)(hash & (uint32_t)mask); t->entries[i]; i = (i + 1) & mask) {
+        int slot = t->entries[i] - 1;
+        if (t->hashes[i] == hash && expr_equal(c->slot_calls[slot], e)) return slot;
+    }
+    return -1;
+}
+
+/* Emits the updates for every call in e, nested calls first, and records
+ * each call's slot in the AST for compile_expr. */
+static void compile_call_updates(Compiler *c, Expr *e) {
+    Chunk *chunk = c->chunk;
+    switch (e->kind) {
+        case EXPR_BINARY:
+            compile_updates(c, e->as.op.left);
+            compile_updates(c, e->as.op.right);
+            return;
+        case EXPR_UNARY:
+            compile_updates(c, e->as.op.left);
+            return;
+        case EXPR_CALL:
+            break;
+        default:
+            return;
+    }
+
+    const Builtin *fn = find_builtin_func(e->as.call.func_name);
+    if (!fn) {
+        compile_error(c, e, "Unknown function: %s", e->as.call.func_name);
+    }
+    FuncId f = (FuncId)fn->id;
+    /* Arity 2 is (series, period); arity 1 is (period) over close.
+     * The period sizes the slot's state, so it must be a whole literal,
+     * or a parameter: init_indicators_with then sizes the slot per run. */
+    int expected = fn->arity;
+    if (e->as.call.arg_count != expected) {
+        compile_error(c, e, "%s expects %d arg%s", e->as.call.func_name,
+                      expected, expected == 1 ? "" : "s");
+    }
+    Expr *period = e->as.call.args[expected - 1];
+    int param = period->kind == EXPR_PARAM ? period->as.param.index : -1;
+    double length = param >= 0 ? chunk->params[param].value
+                  : period->kind == EXPR_NUMBER ? period->as.number.value : 0.0;
+    if ((param < 0 && period->kind != EXPR_NUMBER) || !(length >= 1 && length <= TLC_PERIOD_MAX)) {
+        compile_error(c, e, "%s period must be a number or parameter between 1 and %d",
+                      e->as.call.func_name, TLC_PERIOD_MAX);
+    }
+    if (length != floor(length)) {
+        if (param >= 0)
+            compile_error(c, period, "parameter %s is a period; %g is not a whole number",
+                          chunk->params[param].name, length);
+        compile_error(c, period, "%s period must be a whole number, not %g",
+                      e->as.call.func_name, length);
+    }
+    /* the same call elsewhere already feeds a slot: share its state */
+    uint32_t hash = expr_hash(e);
+    int shared = find_slot(c, e, hash);
+    if (shared >= 0) {
+        e->as.call.slot = shared;
+        return;
+    }
+    int tf = e->as.call.timeframe;
+    if (expected == 1) {
+        open_gate(c, tf);
+        if (tf != TF_BAR) {
+            write_byte(chunk, BC_LOAD_TF_VAR);
+            write_byte(chunk, (uint8_t)tf);
+        } else {
+            write_byte(chunk, BC_LOAD_VAR);
+        }
+        write_byte(chunk, (uint8_t)VAR_CLOSE);
+    } else {
+        compile_updates(c, e->as.call.args[0]);
+        open_gate(c, tf);
+        compile_expr(c, e->as.call.args[0]);
+    }
+    if (chunk->slot_count == 0xFFFF) {
+        compile_error(c, e, "Too many indicator calls in one program");
+    }
+    int slot = add_slot(chunk, f, (int)length, param);
+    c->slot_calls = (Expr**)realloc(c->slot_calls, (size_t)chunk->slot_count * sizeof(Expr*));
+    c->slot_calls[slot] = e;
+    table_add(&c->slot_table, hash, slot);
+    write_byte(chunk, BC_IND_UPDATE);
+    write_byte(chunk, (uint8_t)f);
+    write_uint16(chunk, (uint16_t)slot);
+    e->as.call.slot = slot;
+}
+
+/* The three walkers below run under the node's source position, so the
+ * source map attributes each instruction to the innermost node that
+ * emitted it. */
+static void compile_updates(Compiler *c, Expr *e) {
+    int line = c->line;
+    set_position(c, e->line, c->rule);
+    compile_call_updates(c, e);
+    set_position(c, line, c->rule);
+}
+
+/* ---------- Common subexpressions ----------
+ *
+ * A pure subexpression that several rules repeat is computed once per bar
+ * after the indicator updates (STORE_TEMP) and every use loads it
+ * (LOAD_TEMP). Only compound nodes outside indicator arguments are
+ * considered, and only when the instructions saved outweigh the store and
+ * the loads: with k uses of an n-instruction expression that is
+ * (k - 1) * n > k + 1.
+ *
+ * A subexpression that reads only date and weekday (FREQ_DAY) is kept in
+ * IndicatorState.cached instead and recomputed only on the first bar of
+ * each day, behind one JUMP_IF_SAME; it pays off even with a single use
+ * once n > 2, since each use is then one instruction (a skip is one
+ * JUMP_IF_NOT_CACHED). One that also reads the time of day (FREQ_MINUTE)
+ * is recomputed only when the bar's minute changes. On minute bars that
+ * is every bar, so it is chosen like a temp and only sub-minute bars and
+ * ticks save more.
  */
 
-static void compile_expr(Chunk *chunk, Expr *e) {
+/* Instructions e compiles to inline, fused forms included */
+static int expr_cost(Compiler *c, Expr *e) {
+    switch (e->kind) {
+        case EXPR_BINARY:
+            if (is_compare(e) && plan_compare(c, e).has_const) return 1;
+            return expr_cost(c, e->as.op.left) + expr_cost(c, e->as.op.right) + 1;
+        case EXPR_UNARY:
+            return expr_cost(c, e->as.op.left) + 1;
+        default:
+            return 1;
+    }
+}
+
+static CseEntry *find_cse(Compiler *c, const Expr *e, uint32_t hash) {
+    const ExprTable *t = &c->cse_table;
+    if (!t->size) return NULL;
+    int mask = t->size - 1;
+    for (int i = (int)(hash & (uint32_t)mask); t->entries[i]; i = (i + 1) & mask) {
+        CseEntry *en = &c->cse[t->entries[i] - 1];
+        if (t->hashes[i] == hash && expr_equal(en->expr, e)) return en;
+    }
+    return NULL;
+}
+
+static int is_compound(const Expr *e) {
+    return e->kind == EXPR_BINARY || e->kind == EXPR_UNARY;
+}
+
+/* Sets temp = cached = -1 on every node, indicator arguments included */
+static void clear_temps(Expr *e) {
+    e->temp = e->cached = -1;
+    switch (e->kind) {
+        case EXPR_BINARY:
+            clear_temps(e->as.op.right);
+            /* fall through */
+        case EXPR_UNARY:
+            clear_temps(e->as.op.left);
+            break;
+        case EXPR_CALL:
+            for (int i = 0; i < e->as.call.arg_count; ++i) clear_temps(e->as.call.args[i]);
+            break;
+        default:
+            break;
+    }
+}
+
+static void count_subexprs(Compiler *c, Expr *e) {
+    if (!is_compound(e)) return;
+    count_subexprs(c, e->as.op.left);
+    if (e->kind == EXPR_BINARY) count_subexprs(c, e->as.op.right);
+
+    uint32_t hash = expr_hash(e);
+    CseEntry *en = find_cse(c, e, hash);
+    if (en) {
+        en->count++;
+        return;
+    }
+    if (c->cse_count == c->cse_capacity) {
+        c->cse_capacity = c->cse_capacity ? c->cse_capacity * 2 : 32;
+        c->cse = (CseEntry*)realloc(c->cse, (size_t)c->cse_capacity * sizeof(CseEntry));
+    }
+    table_add(&c->cse_table, hash, c->cse_count);
+    en = &c->cse[c->cse_count];
+    en->expr = e;
+    en->hash = hash;
+    en->count = 1;
+    en->cost = expr_cost(c, e);
+    en->order = c->cse_count++;
+    en->freq = (int)expr_frequency(e);
+    en->temp = en->cached = -1;
+}
+
+/* Once e is a temp, the copies of its subexpressions inside e's other
+ * `uses` occurrences are no longer evaluated */
+static void absorb_subexprs(Compiler *c, Expr *e, int uses) {
+    if (!is_compound(e)) return;
+    Expr *kids[2] = { e->as.op.left, e->kind == EXPR_BINARY ? e->as.op.right : NULL };
+    for (int i = 0; i < 2; ++i) {
+        if (!kids[i] || !is_compound(kids[i])) continue;
+        CseEntry *en = find_cse(c, kids[i], expr_hash(kids[i]));
+        if (en) en->count -= uses;
+        absorb_subexprs(c, kids[i], uses);
+    }
+}
+
+static void mark_temps(Compiler *c, Expr *e) {
+    if (!is_compound(e)) return;
+    CseEntry *en = find_cse(c, e, expr_hash(e));
+    e->temp = en ? en->temp : -1;
+    e->cached = en ? en->cached : -1;
+    mark_temps(c, e->as.op.left);
+    if (e->kind == EXPR_BINARY) mark_temps(c, e->as.op.right);
+}
+
+/* largest first, ties in source order */
+static int by_cost_desc(const void *pa, const void *pb) {
+    const CseEntry *a = (const CseEntry*)pa, *b = (const CseEntry*)pb;
+    if (a->cost != b->cost) return b->cost - a->cost;
+    return a->order - b->order;
+}
+
+/* Picks the temps and cached values, largest expressions first so their
+ * parts are not counted twice, and emits them smallest first so each can
+ * load the ones inside it: the per-day values, the per-minute ones, then
+ * the per-bar temps. */
+static void compile_temps(Compiler *c, Program *program) {
+    Chunk *chunk = c->chunk;
+    c->cse_count = 0;
+    table_clear(&c->cse_table);
+    for (Rule *r = program->rules; r; r = r->next) count_subexprs(c, r->condition);
+    if (c->cse_count == 0) return;
+
+    qsort(c->cse, (size_t)c->cse_count, sizeof(CseEntry), by_cost_desc);
+    table_clear(&c->cse_table);
+    for (int i = 0; i < c->cse_count; ++i) table_add(&c->cse_table, c->cse[i].hash, i);
+    int temps = 0, per_day = 0, per_minute = 0;
+    for (int i = 0; i < c->cse_count; ++i) {
+        CseEntry *en = &c->cse[i];
+        int k = en->count;
+        if (en->freq <= FREQ_DAY) {
+            if (k < 1 || k * en->cost <= k + 1 || per_day + per_minute >= TEMP_MAX) continue;
+            en->cached = per_day++;
+        } else if (k >= 2 && (k - 1) * en->cost > k + 1) {
+            if (en->freq == FREQ_MINUTE) {
+                if (per_day + per_minute >= TEMP_MAX) continue;
+                en->cached = per_minute++;
+            } else {
+                if (temps >= TEMP_MAX) continue;
+                en->temp = temps++;
+            }
+        } else {
+            continue;
+        }
+        /* a cached value's parts run only when it is recomputed, so none
+         * of its uses leave a copy behind that is worth keeping */
+        absorb_subexprs(c, en->expr, en->cached >= 0 ? k : k - 1);
+    }
+    int cached = per_day + per_minute;
+    if (temps == 0 && cached == 0) return;
+
+    /* number each kind in emission order: ascending cost, per-day values
+     * before per-minute ones */
+    int next_temp = 0, next_day = 0, next_minute = per_day;
+    for (int i = c->cse_count - 1; i >= 0; --i) {
+        CseEntry *en = &c->cse[i];
+        if (en->temp >= 0) en->temp = next_temp++;
+        else if (en->cached >= 0) en->cached = en->freq <= FREQ_DAY ? next_day++ : next_minute++;
+    }
+    for (Rule *r = program->rules; r; r = r->next) mark_temps(c, r->condition);
+
+    Expr **by_temp = (Expr**)malloc((size_t)(temps + cached) * sizeof(Expr*));
+    if (!by_temp) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    Expr **by_cached = by_temp + temps;
+    for (int i = 0; i < c->cse_count; ++i) {
+        if (c->cse[i].temp >= 0) by_temp[c->cse[i].temp] = c->cse[i].expr;
+        if (c->cse[i].cached >= 0) by_cached[c->cse[i].cached] = c->cse[i].expr;
+    }
+    chunk->cached_count = cached;
+    compile_cached(c, by_cached, 0, per_day, FREQ_DAY);
+    compile_cached(c, by_cached, per_day, cached, FREQ_MINUTE);
+    chunk->temp_count = temps;
+    for (int t = 0; t < temps; ++t) {
+        compile_expr(c, by_temp[t]);
+        write_byte(chunk, BC_STORE_TEMP);
+        write_uint16(chunk, (uint16_t)t);
+        c->temps_ready = t + 1;
+    }
+    free(by_temp);
+}
+
+static int temp_ready(const Compiler *c, const Expr *e) {
+    return is_compound(e) && e->temp >= 0 && e->temp < c->temps_ready;
+}
+
+static int cached_ready(const Compiler *c, const Expr *e) {
+    return is_compound(e) && e->cached >= 0 && e->cached < c->cached_ready;
+}
+
+static void compile_node(Compiler *c, Expr *e) {
+    Chunk *chunk = c->chunk;
+    if (temp_ready(c, e)) {
+        write_byte(chunk, BC_LOAD_TEMP);
+        write_uint16(chunk, (uint16_t)e->temp);
+        return;
+    }
+    if (cached_ready(c, e)) {
+        write_byte(chunk, BC_LOAD_CACHED);
+        write_uint16(chunk, (uint16_t)e->cached);
+        return;
+    }
     switch (e->kind) {
         case EXPR_NUMBER:
             write_byte(chunk, BC_PUSH_CONST);
@@ -142,10 +949,14 @@ static void compile_expr(Chunk *chunk, Expr *e) {
         case EXPR_IDENT: {
             VarId id;
             if (!is_builtin_var(e->as.ident.name, &id)) {
-                fprintf(stderr, "Unknown identifier: %s\n", e->as.ident.name);
-                exit(1);
+                compile_error(c, e, "Unknown identifier: %s", e->as.ident.name);
+            }
+            if (e->as.ident.timeframe != TF_BAR) {
+                write_byte(chunk, BC_LOAD_TF_VAR);
+                write_byte(chunk, (uint8_t)e->as.ident.timeframe);
+            } else {
+                write_byte(chunk, BC_LOAD_VAR);
             }
-            write_byte(chunk, BC_LOAD_VAR);
             write_byte(chunk, (uint8_t)id);
             break;
         }
@@ -154,241 +965,1357 @@ static void compile_expr(Chunk *chunk, Expr *e) {
             // A raw string alone is not allowed in expressions in v0.1
             // (must be used only in comparisons). In full implementation,
             // you'd handle proper type checking. Here we just error.
-            fprintf(stderr, "Bare string literal in expression not supported in skeleton.\n");
-            exit(1);
+            compile_error(c, e, "Bare string literal in expression not supported in skeleton.");
             break;
 
-        case EXPR_CALL: {
-            FuncId f;
-            if (!is_builtin_func(e->as.call.func_name, &f)) {
-                fprintf(stderr, "Unknown function: %s\n", e->as.call.func_name);
-                exit(1);
-            }
-            for (int i = 0; i < e->as.call.arg_count; ++i) {
-                compile_expr(chunk, e->as.call.args[i]);
-            }
-            write_byte(chunk, BC_CALL_FUNC);
-            write_byte(chunk, (uint8_t)f);
-            write_byte(chunk, (uint8_t)e->as.call.arg_count);
+        case EXPR_CALL:
+            write_byte(chunk, BC_LOAD_IND);
+            write_uint16(chunk, (uint16_t)e->as.call.slot);
+            break;
+
+        case EXPR_PARAM:
+            write_byte(chunk, BC_LOAD_PARAM);
+            write_uint16(chunk, (uint16_t)e->as.param.index);
             break;
-        }
 
         case EXPR_BINARY:
-            compile_binary(chunk, e);
+            compile_binary(c, e);
             break;
 
         case EXPR_UNARY:
-            compile_unary(chunk, e);
+            compile_unary(c, e);
             break;
     }
 }
 
+static void compile_expr(Compiler *c, Expr *e) {
+    int line = c->line;
+    set_position(c, e->line, c->rule);
+    compile_node(c, e);
+    set_position(c, line, c->rule);
+}
+
+/* ---------- Conditions ----------
+ *
+ * Conditions compile to jumps rather than values, so `and`/`or` skip their
+ * right side once the outcome is known. Jumps that go to the same place
+ * are chained through their own operand fields until that place is known
+ * (NO_JUMP ends the chain), so no list has to be allocated.
+ */
+
+#define NO_JUMP (-1)
+
+/* Emits a jump operand and links it into the chain `*list` */
+static void add_jump(Compiler *c, int *list) {
+    int pos = c->chunk->count;
+    write_int32(c->chunk, (int32_t)*list);
+    *list = pos;
+}
+
+/* Points every jump in the chain at the current end of the code */
+static void patch_jumps(Compiler *c, int list) {
+    Chunk *chunk = c->chunk;
+    while (list != NO_JUMP) {
+        uint32_t next = 0;
+        for (int i = 0; i < 4; ++i) next |= (uint32_t)chunk->code[list + i] << (i * 8);
+        int32_t offset = chunk->count - (list + 4);
+        for (int i = 0; i < 4; ++i) {
+            chunk->code[list + i] = (uint8_t)((offset >> (i * 8)) & 0xFF);
+        }
+        list = (int32_t)next;
+    }
+}
+
+/* Updates for timeframe tf follow: end the current gate unless it is
+ * already on tf, and start one unless tf is TF_BAR */
+static void close_gate(Compiler *c) {
+    patch_jumps(c, c->gate_jumps);
+    c->gate_jumps = NO_JUMP;
+    c->gate = TF_BAR;
+}
+
+static void open_gate(Compiler *c, int tf) {
+    if (c->gate == tf) return;
+    close_gate(c);
+    if (tf == TF_BAR) return;
+    write_byte(c->chunk, BC_JUMP_IF_NOT_CLOSED);
+    write_byte(c->chunk, (uint8_t)(1u << tf));
+    add_jump(c, &c->gate_jumps);
+    c->gate = tf;
+}
+
+/* Emits one block of cached values: skipped while the bar is in the day
+ * or minute it last ran for */
+static void compile_cached(Compiler *c, Expr **by_cached, int from, int to, int freq) {
+    if (from == to) return;
+    Chunk *chunk = c->chunk;
+    int same = NO_JUMP;
+    write_byte(chunk, BC_JUMP_IF_SAME);
+    write_byte(chunk, (uint8_t)freq);
+    add_jump(c, &same);
+    for (int i = from; i < to; ++i) {
+        compile_expr(c, by_cached[i]);
+        write_byte(chunk, BC_STORE_CACHED);
+        write_uint16(chunk, (uint16_t)i);
+        c->cached_ready = i + 1;
+    }
+    patch_jumps(c, same);
+}
+
+static void compile_branch(Compiler *c, Expr *e, int when, int *list);
+
+/* Emits code that jumps (into `list`) when e's truth equals `when` and
+ * falls through otherwise. */
+static void compile_condition(Compiler *c, Expr *e, int when, int *list) {
+    Chunk *chunk = c->chunk;
+    if (!when && c->fuse && cached_ready(c, e)) {
+        write_byte(chunk, BC_JUMP_IF_NOT_CACHED);
+        write_uint16(chunk, (uint16_t)e->cached);
+        add_jump(c, list);
+        return;
+    }
+    if (temp_ready(c, e) || cached_ready(c, e)) {
+        compile_expr(c, e);
+        write_byte(chunk, when ? BC_JUMP_IF_TRUE : BC_JUMP_IF_FALSE);
+        add_jump(c, list);
+        return;
+    }
+    if (e->kind == EXPR_BINARY && (e->as.op.op == OP_AND_OP || e->as.op.op == OP_OR_OP)) {
+        int is_and = e->as.op.op == OP_AND_OP;
+        if (is_and != when) {
+            /* false `and` / true `or`: either side alone decides */
+            compile_branch(c, e->as.op.left, when, list);
+            compile_branch(c, e->as.op.right, when, list);
+        } else {
+            /* the left side can only decide the opposite outcome */
+            int skip = NO_JUMP;
+            compile_branch(c, e->as.op.left, !when, &skip);
+            compile_branch(c, e->as.op.right, when, list);
+            patch_jumps(c, skip);
+        }
+        return;
+    }
+    if (e->kind == EXPR_UNARY && e->as.op.op == OP_NOT_OP) {
+        compile_branch(c, e->as.op.left, !when, list);
+        return;
+    }
+
+    /* a comparison that decides a skip fuses with the jump */
+    if (!when && c->fuse && is_compare(e)) {
+        Comparison cmp = plan_compare(c, e);
+        if (cmp.has_const) {
+            write_byte(chunk, BC_JUMP_IF_NOT_VAR_CONST);
+            write_byte(chunk, cmp.var);
+            write_byte(chunk, compare_opcode(cmp.op));
+            write_double(chunk, cmp.value);
+            add_jump(c, list);
+            return;
+        }
+        if (cmp.right->kind != EXPR_CALL) {
+            compile_operand(c, cmp.left, cmp.right);
+            compile_operand(c, cmp.right, cmp.left);
+            write_byte(chunk, BC_JUMP_IF_NOT_CMP);
+            write_byte(chunk, compare_opcode(cmp.op));
+            add_jump(c, list);
+            return;
+        }
+    }
+    compile_expr(c, e); // an indicator compare is already CMP_IND
+    write_byte(chunk, when ? BC_JUMP_IF_TRUE : BC_JUMP_IF_FALSE);
+    add_jump(c, list);
+}
+
+static void compile_branch(Compiler *c, Expr *e, int when, int *list) {
+    int line = c->line;
+    set_position(c, e->line, c->rule);
+    compile_condition(c, e, when, list);
+    set_position(c, line, c->rule);
+}
+
 /* Compile a single rule:
  * condition -> if false, jump over action
  * action    -> BUY/SELL qty
+ * A rule that reads other timeframes runs only on the bars that close
+ * one of them (Rule.timeframes), whatever else it reads.
  */
 
-static void compile_rule(Chunk *chunk, Rule *r) {
-    /* condition */
-    compile_expr(chunk, r->condition);
-    write_byte(chunk, BC_JUMP_IF_FALSE);
-    int jmp_pos = chunk->count;
-    write_int32(chunk, 0); // placeholder
-
-    /* action */
-    if (r->action->kind == STMT_BUY) {
-        write_byte(chunk, BC_BUY);
-        write_int32(chunk, (int32_t)r->action->quantity);
-    } else if (r->action->kind == STMT_SELL) {
-        write_byte(chunk, BC_SELL);
-        write_int32(chunk, (int32_t)r->action->quantity);
-    }
-
-    /* patch jump offset */
-    int after = chunk->count;
-    int32_t offset = after - (jmp_pos + 4);
-    // write back
-    for (int i = 0; i < 4; ++i) {
-        chunk->code[jmp_pos + i] = (uint8_t)((offset >> (i * 8)) & 0xFF);
+static void compile_rule(Compiler *c, Rule *r) {
+    Chunk *chunk = c->chunk;
+    int skip = NO_JUMP;
+    set_position(c, r->line, r->index);
+    if (r->timeframes) {
+        write_byte(chunk, BC_JUMP_IF_NOT_CLOSED);
+        write_byte(chunk, (uint8_t)r->timeframes);
+        add_jump(c, &skip);
     }
+    compile_branch(c, r->condition, 0, &skip);
+
+    /* action, tagged with the rule's source position */
+    if (r->index > UINT16_MAX) compile_error(c, NULL, "Too many rules");
+    set_position(c, r->action->line, r->index);
+    write_byte(chunk, r->action->kind == STMT_BUY ? BC_BUY : BC_SELL);
+    write_int32(chunk, (int32_t)r->action->quantity);
+    write_uint16(chunk, (uint16_t)r->index);
+
+    patch_jumps(c, skip);
 }
 
-/* Compile entire program: symbol is handled in runtime; rules emit sequentially. */
+/* Compile entire program: symbol is handled in runtime. The indicator
+ * updates come first, then the cached values and shared temps, then the
+ * rules in order. With a rule index, RULE_INDEX precedes the rules and
+ * each rule ends in NEXT_RULE, so the VM runs only the candidates; a
+ * rule's own jumps never leave it. */
 
-void compile_program(Program *program, Chunk *chunk) {
+int compile_program_r(Program *program, Chunk *chunk, const CompileOptions *opts,
+                      char *err, size_t errlen) {
+    Compiler compiler;
+    Compiler *c = &compiler;
+    c->chunk = chunk;
+    c->fuse = opts ? opts->fuse : 1;
+    c->index_rules = opts ? opts->gate : 1;
+    c->slot_calls = NULL;
+    c->slot_table = (ExprTable){ NULL, NULL, 0, 0 };
+    c->cse = NULL;
+    c->cse_count = c->cse_capacity = 0;
+    c->cse_table = (ExprTable){ NULL, NULL, 0, 0 };
+    c->temps_ready = 0;
+    c->cached_ready = 0;
+    c->gate = TF_BAR;
+    c->gate_jumps = NO_JUMP;
+    c->line = 0;
+    c->rule = -1;
+    c->err = err;
+    c->errlen = errlen;
     init_chunk(chunk);
-    Rule *r = program->rules;
-    while (r) {
-        compile_rule(chunk, r);
-        r = r->next;
+    if (setjmp(c->on_error)) {
+        free(c->slot_calls);
+        free(c->cse);
+        free_table(&c->slot_table);
+        free_table(&c->cse_table);
+        free_chunk(chunk);
+        return -1;
+    }
+
+    if (program->param_count > 0) {
+        chunk->params = (Param*)malloc((size_t)program->param_count * sizeof(Param));
+        if (!chunk->params) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        memcpy(chunk->params, program->params, (size_t)program->param_count * sizeof(Param));
+        chunk->param_count = program->param_count;
     }
+    for (Rule *r = program->rules; r; r = r->next) {
+        clear_temps(r->condition);
+    }
+    for (Rule *r = program->rules; r; r = r->next) {
+        compile_updates(c, r->condition);
+    }
+    close_gate(c);
+    compile_temps(c, program);
+    RuleIndex *index = &chunk->gates;
+    int end = NO_JUMP, position = 0;
+    if (c->index_rules) build_rule_index(index, program);
+    if (index->rule_count > 0) {
+        write_byte(chunk, BC_RULE_INDEX);
+        add_jump(c, &end);
+    }
+    for (Rule *r = program->rules; r; r = r->next) {
+        if (index->rule_count > 0) index->entries[position++] = chunk->count;
+        compile_rule(c, r);
+        if (index->rule_count > 0) {
+            write_byte(chunk, BC_NEXT_RULE);
+            add_jump(c, &end);
+        }
+    }
+    patch_jumps(c, end);
+    set_position(c, 0, -1);
     write_byte(chunk, BC_HALT);
+    free(c->slot_calls);
+    free(c->cse);
+    free_table(&c->slot_table);
+    free_table(&c->cse_table);
+    if (decode_chunk(chunk, err, errlen) != 0) {
+        free_chunk(chunk);
+        return -1;
+    }
+    return 0;
+}
+
+void compile_program(Program *program, Chunk *chunk) {
+    char err[256];
+    if (compile_program_r(program, chunk, NULL, err, sizeof(err)) != 0) {
+        fprintf(stderr, "%s\n", err);
+        exit(1);
+    }
 }
 
 /* ---------- VM ---------- */
 
 #define STACK_MAX 256
 
+/* Threaded dispatch: every handler ends in its own indirect jump through
+ * the decoded instruction's label, which predicts far better than the
+ * single switch jump. Build with -DTLC_NO_THREADED_DISPATCH (or a
+ * compiler without labels-as-values) to get the portable switch loop. */
+#if defined(__GNUC__) && !defined(TLC_NO_THREADED_DISPATCH)
+#define TLC_THREADED_DISPATCH 1
+#endif
+
 typedef struct {
-    double stack[STACK_MAX];
-    int sp;
-    const uint8_t *ip;
-    Chunk *chunk;
+    const Chunk *chunk;
     VMContext ctx;
-    const char *symbol;
+    IndicatorState *ind;
+    const SignalSink *sink;
+    VMProfile *profile;    // vm_exec_profiled only
 } VM;
 
-static double pop(VM *vm) {
-    return vm->stack[--vm->sp];
+static uint16_t read_uint16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
 }
 
-static void push(VM *vm, double v) {
-    vm->stack[vm->sp++] = v;
+static int32_t read_int32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= ((uint32_t)p[i] << (i * 8));
+    return (int32_t)v;
 }
 
-/* Dummy indicator implementations for skeleton. You will replace with real ones. */
-static double builtin_sma(double series, double period) {
-    (void)series; (void)period;
-    return series; // placeholder
+static double read_double(const uint8_t *p) {
+    union { double d; uint8_t b[8]; } u;
+    memcpy(u.b, p, 8);
+    return u.d;
 }
 
-static double builtin_ema(double series, double period) {
-    (void)series; (void)period;
-    return series; // placeholder
+static double load_var(const VMContext *ctx, uint8_t id) {
+    switch (id) {
+        case VAR_OPEN:    return ctx->open;
+        case VAR_HIGH:    return ctx->high;
+        case VAR_LOW:     return ctx->low;
+        case VAR_CLOSE:   return ctx->close;
+        case VAR_VOLUME:  return ctx->volume;
+        case VAR_DATE:    return (double)ctx->date;
+        case VAR_TIME:    return (double)ctx->time;
+        case VAR_HOUR:    return (double)ctx->hour;
+        case VAR_MINUTE:  return (double)ctx->minute;
+        case VAR_WEEKDAY: return (double)ctx->weekday;
+        default:          return 0.0;
+    }
 }
 
-static double builtin_rsi(double period) {
-    (void)period;
-    return 50.0; // placeholder
+/* Field of tf's last closed bar; NaN until one has closed */
+static double load_frame_var(const BarAggregator *agg, int tf, uint8_t id) {
+    if (!agg || agg->count[tf] == 0) return NAN;
+    return load_var(&agg->history[tf][(agg->count[tf] - 1) % TF_HISTORY], id);
 }
 
-static void vm_run(VM *vm) {
-    vm->ip = vm->chunk->code;
-    vm->sp = 0;
+/* cmp operand of the fused opcodes */
+static int compare(uint8_t cmp, double a, double b) {
+    switch (cmp) {
+        case BC_GT: return a >  b;
+        case BC_LT: return a <  b;
+        case BC_GE: return a >= b;
+        case BC_LE: return a <= b;
+        case BC_EQ: return a == b;
+        default:    return a != b;
+    }
+}
 
-    for (;;) {
-        OpCode op = (OpCode)(*vm->ip++);
-        switch (op) {
-            case BC_HALT:
-                return;
+/* ---------- Streaming indicators ----------
+ *
+ * Every IND_UPDATE site owns one slot. Each bar pushes one input value into
+ * its slot and reads the new output; no call recomputes a window and
+ * nothing allocates after init_indicators.
+ *
+ * Warm-up: SMA averages the bars seen so far, EMA seeds with the first
+ * input, RSI reports a neutral 50 until `period` changes have been seen.
+ */
+
+static BatchLanes *new_batch_lanes(const Chunk *chunk);
+static void free_batch_lanes(BatchLanes *lanes);
+
+static int slot_period(const IndicatorState *state, const IndicatorSlot *slot) {
+    return slot->param >= 0 ? (int)state->params[slot->param] : slot->period;
+}
+
+void init_indicators(IndicatorState *state, const Chunk *chunk) {
+    init_indicators_with(state, chunk, NULL);
+}
+
+/* params overrides the chunk's parameter defaults (NULL keeps them); a
+ * slot whose period is a parameter is sized by this run's value, which
+ * like the default must be a whole period (run_sweep checks the values
+ * it is given) */
+void init_indicators_with(IndicatorState *state, const Chunk *chunk, const double *params) {
+    state->count = chunk->slot_count;
+    state->slots = NULL;
+    state->windows = NULL;
+    state->bars = 0;
+    state->frames = NULL;
+    state->cached = NULL;
+    state->candidates = NULL;
+    state->params = NULL;
+    state->feeds = NULL;
+    state->lanes = NULL;
+    state->day_stamp = state->minute_stamp[0] = state->minute_stamp[1] = -1;
+    if (chunk->param_count > 0) {
+        state->params = (double*)malloc((size_t)chunk->param_count * sizeof(double));
+        if (!state->params) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        for (int p = 0; p < chunk->param_count; ++p)
+            state->params[p] = params ? params[p] : chunk->params[p].value;
+    }
+    if (chunk->gates.rule_count > 0) {
+        state->candidates = (int32_t*)malloc((size_t)chunk->gates.rule_count * sizeof(int32_t));
+        if (!state->candidates) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    }
+    if (chunk->timeframes) {
+        state->frames = (BarAggregator*)malloc(sizeof(BarAggregator));
+        if (!state->frames) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        init_aggregator(state->frames, chunk->timeframes);
+    }
+    if (chunk->cached_count > 0) {
+        state->cached = (double*)calloc((size_t)chunk->cached_count, sizeof(double));
+        if (!state->cached) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    }
+    /* a decoded chunk on the input bars alone runs a block at a time */
+    if (chunk->instrs && !chunk->timeframes) state->lanes = new_batch_lanes(chunk);
+    if (state->count <= 0) return;
+
+    size_t window_total = 0;
+    for (int i = 0; i < chunk->slot_count; ++i) {
+        if (builtin_func((FuncId)chunk->slots[i].func)->window)
+            window_total += (size_t)slot_period(state, &chunk->slots[i]);
+    }
+    state->slots = (Indicator*)calloc((size_t)state->count, sizeof(Indicator));
+    state->windows = window_total ? (double*)malloc(window_total * sizeof(double)) : NULL;
+    if (!state->slots || (window_total && !state->windows)) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    double *w = state->windows;
+    for (int i = 0; i < state->count; ++i) {
+        Indicator *ind = &state->slots[i];
+        ind->func = chunk->slots[i].func;
+        ind->period = slot_period(state, &chunk->slots[i]);
+        if (builtin_func((FuncId)ind->func)->window) {
+            ind->window = w;
+            w += ind->period;
+        }
+    }
+    reset_indicators(state);
+}
+
+void reset_indicators(IndicatorState *state) {
+    state->bars = 0;
+    if (state->frames) init_aggregator(state->frames, state->frames->used);
+    state->day_stamp = state->minute_stamp[0] = state->minute_stamp[1] = -1;
+    for (int i = 0; i < state->count; ++i) {
+        Indicator *ind = &state->slots[i];
+        ind->head = ind->filled = ind->count = 0;
+        ind->sum = ind->comp = 0.0;
+        ind->value = ind->prev = 0.0;
+        ind->avg_gain = ind->avg_loss = 0.0;
+        ind->output = 0.0;
+    }
+}
+
+void free_indicators(IndicatorState *state) {
+    free(state->slots);
+    free(state->windows);
+    free(state->frames);
+    free(state->cached);
+    free(state->candidates);
+    free(state->params);
+    free_batch_lanes(state->lanes);
+    state->slots = NULL;
+    state->windows = NULL;
+    state->frames = NULL;
+    state->cached = NULL;
+    state->candidates = NULL;
+    state->params = NULL;
+    state->lanes = NULL;
+    state->count = 0;
+}
 
-            case BC_PUSH_CONST: {
-                union { double d; uint8_t b[8]; } u;
-                for (int i = 0; i < 8; ++i) u.b[i] = *vm->ip++;
-                push(vm, u.d);
+/* Kahan-compensated add keeps the running sum from drifting over long histories */
+static void sma_accumulate(Indicator *ind, double x) {
+    double y = x - ind->comp;
+    double t = ind->sum + y;
+    ind->comp = (t - ind->sum) - y;
+    ind->sum = t;
+}
+
+static double builtin_sma(Indicator *ind, double x) {
+    if (ind->filled == ind->period) {
+        sma_accumulate(ind, -ind->window[ind->head]);
+    } else {
+        ind->filled++;
+    }
+    ind->window[ind->head] = x;
+    sma_accumulate(ind, x);
+    if (++ind->head == ind->period) ind->head = 0;
+    return ind->sum / ind->filled;
+}
+
+static double builtin_ema(Indicator *ind, double x) {
+    if (ind->count++ == 0) {
+        ind->value = x;
+    } else {
+        double alpha = 2.0 / (ind->period + 1.0);
+        ind->value += alpha * (x - ind->value);
+    }
+    return ind->value;
+}
+
+/* Wilder's RSI: simple average of the first `period` changes, then
+ * exponential smoothing with factor 1/period. */
+static double builtin_rsi(Indicator *ind, double x) {
+    if (ind->count++ == 0) {
+        ind->prev = x;
+        ind->value = 50.0;
+        return ind->value;
+    }
+    double change = x - ind->prev;
+    double gain = change > 0.0 ? change : 0.0;
+    double loss = change < 0.0 ? -change : 0.0;
+    ind->prev = x;
+
+    int n = ind->count - 1; // changes seen, including this one
+    if (n <= ind->period) {
+        ind->avg_gain += gain;
+        ind->avg_loss += loss;
+        if (n < ind->period) return ind->value;
+        ind->avg_gain /= ind->period;
+        ind->avg_loss /= ind->period;
+    } else {
+        ind->avg_gain = (ind->avg_gain * (ind->period - 1) + gain) / ind->period;
+        ind->avg_loss = (ind->avg_loss * (ind->period - 1) + loss) / ind->period;
+    }
+
+    if (ind->avg_loss == 0.0) {
+        ind->value = ind->avg_gain == 0.0 ? 50.0 : 100.0;
+    } else {
+        ind->value = 100.0 - 100.0 / (1.0 + ind->avg_gain / ind->avg_loss);
+    }
+    return ind->value;
+}
+
+/* IND_UPDATE dispatch, expanded from the builtin registry */
+static const IndicatorUpdate indicator_update[FUNC_COUNT] = {
+#define X(id, name, arity, window, update) [id] = update,
+    TL_BUILTIN_FUNCS(X)
+#undef X
+};
+
+IndicatorUpdate indicator_function(int func) {
+    return (func >= 0 && func < FUNC_COUNT) ? indicator_update[func] : NULL;
+}
+
+#define VM_EXEC vm_exec
+#include "vm_exec.h"
+
+#define VM_EXEC vm_exec_profiled
+#define VM_PROFILE 1
+#include "vm_exec.h"
+
+static int decode_error(const Chunk *chunk, char *err, size_t errlen, int offset,
+                        const char *what) {
+    int line = chunk_line(chunk, offset, NULL);
+    if (!err || !errlen) return -1;
+    if (line > 0) snprintf(err, errlen, "Bad bytecode at %04d (line %d): %s", offset, line, what);
+    else snprintf(err, errlen, "Bad bytecode at %04d: %s", offset, what);
+    return -1;
+}
+
+static int add_constant(Chunk *chunk, double v) {
+    chunk->constants[chunk->constant_count] = v;
+    return chunk->constant_count++;
+}
+
+/* With a rule index the rules follow RULE_INDEX, each one's code ends in
+ * NEXT_RULE, the last NEXT_RULE is followed by the final HALT, and the
+ * entries are where the rules start. `gate_ops` counts the two opcodes
+ * in the code; *at gets the offset a problem is reported at. */
+static const char *check_rule_layout(const Chunk *chunk, const int *index_at, int gate_ops,
+                                     int *at) {
+    const RuleIndex *index = &chunk->gates;
+    *at = 0;
+    if (index->rule_count == 0) return gate_ops ? "rule gating without an index" : NULL;
+    const char *bad = check_rule_index(index);
+    if (bad) return bad;
+    if (gate_ops != index->rule_count + 1) return "rule index does not match the code";
+    for (int p = 0; p < index->rule_count; ++p) {
+        int32_t entry = index->entries[p];
+        if (entry < 5 || entry >= chunk->count || (p > 0 && entry <= index->entries[p - 1]))
+            return "bad rule entry";
+        *at = entry;
+        if (index_at[entry] < 0 || index_at[entry - 5] < 0 ||
+            chunk->code[entry - 5] != (p == 0 ? BC_RULE_INDEX : BC_NEXT_RULE))
+            return "bad rule entry";
+    }
+    int last = chunk->count - 1 - 5;
+    *at = last;
+    if (last < index->entries[index->rule_count - 1] || index_at[last] < 0 ||
+        chunk->code[last] != BC_NEXT_RULE)
+        return "rules do not end in NEXT_RULE";
+    return NULL;
+}
+
+/* Builds chunk->instrs from chunk->code: one aligned Instr per bytecode
+ * instruction, with operands unpacked once here instead of on every bar.
+ * The bytecode is validated on the way (ids, slots, jump targets), so the
+ * dispatch loop needs no checks. compile_program_r calls this. */
+int decode_chunk(Chunk *chunk, char *err, size_t errlen) {
+    free(chunk->instrs);
+    free(chunk->constants);
+    free(chunk->rule_targets);
+    chunk->instrs = NULL;
+    chunk->constants = NULL;
+    chunk->rule_targets = NULL;
+    chunk->instr_count = chunk->constant_count = 0;
+    chunk->timeframes = 0;
+    chunk->stack_depth = chunk->jump_targets = 0;
+
+    /* pass 1: instruction boundaries; index_at[offset] is the instruction
+     * starting there, or -1 */
+    int *index_at = (int*)malloc((size_t)(chunk->count + 1) * sizeof(int));
+    int n = 0, consts = 0, gate_ops = 0;
+    for (int i = 0; i <= chunk->count; ++i) index_at[i] = -1;
+    for (int offset = 0; offset < chunk->count; ) {
+        OpCode op = (OpCode)chunk->code[offset];
+        if (op >= BC_OPCODE_COUNT) {
+            free(index_at);
+            return decode_error(chunk, err, errlen, offset, "unknown opcode");
+        }
+        int len = instruction_length(chunk, offset);
+        if (offset + len > chunk->count) {
+            free(index_at);
+            return decode_error(chunk, err, errlen, offset, "truncated instruction");
+        }
+        if (op == BC_PUSH_CONST || op == BC_CMP_VAR_CONST || op == BC_JUMP_IF_NOT_VAR_CONST)
+            consts++;
+        if (op == BC_RULE_INDEX || op == BC_NEXT_RULE) gate_ops++;
+        index_at[offset] = n++;
+        offset += len;
+    }
+    if (n == 0 || chunk->code[chunk->count - 1] != BC_HALT) {
+        free(index_at);
+        return decode_error(chunk, err, errlen, chunk->count, "missing HALT");
+    }
+    index_at[chunk->count] = n;
+    chunk->stack_depth = max_stack_depth(chunk);
+    if (chunk->stack_depth > STACK_MAX) {
+        free(index_at);
+        return decode_error(chunk, err, errlen, 0, "expression too deep");
+    }
+    if (chunk->temp_count < 0 || chunk->temp_count > TEMP_MAX) {
+        free(index_at);
+        return decode_error(chunk, err, errlen, 0, "too many temps");
+    }
+    if (chunk->cached_count < 0 || chunk->cached_count > TEMP_MAX) {
+        free(index_at);
+        return decode_error(chunk, err, errlen, 0, "too many cached values");
+    }
+    int at;
+    const char *layout = check_rule_layout(chunk, index_at, gate_ops, &at);
+    if (layout) {
+        free(index_at);
+        return decode_error(chunk, err, errlen, at, layout);
+    }
+
+    chunk->instrs = (Instr*)calloc((size_t)n, sizeof(Instr));
+    chunk->constants = (double*)malloc((size_t)(consts ? consts : 1) * sizeof(double));
+    const void *const *labels = vm_exec(NULL);
+
+    /* pass 2: unpack operands. With a rule index, jumps before RULE_INDEX
+     * stay at or before it and a rule's jumps stay inside the rule. */
+    const RuleIndex *index = &chunk->gates;
+    const char *bad = NULL;
+    int offset = 0, region = -1;
+    int limit = index->rule_count ? index->entries[0] - 5 : chunk->count;
+    for (int i = 0; i < n && !bad; ++i) {
+        const uint8_t *p = chunk->code + offset;
+        while (region + 1 < index->rule_count && offset >= index->entries[region + 1]) {
+            region++;
+            limit = (region + 1 < index->rule_count ? index->entries[region + 1]
+                                                    : chunk->count - 1) - 5;
+        }
+        int len = instruction_length(chunk, offset);
+        Instr *in = &chunk->instrs[i];
+        in->op = p[0];
+        in->handler = labels ? labels[p[0]] : NULL;
+        int jump = -1;   // operand offset of a jump displacement
+        switch ((OpCode)p[0]) {
+            case BC_PUSH_CONST:
+                in->arg = add_constant(chunk, read_double(p + 1));
                 break;
-            }
+            case BC_LOAD_VAR:
+                in->a = p[1];
+                if (in->a >= VAR_COUNT) bad = "unknown field";
+                break;
+            case BC_IND_UPDATE:
+                in->a = p[1];
+                in->slot = read_uint16(p + 2);
+                if (in->a >= FUNC_COUNT) bad = "unknown function";
+                else if (in->slot >= chunk->slot_count) bad = "indicator slot out of range";
+                else if (chunk->slots[in->slot].func != in->a) bad = "indicator slot holds another function";
+                break;
+            case BC_STORE_TEMP:
+            case BC_LOAD_TEMP:
+                in->slot = read_uint16(p + 1);
+                if (in->slot >= chunk->temp_count) bad = "temp out of range";
+                break;
+            case BC_STORE_CACHED:
+            case BC_LOAD_CACHED:
+            case BC_JUMP_IF_NOT_CACHED:
+                in->slot = read_uint16(p + 1);
+                if (in->slot >= chunk->cached_count) bad = "cached value out of range";
+                if (p[0] == BC_JUMP_IF_NOT_CACHED) jump = 3;
+                break;
+            case BC_JUMP_IF_SAME:
+                in->a = p[1];
+                if (in->a != FREQ_DAY && in->a != FREQ_MINUTE) bad = "bad frequency";
+                jump = 2;
+                break;
+            case BC_LOAD_IND:
+            case BC_CMP_IND:
+                in->slot = read_uint16(p + 1);
+                if (p[0] == BC_CMP_IND) in->cmp = p[3];
+                if (in->slot >= chunk->slot_count) bad = "indicator slot out of range";
+                break;
+            case BC_CMP_VAR_CONST:
+            case BC_JUMP_IF_NOT_VAR_CONST:
+                in->a = p[1];
+                in->cmp = p[2];
+                in->konst = add_constant(chunk, read_double(p + 3));
+                if (p[0] == BC_JUMP_IF_NOT_VAR_CONST) jump = 11;
+                if (in->a >= VAR_COUNT) bad = "unknown field";
+                break;
+            case BC_JUMP_IF_NOT_CMP:
+                in->cmp = p[1];
+                jump = 2;
+                break;
+            case BC_LOAD_TF_VAR:
+                in->slot = p[1];
+                in->a = p[2];
+                if (in->slot <= TF_BAR || in->slot >= TF_COUNT) bad = "unknown timeframe";
+                else if (in->a >= VAR_COUNT) bad = "unknown field";
+                chunk->timeframes |= 1u << (in->slot & 31);
+                break;
+            case BC_JUMP_IF_NOT_CLOSED:
+                in->slot = p[1];
+                if (in->slot == 0 || (in->slot & ~(((1u << TF_COUNT) - 1) & ~1u)))
+                    bad = "bad timeframe mask";
+                chunk->timeframes |= in->slot;
+                jump = 2;
+                break;
+            case BC_JUMP_IF_FALSE:
+            case BC_JUMP_IF_TRUE:
+            case BC_JUMP:
+            case BC_RULE_INDEX:
+            case BC_NEXT_RULE:
+                jump = 1;
+                break;
+            case BC_BUY:
+            case BC_SELL:
+                in->arg = read_int32(p + 1);
+                in->slot = read_uint16(p + 5);
+                break;
+            case BC_LOAD_PARAM:
+                in->slot = read_uint16(p + 1);
+                if (in->slot >= chunk->param_count) bad = "parameter out of range";
+                break;
+            default:
+                break;
+        }
+        if ((p[0] == BC_CMP_IND || p[0] == BC_CMP_VAR_CONST || p[0] == BC_JUMP_IF_NOT_CMP ||
+             p[0] == BC_JUMP_IF_NOT_VAR_CONST) && (in->cmp < BC_GT || in->cmp > BC_NE)) {
+            bad = "bad compare operand";
+        }
+        if (jump >= 0) {
+            /* forward only, onto an instruction boundary */
+            int32_t rel = read_int32(p + jump);
+            int64_t target = (int64_t)offset + len + rel;
+            int gating = p[0] == BC_RULE_INDEX || p[0] == BC_NEXT_RULE;
+            if (rel < 0 || target > chunk->count || index_at[target] < 0 || target == chunk->count)
+                bad = "bad jump target";
+            else if (gating ? target != chunk->count - 1 : target > limit)
+                bad = "jump leaves its rule";
+            else
+                in->arg = index_at[target];
+        }
+        if (!bad) offset += len;
+    }
+    if (!bad && index->rule_count > 0) {
+        chunk->rule_targets = (int32_t*)malloc((size_t)index->rule_count * sizeof(int32_t));
+        if (!chunk->rule_targets) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        for (int p = 0; p < index->rule_count; ++p) chunk->rule_targets[p] = index_at[index->entries[p]];
+    }
+    free(index_at);
+    if (!bad) chunk->jump_targets = count_jump_targets(chunk->instrs, n);
+    if (bad) {
+        free(chunk->instrs);
+        free(chunk->constants);
+        chunk->instrs = NULL;
+        chunk->constants = NULL;
+        chunk->constant_count = 0;
+        chunk->timeframes = 0;
+        chunk->jump_targets = 0;
+        return decode_error(chunk, err, errlen, offset, bad);
+    }
+    chunk->instr_count = n;
+    return 0;
+}
+
+void send_signal(const SignalSink *sink, const IndicatorState *ind, int side, int32_t qty,
+                 int rule) {
+    Signal sig;
+    sig.bar = ind->bars;
+    sig.symbol_id = sink->symbol_id;
+    sig.qty = qty;
+    sig.rule = (uint16_t)rule;
+    sig.side = (uint8_t)side;
+    sink->emit(sink->user, &sig);
+}
+
+/* JUMP_IF_SAME: is ctx in the day (FREQ_DAY) or minute (FREQ_MINUTE) the
+ * cached values of that frequency were computed for? If not, it is now. */
+int same_period(IndicatorState *ind, const VMContext *ctx, int freq) {
+    if (freq == FREQ_DAY) {
+        if (ind->day_stamp == ctx->date) return 1;
+        ind->day_stamp = ctx->date;
+        return 0;
+    }
+    if (ind->minute_stamp[0] == ctx->date && ind->minute_stamp[1] == ctx->time) return 1;
+    ind->minute_stamp[0] = ctx->date;
+    ind->minute_stamp[1] = ctx->time;
+    return 0;
+}
+
+void run_chunk(Chunk *chunk, IndicatorState *ind, const VMContext *ctx, const SignalSink *sink) {
+    VM vm;
+    vm.chunk = chunk;
+    vm.ctx = *ctx;
+    vm.ind = ind;
+    vm.sink = sink;
+    vm.profile = NULL;
+    if (ind->frames) aggregate_bar(ind->frames, ctx);
+    vm_exec(&vm);
+    ind->bars++;
+}
+
+void run_chunk_profiled(Chunk *chunk, IndicatorState *ind, const VMContext *ctx,
+                        const SignalSink *sink, VMProfile *profile) {
+    VM vm;
+    vm.chunk = chunk;
+    vm.ctx = *ctx;
+    vm.ind = ind;
+    vm.sink = sink;
+    vm.profile = profile;
+    if (ind->frames) aggregate_bar(ind->frames, ctx);
+    vm_exec_profiled(&vm);
+    ind->bars++;
+    profile->bars++;
+}
+
+/* ---------- Batch VM ----------
+ *
+ * Runs the same bytecode over a block of bars at a time. Every stack slot
+ * holds BATCH_BLOCK lanes (one per bar), so each opcode is a tight loop over
+ * a column that the compiler can vectorize, and dispatch is paid once per
+ * block instead of once per bar.
+ *
+ * Control flow is handled with lane masks: a conditional jump parks the
+ * lanes that take it on the jump target and execution continues in a
+ * straight line (all jumps are forward). Pure opcodes compute every lane;
+ * only side effects (indicator updates, BUY/SELL) look at the active mask.
+ * Signals are staged per block and replayed in bar order, so the output is
+ * identical to calling run_chunk once per bar, bar indices included.
+ */
+
+#define BATCH_BLOCK 256
+#define MASK_WORDS (BATCH_BLOCK / 64)
+
+typedef struct {
+    uint64_t w[MASK_WORDS];
+} LaneMask;
+
+typedef struct {
+    int target;     // bytecode offset the parked lanes resume at
+    LaneMask mask;
+} PendingJump;
+
+typedef struct {
+    int lane;
+    int side;       // BC_BUY or BC_SELL
+    int32_t qty;
+    uint16_t rule;
+} StagedSignal;
+
+/* Block buffers, sized from the chunk by init_indicators so that
+ * run_chunk_batch allocates nothing; only the staged signals grow past
+ * one per lane, and they are kept for the next call. */
+struct BatchLanes {
+    double (*stack)[BATCH_BLOCK];    // stack_depth + 1: a scratch block for fused compares
+    double (*ind_out)[BATCH_BLOCK];  // IND_UPDATE keeps every lane's output for LOAD_IND
+    double (*temps)[BATCH_BLOCK];
+    double (*cached)[BATCH_BLOCK];   // recomputed every block, kept per lane like temps
+    uint64_t *block_rules;           // rules that are a candidate on some bar of the block
+    PendingJump *pending;            // one per outstanding jump target
+    StagedSignal *staged, *sorted;
+    int staged_cap, sorted_cap;
+};
 
-            case BC_LOAD_VAR: {
-                uint8_t id = *vm->ip++;
-                double val = 0.0;
-                switch (id) {
-                    case VAR_OPEN:    val = vm->ctx.open; break;
-                    case VAR_HIGH:    val = vm->ctx.high; break;
-                    case VAR_LOW:     val = vm->ctx.low; break;
-                    case VAR_CLOSE:   val = vm->ctx.close; break;
-                    case VAR_VOLUME:  val = vm->ctx.volume; break;
-                    case VAR_DATE:    val = (double)vm->ctx.date; break;
-                    case VAR_TIME:    val = (double)vm->ctx.time; break;
-                    case VAR_HOUR:    val = (double)vm->ctx.hour; break;
-                    case VAR_MINUTE:  val = (double)vm->ctx.minute; break;
-                    case VAR_WEEKDAY: val = (double)vm->ctx.weekday; break;
-                    default: val = 0.0; break;
+static BatchLanes *new_batch_lanes(const Chunk *chunk) {
+    size_t blocks = (size_t)chunk->stack_depth + 1 + (size_t)chunk->slot_count +
+                    (size_t)chunk->temp_count + (size_t)chunk->cached_count;
+    BatchLanes *lanes = (BatchLanes*)calloc(1, sizeof(BatchLanes));
+    double (*block)[BATCH_BLOCK] = (double (*)[BATCH_BLOCK])malloc(blocks * sizeof(*block));
+    int words = chunk->gates.words ? chunk->gates.words : 1;
+    int targets = chunk->jump_targets ? chunk->jump_targets : 1;
+    if (lanes) {
+        lanes->block_rules = (uint64_t*)malloc((size_t)words * sizeof(uint64_t));
+        lanes->pending = (PendingJump*)malloc((size_t)targets * sizeof(PendingJump));
+        lanes->staged = (StagedSignal*)malloc(BATCH_BLOCK * sizeof(StagedSignal));
+        lanes->sorted = (StagedSignal*)malloc(BATCH_BLOCK * sizeof(StagedSignal));
+        lanes->staged_cap = lanes->sorted_cap = BATCH_BLOCK;
+    }
+    if (!lanes || !block || !lanes->block_rules || !lanes->pending || !lanes->staged ||
+        !lanes->sorted) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    lanes->stack = block;
+    lanes->ind_out = lanes->stack + chunk->stack_depth + 1;
+    lanes->temps = lanes->ind_out + chunk->slot_count;
+    lanes->cached = lanes->temps + chunk->temp_count;
+    return lanes;
+}
+
+static void free_batch_lanes(BatchLanes *lanes) {
+    if (!lanes) return;
+    free(lanes->stack);
+    free(lanes->block_rules);
+    free(lanes->pending);
+    free(lanes->staged);
+    free(lanes->sorted);
+    free(lanes);
+}
+
+/* Bytecode is stack-balanced per rule and jumps only forward, so a linear
+ * scan of stack effects gives the deepest stack any path can reach. */
+
+static void stage_signal(StagedSignal **staged, int *count, int *cap,
+                         int lane, int side, int32_t qty, uint16_t rule) {
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        *staged = (StagedSignal*)realloc(*staged, (size_t)*cap * sizeof(StagedSignal));
+        if (!*staged) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    }
+    (*staged)[*count].lane = lane;
+    (*staged)[*count].side = side;
+    (*staged)[*count].qty = qty;
+    (*staged)[*count].rule = rule;
+    (*count)++;
+}
+
+#define LANES(expr) for (int l = 0; l < n; ++l) { expr; }
+#define BINARY_LANES(op) do {                          \
+        double *a = stack[sp - 2], *b = stack[sp - 1]; \
+        LANES(a[l] = op);                              \
+        sp--;                                          \
+    } while (0)
+
+#define INDICATOR_LANES(fn) do {                                   \
+        if (all) { LANES(v[l] = fn(slot, v[l])); }                 \
+        else { LANES(if (lane_active(&active, l)) v[l] = fn(slot, v[l])); } \
+    } while (0)
+
+static int lane_active(const LaneMask *m, int lane) {
+    return (int)((m->w[lane >> 6] >> (lane & 63)) & 1);
+}
+
+static int mask_equal(const LaneMask *a, const LaneMask *b) {
+    uint64_t diff = 0;
+    for (int i = 0; i < MASK_WORDS; ++i) diff |= a->w[i] ^ b->w[i];
+    return diff == 0;
+}
+
+static int mask_empty(const LaneMask *m) {
+    uint64_t any = 0;
+    for (int i = 0; i < MASK_WORDS; ++i) any |= m->w[i];
+    return any == 0;
+}
+
+static void load_column_double(double *dst, const double *src, int n) {
+    memcpy(dst, src, (size_t)n * sizeof(double));
+}
+
+static void load_column_int(double *dst, const int32_t *src, int n) {
+    LANES(dst[l] = (double)src[l]);
+}
+
+static void load_var_lanes(double *dst, const BarColumns *bars, size_t base, int n, uint8_t id) {
+    switch (id) {
+        case VAR_OPEN:    load_column_double(dst, bars->open + base, n); break;
+        case VAR_HIGH:    load_column_double(dst, bars->high + base, n); break;
+        case VAR_LOW:     load_column_double(dst, bars->low + base, n); break;
+        case VAR_CLOSE:   load_column_double(dst, bars->close + base, n); break;
+        case VAR_VOLUME:  load_column_double(dst, bars->volume + base, n); break;
+        case VAR_DATE:    load_column_int(dst, bars->date + base, n); break;
+        case VAR_TIME:    load_column_int(dst, bars->time + base, n); break;
+        case VAR_HOUR:    load_column_int(dst, bars->hour + base, n); break;
+        case VAR_MINUTE:  load_column_int(dst, bars->minute + base, n); break;
+        case VAR_WEEKDAY: load_column_int(dst, bars->weekday + base, n); break;
+        default: LANES(dst[l] = 0.0); break;
+    }
+}
+
+/* dst[l] = a[l] cmp b[l], or a[l] cmp k when b is NULL; dst may alias a or b */
+static void compare_lanes(uint8_t cmp, double *dst, const double *a, const double *b,
+                          double k, int n) {
+#define CMP_LANES(op) do {                                       \
+        if (b) { LANES(dst[l] = (double)(a[l] op b[l])); }       \
+        else   { LANES(dst[l] = (double)(a[l] op k)); }          \
+    } while (0)
+    switch (cmp) {
+        case BC_GT: CMP_LANES(>);  break;
+        case BC_LT: CMP_LANES(<);  break;
+        case BC_GE: CMP_LANES(>=); break;
+        case BC_LE: CMP_LANES(<=); break;
+        case BC_EQ: CMP_LANES(==); break;
+        default:    CMP_LANES(!=); break;
+    }
+#undef CMP_LANES
+}
+
+/* Position of the first set bit at or after `from`, or -1 */
+static int next_set_bit(const uint64_t *bits, int words, int from) {
+    for (int w = from >> 6; w < words; ++w) {
+        uint64_t b = bits[w];
+        if (w == from >> 6) b &= ~(uint64_t)0 << (from & 63);
+        if (b) {
+#if defined(__GNUC__)
+            return w * 64 + __builtin_ctzll(b);
+#else
+            int bit = 0;
+            while (!((b >> bit) & 1)) bit++;
+            return w * 64 + bit;
+#endif
+        }
+    }
+    return -1;
+}
+
+/* Moves the active lanes whose cond truth equals `when` (all active lanes
+ * when cond is NULL) to the pending set for `target`. */
+static void park_lanes(LaneMask *active, PendingJump *pending, int *pending_count,
+                       const double *cond, int when, int n, int target) {
+    LaneMask taken;
+    if (!cond) {
+        taken = *active;
+    } else {
+        for (int i = 0; i < MASK_WORDS; ++i) {
+            uint64_t hit = 0;
+            int lo = i * 64;
+            int hi = n - lo < 64 ? n - lo : 64;
+            for (int l = 0; l < hi; ++l)
+                hit |= (uint64_t)((cond[lo + l] != 0.0) == when) << l;
+            taken.w[i] = active->w[i] & hit;
+        }
+    }
+    if (mask_empty(&taken)) return;
+    for (int i = 0; i < MASK_WORDS; ++i) active->w[i] &= ~taken.w[i];
+
+    /* decode_chunk counted the targets that can be outstanding at once
+     * (Chunk.jump_targets), and pending holds that many */
+    int p = 0;
+    while (p < *pending_count && pending[p].target != target) ++p;
+    if (p == *pending_count) {
+        pending[p].target = target;
+        memset(&pending[p].mask, 0, sizeof(LaneMask));
+        (*pending_count)++;
+    }
+    for (int i = 0; i < MASK_WORDS; ++i) pending[p].mask.w[i] |= taken.w[i];
+}
+
+void run_chunk_batch(const Chunk *chunk, IndicatorState *ind, const BarColumns *bars,
+                     const SignalSink *sink) {
+    if (chunk->timeframes) {
+        /* aggregation is sequential: bar by bar */
+        for (size_t i = 0; i < bars->count; ++i) {
+            VMContext ctx = {
+                bars->open[i], bars->high[i], bars->low[i], bars->close[i], bars->volume[i],
+                bars->date[i], bars->time[i], bars->hour[i], bars->minute[i], bars->weekday[i]
+            };
+            run_chunk((Chunk*)chunk, ind, &ctx, sink);
+        }
+        return;
+    }
+    BatchLanes *lanes = ind->lanes;
+    double (*stack)[BATCH_BLOCK] = lanes->stack;
+    double (*ind_out)[BATCH_BLOCK] = lanes->ind_out;
+    double (*temps)[BATCH_BLOCK] = lanes->temps;
+    double (*cached)[BATCH_BLOCK] = lanes->cached;   // JUMP_IF_SAME never skips here
+    /* rules that are a candidate on at least one bar of the block; the
+     * others are jumped over, the rest run on every lane as usual */
+    const RuleIndex *index = &chunk->gates;
+    uint64_t *block_rules = lanes->block_rules;
+    PendingJump *pending = lanes->pending;
+    int rule_at = -1;
+
+    StagedSignal *staged = lanes->staged, *sorted = lanes->sorted;
+    int staged_count = 0, staged_cap = lanes->staged_cap, sorted_cap = lanes->sorted_cap;
+    int lane_counts[BATCH_BLOCK + 1];
+
+    const uint8_t *code = chunk->code;
+
+    for (size_t base = 0; base < bars->count; base += BATCH_BLOCK) {
+        int n = (int)((bars->count - base < BATCH_BLOCK) ? bars->count - base : BATCH_BLOCK);
+        LaneMask full, active;
+        for (int i = 0; i < MASK_WORDS; ++i) {
+            int lo = i * 64;
+            int live = n - lo;
+            full.w[i] = live >= 64 ? ~(uint64_t)0
+                      : live > 0   ? (((uint64_t)1 << live) - 1)
+                      : 0;
+        }
+        active = full;
+        int pending_count = 0;
+        int sp = 0;
+        staged_count = 0;
+
+        int ip = 0;
+        for (;;) {
+            /* lanes parked on this offset rejoin before it executes */
+            for (int p = 0; p < pending_count; ) {
+                if (pending[p].target == ip) {
+                    for (int i = 0; i < MASK_WORDS; ++i) active.w[i] |= pending[p].mask.w[i];
+                    pending[p] = pending[--pending_count];
+                } else {
+                    ++p;
                 }
-                push(vm, val);
-                break;
             }
 
-            case BC_CALL_FUNC: {
-                uint8_t fid = *vm->ip++;
-                uint8_t argc = *vm->ip++;
-                double result = 0.0;
-                if (fid == FUNC_SMA) {
-                    if (argc != 2) { fprintf(stderr, "sma expects 2 args\n"); exit(1); }
-                    double period = pop(vm);
-                    double series = pop(vm);
-                    result = builtin_sma(series, period);
-                } else if (fid == FUNC_EMA) {
-                    if (argc != 2) { fprintf(stderr, "ema expects 2 args\n"); exit(1); }
-                    double period = pop(vm);
-                    double series = pop(vm);
-                    result = builtin_ema(series, period);
-                } else if (fid == FUNC_RSI) {
-                    if (argc != 1) { fprintf(stderr, "rsi expects 1 arg\n"); exit(1); }
-                    double period = pop(vm);
-                    result = builtin_rsi(period);
+            OpCode op = (OpCode)code[ip++];
+            if (op == BC_HALT) break;
+
+            switch (op) {
+                case BC_PUSH_CONST: {
+                    double v = read_double(code + ip);
+                    ip += 8;
+                    double *dst = stack[sp++];
+                    LANES(dst[l] = v);
+                    break;
                 }
-                push(vm, result);
-                break;
-            }
 
-            case BC_ADD: { double b = pop(vm), a = pop(vm); push(vm, a + b); break; }
-            case BC_SUB: { double b = pop(vm), a = pop(vm); push(vm, a - b); break; }
-            case BC_MUL: { double b = pop(vm), a = pop(vm); push(vm, a * b); break; }
-            case BC_DIV: { double b = pop(vm), a = pop(vm); push(vm, a / b); break; }
-
-            case BC_GT:  { double b = pop(vm), a = pop(vm); push(vm, a >  b); break; }
-            case BC_LT:  { double b = pop(vm), a = pop(vm); push(vm, a <  b); break; }
-            case BC_GE:  { double b = pop(vm), a = pop(vm); push(vm, a >= b); break; }
-            case BC_LE:  { double b = pop(vm), a = pop(vm); push(vm, a <= b); break; }
-            case BC_EQ:  { double b = pop(vm), a = pop(vm); push(vm, a == b); break; }
-            case BC_NE:  { double b = pop(vm), a = pop(vm); push(vm, a != b); break; }
-
-            case BC_AND: { double b = pop(vm), a = pop(vm); push(vm, (a != 0.0) && (b != 0.0)); break; }
-            case BC_OR:  { double b = pop(vm), a = pop(vm); push(vm, (a != 0.0) || (b != 0.0)); break; }
-            case BC_NEG: { double a = pop(vm); push(vm, -a); break; }
-            case BC_NOT: { double a = pop(vm); push(vm, (a == 0.0)); break; }
-
-            case BC_JUMP_IF_FALSE: {
-                int32_t offset = 0;
-                for (int i = 0; i < 4; ++i) {
-                    offset |= ((int32_t)(*vm->ip++) << (i * 8));
+                case BC_LOAD_VAR: {
+                    uint8_t id = code[ip++];
+                    load_var_lanes(stack[sp++], bars, base, n, id);
+                    break;
                 }
-                double cond = pop(vm);
-                if (!cond) {
-                    vm->ip += offset;
+
+                case BC_IND_UPDATE: {
+                    /* indicator state is a recurrence over bars: walk lanes in order */
+                    uint8_t fid = code[ip];
+                    uint16_t si = read_uint16(code + ip + 1);
+                    ip += 3;
+                    Indicator *slot = &ind->slots[si];
+                    double *v = stack[--sp];
+                    if (ind->feeds && ind->feeds[si]) {
+                        /* computed once for every run that shares it (sweep.c) */
+                        memcpy(ind_out[si], ind->feeds[si] + base, (size_t)n * sizeof(double));
+                        break;
+                    }
+                    int all = mask_equal(&active, &full);
+                    IndicatorUpdate update = indicator_update[fid];
+                    INDICATOR_LANES(update);
+                    memcpy(ind_out[si], v, (size_t)n * sizeof(double));
+                    break;
                 }
-                break;
-            }
 
-            case BC_JUMP: {
-                int32_t offset = 0;
-                for (int i = 0; i < 4; ++i) {
-                    offset |= ((int32_t)(*vm->ip++) << (i * 8));
+                case BC_LOAD_IND: {
+                    const double *src = ind_out[read_uint16(code + ip)];
+                    ip += 2;
+                    memcpy(stack[sp++], src, (size_t)n * sizeof(double));
+                    break;
                 }
-                vm->ip += offset;
-                break;
-            }
 
-            case BC_BUY: {
-                int32_t qty = 0;
-                for (int i = 0; i < 4; ++i) {
-                    qty |= ((int32_t)(*vm->ip++) << (i * 8));
+                case BC_STORE_TEMP:
+                    memcpy(temps[read_uint16(code + ip)], stack[--sp], (size_t)n * sizeof(double));
+                    ip += 2;
+                    break;
+
+                case BC_LOAD_TEMP:
+                    memcpy(stack[sp++], temps[read_uint16(code + ip)], (size_t)n * sizeof(double));
+                    ip += 2;
+                    break;
+
+                case BC_JUMP_IF_SAME:
+                    ip += 5;
+                    break;
+
+                case BC_STORE_CACHED:
+                    memcpy(cached[read_uint16(code + ip)], stack[--sp], (size_t)n * sizeof(double));
+                    ip += 2;
+                    break;
+
+                case BC_LOAD_CACHED:
+                    memcpy(stack[sp++], cached[read_uint16(code + ip)], (size_t)n * sizeof(double));
+                    ip += 2;
+                    break;
+
+                case BC_LOAD_PARAM: {
+                    double v = ind->params[read_uint16(code + ip)];
+                    ip += 2;
+                    double *dst = stack[sp++];
+                    LANES(dst[l] = v);
+                    break;
                 }
-                printf("SYMBOL %s: BUY %d\n", vm->symbol, qty);
-                break;
-            }
 
-            case BC_SELL: {
-                int32_t qty = 0;
-                for (int i = 0; i < 4; ++i) {
-                    qty |= ((int32_t)(*vm->ip++) << (i * 8));
+                case BC_JUMP_IF_NOT_CACHED: {
+                    const double *cond = cached[read_uint16(code + ip)];
+                    int32_t offset = read_int32(code + ip + 2);
+                    ip += 6;
+                    park_lanes(&active, pending, &pending_count, cond, 0, n, ip + offset);
+                    break;
                 }
-                printf("SYMBOL %s: SELL %d\n", vm->symbol, qty);
-                break;
+
+                case BC_CMP_IND: {
+                    const double *src = ind_out[read_uint16(code + ip)];
+                    uint8_t cmp = code[ip + 2];
+                    ip += 3;
+                    double *a = stack[sp - 1];
+                    compare_lanes(cmp, a, a, src, 0.0, n);
+                    break;
+                }
+
+                case BC_CMP_VAR_CONST: {
+                    uint8_t id = code[ip];
+                    uint8_t cmp = code[ip + 1];
+                    double k = read_double(code + ip + 2);
+                    ip += 10;
+                    double *dst = stack[sp++];
+                    load_var_lanes(dst, bars, base, n, id);
+                    compare_lanes(cmp, dst, dst, NULL, k, n);
+                    break;
+                }
+
+                case BC_ADD: BINARY_LANES(a[l] + b[l]); break;
+                case BC_SUB: BINARY_LANES(a[l] - b[l]); break;
+                case BC_MUL: BINARY_LANES(a[l] * b[l]); break;
+                case BC_DIV: BINARY_LANES(a[l] / b[l]); break;
+
+                case BC_GT:  BINARY_LANES((double)(a[l] >  b[l])); break;
+                case BC_LT:  BINARY_LANES((double)(a[l] <  b[l])); break;
+                case BC_GE:  BINARY_LANES((double)(a[l] >= b[l])); break;
+                case BC_LE:  BINARY_LANES((double)(a[l] <= b[l])); break;
+                case BC_EQ:  BINARY_LANES((double)(a[l] == b[l])); break;
+                case BC_NE:  BINARY_LANES((double)(a[l] != b[l])); break;
+
+                case BC_AND: BINARY_LANES((double)((a[l] != 0.0) & (b[l] != 0.0))); break;
+                case BC_OR:  BINARY_LANES((double)((a[l] != 0.0) | (b[l] != 0.0))); break;
+                case BC_NEG: { double *a = stack[sp - 1]; LANES(a[l] = -a[l]); break; }
+                case BC_NOT: { double *a = stack[sp - 1]; LANES(a[l] = (double)(a[l] == 0.0)); break; }
+
+                case BC_JUMP_IF_FALSE:
+                case BC_JUMP_IF_TRUE:
+                case BC_JUMP: {
+                    int32_t offset = read_int32(code + ip);
+                    ip += 4;
+                    const double *cond = (op == BC_JUMP) ? NULL : stack[--sp];
+                    park_lanes(&active, pending, &pending_count, cond, op == BC_JUMP_IF_TRUE,
+                               n, ip + offset);
+                    break;
+                }
+
+                case BC_JUMP_IF_NOT_CMP: {
+                    uint8_t cmp = code[ip];
+                    int32_t offset = read_int32(code + ip + 1);
+                    ip += 5;
+                    double *a = stack[sp - 2];
+                    compare_lanes(cmp, a, a, stack[sp - 1], 0.0, n);
+                    sp -= 2;
+                    park_lanes(&active, pending, &pending_count, a, 0, n, ip + offset);
+                    break;
+                }
+
+                case BC_JUMP_IF_NOT_VAR_CONST: {
+                    uint8_t id = code[ip];
+                    uint8_t cmp = code[ip + 1];
+                    double k = read_double(code + ip + 2);
+                    int32_t offset = read_int32(code + ip + 10);
+                    ip += 14;
+                    double *scratch = stack[sp];
+                    load_var_lanes(scratch, bars, base, n, id);
+                    compare_lanes(cmp, scratch, scratch, NULL, k, n);
+                    park_lanes(&active, pending, &pending_count, scratch, 0, n, ip + offset);
+                    break;
+                }
+
+                case BC_RULE_INDEX:
+                    block_candidates(index, bars, base, n, block_rules);
+                    rule_at = -1;
+                    /* fall through */
+                case BC_NEXT_RULE: {
+                    int32_t offset = read_int32(code + ip);
+                    ip += 4;
+                    rule_at = next_set_bit(block_rules, index->words, rule_at + 1);
+                    ip = rule_at >= 0 ? index->entries[rule_at] : ip + offset;
+                    break;
+                }
+
+                case BC_BUY:
+                case BC_SELL: {
+                    int32_t qty = read_int32(code + ip);
+                    uint16_t rule = read_uint16(code + ip + 4);
+                    ip += 6;
+                    for (int l = 0; l < n; ++l) {
+                        if (lane_active(&active, l))
+                            stage_signal(&staged, &staged_count, &staged_cap, l, op, qty, rule);
+                    }
+                    break;
+                }
+
+                default:
+                    fprintf(stderr, "Unknown opcode %d\n", op);
+                    lanes->staged = staged;
+                    lanes->sorted = sorted;
+                    lanes->staged_cap = staged_cap;
+                    lanes->sorted_cap = sorted_cap;
+                    return;
             }
+        }
 
-            default:
-                fprintf(stderr, "Unknown opcode %d\n", op);
-                return;
+        /* replay in bar order; staging order within a lane is program order */
+        if (staged_count) {
+            memset(lane_counts, 0, sizeof(lane_counts));
+            for (int i = 0; i < staged_count; ++i) lane_counts[staged[i].lane + 1]++;
+            for (int l = 0; l < n; ++l) lane_counts[l + 1] += lane_counts[l];
+            if (sorted_cap < staged_cap) {
+                sorted_cap = staged_cap;
+                sorted = (StagedSignal*)realloc(sorted, (size_t)sorted_cap * sizeof(StagedSignal));
+                if (!sorted) { fprintf(stderr, "Out of memory\n"); exit(1); }
+            }
+            for (int i = 0; i < staged_count; ++i) sorted[lane_counts[staged[i].lane]++] = staged[i];
+            for (int i = 0; i < staged_count; ++i) {
+                Signal sig;
+                sig.bar = ind->bars + base + (size_t)sorted[i].lane;
+                sig.symbol_id = sink->symbol_id;
+                sig.qty = sorted[i].qty;
+                sig.rule = sorted[i].rule;
+                sig.side = (uint8_t)sorted[i].side;
+                sink->emit(sink->user, &sig);
+            }
         }
     }
-}
+    ind->bars += bars->count;
+    /* ind->cached was not kept up to date: have run_chunk recompute it */
+    ind->day_stamp = ind->minute_stamp[0] = ind->minute_stamp[1] = -1;
 
-void run_chunk(Chunk *chunk, const VMContext *ctx, const char *symbol) {
-    VM vm;
-    vm.chunk = chunk;
-    vm.ctx = *ctx;
-    vm.symbol = symbol;
-    vm_run(&vm);
+    lanes->staged = staged;
+    lanes->sorted = sorted;
+    lanes->staged_cap = staged_cap;
+    lanes->sorted_cap = sorted_cap;
 }
+
+#undef INDICATOR_LANES
+#undef BINARY_LANES
+#undef LANES
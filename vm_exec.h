@@ -0,0 +1,265 @@
+/* The per-bar dispatch loop, included by vm.c once per variant: define
+ * VM_EXEC as the function name, and VM_PROFILE for the copy that counts
+ * executions and clock ticks per instruction into vm->profile. Keeping
+ * the profiled copy separate leaves the plain loop without a single
+ * extra instruction. */
+
+#ifdef VM_PROFILE
+/* Charge the ticks since the last dispatch to the instruction that ran,
+ * then count the one about to run */
+#define VM_TICK() do {                                  \
+        uint64_t now = profile_clock();                 \
+        profile->ticks[current] += now - last;          \
+        last = now;                                     \
+        current = (int)(ip - code);                     \
+        profile->counts[current]++;                     \
+    } while (0)
+#define VM_STOP()      (profile->ticks[current] += profile_clock() - last)
+#else
+#define VM_TICK()      ((void)0)
+#define VM_STOP()      ((void)0)
+#endif
+
+#if defined(TLC_THREADED_DISPATCH) && defined(VM_PROFILE)
+/* decoded handlers belong to the plain loop; use this copy's own labels */
+#define VM_DISPATCH()  do { VM_TICK(); goto *labels[ip->op]; } while (0)
+#define VM_LOOP        VM_DISPATCH();
+#define VM_CASE(op)    L_##op:
+#define VM_END
+#elif defined(TLC_THREADED_DISPATCH)
+#define VM_DISPATCH()  goto *ip->handler
+#define VM_LOOP        VM_DISPATCH();
+#define VM_CASE(op)    L_##op:
+#define VM_END
+#else
+#define VM_DISPATCH()  continue
+#define VM_LOOP        for (;;) { VM_TICK(); switch ((OpCode)ip->op) {
+#define VM_CASE(op)    case op:
+#define VM_END         default: return NULL; } }
+#endif
+
+#define VM_BINARY(expr) do { double b = *--sp, a = sp[-1]; sp[-1] = (expr); } while (0)
+
+/* Runs one bar over the decoded instructions. Called with vm == NULL it
+ * only returns the label table (NULL without threaded dispatch), which
+ * decode_chunk stores in each instruction. */
+static const void *const *VM_EXEC(const VM *vm) {
+#ifdef TLC_THREADED_DISPATCH
+    static const void *const labels[BC_OPCODE_COUNT] = {
+        [BC_HALT] = &&L_BC_HALT,
+        [BC_PUSH_CONST] = &&L_BC_PUSH_CONST,
+        [BC_LOAD_VAR] = &&L_BC_LOAD_VAR,
+        [BC_IND_UPDATE] = &&L_BC_IND_UPDATE,
+        [BC_LOAD_IND] = &&L_BC_LOAD_IND,
+        [BC_ADD] = &&L_BC_ADD,
+        [BC_SUB] = &&L_BC_SUB,
+        [BC_MUL] = &&L_BC_MUL,
+        [BC_DIV] = &&L_BC_DIV,
+        [BC_GT] = &&L_BC_GT,
+        [BC_LT] = &&L_BC_LT,
+        [BC_GE] = &&L_BC_GE,
+        [BC_LE] = &&L_BC_LE,
+        [BC_EQ] = &&L_BC_EQ,
+        [BC_NE] = &&L_BC_NE,
+        [BC_AND] = &&L_BC_AND,
+        [BC_OR] = &&L_BC_OR,
+        [BC_NEG] = &&L_BC_NEG,
+        [BC_NOT] = &&L_BC_NOT,
+        [BC_JUMP_IF_FALSE] = &&L_BC_JUMP_IF_FALSE,
+        [BC_JUMP_IF_TRUE] = &&L_BC_JUMP_IF_TRUE,
+        [BC_STORE_TEMP] = &&L_BC_STORE_TEMP,
+        [BC_LOAD_TEMP] = &&L_BC_LOAD_TEMP,
+        [BC_JUMP] = &&L_BC_JUMP,
+        [BC_BUY] = &&L_BC_BUY,
+        [BC_SELL] = &&L_BC_SELL,
+        [BC_CMP_VAR_CONST] = &&L_BC_CMP_VAR_CONST,
+        [BC_JUMP_IF_NOT_CMP] = &&L_BC_JUMP_IF_NOT_CMP,
+        [BC_JUMP_IF_NOT_VAR_CONST] = &&L_BC_JUMP_IF_NOT_VAR_CONST,
+        [BC_CMP_IND] = &&L_BC_CMP_IND,
+        [BC_LOAD_TF_VAR] = &&L_BC_LOAD_TF_VAR,
+        [BC_JUMP_IF_NOT_CLOSED] = &&L_BC_JUMP_IF_NOT_CLOSED,
+        [BC_JUMP_IF_SAME] = &&L_BC_JUMP_IF_SAME,
+        [BC_STORE_CACHED] = &&L_BC_STORE_CACHED,
+        [BC_LOAD_CACHED] = &&L_BC_LOAD_CACHED,
+        [BC_JUMP_IF_NOT_CACHED] = &&L_BC_JUMP_IF_NOT_CACHED,
+        [BC_RULE_INDEX] = &&L_BC_RULE_INDEX,
+        [BC_NEXT_RULE] = &&L_BC_NEXT_RULE,
+        [BC_LOAD_PARAM] = &&L_BC_LOAD_PARAM,
+    };
+    if (!vm) return labels;
+#else
+    if (!vm) return NULL;
+#endif
+
+    const Instr *code = vm->chunk->instrs;
+    const double *k = vm->chunk->constants;
+    Indicator *slots = vm->ind->slots;
+    const VMContext *ctx = &vm->ctx;
+    const BarAggregator *frames = vm->ind->frames;
+    double *cached = vm->ind->cached;
+    const double *params = vm->ind->params;
+    const Instr *ip = code;
+    double stack[STACK_MAX];
+    double *sp = stack;
+    double temps[TEMP_MAX];
+    const int32_t *rule_targets = vm->chunk->rule_targets;
+    const int32_t *candidate = NULL, *candidates_end = NULL;
+#ifdef VM_PROFILE
+    VMProfile *profile = vm->profile;
+    int current = 0;
+    uint64_t last = profile_clock();
+#endif
+
+    VM_LOOP
+
+    VM_CASE(BC_HALT)
+        VM_STOP();
+        return NULL;
+
+    VM_CASE(BC_PUSH_CONST)
+        *sp++ = k[ip->arg];
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_LOAD_VAR)
+        *sp++ = load_var(ctx, ip->a);
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_IND_UPDATE) {
+        Indicator *ind = &slots[ip->slot];
+        ind->output = indicator_update[ip->a](ind, *--sp);
+        ip++;
+        VM_DISPATCH();
+    }
+
+    VM_CASE(BC_LOAD_IND)
+        *sp++ = slots[ip->slot].output;
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_CMP_VAR_CONST)
+        *sp++ = compare(ip->cmp, load_var(ctx, ip->a), k[ip->konst]);
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_JUMP_IF_NOT_CMP)
+        sp -= 2;
+        ip = compare(ip->cmp, sp[0], sp[1]) ? ip + 1 : code + ip->arg;
+        VM_DISPATCH();
+
+    VM_CASE(BC_JUMP_IF_NOT_VAR_CONST)
+        ip = compare(ip->cmp, load_var(ctx, ip->a), k[ip->konst]) ? ip + 1 : code + ip->arg;
+        VM_DISPATCH();
+
+    VM_CASE(BC_CMP_IND)
+        sp[-1] = compare(ip->cmp, sp[-1], slots[ip->slot].output);
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_LOAD_TF_VAR)
+        *sp++ = load_frame_var(frames, ip->slot, ip->a);
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_JUMP_IF_NOT_CLOSED)
+        ip = frames && (frames->closed & ip->slot) ? ip + 1 : code + ip->arg;
+        VM_DISPATCH();
+
+    VM_CASE(BC_JUMP_IF_SAME)
+        ip = same_period(vm->ind, ctx, ip->a) ? code + ip->arg : ip + 1;
+        VM_DISPATCH();
+
+    VM_CASE(BC_STORE_CACHED)
+        cached[ip->slot] = *--sp;
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_LOAD_CACHED)
+        *sp++ = cached[ip->slot];
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_LOAD_PARAM)
+        *sp++ = params[ip->slot];
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_JUMP_IF_NOT_CACHED)
+        ip = cached[ip->slot] ? ip + 1 : code + ip->arg;
+        VM_DISPATCH();
+
+    VM_CASE(BC_RULE_INDEX)
+        candidate = vm->ind->candidates;
+        candidates_end = candidate + rule_candidates(&vm->chunk->gates, ctx, vm->ind->candidates);
+        ip = candidate < candidates_end ? code + rule_targets[*candidate++] : code + ip->arg;
+        VM_DISPATCH();
+
+    VM_CASE(BC_NEXT_RULE)
+        ip = candidate < candidates_end ? code + rule_targets[*candidate++] : code + ip->arg;
+        VM_DISPATCH();
+
+    VM_CASE(BC_ADD) VM_BINARY(a + b);  ip++; VM_DISPATCH();
+    VM_CASE(BC_SUB) VM_BINARY(a - b);  ip++; VM_DISPATCH();
+    VM_CASE(BC_MUL) VM_BINARY(a * b);  ip++; VM_DISPATCH();
+    VM_CASE(BC_DIV) VM_BINARY(a / b);  ip++; VM_DISPATCH();
+
+    VM_CASE(BC_GT)  VM_BINARY(a >  b); ip++; VM_DISPATCH();
+    VM_CASE(BC_LT)  VM_BINARY(a <  b); ip++; VM_DISPATCH();
+    VM_CASE(BC_GE)  VM_BINARY(a >= b); ip++; VM_DISPATCH();
+    VM_CASE(BC_LE)  VM_BINARY(a <= b); ip++; VM_DISPATCH();
+    VM_CASE(BC_EQ)  VM_BINARY(a == b); ip++; VM_DISPATCH();
+    VM_CASE(BC_NE)  VM_BINARY(a != b); ip++; VM_DISPATCH();
+
+    VM_CASE(BC_AND) VM_BINARY((a != 0.0) && (b != 0.0)); ip++; VM_DISPATCH();
+    VM_CASE(BC_OR)  VM_BINARY((a != 0.0) || (b != 0.0)); ip++; VM_DISPATCH();
+    VM_CASE(BC_NEG) sp[-1] = -sp[-1];          ip++; VM_DISPATCH();
+    VM_CASE(BC_NOT) sp[-1] = (sp[-1] == 0.0);  ip++; VM_DISPATCH();
+
+    VM_CASE(BC_JUMP_IF_FALSE)
+        ip = *--sp ? ip + 1 : code + ip->arg;
+        VM_DISPATCH();
+
+    VM_CASE(BC_JUMP_IF_TRUE)
+        ip = *--sp ? code + ip->arg : ip + 1;
+        VM_DISPATCH();
+
+    VM_CASE(BC_JUMP)
+        ip = code + ip->arg;
+        VM_DISPATCH();
+
+    VM_CASE(BC_STORE_TEMP)
+        temps[ip->slot] = *--sp;
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_LOAD_TEMP)
+        *sp++ = temps[ip->slot];
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_BUY)
+        send_signal(vm->sink, vm->ind, BC_BUY, ip->arg, ip->slot);
+        ip++;
+        VM_DISPATCH();
+
+    VM_CASE(BC_SELL)
+        send_signal(vm->sink, vm->ind, BC_SELL, ip->arg, ip->slot);
+        ip++;
+        VM_DISPATCH();
+
+    VM_END
+#ifndef TLC_THREADED_DISPATCH
+    return NULL;
+#endif
+}
+
+#undef VM_BINARY
+#undef VM_END
+#undef VM_CASE
+#undef VM_LOOP
+#undef VM_DISPATCH
+#undef VM_STOP
+#undef VM_TICK
+#undef VM_EXEC
+#undef VM_PROFILE